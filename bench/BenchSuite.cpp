@@ -0,0 +1,675 @@
+#include "CpuRenderer.hpp"
+#include "DepthSort.hpp"
+#include "MappedFile.hpp"
+#include "Model.hpp"
+#include "ObjParser.hpp"
+#include "Raster.hpp"
+#include "Scene.hpp"
+#include "ThreadPool.hpp"
+#include "TriangleSetup.hpp"
+#include "VertexTransform.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <limits>
+#include <random>
+#include <string>
+#include <vector>
+
+/*
+** Benchmark suite behind "make bench".
+** Every case runs "warmup" untimed samples, then "iterations" timed
+** ones. A sample repeats the operation enough times to last about
+** MIN_SAMPLE_MS (sized once, on the first warmup sample, and reported
+** as "repeat"), and its time is divided back per operation, so small
+** meshes are not lost in timer noise. Stages run on this thread alone
+** to compare work; OBJ loads and whole frames use the thread pool
+** (-t), like the viewer. The JSON document goes to stdout, progress
+** to stderr; bench/compare.py diffs two of them.
+**
+** Meshes: the shipped tree, fox and whale, plus sphere grids of 1M and
+** 10M triangles written once as OBJ files to the data directory. The
+** 10M one is only parsed and transformed: building its BVH and LOD
+** chain would take longer than the rest of the suite.
+*/
+
+static const double MIN_SAMPLE_MS = 20.0;
+static const int MAX_REPEAT = 100000;
+static const unsigned int FRAME_W = 1920;
+static const unsigned int FRAME_H = 1080;
+static const int FILL_LAYERS = 8;
+
+struct BenchConfig {
+    int iterations = 10;
+    int warmup = 2;
+    unsigned int threads = 0;
+    RasterKernel kernel = RasterKernel::Scalar;
+    std::size_t maxTriangles = 10000000;
+    std::string dataDir = "/tmp";
+    /* Only cases whose name contains it, null for all. */
+    const char *filter = nullptr;
+};
+
+struct CaseResult {
+    std::string name;
+    /* What one operation processes: items of unit. */
+    const char *unit;
+    double items;
+    int repeat;
+    std::vector<double> ms;
+};
+
+struct BenchMesh {
+    std::string name;
+    std::string objPath;
+    std::string mtlPath;
+    std::size_t triangles;
+};
+
+static double elapsed_ms(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double, std::milli>(
+        std::chrono::steady_clock::now() - start).count();
+}
+
+static bool selected(const BenchConfig &cfg, const std::string &name)
+{
+    return !cfg.filter || name.find(cfg.filter) != std::string::npos;
+}
+
+/* Whether a case of mesh could be selected, to skip loading it. */
+static bool mesh_selected(const BenchConfig &cfg, const std::string &mesh)
+{
+    const char *stages[8] = {
+        "parse/obj/", "parse/mtl/", "load/obj/", "transform/", "setup/",
+        "sort/radix/", "sort/painter/", "frame/"
+    };
+    int i;
+
+    i = 0;
+    while (i < 8) {
+        if (selected(cfg, stages[i] + mesh + "/"))
+            return true;
+        i++;
+    }
+    return false;
+}
+
+/* Times repeat calls of op, in milliseconds per call. */
+template <typename Op>
+static double time_sample(Op &op, int repeat)
+{
+    std::chrono::steady_clock::time_point start;
+    int i;
+
+    start = std::chrono::steady_clock::now();
+    i = 0;
+    while (i < repeat) {
+        op();
+        i++;
+    }
+    return elapsed_ms(start) / repeat;
+}
+
+template <typename Op>
+static void run_case(const BenchConfig &cfg, const std::string &name,
+                     const char *unit, double items, Op op,
+                     std::vector<CaseResult> &results)
+{
+    CaseResult result;
+    double once;
+    int i;
+
+    if (!selected(cfg, name))
+        return;
+    std::cerr << "Info: " << name << std::endl;
+    result.name = name;
+    result.unit = unit;
+    result.items = items;
+    once = time_sample(op, 1);
+    result.repeat = 1;
+    if (once < MIN_SAMPLE_MS)
+        result.repeat = (int)std::min(
+            (double)MAX_REPEAT,
+            std::ceil(MIN_SAMPLE_MS / std::max(once, 1e-6)));
+    i = 1;
+    while (i < cfg.warmup) {
+        time_sample(op, result.repeat);
+        i++;
+    }
+    i = 0;
+    while (i < cfg.iterations) {
+        result.ms.push_back(time_sample(op, result.repeat));
+        i++;
+    }
+    results.push_back(result);
+}
+
+/*
+** side x side sphere grid, two triangles per quad, as OBJ. Kept in
+** dataDir across runs; the name holds the triangle count.
+*/
+static bool write_grid_obj(const std::string &path, std::size_t triangles)
+{
+    std::FILE *file;
+    int side;
+    int i;
+    int j;
+
+    side = (int)std::ceil(std::sqrt((double)triangles / 2.0)) + 1;
+    file = std::fopen(path.c_str(), "wb");
+    if (!file)
+        return false;
+    std::fprintf(file, "# %d x %d sphere grid\nusemtl grid\n", side, side);
+    j = 0;
+    while (j < side) {
+        i = 0;
+        while (i < side) {
+            double u;
+            double v;
+
+            u = (double)i / (double)(side - 1) * 6.2831853;
+            v = (double)j / (double)(side - 1) * 3.1415926;
+            std::fprintf(file, "v %.6f %.6f %.6f\n",
+                         std::sin(v) * std::cos(u), std::cos(v),
+                         std::sin(v) * std::sin(u));
+            i++;
+        }
+        j++;
+    }
+    j = 0;
+    while (j + 1 < side) {
+        i = 0;
+        while (i + 1 < side) {
+            int k;
+
+            k = j * side + i + 1;
+            std::fprintf(file, "f %d %d %d\nf %d %d %d\n", k, k + side,
+                         k + 1, k + 1, k + side, k + side + 1);
+            i++;
+        }
+        j++;
+    }
+    return std::fclose(file) == 0;
+}
+
+static bool generated_mesh(const BenchConfig &cfg, std::size_t triangles,
+                           const char *name, BenchMesh &mesh)
+{
+    MappedFile existing;
+
+    mesh.name = name;
+    mesh.objPath = cfg.dataDir + "/bench_grid_"
+        + std::to_string(triangles) + ".obj";
+    mesh.mtlPath.clear();
+    mesh.triangles = triangles;
+    if (existing.open(mesh.objPath) && existing.size() > 0)
+        return true;
+    std::cerr << "Info: writing " << mesh.objPath << std::endl;
+    if (write_grid_obj(mesh.objPath, triangles))
+        return true;
+    std::cerr << "Warning: cannot write " << mesh.objPath << std::endl;
+    return false;
+}
+
+/* The whole file on this thread, as one loadFromObj() chunk. */
+static void parse_whole(const MappedFile &file,
+                        const MaterialIndex &materials,
+                        std::vector<Vec3> &vertices,
+                        std::vector<Face> &faces)
+{
+    std::vector<ObjChunk> chunks(1);
+
+    chunks[0].begin = file.data();
+    chunks[0].end = file.data() + file.size();
+    count_obj_range(chunks[0]);
+    place_obj_chunks(chunks, materials, vertices, faces);
+    parse_obj_range(chunks[0], materials, vertices, faces);
+    merge_obj_chunks(chunks, faces);
+}
+
+/* Counting pass included; vertices and faces get the last parse. */
+static void bench_parse(const BenchConfig &cfg, const BenchMesh &mesh,
+                        std::vector<Vec3> &vertices,
+                        std::vector<Face> &faces,
+                        std::vector<CaseResult> &results)
+{
+    MappedFile file;
+    MaterialIndex materials;
+    MappedFile mtl;
+
+    if (!file.open(mesh.objPath)) {
+        std::cerr << "Warning: cannot read " << mesh.objPath << std::endl;
+        return;
+    }
+    run_case(cfg, "parse/obj/" + mesh.name, "bytes", (double)file.size(),
+             [&]() {
+                 std::vector<Vec3> v;
+                 std::vector<Face> f;
+
+                 parse_whole(file, materials, v, f);
+             }, results);
+    parse_whole(file, materials, vertices, faces);
+    if (mesh.mtlPath.empty() || !mtl.open(mesh.mtlPath))
+        return;
+    run_case(cfg, "parse/mtl/" + mesh.name, "bytes", (double)mtl.size(),
+             [&]() {
+                 Model model;
+
+                 model.loadFromMtl(mesh.mtlPath);
+             }, results);
+}
+
+static ViewTransform bench_view(float angleY)
+{
+    return make_view_transform(angleY, 0.3f, make_vec3(0.0f, 0.0f, 4.0f),
+                               1.0f, (float)FRAME_W, (float)FRAME_H);
+}
+
+/* Setup output of model, as the sort cases get it from a frame. */
+static void bench_stages(const BenchConfig &cfg, const BenchMesh &mesh,
+                         const Model &model,
+                         std::vector<CaseResult> &results)
+{
+    ViewTransform view;
+    VertexStream vs;
+    SetupParams params;
+    SetupStats stats;
+    std::vector<TriData> tris;
+    std::vector<TriData> sorted;
+    std::vector<DepthKey> keys;
+    std::vector<DepthKey> work;
+    std::vector<DepthKey> scratch;
+    std::vector<unsigned int> counts;
+    std::size_t i;
+
+    view = bench_view(0.5f);
+    run_case(cfg, "transform/" + mesh.name, "vertices",
+             (double)model.getVertexCount(),
+             [&]() { transform_vertices(view, model.getPositions(), vs,
+                                        nullptr); }, results);
+    transform_vertices(view, model.getPositions(), vs, nullptr);
+    run_case(cfg, "setup/" + mesh.name, "faces",
+             (double)model.getFaceCount(),
+             [&]() {
+                 tris.clear();
+                 stats = SetupStats();
+                 build_triangles(model, view, vs, params, tris, stats);
+             }, results);
+    tris.clear();
+    build_triangles(model, view, vs, params, tris, stats);
+    keys.resize(tris.size());
+    i = 0;
+    while (i < tris.size()) {
+        keys[i].key = depth_key(tris[i].w1.z + tris[i].w2.z
+                                + tris[i].w3.z);
+        keys[i].index = (std::uint32_t)i;
+        i++;
+    }
+    run_case(cfg, "sort/radix/" + mesh.name, "triangles",
+             (double)keys.size(),
+             [&]() {
+                 work = keys;
+                 radix_sort_keys(work, scratch, counts, nullptr);
+             }, results);
+    run_case(cfg, "sort/painter/" + mesh.name, "triangles",
+             (double)tris.size(),
+             [&]() {
+                 sorted = tris;
+                 std::sort(sorted.begin(), sorted.end(),
+                           [](const TriData &a, const TriData &b) {
+                               return a.w1.z + a.w2.z + a.w3.z
+                                   > b.w1.z + b.w2.z + b.w3.z;
+                           });
+             }, results);
+}
+
+/*
+** Whole frames at FRAME_W x FRAME_H, switching between two angles so
+** no frame is reused. Models are drawn at LOD 0, so that a change to
+** the LOD choice does not hide one to the pipeline; items are the
+** faces of the full models.
+*/
+static void bench_frame(const BenchConfig &cfg, const std::string &name,
+                        CpuRenderer &renderer, double faces,
+                        std::vector<CaseResult> &results)
+{
+    bool odd;
+
+    odd = false;
+    renderer.setThreadCount(cfg.threads);
+    renderer.setRasterKernel(cfg.kernel);
+    run_case(cfg, "frame/" + name + "/" + std::to_string(FRAME_W) + "x"
+             + std::to_string(FRAME_H), "faces", faces,
+             [&]() {
+                 odd = !odd;
+                 renderer.setAngles(odd ? 0.51f : 0.5f, 0.3f);
+                 renderer.render(FRAME_W, FRAME_H);
+             }, results);
+}
+
+static void bench_model(const BenchConfig &cfg, const BenchMesh &mesh,
+                        std::vector<CaseResult> &results)
+{
+    Model model;
+    CpuRenderer renderer;
+
+    renderer.setThreadCount(cfg.threads);
+    run_case(cfg, "load/obj/" + mesh.name, "faces",
+             (double)mesh.triangles,
+             [&]() {
+                 Model loaded;
+
+                 loaded.loadFromObj(mesh.objPath, &renderer.getThreadPool());
+             }, results);
+    if (!model.loadFromObj(mesh.objPath, &renderer.getThreadPool())) {
+        std::cerr << "Warning: cannot load " << mesh.objPath << std::endl;
+        return;
+    }
+    if (!mesh.mtlPath.empty())
+        model.loadFromMtl(mesh.mtlPath);
+    bench_stages(cfg, mesh, model, results);
+    renderer.setModel(&model);
+    renderer.setLod(0);
+    bench_frame(cfg, mesh.name, renderer, (double)model.getFaceCount(),
+                results);
+}
+
+static void bench_scene(const BenchConfig &cfg, const char *path,
+                        const char *name, std::vector<CaseResult> &results)
+{
+    Options opts;
+    Scene scene;
+    CpuRenderer renderer;
+    std::size_t faces;
+
+    if (!selected(cfg, std::string("frame/") + name))
+        return;
+    opts.useCache = false;
+    opts.threads = cfg.threads;
+    renderer.setThreadCount(cfg.threads);
+    if (!scene.load(path, opts, &renderer.getThreadPool()))
+        return;
+    faces = 0;
+    for (const SceneInstance &inst : scene.getInstances())
+        faces += scene.getMesh(inst.mesh).getFaceCount();
+    renderer.setScene(&scene);
+    bench_frame(cfg, name, renderer, (double)faces, results);
+}
+
+/*
+** FILL_LAYERS screen-covering quads drawn back to front, so every
+** pixel is written by every layer; the targets are cleared each time
+** as in a frame.
+*/
+static void bench_fill(const BenchConfig &cfg, unsigned int width,
+                       unsigned int height,
+                       std::vector<CaseResult> &results)
+{
+    std::vector<std::uint32_t> color((std::size_t)width * height);
+    std::vector<float> depth(color.size());
+    std::vector<RasterTriangle> tris;
+    RasterTarget target;
+    int layer;
+
+    layer = 0;
+    while (layer < FILL_LAYERS) {
+        RasterTriangle t;
+
+        t.z1 = (float)(FILL_LAYERS - layer);
+        t.z2 = t.z1;
+        t.z3 = t.z1;
+        t.color = pack_rgba((unsigned char)(layer * 30), 128, 200, 255);
+        t.x1 = -1.0f;
+        t.y1 = -1.0f;
+        t.x2 = (float)width + 1.0f;
+        t.y2 = -1.0f;
+        t.x3 = -1.0f;
+        t.y3 = (float)height + 1.0f;
+        tris.push_back(t);
+        t.x1 = (float)width + 1.0f;
+        t.y1 = (float)height + 1.0f;
+        tris.push_back(t);
+        layer++;
+    }
+    target.color = color.data();
+    target.colorStride = width;
+    target.depth = depth.data();
+    target.depthStride = width;
+    target.clipX1 = (int)width - 1;
+    target.clipY1 = (int)height - 1;
+    run_case(cfg, "raster/fill/" + std::to_string(width) + "x"
+             + std::to_string(height), "pixels",
+             (double)color.size() * FILL_LAYERS,
+             [&]() {
+                 std::fill(color.begin(), color.end(), 0u);
+                 std::fill(depth.begin(), depth.end(),
+                           std::numeric_limits<float>::infinity());
+                 for (const RasterTriangle &t : tris)
+                     raster_triangle(cfg.kernel, t, target);
+             }, results);
+}
+
+/* 20000 random triangles about 16 pixels wide, at FRAME_W x FRAME_H. */
+static void bench_small_triangles(const BenchConfig &cfg,
+                                  std::vector<CaseResult> &results)
+{
+    std::vector<std::uint32_t> color((std::size_t)FRAME_W * FRAME_H);
+    std::vector<float> depth(color.size());
+    std::vector<RasterTriangle> tris(20000);
+    std::mt19937 rng(1234u);
+    std::uniform_real_distribution<float> posX(0.0f, (float)FRAME_W);
+    std::uniform_real_distribution<float> posY(0.0f, (float)FRAME_H);
+    std::uniform_real_distribution<float> off(-8.0f, 8.0f);
+    std::uniform_real_distribution<float> z(1.0f, 10.0f);
+    RasterTarget target;
+
+    for (RasterTriangle &t : tris) {
+        float cx;
+        float cy;
+
+        cx = posX(rng);
+        cy = posY(rng);
+        t.x1 = cx + off(rng);
+        t.y1 = cy + off(rng);
+        t.x2 = cx + off(rng);
+        t.y2 = cy + off(rng);
+        t.x3 = cx + off(rng);
+        t.y3 = cy + off(rng);
+        t.z1 = z(rng);
+        t.z2 = t.z1;
+        t.z3 = t.z1;
+        t.color = pack_rgba(200, 90, 40, 255);
+    }
+    target.color = color.data();
+    target.colorStride = FRAME_W;
+    target.depth = depth.data();
+    target.depthStride = FRAME_W;
+    target.clipX1 = (int)FRAME_W - 1;
+    target.clipY1 = (int)FRAME_H - 1;
+    run_case(cfg, "raster/small/" + std::to_string(FRAME_W) + "x"
+             + std::to_string(FRAME_H), "triangles", (double)tris.size(),
+             [&]() {
+                 std::fill(depth.begin(), depth.end(),
+                           std::numeric_limits<float>::infinity());
+                 for (const RasterTriangle &t : tris)
+                     raster_triangle(cfg.kernel, t, target);
+             }, results);
+}
+
+static void bench_generated(const BenchConfig &cfg, std::size_t triangles,
+                            const char *name,
+                            std::vector<CaseResult> &results)
+{
+    BenchMesh mesh;
+    std::vector<Vec3> vertices;
+    std::vector<Face> faces;
+    VertexStream vs;
+    ViewTransform view;
+
+    if (triangles > cfg.maxTriangles
+        || !mesh_selected(cfg, name)
+        || !generated_mesh(cfg, triangles, name, mesh))
+        return;
+    bench_parse(cfg, mesh, vertices, faces, results);
+    mesh.triangles = faces.size();
+    std::vector<Face>().swap(faces);
+    if (triangles <= 1000000) {
+        std::vector<Vec3>().swap(vertices);
+        bench_model(cfg, mesh, results);
+        return;
+    }
+    view = bench_view(0.5f);
+    run_case(cfg, "transform/" + mesh.name, "vertices",
+             (double)vertices.size(),
+             [&]() { transform_vertices(view, vertices, vs, nullptr); },
+             results);
+}
+
+/* Times as JSON numbers: min, median, mean, p99 and spread. */
+static void print_case(const CaseResult &c, bool last)
+{
+    std::vector<double> sorted;
+    double mean;
+    double var;
+    std::size_t rank;
+
+    sorted = c.ms;
+    std::sort(sorted.begin(), sorted.end());
+    mean = 0.0;
+    for (double v : sorted)
+        mean += v;
+    mean /= (double)sorted.size();
+    var = 0.0;
+    for (double v : sorted)
+        var += (v - mean) * (v - mean);
+    var /= (double)sorted.size();
+    rank = (sorted.size() * 99 + 99) / 100 - 1;
+    std::printf("    {\"name\": \"%s\", \"unit\": \"%s\", \"items\": %.0f, "
+                "\"repeat\": %d,\n"
+                "     \"min_ms\": %.6f, \"median_ms\": %.6f, "
+                "\"mean_ms\": %.6f, \"p99_ms\": %.6f, "
+                "\"stddev_ms\": %.6f,\n"
+                "     \"items_per_s\": %.0f}%s\n",
+                c.name.c_str(), c.unit, c.items, c.repeat, sorted.front(),
+                sorted[sorted.size() / 2], mean, sorted[rank],
+                std::sqrt(var),
+                c.items / (sorted[sorted.size() / 2] / 1000.0),
+                last ? "" : ",");
+}
+
+static void print_results(const BenchConfig &cfg,
+                          const std::vector<CaseResult> &results)
+{
+    std::size_t i;
+
+    std::printf("{\n  \"suite\": \"bench_suite\",\n  \"version\": 1,\n"
+                "  \"threads\": %u,\n  \"kernel\": \"%s\",\n"
+                "  \"iterations\": %d,\n  \"warmup\": %d,\n"
+                "  \"cases\": [\n",
+                cfg.threads, raster_kernel_name(cfg.kernel),
+                cfg.iterations, cfg.warmup);
+    i = 0;
+    while (i < results.size()) {
+        print_case(results[i], i + 1 == results.size());
+        i++;
+    }
+    std::printf("  ]\n}\n");
+}
+
+static bool parse_count(const char *str, long min, long &out)
+{
+    char *end;
+
+    out = std::strtol(str, &end, 10);
+    return *str && !*end && out >= min;
+}
+
+static bool parse_args(int argc, char **argv, BenchConfig &cfg)
+{
+    long n;
+    int i;
+
+    i = 1;
+    while (i < argc) {
+        std::string arg(argv[i]);
+
+        if (i + 1 >= argc)
+            return false;
+        if (arg == "--iterations" && parse_count(argv[i + 1], 1, n))
+            cfg.iterations = (int)n;
+        else if (arg == "--warmup" && parse_count(argv[i + 1], 1, n))
+            cfg.warmup = (int)n;
+        else if ((arg == "-t" || arg == "--threads")
+                 && parse_count(argv[i + 1], 1, n))
+            cfg.threads = (unsigned int)n;
+        else if (arg == "--kernel") {
+            if (!raster_kernel_from_name(argv[i + 1], cfg.kernel)
+                || !raster_kernel_supported(cfg.kernel))
+                return false;
+        } else if (arg == "--max-tris" && parse_count(argv[i + 1], 0, n))
+            cfg.maxTriangles = (std::size_t)n;
+        else if (arg == "--data-dir")
+            cfg.dataDir = argv[i + 1];
+        else if (arg == "--filter")
+            cfg.filter = argv[i + 1];
+        else
+            return false;
+        i += 2;
+    }
+    return true;
+}
+
+int main(int argc, char **argv)
+{
+    BenchConfig cfg;
+    std::vector<CaseResult> results;
+    BenchMesh shipped[3] = {
+        {"tree", "assets/models/tree/tree-branched.obj",
+         "assets/models/tree/tree-branched.mtl", 0},
+        {"fox", "assets/models/fox/Red Fox.obj",
+         "assets/models/fox/Red Fox.mtl", 0},
+        {"whale", "assets/models/whale/Whale.obj",
+         "assets/models/whale/Whale.mtl", 0}
+    };
+    const unsigned int fill[4][2] = {
+        {640, 360}, {1280, 720}, {1920, 1080}, {3840, 2160}
+    };
+    int i;
+
+    cfg.kernel = raster_best_kernel();
+    cfg.threads = ThreadPool::defaultThreadCount();
+    if (!parse_args(argc, argv, cfg)) {
+        std::cerr << "Usage: " << argv[0] << " [--iterations N]"
+                  << " [--warmup N] [-t N] [--kernel NAME]\n"
+                  << "       [--max-tris N] [--data-dir DIR]"
+                  << " [--filter TEXT]" << std::endl;
+        return 84;
+    }
+    for (BenchMesh &mesh : shipped) {
+        std::vector<Vec3> vertices;
+        std::vector<Face> faces;
+
+        if (!mesh_selected(cfg, mesh.name))
+            continue;
+        bench_parse(cfg, mesh, vertices, faces, results);
+        mesh.triangles = faces.size();
+        if (mesh.triangles > 0)
+            bench_model(cfg, mesh, results);
+    }
+    bench_generated(cfg, 1000000, "grid_1m", results);
+    bench_generated(cfg, 10000000, "grid_10m", results);
+    bench_scene(cfg, "assets/scenes/forest.scene", "forest", results);
+    i = 0;
+    while (i < 4) {
+        bench_fill(cfg, fill[i][0], fill[i][1], results);
+        i++;
+    }
+    bench_small_triangles(cfg, results);
+    print_results(cfg, results);
+    return results.empty() ? 84 : 0;
+}
@@ -0,0 +1,421 @@
+#include "Raster.hpp"
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <limits>
+#include <random>
+#include <vector>
+
+/*
+** Fill-rate microbenchmark for the raster kernels.
+** Every scene is drawn into the same 1920x1080 target with each kernel
+** supported by the CPU; the scalar kernel is the reference for both the
+** timing ratio and the pixel comparison.
+** Each kernel is then checked for watertightness on meshes whose
+** triangles share every inner edge, see check_watertight().
+** Exits with 1 when a kernel differs from the scalar one by a single
+** pixel or leaves a hole or an overlap, so it doubles as a test.
+*/
+
+static const int BENCH_W = 1920;
+static const int BENCH_H = 1080;
+
+struct Scene {
+    const char *name;
+    std::vector<RasterTriangle> tris;
+};
+
+static RasterTriangle make_tri(float x1, float y1, float x2, float y2,
+                               float x3, float y3, float z,
+                               std::uint32_t color)
+{
+    RasterTriangle t;
+
+    t.x1 = x1;
+    t.y1 = y1;
+    t.x2 = x2;
+    t.y2 = y2;
+    t.x3 = x3;
+    t.y3 = y3;
+    t.z1 = z;
+    t.z2 = z + 0.25f;
+    t.z3 = z + 0.5f;
+    t.color = color;
+    return t;
+}
+
+static Scene make_fullscreen_scene()
+{
+    Scene scene;
+    int layer;
+
+    scene.name = "fullscreen";
+    layer = 0;
+    while (layer < 8) {
+        float z;
+        std::uint32_t c;
+
+        z = 8.0f - (float)layer;
+        c = pack_rgba((unsigned char)(layer * 30), 128, 200, 255);
+        scene.tris.push_back(make_tri(-10.0f, -10.0f,
+                                      BENCH_W + 10.0f, -10.0f,
+                                      -10.0f, BENCH_H + 10.0f, z, c));
+        scene.tris.push_back(make_tri(BENCH_W + 10.0f, -10.0f,
+                                      BENCH_W + 10.0f, BENCH_H + 10.0f,
+                                      -10.0f, BENCH_H + 10.0f, z, c));
+        layer++;
+    }
+    return scene;
+}
+
+static Scene make_random_scene(const char *name, int count, float size)
+{
+    Scene scene;
+    std::mt19937 rng(1234u);
+    std::uniform_real_distribution<float> posX(0.0f, (float)BENCH_W);
+    std::uniform_real_distribution<float> posY(0.0f, (float)BENCH_H);
+    std::uniform_real_distribution<float> off(-size, size);
+    std::uniform_real_distribution<float> depth(1.0f, 10.0f);
+    int i;
+
+    scene.name = name;
+    i = 0;
+    while (i < count) {
+        float cx;
+        float cy;
+
+        cx = posX(rng);
+        cy = posY(rng);
+        scene.tris.push_back(make_tri(cx + off(rng), cy + off(rng),
+                                      cx + off(rng), cy + off(rng),
+                                      cx + off(rng), cy + off(rng),
+                                      depth(rng),
+                                      pack_rgba((unsigned char)i, 90,
+                                                40, 255)));
+        i++;
+    }
+    return scene;
+}
+
+static double run_kernel(RasterKernel kernel, const Scene &scene,
+                         int iterations,
+                         std::vector<std::uint32_t> &color,
+                         std::vector<float> &depth)
+{
+    RasterTarget target;
+    std::chrono::steady_clock::time_point start;
+    std::chrono::duration<double> elapsed;
+    int it;
+
+    target.color = color.data();
+    target.colorStride = BENCH_W;
+    target.depth = depth.data();
+    target.depthStride = BENCH_W;
+    target.clipX1 = BENCH_W - 1;
+    target.clipY1 = BENCH_H - 1;
+    start = std::chrono::steady_clock::now();
+    it = 0;
+    while (it < iterations) {
+        std::fill(color.begin(), color.end(), 0u);
+        std::fill(depth.begin(), depth.end(),
+                  std::numeric_limits<float>::infinity());
+        for (const RasterTriangle &t : scene.tris)
+            raster_triangle(kernel, t, target);
+        it++;
+    }
+    elapsed = std::chrono::steady_clock::now() - start;
+    return elapsed.count() / iterations;
+}
+
+static unsigned long long covered_pixels(const Scene &scene)
+{
+    unsigned long long total;
+
+    total = 0;
+    for (const RasterTriangle &t : scene.tris) {
+        int x0;
+        int y0;
+        int x1;
+        int y1;
+
+        if (raster_bounds(t, 0, 0, BENCH_W - 1, BENCH_H - 1,
+                          x0, y0, x1, y1))
+            total += (unsigned long long)(x1 - x0 + 1) * (y1 - y0 + 1);
+    }
+    return total;
+}
+
+/*
+** Triangles sharing every inner edge, and the outline of the area they
+** cover: a pixel whose center is strictly inside it has to be filled
+** exactly once. A radius > 0 describes a disk, otherwise a box.
+*/
+struct Mesh2D {
+    const char *name;
+    std::vector<RasterTriangle> tris;
+    float x0;
+    float y0;
+    float x1;
+    float y1;
+    float radius;
+};
+
+/*
+** cols x rows quads of size cell from (x0, y0), split along
+** alternating diagonals; inner corners move by up to jitter.
+*/
+static Mesh2D make_grid_mesh(const char *name, float x0, float y0,
+                             int cols, int rows, float cell, float jitter)
+{
+    Mesh2D mesh;
+    std::mt19937 rng(99u);
+    std::uniform_real_distribution<float> off(-jitter, jitter);
+    std::vector<float> px;
+    std::vector<float> py;
+    int i;
+    int j;
+
+    mesh.name = name;
+    mesh.x0 = x0;
+    mesh.y0 = y0;
+    mesh.x1 = x0 + cols * cell;
+    mesh.y1 = y0 + rows * cell;
+    mesh.radius = 0.0f;
+    j = 0;
+    while (j <= rows) {
+        i = 0;
+        while (i <= cols) {
+            bool inner;
+
+            inner = i > 0 && i < cols && j > 0 && j < rows;
+            px.push_back(x0 + i * cell + (inner ? off(rng) : 0.0f));
+            py.push_back(y0 + j * cell + (inner ? off(rng) : 0.0f));
+            i++;
+        }
+        j++;
+    }
+    j = 0;
+    while (j < rows) {
+        i = 0;
+        while (i < cols) {
+            int a;
+            int b;
+            int c;
+            int d;
+
+            a = j * (cols + 1) + i;
+            b = a + 1;
+            c = a + cols + 1;
+            d = c + 1;
+            if ((i + j) & 1) {
+                mesh.tris.push_back(make_tri(px[a], py[a], px[b], py[b],
+                                             px[d], py[d], 1.0f, 1u));
+                mesh.tris.push_back(make_tri(px[a], py[a], px[d], py[d],
+                                             px[c], py[c], 1.0f, 1u));
+            } else {
+                mesh.tris.push_back(make_tri(px[a], py[a], px[b], py[b],
+                                             px[c], py[c], 1.0f, 1u));
+                mesh.tris.push_back(make_tri(px[b], py[b], px[d], py[d],
+                                             px[c], py[c], 1.0f, 1u));
+            }
+            i++;
+        }
+        j++;
+    }
+    return mesh;
+}
+
+/* count thin slices around (cx, cy), a pixel center. */
+static Mesh2D make_fan_mesh(float cx, float cy, float radius, int count)
+{
+    Mesh2D mesh;
+    int i;
+
+    mesh.name = "fan";
+    mesh.x0 = cx;
+    mesh.y0 = cy;
+    mesh.radius = radius * std::cos(3.14159265f / count) - 1.0f;
+    i = 0;
+    while (i < count) {
+        float a0;
+        float a1;
+
+        a0 = 6.28318531f * i / count;
+        a1 = 6.28318531f * (i + 1) / count;
+        mesh.tris.push_back(make_tri(cx, cy,
+                                     cx + radius * std::cos(a0),
+                                     cy + radius * std::sin(a0),
+                                     cx + radius * std::cos(a1),
+                                     cy + radius * std::sin(a1),
+                                     1.0f, 1u));
+        i++;
+    }
+    return mesh;
+}
+
+/*
+** Draws the triangles one by one into an empty target and counts the
+** writes per pixel. holes: pixels strictly inside the outline never
+** written; overlaps: pixels written more than once.
+*/
+static void check_watertight(RasterKernel kernel, const Mesh2D &mesh,
+                             std::size_t &holes, std::size_t &overlaps)
+{
+    std::vector<std::uint32_t> color;
+    std::vector<float> depth;
+    std::vector<unsigned char> count;
+    RasterTarget target;
+    std::size_t i;
+    int x;
+    int y;
+
+    color.assign((std::size_t)BENCH_W * BENCH_H, 0u);
+    depth.assign(color.size(), std::numeric_limits<float>::infinity());
+    count.assign(color.size(), 0);
+    target.color = color.data();
+    target.colorStride = BENCH_W;
+    target.depth = depth.data();
+    target.depthStride = BENCH_W;
+    target.clipX1 = BENCH_W - 1;
+    target.clipY1 = BENCH_H - 1;
+    for (const RasterTriangle &t : mesh.tris) {
+        int x0;
+        int y0;
+        int x1;
+        int y1;
+
+        raster_triangle(kernel, t, target);
+        if (!raster_bounds(t, 0, 0, BENCH_W - 1, BENCH_H - 1,
+                           x0, y0, x1, y1))
+            continue;
+        y = y0;
+        while (y <= y1) {
+            x = x0;
+            while (x <= x1) {
+                i = (std::size_t)y * BENCH_W + x;
+                if (color[i]) {
+                    count[i]++;
+                    color[i] = 0u;
+                    depth[i] = std::numeric_limits<float>::infinity();
+                }
+                x++;
+            }
+            y++;
+        }
+    }
+    holes = 0;
+    overlaps = 0;
+    y = 0;
+    while (y < BENCH_H) {
+        x = 0;
+        while (x < BENCH_W) {
+            float px;
+            float py;
+            bool inside;
+
+            px = (float)x + 0.5f;
+            py = (float)y + 0.5f;
+            if (mesh.radius > 0.0f)
+                inside = (px - mesh.x0) * (px - mesh.x0)
+                    + (py - mesh.y0) * (py - mesh.y0)
+                    < mesh.radius * mesh.radius;
+            else
+                inside = px > mesh.x0 && px < mesh.x1
+                    && py > mesh.y0 && py < mesh.y1;
+            i = (std::size_t)y * BENCH_W + x;
+            if (inside && count[i] == 0)
+                holes++;
+            if (count[i] > 1)
+                overlaps++;
+            x++;
+        }
+        y++;
+    }
+}
+
+int main(int argc, char **argv)
+{
+    std::vector<Scene> scenes;
+    std::vector<Mesh2D> meshes;
+    std::vector<std::uint32_t> color;
+    std::vector<std::uint32_t> reference;
+    std::vector<float> depth;
+    const RasterKernel kernels[3] = {
+        RasterKernel::Scalar, RasterKernel::SSE2, RasterKernel::AVX2
+    };
+    int iterations;
+    int failures;
+
+    failures = 0;
+    iterations = argc > 1 ? std::atoi(argv[1]) : 20;
+    if (iterations <= 0)
+        iterations = 1;
+    scenes.push_back(make_fullscreen_scene());
+    scenes.push_back(make_random_scene("large", 200, 400.0f));
+    scenes.push_back(make_random_scene("small", 20000, 12.0f));
+    color.resize((std::size_t)BENCH_W * BENCH_H);
+    depth.resize(color.size());
+    std::printf("%-11s %-7s %10s %12s %9s %10s\n", "scene", "kernel",
+                "ms/frame", "Mpix(bb)/s", "speedup", "mismatch");
+    for (const Scene &scene : scenes) {
+        double scalarTime;
+
+        scalarTime = 0.0;
+        for (RasterKernel kernel : kernels) {
+            double t;
+            std::size_t mismatch;
+            std::size_t i;
+
+            if (!raster_kernel_supported(kernel))
+                continue;
+            run_kernel(kernel, scene, 1, color, depth);
+            t = run_kernel(kernel, scene, iterations, color, depth);
+            if (kernel == RasterKernel::Scalar) {
+                scalarTime = t;
+                reference = color;
+            }
+            mismatch = 0;
+            i = 0;
+            while (i < color.size()) {
+                if (color[i] != reference[i])
+                    mismatch++;
+                i++;
+            }
+            std::printf("%-11s %-7s %10.3f %12.1f %8.2fx %10zu\n",
+                        scene.name, raster_kernel_name(kernel),
+                        t * 1000.0,
+                        (double)covered_pixels(scene) / t / 1e6,
+                        scalarTime / t, mismatch);
+            if (mismatch != 0)
+                failures++;
+        }
+    }
+    meshes.push_back(make_grid_mesh("grid", 20.3f, 15.2f, 60, 33, 31.0f,
+                                    7.0f));
+    meshes.push_back(make_grid_mesh("grid-pixel", 100.5f, 60.5f, 200, 110,
+                                    8.0f, 0.0f));
+    meshes.push_back(make_fan_mesh(960.5f, 540.5f, 500.0f, 257));
+    std::printf("\n%-11s %-7s %10s %10s\n", "mesh", "kernel", "holes",
+                "overlaps");
+    for (const Mesh2D &mesh : meshes) {
+        for (RasterKernel kernel : kernels) {
+            std::size_t holes;
+            std::size_t overlaps;
+
+            if (!raster_kernel_supported(kernel))
+                continue;
+            check_watertight(kernel, mesh, holes, overlaps);
+            std::printf("%-11s %-7s %10zu %10zu\n", mesh.name,
+                        raster_kernel_name(kernel), holes, overlaps);
+            if (holes != 0 || overlaps != 0)
+                failures++;
+        }
+    }
+    if (failures != 0) {
+        std::fprintf(stderr, "Error: %d kernel check(s) failed.\n",
+                     failures);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,106 @@
+#include "CpuRenderer.hpp"
+#include "DepthSort.hpp"
+#include "Model.hpp"
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+/*
+** Depth order microbenchmark.
+** Renders an orbit of every model with each DepthSort mode through
+** the whole CpuRenderer pipeline and prints the mean sort, raster and
+** frame time. "same" tells whether the last frame matches the
+** painter's one pixel for pixel (only z ties may differ).
+*/
+
+static const unsigned int BENCH_W = 1920;
+static const unsigned int BENCH_H = 1080;
+
+struct Timing {
+    double sortMs;
+    double rasterMs;
+    double frameMs;
+};
+
+static Timing run_orbit(CpuRenderer &renderer, int frames)
+{
+    Timing sum;
+    int i;
+
+    sum.sortMs = 0.0;
+    sum.rasterMs = 0.0;
+    sum.frameMs = 0.0;
+    renderer.setAngles(0.5f, 0.3f);
+    renderer.render(BENCH_W, BENCH_H);
+    i = 0;
+    while (i < frames) {
+        const RenderStats &s = renderer.getStats();
+
+        renderer.setAngles(0.5f + 0.01f * (i + 1), 0.3f);
+        renderer.render(BENCH_W, BENCH_H);
+        sum.sortMs += s.sortMs;
+        sum.rasterMs += s.rasterMs;
+        sum.frameMs += s.transformMs + s.setupMs + s.sortMs + s.binMs
+            + s.rasterMs;
+        i++;
+    }
+    sum.sortMs /= frames;
+    sum.rasterMs /= frames;
+    sum.frameMs /= frames;
+    return sum;
+}
+
+int main(int argc, char **argv)
+{
+    std::vector<std::string> paths;
+    const DepthSort modes[3] = {
+        DepthSort::BackToFront, DepthSort::FrontToBack, DepthSort::None
+    };
+    int frames;
+    int i;
+
+    frames = argc > 1 ? std::atoi(argv[1]) : 100;
+    if (frames <= 0)
+        frames = 1;
+    paths.push_back("assets/models/tree/tree-branched.obj");
+    paths.push_back("assets/models/fox/Red Fox.obj");
+    paths.push_back("assets/models/whale/Whale.obj");
+    i = 2;
+    while (i < argc) {
+        paths.push_back(argv[i]);
+        i++;
+    }
+    std::printf("%-20s %10s %-8s %10s %10s %10s %5s\n", "mesh", "faces",
+                "sort", "sort ms", "raster ms", "frame ms", "same");
+    for (const std::string &path : paths) {
+        Model model;
+        CpuRenderer renderer;
+        std::vector<std::uint32_t> painter;
+        std::string name;
+
+        if (!model.loadFromObj(path)) {
+            std::fprintf(stderr, "Warning: cannot load %s\n", path.c_str());
+            continue;
+        }
+        name = path.substr(path.find_last_of('/') + 1);
+        renderer.setModel(&model);
+        renderer.setZoom(1.2f);
+        renderer.setLod(0);
+        for (DepthSort mode : modes) {
+            Timing t;
+
+            renderer.setDepthSort(mode);
+            t = run_orbit(renderer, frames);
+            if (mode == DepthSort::BackToFront)
+                painter = renderer.getFrame().pixels;
+            std::printf("%-20s %10zu %-8s %10.4f %10.4f %10.4f %5s\n",
+                        name.c_str(), model.getFaceCount(),
+                        depth_sort_name(mode), t.sortMs, t.rasterMs,
+                        t.frameMs,
+                        renderer.getFrame().pixels == painter
+                            ? "yes" : "no");
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,258 @@
+#include "Math.hpp"
+#include "Model.hpp"
+#include "Raster.hpp"
+#include "VertexTransform.hpp"
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+/*
+** Vertex stage microbenchmark.
+** "per-corner" is the old triangle setup: rotate_xy() (with its own
+** cos/sin) + translate + project for each of the three corners of
+** every face. "per-vertex" transforms the vertex array once with
+** transform_vertices() and then gathers the corners by index. Both
+** produce the same RasterTriangle positions; lighting is left out as
+** it is identical in both. Runs on one thread to compare work, not
+** scaling.
+*/
+
+static const std::size_t OUT_RING = 4096;
+static const float BENCH_W = 1920.0f;
+static const float BENCH_H = 1080.0f;
+
+struct Mesh {
+    std::string name;
+    std::vector<Vec3> vertices;
+    std::vector<Face> faces;
+};
+
+/* side x side grid on a sphere, two triangles per quad. */
+static Mesh make_grid_mesh(int side)
+{
+    Mesh mesh;
+    int i;
+    int j;
+
+    mesh.name = "grid " + std::to_string(side) + "^2";
+    mesh.vertices.reserve((std::size_t)side * side);
+    j = 0;
+    while (j < side) {
+        i = 0;
+        while (i < side) {
+            float u;
+            float v;
+
+            u = (float)i / (float)(side - 1) * 6.2831853f;
+            v = (float)j / (float)(side - 1) * 3.1415926f;
+            mesh.vertices.push_back(make_vec3(std::sin(v) * std::cos(u),
+                                              std::cos(v),
+                                              std::sin(v) * std::sin(u)));
+            i++;
+        }
+        j++;
+    }
+    mesh.faces.reserve((std::size_t)(side - 1) * (side - 1) * 2);
+    j = 0;
+    while (j + 1 < side) {
+        i = 0;
+        while (i + 1 < side) {
+            Face f;
+            int k;
+
+            k = j * side + i;
+            f.a = k;
+            f.b = k + side;
+            f.c = k + 1;
+            mesh.faces.push_back(f);
+            f.a = k + 1;
+            f.b = k + side;
+            f.c = k + side + 1;
+            mesh.faces.push_back(f);
+            i++;
+        }
+        j++;
+    }
+    return mesh;
+}
+
+static bool load_mesh(const char *path, Mesh &mesh)
+{
+    Model model;
+    std::size_t i;
+
+    if (!model.loadFromObj(path))
+        return false;
+    mesh.name = path;
+    if (mesh.name.find_last_of('/') != std::string::npos)
+        mesh.name = mesh.name.substr(mesh.name.find_last_of('/') + 1);
+    mesh.vertices.resize(model.getVertexCount());
+    i = 0;
+    while (i < mesh.vertices.size()) {
+        mesh.vertices[i] = model.getPositions().get(i);
+        i++;
+    }
+    mesh.faces.resize(model.getFaceCount());
+    i = 0;
+    while (i < mesh.faces.size()) {
+        mesh.faces[i] = model.getLodIndices(0).getFace(i);
+        i++;
+    }
+    return true;
+}
+
+static void store_corners(RasterTriangle &t, const Vec2 &p1,
+                          const Vec2 &p2, const Vec2 &p3,
+                          float z1, float z2, float z3)
+{
+    t.x1 = p1.x;
+    t.y1 = p1.y;
+    t.x2 = p2.x;
+    t.y2 = p2.y;
+    t.x3 = p3.x;
+    t.y3 = p3.y;
+    t.z1 = z1;
+    t.z2 = z2;
+    t.z3 = z3;
+}
+
+static void run_per_corner(const Mesh &mesh, float angle,
+                           std::vector<RasterTriangle> &out)
+{
+    Vec3 offset;
+    std::size_t i;
+
+    offset = make_vec3(0.0f, 0.0f, 4.0f);
+    i = 0;
+    while (i < mesh.faces.size()) {
+        const Face &f = mesh.faces[i];
+        Vec3 w1;
+        Vec3 w2;
+        Vec3 w3;
+
+        w1 = translate(rotate_xy(mesh.vertices[f.a], angle, 0.3f), offset);
+        w2 = translate(rotate_xy(mesh.vertices[f.b], angle, 0.3f), offset);
+        w3 = translate(rotate_xy(mesh.vertices[f.c], angle, 0.3f), offset);
+        store_corners(out[i % OUT_RING],
+                      project_perspective(w1, 1.2f, BENCH_W, BENCH_H),
+                      project_perspective(w2, 1.2f, BENCH_W, BENCH_H),
+                      project_perspective(w3, 1.2f, BENCH_W, BENCH_H),
+                      w1.z, w2.z, w3.z);
+        i++;
+    }
+}
+
+static void run_per_vertex(const Mesh &mesh, float angle,
+                           VertexStream &vs,
+                           std::vector<RasterTriangle> &out)
+{
+    ViewTransform view;
+    std::size_t i;
+
+    view = make_view_transform(angle, 0.3f, make_vec3(0.0f, 0.0f, 4.0f),
+                               1.2f, BENCH_W, BENCH_H);
+    transform_vertices(view, mesh.vertices, vs, nullptr);
+    i = 0;
+    while (i < mesh.faces.size()) {
+        const Face &f = mesh.faces[i];
+
+        store_corners(out[i % OUT_RING],
+                      make_vec2(vs.sx[f.a], vs.sy[f.a]),
+                      make_vec2(vs.sx[f.b], vs.sy[f.b]),
+                      make_vec2(vs.sx[f.c], vs.sy[f.c]),
+                      vs.z[f.a], vs.z[f.b], vs.z[f.c]);
+        i++;
+    }
+}
+
+/* Largest screen-space gap between both paths on the last frame. */
+static float max_difference(const Mesh &mesh, const VertexStream &vs,
+                            float angle)
+{
+    Vec3 offset;
+    float worst;
+    std::size_t i;
+
+    offset = make_vec3(0.0f, 0.0f, 4.0f);
+    worst = 0.0f;
+    i = 0;
+    while (i < mesh.vertices.size()) {
+        Vec2 p;
+
+        p = project_perspective(
+            translate(rotate_xy(mesh.vertices[i], angle, 0.3f), offset),
+            1.2f, BENCH_W, BENCH_H);
+        worst = std::fmax(worst, std::fabs(p.x - vs.sx[i]));
+        worst = std::fmax(worst, std::fabs(p.y - vs.sy[i]));
+        i++;
+    }
+    return worst;
+}
+
+int main(int argc, char **argv)
+{
+    std::vector<Mesh> meshes;
+    std::vector<RasterTriangle> out(OUT_RING);
+    VertexStream vs;
+    const char *defaults[2] = {
+        "assets/models/tree/tree-branched.obj",
+        "assets/models/whale/Whale.obj"
+    };
+    int iterations;
+    int side;
+    int i;
+
+    iterations = argc > 1 ? std::atoi(argv[1]) : 10;
+    if (iterations <= 0)
+        iterations = 1;
+    side = argc > 2 ? std::atoi(argv[2]) : 3163;
+    i = 0;
+    while (i < 2) {
+        Mesh mesh;
+
+        if (load_mesh(defaults[i], mesh))
+            meshes.push_back(mesh);
+        else
+            std::fprintf(stderr, "Warning: cannot load %s\n", defaults[i]);
+        i++;
+    }
+    if (side >= 2)
+        meshes.push_back(make_grid_mesh(side));
+    std::printf("%-20s %10s %10s %12s %12s %9s %9s\n", "mesh", "vertices",
+                "faces", "corner ms", "vertex ms", "speedup", "max err");
+    for (const Mesh &mesh : meshes) {
+        std::chrono::steady_clock::time_point start;
+        double corner;
+        double vertex;
+        int runs;
+        int it;
+
+        runs = iterations;
+        if (mesh.faces.size() < 100000)
+            runs = iterations * 1000;
+        start = std::chrono::steady_clock::now();
+        it = 0;
+        while (it < runs) {
+            run_per_corner(mesh, 0.01f * it, out);
+            it++;
+        }
+        corner = std::chrono::duration<double, std::milli>(
+            std::chrono::steady_clock::now() - start).count() / runs;
+        start = std::chrono::steady_clock::now();
+        it = 0;
+        while (it < runs) {
+            run_per_vertex(mesh, 0.01f * it, vs, out);
+            it++;
+        }
+        vertex = std::chrono::duration<double, std::milli>(
+            std::chrono::steady_clock::now() - start).count() / runs;
+        std::printf("%-20s %10zu %10zu %12.4f %12.4f %8.2fx %9.2g\n",
+                    mesh.name.c_str(), mesh.vertices.size(),
+                    mesh.faces.size(), corner, vertex, corner / vertex,
+                    max_difference(mesh, vs, 0.01f * (runs - 1)));
+    }
+    return 0;
+}
@@ -0,0 +1,78 @@
+#!/usr/bin/env python3
+"""Compares two bench_suite JSON results case by case.
+
+    python3 bench/compare.py BASELINE.json NEW.json [--threshold 0.10]
+
+A case regresses when both its median and its fastest time per
+operation grew by more than the threshold (a fraction), so a few noisy
+samples alone do not flag it; it is faster when both shrank by as
+much. A baseline case missing from the new run (renamed, crashed or
+filtered out) fails like a regression. Exits with 1 when any case
+regressed or is missing, 0 otherwise, and 84 on bad input. Only
+compare runs of one machine, build and thread count.
+"""
+
+import argparse
+import json
+import sys
+
+
+def load(path):
+    try:
+        with open(path) as f:
+            doc = json.load(f)
+        cases = {c["name"]: c for c in doc["cases"]}
+        for c in cases.values():
+            if not (float(c["median_ms"]) > 0 and float(c["min_ms"]) > 0):
+                raise ValueError(f"case {c['name']} has no positive time")
+        return doc, cases
+    except (OSError, ValueError, KeyError, TypeError) as e:
+        print(f"Error: {path}: {e}", file=sys.stderr)
+        sys.exit(84)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("baseline")
+    parser.add_argument("new")
+    parser.add_argument("--threshold", type=float, default=0.10)
+    args = parser.parse_args()
+
+    base_doc, base = load(args.baseline)
+    new_doc, new = load(args.new)
+    for key in ("threads", "kernel"):
+        if base_doc.get(key) != new_doc.get(key):
+            print(f"Warning: {key} differs: {base_doc.get(key)} vs "
+                  f"{new_doc.get(key)}, times are not comparable.",
+                  file=sys.stderr)
+
+    regressions = 0
+    missing = 0
+    print(f"{'case':34} {'base ms':>12} {'new ms':>12} {'change':>8}")
+    for name, b in base.items():
+        n = new.get(name)
+        if n is None:
+            print(f"{name:34} {b['median_ms']:12.4f} {'missing':>12}"
+                  f"{'':9}  MISSING")
+            missing += 1
+            continue
+        change = n["median_ms"] / b["median_ms"] - 1.0
+        fastest = n["min_ms"] / b["min_ms"] - 1.0
+        flag = ""
+        if min(change, fastest) > args.threshold:
+            flag = "  REGRESSION"
+            regressions += 1
+        elif max(change, fastest) < -args.threshold:
+            flag = "  faster"
+        print(f"{name:34} {b['median_ms']:12.4f} {n['median_ms']:12.4f} "
+              f"{change * 100.0:+7.1f}%{flag}")
+    for name in new:
+        if name not in base:
+            print(f"{name:34} {'new':>12} {new[name]['median_ms']:12.4f}")
+    print(f"{regressions} regression(s) above "
+          f"{args.threshold * 100.0:.0f}%, {missing} case(s) missing")
+    return 1 if regressions or missing else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
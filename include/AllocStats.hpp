@@ -0,0 +1,27 @@
+#ifndef ALLOCSTATS_HPP
+#define ALLOCSTATS_HPP
+
+#include <cstddef>
+
+/*
+** Process-wide heap counters, fed by the global operator new
+** replacement in AllocStats.cpp. Take a snapshot before and after a
+** piece of work and subtract to see what it allocated.
+*/
+struct AllocStats {
+    unsigned long long count = 0;
+    unsigned long long bytes = 0;
+};
+
+AllocStats alloc_stats();
+
+/*
+** Peak resident set size of the process in bytes, 0 when unknown.
+** reset_peak_rss() restarts the peak from the current size so that it
+** covers one piece of work; it needs Linux (/proc/self/clear_refs)
+** and returns false elsewhere, the peak then covering the process.
+*/
+std::size_t peak_rss_bytes();
+bool reset_peak_rss();
+
+#endif
@@ -6,33 +6,49 @@
 #include <string>
 #include "Renderer.hpp"
 #include "Model.hpp"
+#include "Options.hpp"
+#include "Scene.hpp"
 
 class App {
 public:
-    App(const char *objPath, const char *mtlPath, bool &ok);
+    App(const Options &opts, bool &ok);
 
     void run();
 
 private:
-    void handleEvents();
+    bool loadModel(const Options &opts);
+    bool loadScene(const Options &opts);
+    void handleEvents(bool wait);
     void update();
     void render();
     void updateHudText();
+    void updateProfileText();
+    void writeTrace();
+    void cycleEdgeMode();
     void setupHud();
     void updateButtonsStyle();
 
     sf::RenderWindow m_window;
     Renderer m_renderer;
     Model m_model;
+    /* Drawn instead of m_model with --scene. */
+    Scene m_scene;
+    bool m_hasScene;
     bool m_running;
     float m_angleY;
     float m_angleX;
     float m_zoom;
     bool m_autoRotate;
-    bool m_showEdges;
+    EdgeMode m_edgeMode;
+    int m_pickedInstance;
+    int m_pickedFace;
+    bool m_showProfile;
+    std::string m_tracePath;
+    bool m_traceOnExit;
 
     sf::Font m_font;
     std::optional<sf::Text> m_text;
+    std::optional<sf::Text> m_profileText;
     bool m_hasFont;
     std::string m_objName;
     std::string m_mtlName;
@@ -0,0 +1,19 @@
+#ifndef BATCH_HPP
+#define BATCH_HPP
+
+#include "Options.hpp"
+
+/*
+** Headless batch renderer (--batch) for thumbnails and turntables.
+** Every manifest line names an OBJ, optionally followed by a tab and
+** its MTL; blank lines and lines starting with '#' are skipped.
+** Assets are spread over one ThreadPool: each job loads its model,
+** renders opts.views into one of the pooled CpuRenderers (whose
+** FrameContext is reused from job to job) and writes
+** <out-dir>/<obj stem>[_NNN].png|.rgba. Prints a JSON summary with
+** assets/s and frames/s on stdout; returns the process exit code, 84
+** when the manifest cannot be read or any asset failed.
+*/
+int run_batch(const Options &opts);
+
+#endif
@@ -0,0 +1,13 @@
+#ifndef BENCH_HPP
+#define BENCH_HPP
+
+#include "Options.hpp"
+
+/*
+** Headless benchmark: loads the model, renders opts.frames frames
+** into an offscreen RGBA buffer and prints JSON timings on stdout.
+** Returns the process exit code.
+*/
+int run_bench(const Options &opts);
+
+#endif
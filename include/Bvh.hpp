@@ -0,0 +1,67 @@
+#ifndef BVH_HPP
+#define BVH_HPP
+
+#include <cstddef>
+#include <vector>
+#include "Math.hpp"
+
+struct Face;
+class IndexBuffer;
+class PositionBuffer;
+class ThreadPool;
+
+/*
+** Leaf: count > 0 faces, getFaceOrder()[first .. first + count).
+** Inner: count == 0, children are nodes first and first + 1.
+*/
+struct BvhNode {
+    Vec3 min;
+    Vec3 max;
+    unsigned int first = 0;
+    unsigned int count = 0;
+};
+
+/*
+** Bounding volume hierarchy over the faces of a model, built with a
+** binned surface area heuristic. The upper levels are split on the
+** calling thread until there is one subtree per pool task, the
+** subtrees are then built in parallel and stitched into one array.
+*/
+class Bvh {
+public:
+    Bvh();
+
+    void build(const std::vector<Vec3> &vertices,
+               const std::vector<Face> &faces, ThreadPool *pool);
+    void clear();
+    bool empty() const;
+
+    /* Takes prebuilt arrays (mesh cache); false if they are invalid. */
+    bool assign(std::vector<BvhNode> &nodes,
+                std::vector<unsigned int> &order, std::size_t faceCount);
+
+    const std::vector<BvhNode> &getNodes() const;
+    const std::vector<unsigned int> &getFaceOrder() const;
+
+    /*
+    ** Appends the faces of every leaf touching the frustum to out.
+    ** Returns true, and leaves out empty, when the whole model is
+    ** inside so the caller can skip the list.
+    */
+    bool collectVisible(const Frustum &frustum,
+                        std::vector<unsigned int> &out) const;
+
+    /* Closest face hit by the ray, -1 when there is none. */
+    int intersect(const Vec3 &origin, const Vec3 &dir,
+                  const PositionBuffer &vertices,
+                  const IndexBuffer &faces, float &t) const;
+
+private:
+    void collect(unsigned int index, const Frustum &frustum,
+                 unsigned int mask, std::vector<unsigned int> &out) const;
+
+    std::vector<BvhNode> m_nodes;
+    std::vector<unsigned int> m_order;
+};
+
+#endif
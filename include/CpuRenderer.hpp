@@ -0,0 +1,149 @@
+#ifndef CPURENDERER_HPP
+#define CPURENDERER_HPP
+
+#include <memory>
+#include "AllocStats.hpp"
+#include "Model.hpp"
+#include "FrameContext.hpp"
+#include "Raster.hpp"
+#include "ThreadPool.hpp"
+#include "TriangleSetup.hpp"
+#include "VisBuffer.hpp"
+#include "Wireframe.hpp"
+
+class Scene;
+
+struct RenderStats {
+    unsigned long long allocations = 0;
+    std::size_t triangles = 0;
+    /* Finest level drawn; faces of the drawn levels of all instances. */
+    int lod = 0;
+    std::size_t lodFaces = 0;
+    /* Instances drawn, and left out by their bounding sphere. */
+    std::size_t instances = 0;
+    std::size_t instancesCulled = 0;
+    SetupStats culling;
+    double transformMs = 0.0;
+    double setupMs = 0.0;
+    double sortMs = 0.0;
+    double binMs = 0.0;
+    double rasterMs = 0.0;
+    /* Visibility shading pass, 0 in forward shading. */
+    double resolveMs = 0.0;
+    double uploadMs = 0.0;
+    double edgesMs = 0.0;
+    /*
+    ** reused: nothing changed since the last frame, so it was kept and
+    ** the figures above still describe that frame.
+    */
+    bool reused = false;
+    unsigned long long framesRendered = 0;
+    unsigned long long framesSkipped = 0;
+    /*
+    ** Renderer only: input event to display of the frame answering it,
+    ** for the last such frame.
+    */
+    double latencyMs = 0.0;
+};
+
+/*
+** The window-free half of the renderer: transforms, sorts, bins and
+** rasterizes the model, or every instance of a scene, into the RGBA
+** buffer of its FrameContext.
+** FramePipeline runs it for the window (Renderer) and --bench,
+** --batch and the bench programs drive it directly.
+** Setters only mark the frame dirty when a value changes, and render()
+** keeps the previous frame when nothing did.
+*/
+class CpuRenderer {
+public:
+    CpuRenderer();
+
+    /* Draws model alone, or scene; setting one unsets the other. */
+    void setModel(const Model *model);
+    void setScene(const Scene *scene);
+    void setAngles(float angleY, float angleX);
+    void setZoom(float zoom);
+    /*
+    ** The tile pool is only started by setThreadCount() or on first
+    ** use, so a renderer configured right away starts its threads once.
+    */
+    void setThreadCount(unsigned int threads);
+    unsigned int getThreadCount() const;
+    /* Rasterizes on other's pool from now on (FramePipeline). */
+    void shareThreadPool(CpuRenderer &other);
+    /*
+    ** The tile pool, for loads to run on between frames; never while a
+    ** frame of this renderer is being drawn.
+    */
+    ThreadPool &getThreadPool();
+    void setRasterKernel(RasterKernel kernel);
+    RasterKernel getRasterKernel() const;
+    void setCullMode(unsigned int mode);
+    unsigned int getCullMode() const;
+    void setDepthSort(DepthSort sort);
+    DepthSort getDepthSort() const;
+    /*
+    ** Only EdgeMode::Visible is drawn here; All is left to the caller
+    ** (Renderer), on top of the frame.
+    */
+    void setEdgeMode(EdgeMode mode);
+    EdgeMode getEdgeMode() const;
+    void setShading(ShadingMode mode);
+    ShadingMode getShading() const;
+    /*
+    ** Face of scene instance drawn highlighted (instance 0 for a lone
+    ** model), -1 for none.
+    */
+    void setHighlightFace(int instance, int face);
+    /* Forces a level of detail; -1 picks it from the view each frame. */
+    void setLod(int level);
+
+    /*
+    ** Index of the face under screen point (x, y), -1 for none, and
+    ** the scene instance it is on. Read from the visibility buffer
+    ** when the last frame has one with that instance at level 0,
+    ** otherwise cast through the BVH of every drawn instance.
+    */
+    int pick(float x, float y, int &instance) const;
+
+    bool render(unsigned int width, unsigned int height);
+    /*
+    ** render() in two halves, for FramePipeline: prepare() transforms,
+    ** sets up, sorts and bins (on the calling thread alone when
+    ** serial, leaving the pool to another frame's raster), rasterize()
+    ** fills the buffers on the pool. prepare() returns false when
+    ** there is nothing to draw; rasterize() keeps a reused frame.
+    */
+    bool prepare(unsigned int width, unsigned int height, bool serial);
+    void rasterize();
+    const FrameContext &getFrame() const;
+    const RenderStats &getStats() const;
+
+private:
+    void placeInstances(const ViewTransform &view);
+    void transformInstances(ThreadPool *pool);
+    void setupInstances();
+
+    const Model *m_model;
+    const Scene *m_scene;
+    float m_angleY;
+    float m_angleX;
+    float m_zoom;
+    RasterKernel m_kernel;
+    unsigned int m_cullMode;
+    DepthSort m_sort;
+    EdgeMode m_edgeMode;
+    ShadingMode m_shading;
+    int m_highlightInstance;
+    int m_highlightFace;
+    int m_lodMode;
+    bool m_hasView;
+    bool m_dirty;
+    std::shared_ptr<ThreadPool> m_pool;
+    FrameContext m_frame;
+    RenderStats m_stats;
+    AllocStats m_allocBase;
+};
+
+#endif
@@ -0,0 +1,43 @@
+#ifndef DEPTHSORT_HPP
+#define DEPTHSORT_HPP
+
+#include <cstdint>
+#include <vector>
+
+class ThreadPool;
+
+/*
+** Order in which triangles reach the tiles.
+** BackToFront is the painter's std::sort over the triangles
+** themselves. FrontToBack radix sorts compact (key, index) pairs so
+** the z-buffer rejects hidden pixels early. None keeps setup order and
+** leaves visibility to the z-buffer alone.
+*/
+enum class DepthSort {
+    BackToFront,
+    FrontToBack,
+    None
+};
+
+const char *depth_sort_name(DepthSort sort);
+bool depth_sort_from_name(const char *name, DepthSort &sort);
+
+struct DepthKey {
+    std::uint32_t key;
+    std::uint32_t index;
+};
+
+/* Maps a float onto an unsigned int with the same ordering. */
+std::uint32_t depth_key(float z);
+
+/*
+** Stable LSD radix sort on key, 8 bits per pass. Every pass counts
+** and scatters per block on the pool; passes whose digit is the same
+** for all keys (the exponent of a narrow depth range) are skipped.
+** scratch and counts are work buffers kept by the caller.
+*/
+void radix_sort_keys(std::vector<DepthKey> &keys,
+                     std::vector<DepthKey> &scratch,
+                     std::vector<unsigned int> &counts, ThreadPool *pool);
+
+#endif
@@ -0,0 +1,19 @@
+#ifndef EDGELIST_HPP
+#define EDGELIST_HPP
+
+#include <cstddef>
+#include <vector>
+#include "Model.hpp"
+
+/*
+** Unique undirected edges of a face list, for the wireframe overlay.
+** Each edge shared by several faces is kept once, as (a, b) with
+** a < b, sorted by a then b. Degenerate edges (a == b) are dropped.
+** Faces are bucketed by their lower vertex (count / prefix-sum /
+** scatter), so the cost is linear in the faces plus one small sort
+** per vertex.
+*/
+void build_edge_list(const IndexBuffer &faces, std::size_t vertexCount,
+                     std::vector<Edge> &edges);
+
+#endif
@@ -0,0 +1,103 @@
+#ifndef FRAMECONTEXT_HPP
+#define FRAMECONTEXT_HPP
+
+#include <cstdint>
+#include <vector>
+#include "DepthSort.hpp"
+#include "Math.hpp"
+#include "VertexTransform.hpp"
+
+struct TriData {
+    Vec3 w1;
+    Vec3 w2;
+    Vec3 w3;
+    Vec2 p1;
+    Vec2 p2;
+    Vec2 p3;
+    /* Flat color; left at 0 when the visibility resolve shades it. */
+    std::uint32_t color;
+    /* Face of the drawn level this triangle (or clipped piece) is from. */
+    std::uint32_t face;
+    /* Index of its FrameInstance. */
+    std::uint32_t instance;
+};
+
+class Model;
+
+/*
+** One model drawn in the frame: the lone model of the renderer, or a
+** scene instance that passed the bounding sphere test. Its vertices
+** are verts[firstVertex .. firstVertex + vertex count).
+*/
+struct FrameInstance {
+    const Model *model;
+    /* Scene placement folded into the camera, see instance_view(). */
+    ViewTransform view;
+    float scale;
+    int lod;
+    /* Face of level lod drawn highlighted, -1 for none. */
+    int highlightFace;
+    /* Index in the scene (0 for a lone model). */
+    unsigned int source;
+    std::size_t firstVertex;
+    /* First transform job, TRANSFORM_BLOCK vertices each. */
+    std::size_t firstBlock;
+};
+
+static const unsigned int TILE_SIZE = 64;
+static const unsigned int TILE_AREA = TILE_SIZE * TILE_SIZE;
+
+struct Tile {
+    int x0 = 0;
+    int y0 = 0;
+    int x1 = -1;
+    int y1 = -1;
+    unsigned int first = 0;
+    unsigned int count = 0;
+};
+
+/* Inclusive range of tiles a triangle overlaps; empty when x0 > x1. */
+struct TileRect {
+    int x0;
+    int y0;
+    int x1;
+    int y1;
+};
+
+/*
+** Everything one frame of the CPU pipeline writes into. It lives as
+** long as the Renderer: vectors are cleared, never freed, and only
+** grow when the model or the target size grows, so a steady camera
+** orbit renders without touching the heap.
+*/
+class FrameContext {
+public:
+    FrameContext();
+
+    bool resize(unsigned int width, unsigned int height);
+
+    unsigned int width;
+    unsigned int height;
+    unsigned int tilesX;
+    unsigned int tilesY;
+    std::vector<FrameInstance> instances;
+    VertexStream verts;
+    std::vector<unsigned int> visibleFaces;
+    std::vector<TriData> tris;
+    /* Walk order of tris for the tiles, empty for their own order. */
+    std::vector<DepthKey> sortKeys;
+    std::vector<DepthKey> sortScratch;
+    std::vector<unsigned int> sortCounts;
+    std::vector<Tile> tiles;
+    std::vector<TileRect> triTiles;
+    std::vector<unsigned int> bins;
+    std::vector<float> depth;
+    std::vector<std::uint32_t> pixels;
+    /*
+    ** Visibility mode only: index into tris of the triangle seen at
+    ** each pixel (NO_TRIANGLE for none), laid out like pixels.
+    */
+    std::vector<std::uint32_t> ids;
+};
+
+#endif
@@ -0,0 +1,152 @@
+#ifndef FRAMEPIPELINE_HPP
+#define FRAMEPIPELINE_HPP
+
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include "CpuRenderer.hpp"
+
+/* What the caller sets; copied into a buffer's renderer on submit(). */
+struct FrameSettings {
+    /* At most one of both is set. */
+    const Model *model = nullptr;
+    const Scene *scene = nullptr;
+    float angleY = 0.0f;
+    float angleX = 0.0f;
+    float zoom = 1.0f;
+    RasterKernel kernel = RasterKernel::Scalar;
+    unsigned int cullMode = CULL_ALL;
+    DepthSort sort = DepthSort::None;
+    EdgeMode edges = EdgeMode::Off;
+    ShadingMode shading = ShadingMode::Forward;
+    int highlightInstance = 0;
+    int highlightFace = -1;
+    int lod = -1;
+};
+
+/*
+** Double-buffered CPU frames: two CpuRenderers, so two FrameContexts,
+** rasterizing on one shared ThreadPool.
+** Pipelined, a setup thread runs transform .. bin of frame N+1 (on
+** itself alone) while a raster thread fills frame N with the pool;
+** the caller only submits views and collects finished frames. At most
+** two frames are in flight and an older finished frame is dropped
+** when a newer one is done, so a view change is on screen within two
+** frame times. Sequential, submit() renders on the calling thread.
+** Every method is for one caller thread only.
+*/
+class FramePipeline {
+public:
+    typedef std::chrono::steady_clock Clock;
+
+    FramePipeline();
+    ~FramePipeline();
+
+    FramePipeline(const FramePipeline &) = delete;
+    FramePipeline &operator=(const FramePipeline &) = delete;
+
+    void setPipelined(bool pipelined);
+    bool isPipelined() const;
+
+    void setModel(const Model *model);
+    void setScene(const Scene *scene);
+    void setAngles(float angleY, float angleX);
+    void setZoom(float zoom);
+    void setThreadCount(unsigned int threads);
+    unsigned int getThreadCount() const;
+    /* The raster pool, idle once this returns: loads can run on it. */
+    ThreadPool &getThreadPool();
+    void setRasterKernel(RasterKernel kernel);
+    RasterKernel getRasterKernel() const;
+    void setCullMode(unsigned int mode);
+    unsigned int getCullMode() const;
+    void setDepthSort(DepthSort sort);
+    DepthSort getDepthSort() const;
+    void setEdgeMode(EdgeMode mode);
+    EdgeMode getEdgeMode() const;
+    void setShading(ShadingMode mode);
+    ShadingMode getShading() const;
+    void setHighlightFace(int instance, int face);
+    void setLod(int level);
+
+    /*
+    ** An input arrived at time; the next submitted frame answers it.
+    ** Only the oldest input pending is kept.
+    */
+    void markInput(Clock::time_point time);
+
+    /*
+    ** Queues a frame of the current settings. False when nothing
+    ** changed since the last frame (pending input is then dropped) or
+    ** both buffers are busy (try again after the next acquire()).
+    */
+    bool submit(unsigned int width, unsigned int height);
+
+    /*
+    ** Newest finished frame, or null when none is. With wait, blocks
+    ** while frames are in flight. The frame is left alone until
+    ** release(), which must come before the next submit().
+    */
+    const CpuRenderer *acquire(bool wait);
+    void release();
+    /* Input the acquired frame answers; false when it had none. */
+    bool acquiredInput(Clock::time_point &time) const;
+
+    /* Frames queued, in setup or in raster. */
+    bool busy() const;
+    /* CpuRenderer::pick() in the newest finished frame. */
+    int pick(float x, float y, int &instance);
+
+private:
+    enum class SlotState {
+        Free,
+        Queued,
+        Setup,
+        Prepared,
+        Raster,
+        Ready,
+        Acquired
+    };
+
+    struct Slot {
+        CpuRenderer renderer;
+        SlotState state = SlotState::Free;
+        unsigned long long sequence = 0;
+        unsigned int width = 0;
+        unsigned int height = 0;
+        bool hasInput = false;
+        Clock::time_point input;
+    };
+
+    static const int SLOTS = 2;
+
+    void applySettings(CpuRenderer &renderer) const;
+    bool sameAsLast(unsigned int width, unsigned int height) const;
+    bool inFlight() const;
+    void drain();
+    void startThreads();
+    void stopThreads();
+    int nextSlot(SlotState state) const;
+    void setupLoop();
+    void rasterLoop();
+
+    Slot m_slots[SLOTS];
+    FrameSettings m_settings;
+    FrameSettings m_last;
+    unsigned int m_lastWidth;
+    unsigned int m_lastHeight;
+    unsigned long long m_sequence;
+    int m_acquired;
+    bool m_hasInput;
+    Clock::time_point m_input;
+    bool m_pipelined;
+    bool m_stop;
+    mutable std::mutex m_mutex;
+    std::condition_variable m_wake;
+    std::condition_variable m_done;
+    std::thread m_setupThread;
+    std::thread m_rasterThread;
+};
+
+#endif
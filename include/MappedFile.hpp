@@ -0,0 +1,35 @@
+#ifndef MAPPEDFILE_HPP
+#define MAPPEDFILE_HPP
+
+#include <cstddef>
+#include <string>
+
+/*
+** Read-only memory mapping of a whole file (POSIX mmap).
+** The mapping is released by close() or the destructor.
+*/
+class MappedFile {
+public:
+    MappedFile();
+    ~MappedFile();
+
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    bool open(const std::string &path);
+    void close();
+    /*
+    ** open() advises sequential reading; a mapping kept in use after
+    ** a first pass (the mesh cache) is advised normal access instead.
+    */
+    void keepMapped();
+
+    const char *data() const;
+    std::size_t size() const;
+
+private:
+    const char *m_data;
+    std::size_t m_size;
+};
+
+#endif
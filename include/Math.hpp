@@ -27,4 +27,49 @@ Vec3 translate(const Vec3 &v, const Vec3 &t);
 Vec2 project_perspective(const Vec3 &v, float fovScale,
                          float width, float height);
 
+/*
+** rotate_xy() + translate() + project_perspective() folded into one
+** matrix and a few constants, built once per frame.
+*/
+struct ViewTransform {
+    float m[3][3];
+    Vec3 offset;
+    float centerX;
+    float centerY;
+    float scaleX;
+    float scaleY;
+};
+
+ViewTransform make_view_transform(float angleY, float angleX,
+                                  const Vec3 &offset, float fovScale,
+                                  float width, float height);
+Vec2 project_view(const ViewTransform &view, const Vec3 &v);
+
+/*
+** view of a model placed at position, turned by yaw radians around
+** its Y axis and scaled by scale: m becomes scale * m * R_y(yaw) and
+** offset m * position + offset. Every function below still applies.
+*/
+ViewTransform instance_view(const ViewTransform &view,
+                            const Vec3 &position, float yaw, float scale);
+
+/*
+** The five planes (left, right, top, bottom, near) bounding what
+** the view puts on screen, in model space: n . p + d >= 0 inside.
+*/
+struct Frustum {
+    Vec3 n[5];
+    float d[5];
+};
+
+Frustum make_view_frustum(const ViewTransform &view, float nearZ);
+
+/*
+** Model-space ray through screen point (sx, sy); dir is unit length.
+** For an instance_view(), a distance along it is in model units:
+** times the instance scale for view units.
+*/
+void view_ray(const ViewTransform &view, float sx, float sy,
+              Vec3 &origin, Vec3 &dir);
+
 #endif
@@ -0,0 +1,121 @@
+#ifndef MESHBUFFERS_HPP
+#define MESHBUFFERS_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include "Math.hpp"
+
+struct Face;
+
+/*
+** Resident mesh storage.
+** Parsing and the load-time passes (welding, BVH, LOD) work on plain
+** Face / Vec3 vectors; once they are done the model keeps its mesh in
+** these compact buffers and frees the vectors:
+** - IndexBuffer: three vertex indices per face, 16-bit when the mesh
+**   has at most 65536 vertices and 32-bit otherwise, plus a 16-bit
+**   material id per face (0 for none, k + 1 for material k).
+** - PositionBuffer: float positions, or 16-bit fixed point when
+**   quantized; normalize() already fits every model in [-1, 1]^3.
+** Hot loops call visit_indices() once and run a template specialized
+** for the index width; cold paths use getFace() / get().
+** Either buffer can also use arrays it does not own, in place (the
+** mapped mesh cache): it then holds backing, which keeps them alive,
+** so copies of the buffer stay valid too.
+*/
+
+/* Material ids above this are dropped to "none" (0). */
+static const unsigned int MAX_MATERIAL_ID = 0xFFFF;
+static const float POSITION_QUANTUM = 1.0f / 32767.0f;
+
+class IndexBuffer {
+public:
+    IndexBuffer();
+
+    /*
+    ** Packs faces (mat = -1 for none) at the width that fits
+    ** vertexCount. Returns the number of faces whose material id did
+    ** not fit in 16 bits and was dropped to none.
+    */
+    std::size_t assign(const std::vector<Face> &faces,
+                       std::size_t vertexCount);
+    /* Raw arrays as stored by the mesh cache, used in place. */
+    void assign(bool wide, const void *indices,
+                const std::uint16_t *materials, std::size_t faceCount,
+                std::shared_ptr<const void> backing);
+    void clear();
+
+    std::size_t size() const;
+    bool isWide() const;
+    const std::uint16_t *narrow() const;
+    const std::uint32_t *wide() const;
+    const std::uint16_t *materials() const;
+    const void *indexData() const;
+    std::size_t indexBytes() const;
+    std::size_t bytes() const;
+
+    /* Unpacked face, mat = -1 for none. */
+    Face getFace(std::size_t face) const;
+
+private:
+    std::vector<std::uint16_t> m_narrow;
+    std::vector<std::uint32_t> m_wide;
+    std::vector<std::uint16_t> m_materials;
+    /* Set, with the arrays below, when they are not owned. */
+    std::shared_ptr<const void> m_backing;
+    const void *m_mappedIndices;
+    const std::uint16_t *m_mappedMaterials;
+    std::size_t m_size;
+    bool m_isWide;
+};
+
+/* Calls fn(const Index *) with the index array at its stored width. */
+template <typename Fn>
+void visit_indices(const IndexBuffer &indices, Fn &&fn)
+{
+    if (indices.isWide())
+        fn(indices.wide());
+    else
+        fn(indices.narrow());
+}
+
+/* v snapped to the grid a quantized PositionBuffer stores. */
+Vec3 quantize_position(const Vec3 &v);
+
+class PositionBuffer {
+public:
+    PositionBuffer();
+
+    /*
+    ** Takes vertices over as they are (trimmed to their size), or
+    ** quantizes them and frees them.
+    */
+    void assign(std::vector<Vec3> &&vertices, bool quantize);
+    /* Raw array as stored by the mesh cache, used in place. */
+    void assign(bool quantized, const void *data, std::size_t count,
+                std::shared_ptr<const void> backing);
+    void clear();
+
+    std::size_t size() const;
+    bool isQuantized() const;
+    /* x, y, z per vertex; only one of both is filled. */
+    const Vec3 *floats() const;
+    const std::int16_t *quantized() const;
+    const void *data() const;
+    std::size_t bytes() const;
+
+    Vec3 get(std::size_t i) const;
+
+private:
+    std::vector<Vec3> m_floats;
+    std::vector<std::int16_t> m_quantized;
+    /* Set, with m_mapped, when the array is not owned. */
+    std::shared_ptr<const void> m_backing;
+    const void *m_mapped;
+    std::size_t m_count;
+    bool m_isQuantized;
+};
+
+#endif
@@ -0,0 +1,48 @@
+#ifndef MESHCACHE_HPP
+#define MESHCACHE_HPP
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "Model.hpp"
+
+/*
+** Binary mesh cache (.objc) written next to the OBJ.
+** It stores the resident mesh buffers as they are in memory (float or
+** quantized positions, 16- or 32-bit indices, material ids), the
+** resolved materials, the face BVH and the LOD chain, behind a
+** versioned header that records which OBJ/MTL it was built from
+** (path, size, mtime in nanoseconds), whether the mesh was optimized
+** or quantized, and a checksum of the payload. Reading maps the file;
+** the position and index buffers use its arrays in place and keep the
+** mapping alive, only materials and the BVH are copied out. A stale,
+** foreign or damaged cache, or one with an index outside its arrays,
+** is simply refused.
+*/
+struct CacheKey {
+    std::string objPath;
+    std::string mtlPath;
+    std::uint64_t objSize = 0;
+    std::int64_t objMtime = 0;
+    std::uint64_t mtlSize = 0;
+    std::int64_t mtlMtime = 0;
+    bool optimized = false;
+    bool quantized = false;
+};
+
+std::string mesh_cache_path(const std::string &objPath);
+bool make_cache_key(const std::string &objPath, const std::string &mtlPath,
+                    bool optimized, bool quantized, CacheKey &key);
+bool write_mesh_cache(const std::string &cachePath, const CacheKey &key,
+                      const PositionBuffer &vertices,
+                      const IndexBuffer &faces,
+                      const std::vector<Material> &materials,
+                      bool hasMaterial, const Bvh &bvh,
+                      const std::vector<LodLevel> &lods);
+bool read_mesh_cache(const std::string &cachePath, const CacheKey &key,
+                     PositionBuffer &vertices, IndexBuffer &faces,
+                     std::vector<Material> &materials, bool &hasMaterial,
+                     Bvh &bvh, std::vector<LodLevel> &lods,
+                     std::size_t &bytes);
+
+#endif
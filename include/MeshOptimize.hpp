@@ -0,0 +1,42 @@
+#ifndef MESHOPTIMIZE_HPP
+#define MESHOPTIMIZE_HPP
+
+#include <cstddef>
+#include <vector>
+#include "Model.hpp"
+
+/*
+** Optional load-time mesh optimization (--optimize).
+** Welding merges vertices closer than epsilon, then the faces are
+** reordered for post-transform vertex cache locality (Forsyth's
+** linear-speed algorithm) and the vertices renumbered in first-use
+** order, so triangle setup walks both arrays mostly forward.
+*/
+
+/*
+** Merges every vertex into the first earlier one within epsilon on
+** each axis, remaps the faces and drops those that become degenerate.
+** Vertices are left in place; reorder_vertices() compacts them.
+** Returns the number of vertices merged.
+*/
+std::size_t weld_vertices(const std::vector<Vec3> &vertices,
+                          std::vector<Face> &faces, float epsilon);
+
+/* Reorders faces for a 32-entry LRU post-transform cache. */
+void optimize_vertex_cache(std::vector<Face> &faces,
+                           std::size_t vertexCount);
+
+/*
+** Renumbers vertices in order of first use by the faces and drops
+** unreferenced ones.
+*/
+void reorder_vertices(std::vector<Vec3> &vertices,
+                      std::vector<Face> &faces);
+
+/*
+** Average cache miss ratio: vertices transformed per face with a
+** 16-entry FIFO cache, from 3.0 (no reuse) down to about 0.5.
+*/
+float compute_acmr(const std::vector<Face> &faces, std::size_t vertexCount);
+
+#endif
@@ -1,9 +1,12 @@
 #ifndef MODEL_HPP
 #define MODEL_HPP
 
+#include <cstdint>
 #include <vector>
 #include <string>
 #include "Math.hpp"
+#include "Bvh.hpp"
+#include "MeshBuffers.hpp"
 
 struct Face {
     int a = 0;
@@ -12,6 +15,12 @@ struct Face {
     int mat = -1;
 };
 
+/* Undirected edge between two vertex indices, a < b. */
+struct Edge {
+    unsigned int a = 0;
+    unsigned int b = 0;
+};
+
 struct Material {
     float r = 1.0f;
     float g = 1.0f;
@@ -19,27 +28,144 @@ struct Material {
     std::string name;
 };
 
+/* Simplified copy of the faces, over the same vertices. */
+struct LodLevel {
+    /* Load-time faces, emptied once packed into indices. */
+    std::vector<Face> faces;
+    IndexBuffer indices;
+    /* Geometric error against the full model, in model units. */
+    float error = 0.0f;
+    /* Unique edges, built by Model::prepareEdges(); not cached. */
+    std::vector<Edge> edges;
+};
+
+class ThreadPool;
+
+/*
+** Every model is normalized into [-1, 1]^3 around the origin; this is
+** the radius of the sphere around that box.
+*/
+static const float MODEL_RADIUS = 1.7320508f;
+
+struct LoadStats {
+    std::size_t bytes = 0;
+    std::size_t chunks = 0;
+    unsigned int threads = 0;
+    double ms = 0.0;
+    double mbPerSec = 0.0;
+    double bvhMs = 0.0;
+    std::size_t bvhNodes = 0;
+    double lodMs = 0.0;
+    std::size_t lodLevels = 0;
+    double edgesMs = 0.0;
+    std::size_t edges = 0;
+    /* Only set by loadFromObj() with optimize. */
+    bool optimized = false;
+    std::size_t weldedVertices = 0;
+    float acmrBefore = 0.0f;
+    float acmrAfter = 0.0f;
+    double optimizeMs = 0.0;
+    bool quantized = false;
+    bool fromCache = false;
+    /*
+    ** Heap allocations made during the load and peak resident size of
+    ** the process over it, or since it started when peakRssOfLoad is
+    ** false (see reset_peak_rss()). Both are process-wide, so loads
+    ** running at the same time (--batch) count each other's.
+    */
+    unsigned long long allocations = 0;
+    unsigned long long allocatedBytes = 0;
+    std::size_t peakRss = 0;
+    bool peakRssOfLoad = false;
+};
+
 class Model {
 public:
     Model();
 
-    const std::vector<Vec3> &getVertices() const;
-    const std::vector<Face> &getFaces() const;
+    /* Resident mesh, see MeshBuffers.hpp. */
+    const PositionBuffer &getPositions() const;
+    std::size_t getVertexCount() const;
+    std::size_t getFaceCount() const;
+    /* Bytes held by positions, indices, BVH, edges and palette. */
+    std::size_t getMeshBytes() const;
 
-    bool loadFromObj(const std::string &path);
+    /*
+    ** Large files are parsed, and their BVH and LODs built, on pool
+    ** (null runs serially); the caller keeps one pool across loads.
+    ** optimize welds duplicate vertices and reorders faces and
+    ** vertices for cache locality before the BVH and LODs are built.
+    ** quantize keeps 16-bit positions instead of floats.
+    */
+    bool loadFromObj(const std::string &path, ThreadPool *pool = nullptr,
+                     bool optimize = false, bool quantize = false);
     bool loadFromMtl(const std::string &path);
 
+    /*
+    ** Binary cache of the loaded mesh, keyed on both source files.
+    ** mtlPath may be empty. loadCache() fails on any mismatch, including
+    ** a cache written with a different optimize or quantize setting.
+    */
+    bool loadCache(const std::string &objPath, const std::string &mtlPath,
+                   bool optimized = false, bool quantized = false);
+    bool saveCache(const std::string &objPath,
+                   const std::string &mtlPath) const;
+
+    const LoadStats &getLoadStats() const;
+
     bool hasMaterial() const;
-    void getFaceColor(int faceIndex,
-                      float &r, float &g, float &b) const;
+    void getMaterialColor(int mat, float &r, float &g, float &b) const;
+    std::string getFaceMaterial(int faceIndex) const;
+
+    /* Built by loadFromObj(), restored by loadCache(). */
+    const Bvh &getBvh() const;
+
+    /*
+    ** Level of detail chain, built by loadFromObj() and restored by
+    ** loadCache(). Level 0 is the full model, getLodCount() - 1 the
+    ** coarsest; error is 0 for level 0.
+    */
+    int getLodCount() const;
+    const IndexBuffer &getLodIndices(int level) const;
+    float getLodError(int level) const;
+
+    /*
+    ** Unique edges of every level for the wireframe, built on the
+    ** first call only: a model never shown with edges does not pay
+    ** for them. getLodEdges() is empty until then.
+    */
+    void prepareEdges();
+    const std::vector<Edge> &getLodEdges(int level) const;
+
+    /*
+    ** Unshaded packed RGBA8 color of every IndexBuffer material id
+    ** (one entry per material plus id 0, white for none or without
+    ** materials), baked once at load so triangle setup does no
+    ** material lookup. Ids never exceed the material count: the
+    ** parser resolves names against it and the cache is checked.
+    */
+    const std::vector<std::uint32_t> &getPalette() const;
 
 private:
-    void normalize();
+    void normalize(ThreadPool *pool);
+    void optimizeMesh();
+    void pack(bool quantize);
+    void bakePalette();
+    void clearMesh();
 
+    /* Load-time mesh, freed by pack(). */
     std::vector<Vec3> m_vertices;
     std::vector<Face> m_faces;
+    PositionBuffer m_positions;
+    IndexBuffer m_indices;
+    std::vector<Edge> m_edges;
+    bool m_hasEdges;
+    std::vector<std::uint32_t> m_palette;
     std::vector<Material> m_materials;
     bool m_hasMaterial;
+    Bvh m_bvh;
+    std::vector<LodLevel> m_lods;
+    LoadStats m_loadStats;
 };
 
 #endif
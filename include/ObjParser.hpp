@@ -0,0 +1,90 @@
+#ifndef OBJPARSER_HPP
+#define OBJPARSER_HPP
+
+#include <cstddef>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+#include "Model.hpp"
+
+/*
+** Allocation-free OBJ tokenizer working directly on a memory range
+** (typically a MappedFile). Only the lines the viewer uses are read:
+** "v", "f" (fan-triangulated, "v/vt/vn" tokens keep the position
+** index) and "usemtl". Faces get 0-based vertex indices.
+**
+** A range can be any newline-aligned slice of the file, so big files
+** are parsed as independent chunks. A first pass counts every chunk
+** (count_obj_range()), place_obj_chunks() then sizes the mesh arrays
+** once and gives each chunk its slice of them, and each chunk is
+** parsed straight into its slice: nothing grows while parsing and
+** nothing is copied afterwards, except closing the rare gaps left by
+** invalid faces (merge_obj_chunks()).
+*/
+struct ObjCounts {
+    /* Exact: every "v" line makes a vertex. */
+    std::size_t vertices = 0;
+    /* Upper bound: tokens that are not indices make fewer faces. */
+    std::size_t faces = 0;
+    /* Start of the last usemtl line, null for none. */
+    const char *lastMaterial = nullptr;
+};
+
+struct ObjChunk {
+    const char *begin = nullptr;
+    const char *end = nullptr;
+    ObjCounts counts;
+    /* Slices, set by place_obj_chunks(). */
+    std::size_t firstVertex = 0;
+    std::size_t firstFace = 0;
+    /* Material of the faces before the chunk's first usemtl. */
+    int entryMat = -1;
+    /* Set by parse_obj_range(). */
+    std::size_t faceCount = 0;
+    std::size_t dropped = 0;
+};
+
+/*
+** usemtl name -> material index. Keys view the names of the material
+** vector it was built from, which must outlive it and stay unchanged.
+*/
+typedef std::unordered_map<std::string_view, int> MaterialIndex;
+
+/* The first material of a duplicated name wins, as in the MTL file. */
+void index_materials(const std::vector<Material> &materials,
+                     MaterialIndex &index);
+
+/* Cuts [data, data + size) into about "count" newline-aligned ranges. */
+void split_obj_ranges(const char *data, std::size_t size,
+                      std::size_t count,
+                      std::vector<const char *> &bounds);
+
+/* Fills chunk.counts from [chunk.begin, chunk.end). */
+void count_obj_range(ObjChunk &chunk);
+
+/*
+** Resizes vertices (exactly) and faces (to the bound) for the counted
+** chunks, in file order, and sets every chunk's slices and entry
+** material.
+*/
+void place_obj_chunks(std::vector<ObjChunk> &chunks,
+                      const MaterialIndex &materials,
+                      std::vector<Vec3> &vertices,
+                      std::vector<Face> &faces);
+
+/*
+** Parses a placed chunk into its slices. Negative (relative) indices
+** are resolved on the fly and faces referencing a missing vertex
+** dropped, as every chunk knows where its vertices start.
+*/
+void parse_obj_range(ObjChunk &chunk, const MaterialIndex &materials,
+                     std::vector<Vec3> &vertices, std::vector<Face> &faces);
+
+/*
+** Moves the faces of every chunk down over the gaps between slices and
+** trims faces to what was parsed. Returns the number of dropped faces.
+*/
+std::size_t merge_obj_chunks(const std::vector<ObjChunk> &chunks,
+                             std::vector<Face> &faces);
+
+#endif
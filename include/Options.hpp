@@ -0,0 +1,61 @@
+#ifndef OPTIONS_HPP
+#define OPTIONS_HPP
+
+#include <vector>
+#include "DepthSort.hpp"
+#include "Raster.hpp"
+#include "TriangleSetup.hpp"
+#include "VisBuffer.hpp"
+#include "Wireframe.hpp"
+
+/* Camera angles of one batch view, in radians. */
+struct CameraView {
+    float angleY;
+    float angleX;
+};
+
+/* File written per batch view: PNG, or the bare RGBA8 pixel rows. */
+enum class ImageFormat {
+    Png,
+    Rgba
+};
+
+struct Options {
+    const char *objPath = nullptr;
+    const char *mtlPath = nullptr;
+    /* Scene file drawn instead of one model (--scene), see Scene.hpp. */
+    const char *scenePath = nullptr;
+    unsigned int threads = 0;
+    bool hasKernel = false;
+    RasterKernel kernel = RasterKernel::Scalar;
+    unsigned int cullMode = CULL_ALL;
+    DepthSort sort = DepthSort::None;
+    EdgeMode edges = EdgeMode::Off;
+    ShadingMode shading = ShadingMode::Forward;
+    /* Overlap frame setup and raster on two buffers (--pipeline). */
+    bool pipelined = false;
+    /* Forced level of detail, -1 to pick it from the view. */
+    int lod = -1;
+    bool bench = false;
+    unsigned int frames = 100;
+    unsigned int width = 800;
+    unsigned int height = 600;
+    const char *outputPath = nullptr;
+    /* Chrome trace (.json) or CSV (.csv) written on exit. */
+    const char *tracePath = nullptr;
+    bool useCache = true;
+    bool optimize = false;
+    /* 16-bit positions (--quantize), see PositionBuffer. */
+    bool quantize = false;
+    /* Manifest of OBJ [TAB MTL] lines, renders every one (--batch). */
+    const char *batchPath = nullptr;
+    /* Batch views; parse_options() leaves one at the --bench angles. */
+    std::vector<CameraView> views;
+    const char *outDir = ".";
+    ImageFormat format = ImageFormat::Png;
+};
+
+bool parse_options(int argc, char **argv, Options &opts);
+void print_usage();
+
+#endif
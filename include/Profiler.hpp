@@ -0,0 +1,83 @@
+#ifndef PROFILER_HPP
+#define PROFILER_HPP
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/*
+** Scoped stage timers.
+** A ScopedTimer measures the rest of its block and, when PROFILE is
+** on, adds its duration to the rolling window of its stage (the HUD
+** panel) and appends {name, start, duration, thread} to a process-wide
+** ring of the last PROFILE_RING events (the Chrome trace / CSV
+** export). Neither takes a lock but on the first use of a name.
+** PROFILE_SAMPLED_SCOPE() feeds the window with every event and the
+** ring with one in every, for scopes that would flood it (tiles).
+** Build with PROFILE=0 and PROFILE_SCOPE() compiles to nothing; timers
+** that also fill a stats field (RenderStats, LoadStats) keep doing so.
+** name must be a string literal: only the pointer is stored.
+*/
+#ifndef PROFILE
+# define PROFILE 1
+#endif
+
+class ScopedTimer {
+public:
+    explicit ScopedTimer(const char *name);
+    ScopedTimer(const char *name, double &ms);
+    ScopedTimer(const char *name, unsigned int every);
+    ~ScopedTimer();
+
+    ScopedTimer(const ScopedTimer &) = delete;
+    ScopedTimer &operator=(const ScopedTimer &) = delete;
+
+private:
+    const char *m_name;
+    double *m_ms;
+    unsigned int m_every;
+    std::chrono::steady_clock::time_point m_start;
+};
+
+#define PROFILE_CONCAT2(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT2(a, b)
+#if PROFILE
+# define PROFILE_SCOPE(name) \
+    ScopedTimer PROFILE_CONCAT(profileScope, __LINE__)(name)
+# define PROFILE_SAMPLED_SCOPE(name, every) \
+    ScopedTimer PROFILE_CONCAT(profileScope, __LINE__)(name, \
+                                                       (unsigned int)(every))
+#else
+# define PROFILE_SCOPE(name) ((void)0)
+# define PROFILE_SAMPLED_SCOPE(name, every) ((void)0)
+#endif
+
+/*
+** Adds an event that was not timed by a scope, e.g. input-to-photon
+** latency measured across frames. Does nothing with PROFILE=0.
+*/
+void profile_record(const char *name,
+                    std::chrono::steady_clock::time_point start,
+                    std::chrono::steady_clock::time_point end);
+
+/* Rolling figures of one stage over its last PROFILE_WINDOW events. */
+struct ProfileSummary {
+    const char *name = nullptr;
+    std::size_t samples = 0;
+    double meanMs = 0.0;
+    double p50Ms = 0.0;
+    double p99Ms = 0.0;
+};
+
+/* One entry per stage name, in order of first use. */
+void profile_summary(std::vector<ProfileSummary> &out);
+
+/*
+** Writes every event still in the ring: CSV when path ends in .csv,
+** Chrome trace JSON (chrome://tracing, Perfetto) otherwise. False when
+** the file cannot be written or profiling is compiled out.
+*/
+bool profile_write_trace(const std::string &path);
+
+#endif
@@ -0,0 +1,74 @@
+#ifndef RASTER_HPP
+#define RASTER_HPP
+
+#include <cstdint>
+
+/*
+** Triangle fill kernels.
+** A triangle is described in screen space with its view-space depth
+** per corner and one packed RGBA8 color (flat shading). Corners are
+** snapped to 1/16 pixel and the three edge functions stepped in
+** integers over 1, 4 or 8 pixel spans, sampling pixel centers with a
+** top-left fill rule: a mesh covers every pixel once, with no gap or
+** double write along shared edges, whatever the kernel. Kernels write
+** straight into a linear RGBA buffer plus a float depth buffer.
+*/
+
+struct RasterTriangle {
+    float x1 = 0.0f;
+    float y1 = 0.0f;
+    float x2 = 0.0f;
+    float y2 = 0.0f;
+    float x3 = 0.0f;
+    float y3 = 0.0f;
+    float z1 = 0.0f;
+    float z2 = 0.0f;
+    float z3 = 0.0f;
+    std::uint32_t color = 0;
+};
+
+/*
+** color is indexed with absolute pixel coordinates,
+** depth relative to (depthX0, depthY0). Only pixels inside the
+** inclusive clip rectangle are touched.
+*/
+struct RasterTarget {
+    std::uint32_t *color = nullptr;
+    unsigned int colorStride = 0;
+    float *depth = nullptr;
+    unsigned int depthStride = 0;
+    int depthX0 = 0;
+    int depthY0 = 0;
+    int clipX0 = 0;
+    int clipY0 = 0;
+    int clipX1 = -1;
+    int clipY1 = -1;
+};
+
+enum class RasterKernel {
+    Scalar,
+    SSE2,
+    AVX2
+};
+
+std::uint32_t pack_rgba(unsigned char r, unsigned char g,
+                        unsigned char b, unsigned char a);
+
+/*
+** Pixels whose center the snapped triangle may cover, clipped. False
+** when it covers none: zero area, no pixel center inside its bounding
+** box, or a corner past 2^24 pixels (such triangles are not drawn).
+*/
+bool raster_bounds(const RasterTriangle &t,
+                   int clipX0, int clipY0, int clipX1, int clipY1,
+                   int &x0, int &y0, int &x1, int &y1);
+
+bool raster_kernel_supported(RasterKernel kernel);
+RasterKernel raster_best_kernel();
+const char *raster_kernel_name(RasterKernel kernel);
+bool raster_kernel_from_name(const char *name, RasterKernel &kernel);
+
+void raster_triangle(RasterKernel kernel, const RasterTriangle &t,
+                     const RasterTarget &target);
+
+#endif
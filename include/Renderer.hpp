@@ -2,25 +2,69 @@
 #define RENDERER_HPP
 
 #include <SFML/Graphics.hpp>
-#include "Model.hpp"
+#include <optional>
+#include "FramePipeline.hpp"
 
 class Renderer {
 public:
     Renderer();
 
     void setModel(const Model *model);
+    void setScene(const Scene *scene);
     void setAngles(float angleY, float angleX);
     void setZoom(float zoom);
-    void setShowEdges(bool showEdges);
+    void setEdgeMode(EdgeMode mode);
+    EdgeMode getEdgeMode() const;
+    void setThreadCount(unsigned int threads);
+    unsigned int getThreadCount() const;
+    ThreadPool &getThreadPool();
+    void setRasterKernel(RasterKernel kernel);
+    RasterKernel getRasterKernel() const;
+    void setCullMode(unsigned int mode);
+    unsigned int getCullMode() const;
+    void setDepthSort(DepthSort sort);
+    DepthSort getDepthSort() const;
+    void setShading(ShadingMode mode);
+    ShadingMode getShading() const;
+    void setHighlightFace(int instance, int face);
+    void setLod(int level);
+    int pick(float x, float y, int &instance);
 
-    void render(sf::RenderWindow &window) const;
+    /* See FramePipeline; off renders each frame in render(). */
+    void setPipelined(bool pipelined);
+    bool isPipelined() const;
+    /* Frames submitted but not on screen yet. */
+    bool isBusy() const;
+    /* Stamps a user input; its frame's display sets latencyMs. */
+    void markInput();
+
+    /*
+    ** Submits the current view when it changed and draws the newest
+    ** finished frame into the window. The texture is only uploaded
+    ** again when a new frame came out of the pipeline.
+    */
+    void render(sf::RenderWindow &window);
+    /* Call right after window.display(). */
+    void framePresented();
+    const RenderStats &getStats() const;
 
 private:
-    const Model *m_model;
-    float m_angleY;
-    float m_angleX;
-    float m_zoom;
-    bool m_showEdges;
+    bool prepareTexture(unsigned int w, unsigned int h);
+    void buildEdgeLines(const CpuRenderer &frame);
+
+    FramePipeline m_pipeline;
+    /*
+    ** EdgeMode::All as one line batch, rebuilt only with a new frame.
+    ** Cleared, not freed, so it keeps its capacity between frames.
+    */
+    sf::VertexArray m_edgeLines;
+    bool m_drawEdgeLines;
+    sf::Texture m_texture;
+    std::optional<sf::Sprite> m_sprite;
+    /* Input answered by the frame last drawn, until it is displayed. */
+    bool m_inputPending;
+    FramePipeline::Clock::time_point m_input;
+    RenderStats m_stats;
 };
 
 #endif
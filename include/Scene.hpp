@@ -0,0 +1,78 @@
+#ifndef SCENE_HPP
+#define SCENE_HPP
+
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <vector>
+#include "Math.hpp"
+#include "Model.hpp"
+#include "Options.hpp"
+
+/* One placement of a scene mesh; the mesh itself is shared. */
+struct SceneInstance {
+    unsigned int mesh = 0;
+    Vec3 position;
+    /* Turn around the Y axis, in radians. */
+    float yaw = 0.0f;
+    float scale = 1.0f;
+};
+
+/*
+** Several models drawn together.
+** A scene file names each mesh once and places it any number of
+** times. Every OBJ is loaded once and an instance only holds its
+** transform, so memory follows the unique meshes, not the instance
+** count. Lines, '#' starting a comment:
+**
+**   mesh NAME OBJ [TAB MTL]
+**   instance NAME X Y Z [YAW [SCALE]]        YAW in degrees
+**   grid NAME COLUMNS ROWS SPACING [SCALE]   centered, on the XZ plane
+**
+** A model is normalized into [-1, 1]^3, so a scale of 1 makes an
+** instance 2 units wide. load() then fits the whole layout in the
+** sphere of a lone model, which the camera frames the same way.
+*/
+class Scene {
+public:
+    Scene();
+
+    /* Meshes are loaded one after the other, each on pool. */
+    bool load(const std::string &path, const Options &opts,
+              ThreadPool *pool);
+
+    std::size_t getMeshCount() const;
+    const Model &getMesh(std::size_t mesh) const;
+    const std::string &getMeshName(std::size_t mesh) const;
+    const std::vector<SceneInstance> &getInstances() const;
+    /* Model::getMeshBytes() of every unique mesh. */
+    std::size_t getMeshBytes() const;
+    /* Model::prepareEdges() of every mesh. */
+    void prepareEdges();
+
+private:
+    bool parseLine(const std::string &line, const std::string &where,
+                   std::vector<std::string> &objPaths,
+                   std::vector<std::string> &mtlPaths);
+    bool findMesh(const std::string &name, const std::string &where,
+                  unsigned int &mesh) const;
+    void fit();
+
+    std::vector<std::unique_ptr<Model>> m_meshes;
+    std::vector<std::string> m_names;
+    std::vector<SceneInstance> m_instances;
+};
+
+/*
+** Loads objPath and mtlPath (may be empty) through the mesh cache as
+** opts asks, parsing on pool (may be null). Problems are reported as
+** warnings, one write each so parallel loads do not interleave.
+*/
+bool load_model(const Options &opts, const std::string &objPath,
+                const std::string &mtlPath, ThreadPool *pool,
+                Model &model);
+
+/* Prints the LoadStats of the last load_model() as Info lines. */
+void print_load_stats(const Model &model);
+
+#endif
@@ -0,0 +1,23 @@
+#ifndef SIMPLIFY_HPP
+#define SIMPLIFY_HPP
+
+#include <vector>
+#include "Model.hpp"
+
+class ThreadPool;
+
+/*
+** Level of detail chain by quadric error edge collapse (Garland and
+** Heckbert). Each level roughly halves the faces of the previous one
+** by collapsing vertices onto one of their neighbors, so every level
+** indexes the model's own vertex array. Open borders and material
+** boundaries may only slide along themselves; vertices where they
+** branch, and non-manifold ones, are never moved.
+** levels receives the simplified levels only (the model is level 0);
+** the chain stops once a level gets small or stops shrinking.
+*/
+void build_lod_chain(const std::vector<Vec3> &vertices,
+                     const std::vector<Face> &faces,
+                     std::vector<LodLevel> &levels, ThreadPool *pool);
+
+#endif
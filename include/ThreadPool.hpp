@@ -0,0 +1,99 @@
+#ifndef THREADPOOL_HPP
+#define THREADPOOL_HPP
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/*
+** Small work-stealing pool.
+** parallelFor() deals the indices round-robin into one deque per
+** participant (the workers plus the calling thread). Each participant
+** pops from the back of its own deque and, once it is empty, steals
+** from the front of the others. The call blocks until every index ran.
+** Jobs are referenced, never copied, and the deques keep their storage
+** between calls, so a steady stream of parallelFor() does not allocate.
+*/
+class ThreadPool {
+public:
+    explicit ThreadPool(unsigned int threadCount);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool &) = delete;
+    ThreadPool &operator=(const ThreadPool &) = delete;
+
+    unsigned int getThreadCount() const;
+
+    template <typename Job>
+    void parallelFor(std::size_t count, const Job &job)
+    {
+        run(count, &ThreadPool::invoke<Job>, &job);
+    }
+
+    static unsigned int defaultThreadCount();
+    /*
+    ** threadCount within [1, MAX_THREADS_PER_CORE per core], what the
+    ** constructor actually starts: a mistyped count must not spawn
+    ** threads by the million.
+    */
+    static unsigned int clampThreadCount(unsigned int threadCount);
+
+    static const unsigned int MAX_THREADS_PER_CORE = 4;
+
+private:
+    typedef void (*JobFn)(const void *, std::size_t);
+
+    struct Queue {
+        std::mutex lock;
+        std::vector<std::size_t> items;
+        std::size_t head = 0;
+    };
+
+    template <typename Job>
+    static void invoke(const void *job, std::size_t index)
+    {
+        (*static_cast<const Job *>(job))(index);
+    }
+
+    void run(std::size_t count, JobFn fn, const void *job);
+    void workerLoop(unsigned int id);
+    void runItems(unsigned int id);
+    bool popLocal(unsigned int id, std::size_t &item);
+    bool steal(unsigned int id, std::size_t &item);
+
+    std::vector<std::thread> m_threads;
+    std::vector<std::unique_ptr<Queue>> m_queues;
+    std::mutex m_submit;
+    std::mutex m_mutex;
+    std::condition_variable m_wake;
+    std::condition_variable m_done;
+    JobFn m_jobFn;
+    const void *m_job;
+    std::atomic<std::size_t> m_pending;
+    unsigned int m_busy;
+    unsigned long m_generation;
+    bool m_stop;
+};
+
+/* parallelFor() on pool, or a plain loop when there is no pool. */
+template <typename Job>
+void parallel_for(ThreadPool *pool, std::size_t count, const Job &job)
+{
+    std::size_t i;
+
+    if (pool) {
+        pool->parallelFor(count, job);
+        return;
+    }
+    i = 0;
+    while (i < count) {
+        job(i);
+        i++;
+    }
+}
+
+#endif
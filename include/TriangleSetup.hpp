@@ -0,0 +1,76 @@
+#ifndef TRIANGLESETUP_HPP
+#define TRIANGLESETUP_HPP
+
+#include <cstddef>
+#include <vector>
+#include "FrameContext.hpp"
+#include "Model.hpp"
+#include "VertexTransform.hpp"
+
+/*
+** Triangle setup: turns faces into screen-space TriData.
+** Faces behind the near plane are dropped, faces crossing it are
+** clipped into one or two triangles, then the optional tests of
+** cullMode remove back faces, zero-area and off-screen triangles
+** before they reach sorting, binning and the raster kernels.
+*/
+static const unsigned int CULL_NONE = 0;
+static const unsigned int CULL_BACKFACE = 1u << 0;
+static const unsigned int CULL_ZERO_AREA = 1u << 1;
+static const unsigned int CULL_OFFSCREEN = 1u << 2;
+static const unsigned int CULL_ALL =
+    CULL_BACKFACE | CULL_ZERO_AREA | CULL_OFFSCREEN;
+
+/* View-space depth of the near plane. */
+static const float NEAR_PLANE = 0.05f;
+
+struct SetupParams {
+    unsigned int cullMode = CULL_ALL;
+    /* Level of detail to draw; faces and highlightFace index it. */
+    int lod = 0;
+    /* Faces to set up (e.g. the BVH frustum query); null for all. */
+    const std::vector<unsigned int> *faces = nullptr;
+    /* Face drawn in the highlight color, -1 for none. */
+    int highlightFace = -1;
+    /* false leaves TriData::color to the visibility resolve. */
+    bool shade = true;
+    /* FrameInstance the faces belong to, and where its vertices start. */
+    std::uint32_t instance = 0;
+    std::size_t firstVertex = 0;
+};
+
+struct SetupStats {
+    std::size_t culledFrustum = 0;
+    std::size_t culledBackFace = 0;
+    std::size_t culledZeroArea = 0;
+    std::size_t culledOffScreen = 0;
+    std::size_t culledNear = 0;
+    std::size_t clipped = 0;
+
+    std::size_t culled() const
+    {
+        return culledFrustum + culledBackFace + culledZeroArea
+            + culledOffScreen + culledNear;
+    }
+};
+
+/*
+** Flat color of a face with material color base and view-space
+** corners w1..w3: Lambert from a fixed light, pushed towards orange
+** when highlighted.
+*/
+std::uint32_t shade_face(std::uint32_t base, const Vec3 &w1,
+                         const Vec3 &w2, const Vec3 &w3, bool highlight);
+
+/* "none", "all" or a comma list of back, zero, offscreen. */
+bool cull_mode_from_string(const char *str, unsigned int &mode);
+
+/*
+** Appends the triangles of one model to out and adds its counters to
+** stats; the caller clears both once per frame.
+*/
+void build_triangles(const Model &model, const ViewTransform &view,
+                     const VertexStream &vs, const SetupParams &params,
+                     std::vector<TriData> &out, SetupStats &stats);
+
+#endif
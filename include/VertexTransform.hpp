@@ -0,0 +1,53 @@
+#ifndef VERTEXTRANSFORM_HPP
+#define VERTEXTRANSFORM_HPP
+
+#include <cstddef>
+#include <vector>
+#include "Math.hpp"
+
+class ThreadPool;
+class PositionBuffer;
+
+/*
+** Per-frame vertex positions, one array per component (SoA).
+** x/y/z are in view space (camera offset applied), sx/sy on screen.
+** Triangle setup reads them through the face indices, so a vertex
+** shared by several faces is transformed only once.
+*/
+struct VertexStream {
+    std::vector<float> x;
+    std::vector<float> y;
+    std::vector<float> z;
+    std::vector<float> sx;
+    std::vector<float> sy;
+
+    std::size_t size() const { return x.size(); }
+    void resize(std::size_t count);
+};
+
+/* Vertices per transform job. */
+static const std::size_t TRANSFORM_BLOCK = 1 << 14;
+
+void transform_vertices(const ViewTransform &view,
+                        const std::vector<Vec3> &in,
+                        VertexStream &out, ThreadPool *pool);
+/*
+** Same, from the model's resident positions. Quantized ones are
+** decoded a small batch at a time into a stack buffer and go through
+** the same float code, so the output only differs by the rounding of
+** the positions themselves.
+*/
+void transform_vertices(const ViewTransform &view,
+                        const PositionBuffer &in,
+                        VertexStream &out, ThreadPool *pool);
+/*
+** Vertices [begin, begin + count) of in into out from index first;
+** out must already hold them. One job of the instanced pass, which
+** packs the vertices of every drawn instance into one stream.
+*/
+void transform_positions(const ViewTransform &view,
+                         const PositionBuffer &in, std::size_t begin,
+                         std::size_t count, VertexStream &out,
+                         std::size_t first);
+
+#endif
@@ -0,0 +1,45 @@
+#ifndef VISBUFFER_HPP
+#define VISBUFFER_HPP
+
+#include <cstdint>
+#include "FrameContext.hpp"
+#include "Model.hpp"
+
+class ThreadPool;
+
+/*
+** Visibility buffer shading.
+** Forward shades every triangle in setup and writes its color at each
+** pixel that passes the depth test. Visibility has the raster pass
+** write depth and the index of the triangle into FrameContext::ids
+** instead, then resolves the colors in a second pass over the tiles:
+** only triangles that won a pixel are shaded, once per run of pixels,
+** so the cost follows the screen rather than the overdraw. The image
+** is the same either way.
+*/
+enum class ShadingMode {
+    Forward,
+    Visibility
+};
+
+/* FrameContext::ids value of a pixel no triangle covers. */
+static const std::uint32_t NO_TRIANGLE = 0xFFFFFFFFu;
+
+const char *shading_mode_name(ShadingMode mode);
+bool shading_mode_from_name(const char *name, ShadingMode &mode);
+
+/*
+** Fills frame.pixels from frame.ids, one job per tile, shading each
+** triangle with the level and highlight of its FrameInstance.
+*/
+void resolve_visibility(FrameContext &frame, ThreadPool *pool);
+
+/*
+** Face of the drawn level seen at pixel (x, y) of the last resolved
+** frame, -1 for the background or outside the frame; instance is set
+** to the FrameInstance it belongs to.
+*/
+int visible_face(const FrameContext &frame, int x, int y,
+                 unsigned int &instance);
+
+#endif
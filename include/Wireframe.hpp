@@ -0,0 +1,37 @@
+#ifndef WIREFRAME_HPP
+#define WIREFRAME_HPP
+
+#include <cstdint>
+#include <vector>
+#include "FrameContext.hpp"
+#include "Model.hpp"
+
+/*
+** Edge overlay over the shaded model, drawn from the model's unique
+** edge list (each shared edge once) rather than from the triangles.
+** All draws every edge, hidden ones included, as one line batch on
+** the window. Visible draws them into the CPU frame after the raster
+** pass and tests them against its z-buffer, so edges behind the
+** surface are removed.
+*/
+enum class EdgeMode {
+    Off,
+    All,
+    Visible
+};
+
+const char *edge_mode_name(EdgeMode mode);
+bool edge_mode_from_name(const char *name, EdgeMode &mode);
+
+/*
+** Draws the edges into rows [y0, y1) of frame.pixels where they are
+** not behind frame.depth, from the positions the frame was transformed
+** with, the model's vertex 0 being frame.verts[firstVertex]. Edges
+** with an end behind the near plane are skipped. Disjoint row bands
+** never touch the same pixel, so they can run in parallel.
+*/
+void draw_visible_edges(const std::vector<Edge> &edges,
+                        std::size_t firstVertex, FrameContext &frame,
+                        std::uint32_t color, int y0, int y1);
+
+#endif
@@ -0,0 +1,98 @@
+#include "AllocStats.hpp"
+#include <sys/resource.h>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+
+static std::atomic<unsigned long long> g_allocCount(0);
+static std::atomic<unsigned long long> g_allocBytes(0);
+
+AllocStats alloc_stats()
+{
+    AllocStats stats;
+
+    stats.count = g_allocCount.load(std::memory_order_relaxed);
+    stats.bytes = g_allocBytes.load(std::memory_order_relaxed);
+    return stats;
+}
+
+/* VmHWM of /proc/self/status, in kB; 0 without procfs. */
+static std::size_t proc_peak_kb()
+{
+    std::FILE *file;
+    char line[128];
+    std::size_t kb;
+
+    file = std::fopen("/proc/self/status", "r");
+    if (!file)
+        return 0;
+    kb = 0;
+    while (std::fgets(line, sizeof(line), file)) {
+        if (std::strncmp(line, "VmHWM:", 6) == 0) {
+            kb = (std::size_t)std::strtoull(line + 6, nullptr, 10);
+            break;
+        }
+    }
+    std::fclose(file);
+    return kb;
+}
+
+std::size_t peak_rss_bytes()
+{
+    struct rusage usage;
+    std::size_t kb;
+
+    kb = proc_peak_kb();
+    if (kb > 0)
+        return kb * 1024;
+    if (getrusage(RUSAGE_SELF, &usage) != 0)
+        return 0;
+#ifdef __APPLE__
+    return (std::size_t)usage.ru_maxrss;
+#else
+    return (std::size_t)usage.ru_maxrss * 1024;
+#endif
+}
+
+bool reset_peak_rss()
+{
+    std::FILE *file;
+    bool ok;
+
+    file = std::fopen("/proc/self/clear_refs", "w");
+    if (!file)
+        return false;
+    ok = std::fputs("5", file) >= 0;
+    return std::fclose(file) == 0 && ok;
+}
+
+void *operator new(std::size_t size)
+{
+    void *ptr;
+
+    g_allocCount.fetch_add(1, std::memory_order_relaxed);
+    g_allocBytes.fetch_add(size, std::memory_order_relaxed);
+    if (size == 0)
+        size = 1;
+    while (!(ptr = std::malloc(size))) {
+        std::new_handler handler;
+
+        handler = std::get_new_handler();
+        if (!handler)
+            throw std::bad_alloc();
+        handler();
+    }
+    return ptr;
+}
+
+void operator delete(void *ptr) noexcept
+{
+    std::free(ptr);
+}
+
+void operator delete(void *ptr, std::size_t) noexcept
+{
+    std::free(ptr);
+}
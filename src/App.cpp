@@ -1,19 +1,29 @@
 #include "App.hpp"
+#include "Profiler.hpp"
+#include <cstdio>
 #include <iostream>
 
-App::App(const char *objPath, const char *mtlPath, bool &ok)
+App::App(const Options &opts, bool &ok)
     : m_window(sf::VideoMode(sf::Vector2u(800u, 600u)),
                "Low-Poly Tree Viewer"),
       m_renderer(),
       m_model(),
+      m_scene(),
+      m_hasScene(false),
       m_running(true),
       m_angleY(0.5f),
       m_angleX(0.3f),
       m_zoom(1.2f),
       m_autoRotate(false),
-      m_showEdges(false),
+      m_edgeMode(opts.edges),
+      m_pickedInstance(-1),
+      m_pickedFace(-1),
+      m_showProfile(false),
+      m_tracePath(opts.tracePath ? opts.tracePath : "trace.json"),
+      m_traceOnExit(opts.tracePath != nullptr),
       m_font(),
       m_text(),
+      m_profileText(),
       m_hasFont(false),
       m_objName(""),
       m_mtlName("none"),
@@ -22,40 +32,33 @@ App::App(const char *objPath, const char *mtlPath, bool &ok)
       m_btnLinesLabel(),
       m_btnAutoLabel()
 {
-    bool loadedObj;
-    bool loadedMtl;
-
-    loadedObj = false;
-    loadedMtl = false;
-    if (!objPath) {
-        std::cerr << "Error: no OBJ file provided." << std::endl;
-        m_running = false;
-        ok = false;
-        return;
-    }
-    if (mtlPath) {
-        loadedMtl = m_model.loadFromMtl(mtlPath);
-        if (loadedMtl)
-            m_mtlName = mtlPath;
-        else
-            std::cerr << "Warning: failed to load MTL, "
-                      << "rendering in white." << std::endl;
-    } else {
-        std::cerr << "Info: no MTL argument, "
-                  << "rendering in white." << std::endl;
-    }
-    loadedObj = m_model.loadFromObj(objPath);
-    if (loadedObj)
-        m_objName = objPath;
-    if (!loadedObj) {
-        std::cerr << "Error: failed to load OBJ file." << std::endl;
+    m_renderer.setThreadCount(opts.threads);
+    if (!(opts.scenePath ? loadScene(opts) : loadModel(opts))) {
         m_running = false;
         ok = false;
         return;
     }
     ok = true;
     m_window.setFramerateLimit(60);
-    m_renderer.setModel(&m_model);
+    m_renderer.setCullMode(opts.cullMode);
+    m_renderer.setDepthSort(opts.sort);
+    m_renderer.setShading(opts.shading);
+    m_renderer.setPipelined(opts.pipelined);
+    m_renderer.setEdgeMode(opts.edges);
+    m_renderer.setLod(opts.lod);
+    if (opts.hasKernel) {
+        if (raster_kernel_supported(opts.kernel))
+            m_renderer.setRasterKernel(opts.kernel);
+        else
+            std::cerr << "Warning: " << raster_kernel_name(opts.kernel)
+                      << " kernel not supported, using "
+                      << raster_kernel_name(m_renderer.getRasterKernel())
+                      << "." << std::endl;
+    }
+    if (m_hasScene)
+        m_renderer.setScene(&m_scene);
+    else
+        m_renderer.setModel(&m_model);
     m_renderer.setAngles(m_angleY, m_angleX);
     m_renderer.setZoom(m_zoom);
     if (m_font.openFromFile("assets/DejaVuSans.ttf")) {
@@ -63,11 +66,67 @@ App::App(const char *objPath, const char *mtlPath, bool &ok)
         m_text.emplace(m_font, "", 14);
         m_text->setFillColor(sf::Color::White);
         m_text->setPosition(sf::Vector2f(8.0f, 8.0f));
+        m_profileText.emplace(m_font, "", 12);
+        m_profileText->setFillColor(sf::Color(255, 220, 120));
+        m_profileText->setPosition(sf::Vector2f(500.0f, 8.0f));
         setupHud();
         updateHudText();
     }
 }
 
+bool App::loadModel(const Options &opts)
+{
+    const char *objPath;
+    const char *mtlPath;
+
+    objPath = opts.objPath;
+    mtlPath = opts.mtlPath;
+    if (!objPath) {
+        std::cerr << "Error: no OBJ file provided." << std::endl;
+        return false;
+    }
+    if (!mtlPath)
+        std::cerr << "Info: no MTL argument, "
+                  << "rendering in white." << std::endl;
+    if (!load_model(opts, objPath, mtlPath ? mtlPath : "",
+                    &m_renderer.getThreadPool(), m_model)) {
+        std::cerr << "Error: failed to load OBJ file." << std::endl;
+        return false;
+    }
+    m_objName = objPath;
+    if (mtlPath && m_model.hasMaterial())
+        m_mtlName = mtlPath;
+    print_load_stats(m_model);
+    if (opts.edges != EdgeMode::Off)
+        m_model.prepareEdges();
+    return true;
+}
+
+bool App::loadScene(const Options &opts)
+{
+    std::size_t vertices;
+    std::size_t faces;
+
+    if (!m_scene.load(opts.scenePath, opts, &m_renderer.getThreadPool()))
+        return false;
+    m_hasScene = true;
+    m_objName = opts.scenePath;
+    vertices = 0;
+    faces = 0;
+    for (const SceneInstance &inst : m_scene.getInstances()) {
+        vertices += m_scene.getMesh(inst.mesh).getVertexCount();
+        faces += m_scene.getMesh(inst.mesh).getFaceCount();
+    }
+    std::cerr << "Info: scene of " << m_scene.getMeshCount()
+              << " meshes (" << m_scene.getMeshBytes() / 1e6
+              << " MB) in " << m_scene.getInstances().size()
+              << " instances, " << vertices << " vertices and " << faces
+              << " faces at full detail." << std::endl;
+    if (opts.edges != EdgeMode::Off)
+        m_scene.prepareEdges();
+    return true;
+}
+
 void App::setupHud()
 {
     if (!m_hasFont)
@@ -96,8 +155,10 @@ void App::updateButtonsStyle()
 {
     if (!m_hasFont)
         return;
-    if (m_showEdges)
+    if (m_edgeMode == EdgeMode::All)
         m_btnLines.setFillColor(sf::Color(60, 120, 200));
+    else if (m_edgeMode == EdgeMode::Visible)
+        m_btnLines.setFillColor(sf::Color(140, 90, 200));
     else
         m_btnLines.setFillColor(sf::Color(40, 40, 40));
     if (m_autoRotate)
@@ -106,12 +167,14 @@ void App::updateButtonsStyle()
         m_btnAuto.setFillColor(sf::Color(40, 40, 40));
 }
 
-void App::handleEvents()
+/* wait blocks until the first event instead of polling. */
+void App::handleEvents(bool wait)
 {
     std::optional<sf::Event> opt;
     const sf::Event *ev;
 
-    while ((opt = m_window.pollEvent())) {
+    opt = wait ? m_window.waitEvent() : m_window.pollEvent();
+    while (opt) {
         ev = &(*opt);
         if (ev->is<sf::Event::Closed>()) {
             m_running = false;
@@ -121,6 +184,7 @@ void App::handleEvents()
             float rotStep;
             float zoomStep;
 
+            m_renderer.markInput();
             code = key->code;
             rotStep = 0.1f;
             zoomStep = 0.1f;
@@ -138,25 +202,42 @@ void App::handleEvents()
                 m_zoom += zoomStep;
             else if (code == sf::Keyboard::Key::S)
                 m_zoom -= zoomStep;
+            else if (code == sf::Keyboard::Key::P)
+                m_showProfile = !m_showProfile;
+            else if (code == sf::Keyboard::Key::T)
+                writeTrace();
+            else if (code == sf::Keyboard::Key::E)
+                cycleEdgeMode();
+            else if (code == sf::Keyboard::Key::V)
+                m_renderer.setShading(
+                    m_renderer.getShading() == ShadingMode::Forward
+                        ? ShadingMode::Visibility : ShadingMode::Forward);
+            else if (code == sf::Keyboard::Key::L)
+                m_renderer.setPipelined(!m_renderer.isPipelined());
         } else if (const auto *mouse =
                        ev->getIf<sf::Event::MouseButtonPressed>()) {
             if (mouse->button == sf::Mouse::Button::Left) {
                 sf::Vector2i pos;
                 sf::Vector2f fpos;
 
+                m_renderer.markInput();
                 pos = mouse->position;
                 fpos = sf::Vector2f((float)pos.x, (float)pos.y);
                 if (m_btnLines.getGlobalBounds().contains(fpos)) {
-                    m_showEdges = !m_showEdges;
-                    m_renderer.setShowEdges(m_showEdges);
-                    updateButtonsStyle();
+                    cycleEdgeMode();
                 } else if (m_btnAuto.getGlobalBounds()
                                .contains(fpos)) {
                     m_autoRotate = !m_autoRotate;
                     updateButtonsStyle();
+                } else {
+                    m_pickedFace = m_renderer.pick(fpos.x, fpos.y,
+                                                   m_pickedInstance);
+                    m_renderer.setHighlightFace(m_pickedInstance,
+                                                m_pickedFace);
                 }
             }
         }
+        opt = m_window.pollEvent();
     }
 }
 
@@ -165,19 +246,109 @@ void App::updateHudText()
     if (!m_hasFont || !m_text)
         return;
     std::string text;
-    std::string obj;
-    std::string mtl;
+    std::string source;
+    std::string lod;
+    std::string picked;
+    char latency[32];
+    const RenderStats &stats = m_renderer.getStats();
+
+    std::snprintf(latency, sizeof(latency), "%.1f", stats.latencyMs);
+    if (m_hasScene) {
+        source = "Scene: " + m_objName + "\n" + "Instances: "
+            + std::to_string(stats.instances) + " drawn  "
+            + std::to_string(stats.instancesCulled) + " culled  "
+            + std::to_string(m_scene.getMeshCount()) + " meshes\n";
+        lod = std::to_string(stats.lod) + "+";
+    } else {
+        source = "OBJ: "
+            + (m_objName.empty() ? std::string("unknown.obj") : m_objName)
+            + "\n" + "MTL: " + m_mtlName + "\n";
+        lod = std::to_string(stats.lod) + "/"
+            + std::to_string(m_model.getLodCount() - 1);
+    }
+    picked = "none";
+    if (m_pickedFace >= 0 && m_hasScene) {
+        const SceneInstance &inst =
+            m_scene.getInstances()[m_pickedInstance];
 
-    obj = m_objName.empty()
-        ? std::string("unknown.obj")
-        : m_objName;
-    mtl = m_mtlName;
+        picked = m_scene.getMeshName(inst.mesh) + " #"
+            + std::to_string(m_pickedInstance) + " face "
+            + std::to_string(m_pickedFace) + " ("
+            + m_scene.getMesh(inst.mesh).getFaceMaterial(m_pickedFace)
+            + ")";
+    } else if (m_pickedFace >= 0) {
+        picked = "face " + std::to_string(m_pickedFace) + " ("
+            + m_model.getFaceMaterial(m_pickedFace) + ")";
+    }
     text =
-        "OBJ: " + obj + "\n" +
-        "MTL: " + mtl;
+        source +
+        "Raster: " + raster_kernel_name(m_renderer.getRasterKernel())
+        + " x" + std::to_string(m_renderer.getThreadCount()) + "  sort: "
+        + depth_sort_name(m_renderer.getDepthSort()) + "  edges: "
+        + edge_mode_name(m_edgeMode) + "  shading: "
+        + shading_mode_name(m_renderer.getShading()) + "\n" +
+        "Allocs/frame: " + std::to_string(stats.allocations) + "\n" +
+        "Frames: " + std::to_string(stats.framesRendered) + " drawn  "
+        + std::to_string(stats.framesSkipped) + " reused\n" +
+        "Pipeline: " + (m_renderer.isPipelined() ? "on" : "off")
+        + "  latency: " + latency + " ms\n" +
+        "LOD: " + lod + "  " + std::to_string(stats.lodFaces)
+        + " faces\n" +
+        "Tris: " + std::to_string(stats.triangles)
+        + "  culled: " + std::to_string(stats.culling.culled())
+        + "  clipped: " + std::to_string(stats.culling.clipped) + "\n" +
+        "Picked: " + picked;
     m_text->setString(text);
 }
 
+/* Rolling per-stage timings from the profiler, one line per stage. */
+void App::updateProfileText()
+{
+    std::vector<ProfileSummary> stages;
+    std::string text;
+    char line[96];
+
+    if (!m_profileText)
+        return;
+    profile_summary(stages);
+    text = "stage          mean    p50    p99 ms\n";
+    for (const ProfileSummary &s : stages) {
+        std::snprintf(line, sizeof(line), "%-12s %6.2f %6.2f %6.2f\n",
+                      s.name, s.meanMs, s.p50Ms, s.p99Ms);
+        text += line;
+    }
+    if (stages.empty())
+        text += "(built with PROFILE=0)\n";
+    m_profileText->setString(text);
+}
+
+void App::writeTrace()
+{
+    if (profile_write_trace(m_tracePath))
+        std::cerr << "Info: wrote trace to " << m_tracePath << "."
+                  << std::endl;
+    else
+        std::cerr << "Warning: could not write trace to " << m_tracePath
+                  << "." << std::endl;
+}
+
+/* Off -> all edges -> visible edges only -> off. */
+void App::cycleEdgeMode()
+{
+    if (m_edgeMode == EdgeMode::Off)
+        m_edgeMode = EdgeMode::All;
+    else if (m_edgeMode == EdgeMode::All)
+        m_edgeMode = EdgeMode::Visible;
+    else
+        m_edgeMode = EdgeMode::Off;
+    if (m_edgeMode != EdgeMode::Off && m_hasScene)
+        m_scene.prepareEdges();
+    else if (m_edgeMode != EdgeMode::Off)
+        m_model.prepareEdges();
+    m_renderer.setEdgeMode(m_edgeMode);
+    updateButtonsStyle();
+}
+
 void App::update()
 {
     if (m_autoRotate)
@@ -194,6 +365,7 @@ void App::render()
 {
     m_window.clear(sf::Color::Black);
     m_renderer.render(m_window);
+    updateHudText();
     if (m_hasFont && m_text) {
         m_window.draw(*m_text);
         m_window.draw(m_btnLines);
@@ -202,15 +374,32 @@ void App::render()
             m_window.draw(*m_btnLinesLabel);
         if (m_btnAutoLabel)
             m_window.draw(*m_btnAutoLabel);
+        if (m_showProfile && m_profileText) {
+            updateProfileText();
+            m_window.draw(*m_profileText);
+        }
     }
     m_window.display();
+    m_renderer.framePresented();
 }
 
+/*
+** Without auto-rotation nothing changes between events, so the loop
+** sleeps in waitEvent() after each frame, unless a pipelined frame is
+** still on its way to the screen. Events that leave the view alone
+** (mouse moves, focus) only re-present the last frame.
+*/
 void App::run()
 {
+    bool idle;
+
+    idle = false;
     while (m_running) {
-        handleEvents();
+        handleEvents(idle);
         update();
         render();
+        idle = !m_autoRotate && !m_renderer.isBusy();
     }
+    if (m_traceOnExit)
+        writeTrace();
 }
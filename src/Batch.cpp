@@ -0,0 +1,331 @@
+#include "Batch.hpp"
+#include "CpuRenderer.hpp"
+#include "Model.hpp"
+#include "Profiler.hpp"
+#include "Scene.hpp"
+#include <SFML/Graphics/Image.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+struct BatchAsset {
+    std::string objPath;
+    std::string mtlPath;
+    std::string stem;
+};
+
+/*
+** One pooled renderer and what the jobs it ran spent in each step
+** (thread time, summed over jobs; the report adds the slots up).
+*/
+struct BatchSlot {
+    CpuRenderer renderer;
+    std::size_t rendered = 0;
+    std::size_t failed = 0;
+    std::size_t frames = 0;
+    double loadMs = 0.0;
+    double renderMs = 0.0;
+    double writeMs = 0.0;
+};
+
+/*
+** Free slots. A job takes one for its whole asset; there are as many
+** slots as pool participants, so the stack is never empty on take.
+*/
+struct SlotPool {
+    std::mutex lock;
+    std::vector<BatchSlot *> free;
+};
+
+static BatchSlot *take_slot(SlotPool &pool)
+{
+    std::lock_guard<std::mutex> guard(pool.lock);
+    BatchSlot *slot;
+
+    slot = pool.free.back();
+    pool.free.pop_back();
+    return slot;
+}
+
+static void give_slot(SlotPool &pool, BatchSlot *slot)
+{
+    std::lock_guard<std::mutex> guard(pool.lock);
+
+    pool.free.push_back(slot);
+}
+
+/* One write per message so lines of parallel jobs do not interleave. */
+static void warn(const std::string &message)
+{
+    std::cerr << ("Warning: " + message + "\n");
+}
+
+static double elapsed_ms(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double, std::milli>(
+        std::chrono::steady_clock::now() - start).count();
+}
+
+/* File name without directory nor extension. */
+static std::string path_stem(const std::string &path)
+{
+    std::size_t slash;
+    std::size_t dot;
+
+    slash = path.find_last_of('/');
+    slash = slash == std::string::npos ? 0 : slash + 1;
+    dot = path.find_last_of('.');
+    if (dot == std::string::npos || dot < slash)
+        dot = path.size();
+    return path.substr(slash, dot - slash);
+}
+
+static bool read_manifest(const char *path, std::vector<BatchAsset> &assets)
+{
+    std::ifstream file(path);
+    std::unordered_set<std::string> stems;
+    std::string line;
+    std::size_t tab;
+
+    if (!file)
+        return false;
+    while (std::getline(file, line)) {
+        BatchAsset asset;
+
+        if (!line.empty() && line.back() == '\r')
+            line.pop_back();
+        if (line.empty() || line[0] == '#')
+            continue;
+        tab = line.find('\t');
+        asset.objPath = line.substr(0, tab);
+        if (tab != std::string::npos)
+            asset.mtlPath = line.substr(tab + 1);
+        asset.stem = path_stem(asset.objPath);
+        if (!stems.insert(asset.stem).second)
+            warn(asset.objPath + ": another model is named " + asset.stem
+                 + ", its images will be overwritten.");
+        assets.push_back(asset);
+    }
+    return !file.bad();
+}
+
+static bool load_asset(const Options &opts, const BatchAsset &asset,
+                       ThreadPool *pool, Model &model)
+{
+    if (!load_model(opts, asset.objPath, asset.mtlPath, pool, model))
+        return false;
+    if (opts.edges == EdgeMode::Visible)
+        model.prepareEdges();
+    return true;
+}
+
+static std::string view_path(const Options &opts, const BatchAsset &asset,
+                             std::size_t view)
+{
+    char suffix[32];
+
+    suffix[0] = '\0';
+    if (opts.views.size() > 1)
+        std::snprintf(suffix, sizeof(suffix), "_%03zu", view);
+    return std::string(opts.outDir) + "/" + asset.stem + suffix
+        + (opts.format == ImageFormat::Png ? ".png" : ".rgba");
+}
+
+static bool write_view(const FrameContext &frame, const std::string &path,
+                       ImageFormat format)
+{
+    std::FILE *file;
+    std::size_t count;
+    bool ok;
+
+    if (format == ImageFormat::Png) {
+        sf::Image image(sf::Vector2u(frame.width, frame.height),
+                        (const std::uint8_t *)frame.pixels.data());
+
+        return image.saveToFile(path);
+    }
+    file = std::fopen(path.c_str(), "wb");
+    if (!file)
+        return false;
+    count = (std::size_t)frame.width * frame.height;
+    ok = std::fwrite(frame.pixels.data(), sizeof(std::uint32_t), count,
+                     file) == count;
+    return std::fclose(file) == 0 && ok;
+}
+
+/*
+** Loads one asset on the slot renderer's pool, then renders and writes
+** all its views with it.
+*/
+static void run_asset(const Options &opts, const BatchAsset &asset,
+                      BatchSlot &slot)
+{
+    std::chrono::steady_clock::time_point start;
+    std::string path;
+    Model model;
+    std::size_t view;
+    bool ok;
+
+    PROFILE_SCOPE("asset");
+    start = std::chrono::steady_clock::now();
+    ok = load_asset(opts, asset, &slot.renderer.getThreadPool(), model);
+    slot.loadMs += elapsed_ms(start);
+    if (!ok) {
+        slot.failed++;
+        return;
+    }
+    slot.renderer.setModel(&model);
+    view = 0;
+    while (ok && view < opts.views.size()) {
+        start = std::chrono::steady_clock::now();
+        slot.renderer.setAngles(opts.views[view].angleY,
+                                opts.views[view].angleX);
+        slot.renderer.render(opts.width, opts.height);
+        slot.renderMs += elapsed_ms(start);
+        start = std::chrono::steady_clock::now();
+        path = view_path(opts, asset, view);
+        ok = write_view(slot.renderer.getFrame(), path, opts.format);
+        slot.writeMs += elapsed_ms(start);
+        if (!ok)
+            warn("failed to write " + path);
+        else
+            slot.frames++;
+        view++;
+    }
+    slot.renderer.setModel(nullptr);
+    if (ok)
+        slot.rendered++;
+    else
+        slot.failed++;
+}
+
+static void setup_renderer(const Options &opts, unsigned int threads,
+                           CpuRenderer &renderer)
+{
+    renderer.setThreadCount(threads);
+    renderer.setCullMode(opts.cullMode);
+    renderer.setDepthSort(opts.sort);
+    renderer.setShading(opts.shading);
+    renderer.setEdgeMode(opts.edges);
+    renderer.setLod(opts.lod);
+    if (opts.hasKernel)
+        renderer.setRasterKernel(opts.kernel);
+    renderer.setZoom(1.2f);
+}
+
+static void json_string(const char *str)
+{
+    std::putchar('"');
+    while (str && *str) {
+        if (*str == '"' || *str == '\\')
+            std::putchar('\\');
+        std::putchar(*str);
+        str++;
+    }
+    std::putchar('"');
+}
+
+/*
+** Assets are the unit of work: with at least as many assets as
+** threads each job renders single-threaded and the pool keeps every
+** core busy on whole assets (load, raster, PNG encode). With fewer
+** assets each job gets threads / jobs threads: the tile pool of its
+** slot's renderer, started once per slot, runs both its raster and its
+** parallel load, nested in the job pool (a worker only runs inline
+** what it submits to its own pool).
+*/
+int run_batch(const Options &opts)
+{
+    std::chrono::steady_clock::time_point start;
+    std::vector<BatchAsset> assets;
+    std::vector<std::unique_ptr<BatchSlot>> slots;
+    SlotPool slotPool;
+    BatchSlot total;
+    unsigned int threads;
+    unsigned int jobs;
+    unsigned int jobThreads;
+    double wallMs;
+    unsigned int i;
+
+    if (!read_manifest(opts.batchPath, assets)) {
+        std::cerr << "Error: cannot read manifest " << opts.batchPath
+                  << std::endl;
+        return 84;
+    }
+    if (assets.empty()) {
+        std::cerr << "Error: no model in " << opts.batchPath << std::endl;
+        return 84;
+    }
+    if (opts.edges == EdgeMode::All)
+        std::cerr << "Warning: --edges all is drawn by the window only."
+                  << std::endl;
+    threads = opts.threads ? opts.threads
+        : ThreadPool::defaultThreadCount();
+    jobs = (unsigned int)std::min<std::size_t>(threads, assets.size());
+    jobThreads = std::max(1u, threads / jobs);
+    i = 0;
+    while (i < jobs) {
+        slots.push_back(std::make_unique<BatchSlot>());
+        setup_renderer(opts, jobThreads, slots.back()->renderer);
+        slotPool.free.push_back(slots.back().get());
+        i++;
+    }
+    start = std::chrono::steady_clock::now();
+    {
+        ThreadPool pool(jobs);
+
+        pool.parallelFor(assets.size(), [&](std::size_t index) {
+            BatchSlot *slot;
+
+            slot = take_slot(slotPool);
+            run_asset(opts, assets[index], *slot);
+            give_slot(slotPool, slot);
+        });
+    }
+    wallMs = elapsed_ms(start);
+    for (const std::unique_ptr<BatchSlot> &slot : slots) {
+        total.rendered += slot->rendered;
+        total.failed += slot->failed;
+        total.frames += slot->frames;
+        total.loadMs += slot->loadMs;
+        total.renderMs += slot->renderMs;
+        total.writeMs += slot->writeMs;
+    }
+    std::printf("{\n  \"manifest\": ");
+    json_string(opts.batchPath);
+    std::printf(",\n  \"out_dir\": ");
+    json_string(opts.outDir);
+    std::printf(",\n  \"format\": \"%s\",\n"
+                "  \"width\": %u,\n  \"height\": %u,\n"
+                "  \"views\": %zu,\n  \"threads\": %u,\n"
+                "  \"jobs\": %u,\n  \"threads_per_job\": %u,\n"
+                "  \"kernel\": \"%s\",\n  \"shading\": \"%s\",\n"
+                "  \"assets\": %zu,\n  \"rendered\": %zu,\n"
+                "  \"failed\": %zu,\n  \"frames\": %zu,\n"
+                "  \"wall_ms\": %.4f,\n"
+                "  \"assets_per_s\": %.2f,\n  \"frames_per_s\": %.2f,\n"
+                "  \"load_ms\": %.4f,\n  \"render_ms\": %.4f,\n"
+                "  \"write_ms\": %.4f\n}\n",
+                opts.format == ImageFormat::Png ? "png" : "rgba",
+                opts.width, opts.height, opts.views.size(), threads, jobs,
+                jobThreads,
+                raster_kernel_name(slots[0]->renderer.getRasterKernel()),
+                shading_mode_name(opts.shading), assets.size(),
+                total.rendered, total.failed, total.frames, wallMs,
+                (double)total.rendered / (wallMs / 1000.0),
+                (double)total.frames / (wallMs / 1000.0),
+                total.loadMs, total.renderMs, total.writeMs);
+    if (opts.tracePath && !profile_write_trace(opts.tracePath)) {
+        std::cerr << "Error: failed to write " << opts.tracePath
+                  << std::endl;
+        return 84;
+    }
+    return total.failed ? 84 : 0;
+}
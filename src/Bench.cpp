@@ -0,0 +1,370 @@
+#include "Bench.hpp"
+#include "FramePipeline.hpp"
+#include "Model.hpp"
+#include "Profiler.hpp"
+#include "Scene.hpp"
+#include <SFML/Graphics/Image.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <string>
+#include <vector>
+
+/*
+** tris: triangles the stage went through, summed over the frames, so
+** its rate is only counted over the work it actually did.
+*/
+struct StageSamples {
+    const char *name;
+    std::vector<double> ms;
+    double tris;
+};
+
+static void json_string(const char *str)
+{
+    std::putchar('"');
+    while (str && *str) {
+        if (*str == '"' || *str == '\\')
+            std::putchar('\\');
+        std::putchar(*str);
+        str++;
+    }
+    std::putchar('"');
+}
+
+struct Summary {
+    double min;
+    double mean;
+    double p99;
+};
+
+static Summary summarize(const std::vector<double> &ms)
+{
+    std::vector<double> sorted;
+    Summary out;
+    double sum;
+    std::size_t rank;
+
+    sorted = ms;
+    std::sort(sorted.begin(), sorted.end());
+    sum = 0.0;
+    for (double v : sorted)
+        sum += v;
+    out.min = sorted.front();
+    out.mean = sum / (double)sorted.size();
+    rank = (sorted.size() * 99 + 99) / 100;
+    if (rank > 0)
+        rank--;
+    out.p99 = sorted[rank];
+    return out;
+}
+
+static void print_stage(const StageSamples &stage, bool first)
+{
+    Summary s;
+    double tris;
+
+    s = summarize(stage.ms);
+    tris = stage.tris / (double)stage.ms.size();
+    std::printf("%s    \"%s\": {\"min_ms\": %.4f, \"mean_ms\": %.4f, "
+                "\"p99_ms\": %.4f, \"tris_per_s\": %.0f}",
+                first ? "" : ",\n", stage.name, s.min, s.mean, s.p99,
+                s.mean > 0.0 ? tris / (s.mean / 1000.0) : 0.0);
+}
+
+/* Submit to acquire of every frame, and the frames shown per second. */
+static void print_latency(const std::vector<double> &latency,
+                          double wallMs)
+{
+    Summary s;
+
+    if (latency.empty())
+        return;
+    s = summarize(latency);
+    std::printf("  \"latency_ms\": {\"min\": %.4f, \"mean\": %.4f, "
+                "\"p99\": %.4f},\n  \"frames_per_s\": %.2f,\n",
+                s.min, s.mean, s.p99,
+                (double)latency.size() / (wallMs / 1000.0));
+}
+
+static void add_sample(StageSamples &stage, double ms, std::size_t tris)
+{
+    stage.ms.push_back(ms);
+    stage.tris += (double)tris;
+}
+
+/*
+** Transform and setup go through every face submitted (lodFaces), the
+** later stages only through the triangles that survived culling.
+** resolve and edges are left empty when they do not run.
+*/
+static void record_frame(const Options &opts, const RenderStats &s,
+                         StageSamples *stages)
+{
+    add_sample(stages[0], s.transformMs, s.lodFaces);
+    add_sample(stages[1], s.setupMs, s.lodFaces);
+    add_sample(stages[2], s.sortMs, s.triangles);
+    add_sample(stages[3], s.binMs, s.triangles);
+    add_sample(stages[4], s.rasterMs, s.triangles);
+    if (opts.shading == ShadingMode::Visibility)
+        add_sample(stages[5], s.resolveMs, s.triangles);
+    if (opts.edges == EdgeMode::Visible)
+        add_sample(stages[6], s.edgesMs, s.lodFaces);
+    add_sample(stages[7], s.transformMs + s.setupMs + s.sortMs
+               + s.binMs + s.rasterMs + s.resolveMs + s.edgesMs,
+               s.lodFaces);
+}
+
+/* Setup counters of the last frame. */
+static void print_culling(const RenderStats &stats)
+{
+    std::printf("  \"triangles_last_frame\": %zu,\n"
+                "  \"culled_last_frame\": {\"frustum\": %zu, "
+                "\"backface\": %zu, "
+                "\"zero_area\": %zu, \"offscreen\": %zu, "
+                "\"near\": %zu},\n"
+                "  \"clipped_last_frame\": %zu,\n",
+                stats.triangles, stats.culling.culledFrustum,
+                stats.culling.culledBackFace,
+                stats.culling.culledZeroArea,
+                stats.culling.culledOffScreen,
+                stats.culling.culledNear, stats.culling.clipped);
+}
+
+static bool save_frame(const FrameContext &frame, const char *path)
+{
+    sf::Image image(sf::Vector2u(frame.width, frame.height),
+                    (const std::uint8_t *)frame.pixels.data());
+
+    return image.saveToFile(path);
+}
+
+/*
+** Frame i is drawn at angle 0.5 + 0.01 * i after a first frame at 0.5.
+** Frames are submitted as soon as the pipeline has a free buffer; a
+** pipelined frame that finished while a newer one did too is dropped,
+** as on screen.
+*/
+static bool run_frames(const Options &opts, FramePipeline &pipeline,
+                       StageSamples *stages, std::vector<double> &latency,
+                       double &wallMs, RenderStats &last)
+{
+    std::chrono::steady_clock::time_point start;
+    std::chrono::steady_clock::time_point input;
+    const CpuRenderer *frame;
+    unsigned int submitted;
+    bool ok;
+
+    ok = true;
+    pipeline.setAngles(0.5f, 0.3f);
+    pipeline.submit(opts.width, opts.height);
+    frame = pipeline.acquire(true);
+    if (frame) {
+        last = frame->getStats();
+        if (opts.outputPath && opts.frames == 0)
+            ok = save_frame(frame->getFrame(), opts.outputPath);
+        pipeline.release();
+    }
+    submitted = 0;
+    start = std::chrono::steady_clock::now();
+    while (true) {
+        while (submitted < opts.frames) {
+            pipeline.setAngles(0.5f + 0.01f * (submitted + 1), 0.3f);
+            pipeline.markInput(std::chrono::steady_clock::now());
+            if (!pipeline.submit(opts.width, opts.height))
+                break;
+            submitted++;
+        }
+        frame = pipeline.acquire(true);
+        if (!frame)
+            break;
+        pipeline.acquiredInput(input);
+        latency.push_back(std::chrono::duration<double, std::milli>(
+            std::chrono::steady_clock::now() - input).count());
+        last = frame->getStats();
+        record_frame(opts, last, stages);
+        if (opts.outputPath && submitted == opts.frames
+            && !pipeline.busy())
+            ok = save_frame(frame->getFrame(), opts.outputPath);
+        pipeline.release();
+    }
+    wallMs = std::chrono::duration<double, std::milli>(
+        std::chrono::steady_clock::now() - start).count();
+    return ok;
+}
+
+static void print_model(const Model &model, double loadMs,
+                        const RenderStats &last)
+{
+    const LoadStats &ls = model.getLoadStats();
+
+    std::printf("  \"vertices\": %zu,\n"
+                "  \"faces\": %zu,\n  \"load_ms\": %.4f,\n"
+                "  \"quantized\": %s,\n  \"index_bits\": %d,\n"
+                "  \"mesh_bytes\": %zu,\n"
+                "  \"load_from_cache\": %s,\n"
+                "  \"parse_mb_per_s\": %.2f,\n"
+                "  \"bvh_nodes\": %zu,\n  \"bvh_build_ms\": %.4f,\n"
+                "  \"lod_levels\": %zu,\n  \"lod_build_ms\": %.4f,\n"
+                "  \"lod_last_frame\": %d,\n"
+                "  \"lod_faces_last_frame\": %zu,\n"
+                "  \"edge_count\": %zu,\n  \"edge_build_ms\": %.4f,\n"
+                "  \"optimized\": %s,\n  \"welded_vertices\": %zu,\n"
+                "  \"acmr_before\": %.4f,\n  \"acmr_after\": %.4f,\n"
+                "  \"optimize_ms\": %.4f,\n"
+                "  \"load_allocations\": %llu,\n"
+                "  \"load_alloc_bytes\": %llu,\n"
+                "  \"load_peak_rss_bytes\": %zu,\n"
+                "  \"load_peak_rss_of_load\": %s,\n",
+                model.getVertexCount(), model.getFaceCount(), loadMs,
+                model.getPositions().isQuantized() ? "true" : "false",
+                model.getLodIndices(0).isWide() ? 32 : 16,
+                model.getMeshBytes(), ls.fromCache ? "true" : "false",
+                ls.mbPerSec, ls.bvhNodes, ls.bvhMs, ls.lodLevels, ls.lodMs,
+                last.lod, last.lodFaces, ls.edges, ls.edgesMs,
+                ls.optimized ? "true" : "false", ls.weldedVertices,
+                (double)ls.acmrBefore, (double)ls.acmrAfter,
+                ls.optimizeMs, ls.allocations, ls.allocatedBytes,
+                ls.peakRss, ls.peakRssOfLoad ? "true" : "false");
+}
+
+/* vertices and faces: every instance at full detail. */
+static void print_scene(const Scene &scene, std::size_t vertices,
+                        std::size_t faces, double loadMs,
+                        const RenderStats &last)
+{
+    std::printf("  \"meshes\": %zu,\n  \"instances\": %zu,\n"
+                "  \"vertices\": %zu,\n  \"faces\": %zu,\n"
+                "  \"load_ms\": %.4f,\n  \"mesh_bytes\": %zu,\n"
+                "  \"instances_last_frame\": %zu,\n"
+                "  \"instances_culled_last_frame\": %zu,\n"
+                "  \"lod_last_frame\": %d,\n"
+                "  \"lod_faces_last_frame\": %zu,\n",
+                scene.getMeshCount(), scene.getInstances().size(),
+                vertices, faces, loadMs, scene.getMeshBytes(),
+                last.instances, last.instancesCulled, last.lod,
+                last.lodFaces);
+}
+
+int run_bench(const Options &opts)
+{
+    std::chrono::steady_clock::time_point start;
+    double loadMs;
+    double wallMs;
+    Model model;
+    Scene scene;
+    std::size_t vertices;
+    std::size_t faces;
+    FramePipeline renderer;
+    RenderStats last;
+    std::vector<double> latency;
+    StageSamples stages[8] = {
+        {"transform", {}, 0.0}, {"setup", {}, 0.0}, {"sort", {}, 0.0},
+        {"bin", {}, 0.0}, {"raster", {}, 0.0}, {"resolve", {}, 0.0},
+        {"edges", {}, 0.0}, {"frame", {}, 0.0}
+    };
+
+    renderer.setThreadCount(opts.threads);
+    start = std::chrono::steady_clock::now();
+    if (opts.scenePath
+        && !scene.load(opts.scenePath, opts, &renderer.getThreadPool()))
+        return 84;
+    if (!opts.scenePath
+        && !load_model(opts, opts.objPath, opts.mtlPath ? opts.mtlPath : "",
+                       &renderer.getThreadPool(), model)) {
+        std::cerr << "Error: failed to load OBJ file." << std::endl;
+        return 84;
+    }
+    loadMs = std::chrono::duration<double, std::milli>(
+        std::chrono::steady_clock::now() - start).count();
+    vertices = model.getVertexCount();
+    faces = model.getFaceCount();
+    if (opts.scenePath) {
+        vertices = 0;
+        faces = 0;
+        for (const SceneInstance &inst : scene.getInstances()) {
+            vertices += scene.getMesh(inst.mesh).getVertexCount();
+            faces += scene.getMesh(inst.mesh).getFaceCount();
+        }
+    }
+    renderer.setPipelined(opts.pipelined);
+    renderer.setCullMode(opts.cullMode);
+    renderer.setDepthSort(opts.sort);
+    renderer.setShading(opts.shading);
+    if (opts.edges != EdgeMode::Off && opts.scenePath)
+        scene.prepareEdges();
+    else if (opts.edges != EdgeMode::Off)
+        model.prepareEdges();
+    renderer.setEdgeMode(opts.edges);
+    if (opts.edges == EdgeMode::All)
+        std::cerr << "Warning: --edges all is drawn by the window only,"
+                  << " use visible to time edges." << std::endl;
+    renderer.setLod(opts.lod);
+    if (opts.hasKernel)
+        renderer.setRasterKernel(opts.kernel);
+    if (opts.scenePath)
+        renderer.setScene(&scene);
+    else
+        renderer.setModel(&model);
+    renderer.setZoom(1.2f);
+    if (!run_frames(opts, renderer, stages, latency, wallMs, last)) {
+        std::cerr << "Error: failed to write " << opts.outputPath
+                  << std::endl;
+        return 84;
+    }
+    if (opts.scenePath) {
+        std::printf("{\n  \"scene\": ");
+        json_string(opts.scenePath);
+    } else {
+        std::printf("{\n  \"model\": ");
+        json_string(opts.objPath);
+        std::printf(",\n  \"mtl\": ");
+        if (opts.mtlPath)
+            json_string(opts.mtlPath);
+        else
+            std::printf("null");
+    }
+    std::printf(",\n  \"width\": %u,\n  \"height\": %u,\n"
+                "  \"frames\": %u,\n  \"threads\": %u,\n"
+                "  \"kernel\": \"%s\",\n  \"sort\": \"%s\",\n"
+                "  \"edges\": \"%s\",\n  \"shading\": \"%s\",\n"
+                "  \"pipelined\": %s,\n  \"dropped_frames\": %zu,\n",
+                opts.width, opts.height, opts.frames,
+                renderer.getThreadCount(),
+                raster_kernel_name(renderer.getRasterKernel()),
+                depth_sort_name(renderer.getDepthSort()),
+                edge_mode_name(renderer.getEdgeMode()),
+                shading_mode_name(renderer.getShading()),
+                renderer.isPipelined() ? "true" : "false",
+                opts.frames - latency.size());
+    if (opts.scenePath)
+        print_scene(scene, vertices, faces, loadMs, last);
+    else
+        print_model(model, loadMs, last);
+    std::printf("  \"allocs_last_frame\": %llu,\n", last.allocations);
+    print_culling(last);
+    print_latency(latency, wallMs);
+    std::printf("  \"stages\": {\n");
+    {
+        unsigned int i;
+        bool first;
+
+        i = 0;
+        first = true;
+        while (i < 8) {
+            if (!stages[i].ms.empty()) {
+                print_stage(stages[i], first);
+                first = false;
+            }
+            i++;
+        }
+        std::printf("%s  }\n}\n", first ? "" : "\n");
+    }
+    if (opts.tracePath && !profile_write_trace(opts.tracePath)) {
+        std::cerr << "Error: failed to write " << opts.tracePath
+                  << std::endl;
+        return 84;
+    }
+    return 0;
+}
@@ -0,0 +1,635 @@
+#include "Bvh.hpp"
+#include "Model.hpp"
+#include "ThreadPool.hpp"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+static const int BVH_BINS = 16;
+static const unsigned int BVH_LEAF_MIN = 4;
+static const unsigned int BVH_LEAF_MAX = 16;
+static const int BVH_MAX_DEPTH = 48;
+static const float BVH_TRAVERSAL_COST = 1.0f;
+static const int BVH_STACK = 64;
+static const std::size_t BVH_TASK_MIN = 1 << 14;
+static const std::size_t BVH_BLOCK = 1 << 16;
+
+struct Box {
+    Vec3 min;
+    Vec3 max;
+};
+
+/*
+** Bounds and centroid of one face. The build partitions these records
+** themselves, not indices into them, so every pass reads its range
+** sequentially.
+*/
+struct Prim {
+    Box box;
+    Vec3 center;
+    unsigned int face;
+};
+
+/*
+** Chosen plane: faces whose centroid falls in a bin below bin go left.
+** Carries the face and centroid bounds of both sides.
+*/
+struct Split {
+    int axis;
+    int bin;
+    int bins;
+    float cmin;
+    float scale;
+    float cost;
+    Box left;
+    Box leftCentroids;
+    Box right;
+    Box rightCentroids;
+};
+
+/*
+** A range of prims and the node it becomes. Also what is left for the
+** pool, node then being its placeholder in the top tree.
+*/
+struct BuildTask {
+    unsigned int node;
+    unsigned int first;
+    unsigned int count;
+    int depth;
+    Box box;
+    Box centroids;
+};
+
+static Box empty_box()
+{
+    Box b;
+    float inf;
+
+    inf = std::numeric_limits<float>::infinity();
+    b.min = make_vec3(inf, inf, inf);
+    b.max = make_vec3(-inf, -inf, -inf);
+    return b;
+}
+
+static void grow_point(Box &b, const Vec3 &v)
+{
+    b.min.x = std::min(b.min.x, v.x);
+    b.min.y = std::min(b.min.y, v.y);
+    b.min.z = std::min(b.min.z, v.z);
+    b.max.x = std::max(b.max.x, v.x);
+    b.max.y = std::max(b.max.y, v.y);
+    b.max.z = std::max(b.max.z, v.z);
+}
+
+static void grow_box(Box &b, const Box &other)
+{
+    b.min.x = std::min(b.min.x, other.min.x);
+    b.min.y = std::min(b.min.y, other.min.y);
+    b.min.z = std::min(b.min.z, other.min.z);
+    b.max.x = std::max(b.max.x, other.max.x);
+    b.max.y = std::max(b.max.y, other.max.y);
+    b.max.z = std::max(b.max.z, other.max.z);
+}
+
+static float box_area(const Box &b)
+{
+    float dx;
+    float dy;
+    float dz;
+
+    if (b.min.x > b.max.x)
+        return 0.0f;
+    dx = b.max.x - b.min.x;
+    dy = b.max.y - b.min.y;
+    dz = b.max.z - b.min.z;
+    return dx * dy + dy * dz + dz * dx;
+}
+
+static float axis_of(const Vec3 &v, int axis)
+{
+    if (axis == 0)
+        return v.x;
+    if (axis == 1)
+        return v.y;
+    return v.z;
+}
+
+static int bin_of(float c, float cmin, float scale, int bins)
+{
+    int b;
+
+    b = (int)((c - cmin) * scale);
+    return std::min(std::max(b, 0), bins - 1);
+}
+
+/* Bounds of every face in the range and of their centroids. */
+static void range_bounds(const Prim *prims, unsigned int count, Box &box,
+                         Box &cbox)
+{
+    unsigned int i;
+
+    box = empty_box();
+    cbox = empty_box();
+    i = 0;
+    while (i < count) {
+        grow_box(box, prims[i].box);
+        grow_point(cbox, prims[i].center);
+        i++;
+    }
+}
+
+/*
+** Best binned SAH split of the range along the axis where the
+** centroids spread the most; small ranges use one bin per face. The
+** bins also carry centroid bounds so both children get their boxes
+** without another pass. Returns false when every centroid coincides.
+*/
+static bool find_split(const Prim *prims, unsigned int count,
+                       const Box &cbox, Split &best)
+{
+    Box bins[BVH_BINS];
+    Box cbins[BVH_BINS];
+    unsigned int counts[BVH_BINS];
+    Box rightBox[BVH_BINS];
+    Box rightCbox[BVH_BINS];
+    unsigned int rightCount[BVH_BINS];
+    Box acc;
+    Box cacc;
+    float extent;
+    unsigned int n;
+    unsigned int i;
+    int axis;
+    int b;
+
+    best.bins = count < (unsigned int)BVH_BINS ? (int)count : BVH_BINS;
+    best.axis = 0;
+    axis = 1;
+    while (axis < 3) {
+        if (axis_of(cbox.max, axis) - axis_of(cbox.min, axis)
+            > axis_of(cbox.max, best.axis) - axis_of(cbox.min, best.axis))
+            best.axis = axis;
+        axis++;
+    }
+    best.cmin = axis_of(cbox.min, best.axis);
+    extent = axis_of(cbox.max, best.axis) - best.cmin;
+    if (!(extent > 0.0f))
+        return false;
+    best.scale = (float)best.bins / extent;
+    b = 0;
+    while (b < best.bins) {
+        bins[b] = empty_box();
+        cbins[b] = empty_box();
+        counts[b] = 0;
+        b++;
+    }
+    i = 0;
+    while (i < count) {
+        b = bin_of(axis_of(prims[i].center, best.axis), best.cmin,
+                   best.scale, best.bins);
+        counts[b]++;
+        grow_box(bins[b], prims[i].box);
+        grow_point(cbins[b], prims[i].center);
+        i++;
+    }
+    acc = empty_box();
+    cacc = empty_box();
+    n = 0;
+    b = best.bins - 1;
+    while (b > 0) {
+        if (counts[b] > 0) {
+            grow_box(acc, bins[b]);
+            grow_box(cacc, cbins[b]);
+        }
+        n += counts[b];
+        rightBox[b] = acc;
+        rightCbox[b] = cacc;
+        rightCount[b] = n;
+        b--;
+    }
+    best.cost = std::numeric_limits<float>::infinity();
+    best.bin = 0;
+    acc = empty_box();
+    cacc = empty_box();
+    n = 0;
+    b = 1;
+    while (b < best.bins) {
+        float cost;
+
+        if (counts[b - 1] > 0) {
+            grow_box(acc, bins[b - 1]);
+            grow_box(cacc, cbins[b - 1]);
+        }
+        n += counts[b - 1];
+        cost = box_area(acc) * (float)n
+            + box_area(rightBox[b]) * (float)rightCount[b];
+        if (n > 0 && rightCount[b] > 0 && cost < best.cost) {
+            best.cost = cost;
+            best.bin = b;
+            best.left = acc;
+            best.leftCentroids = cacc;
+            best.right = rightBox[b];
+            best.rightCentroids = rightCbox[b];
+        }
+        b++;
+    }
+    return best.bin > 0;
+}
+
+/*
+** Fills nodes[index] for the range, whose face and centroid bounds
+** the caller already knows, and recurses into its children.
+*/
+static void build_node(std::vector<Prim> &prims,
+                       std::vector<BvhNode> &nodes, const BuildTask &node,
+                       std::vector<BuildTask> *tasks, std::size_t taskMin)
+{
+    BuildTask left;
+    BuildTask right;
+    Split split;
+    unsigned int mid;
+    unsigned int child;
+
+    nodes[node.node].min = node.box.min;
+    nodes[node.node].max = node.box.max;
+    nodes[node.node].first = node.first;
+    nodes[node.node].count = node.count;
+    if (tasks && node.count <= taskMin) {
+        tasks->push_back(node);
+        return;
+    }
+    if (node.count <= BVH_LEAF_MIN || node.depth >= BVH_MAX_DEPTH)
+        return;
+    if (find_split(&prims[node.first], node.count, node.centroids,
+                   split)) {
+        if (node.count <= BVH_LEAF_MAX
+            && box_area(node.box) * BVH_TRAVERSAL_COST + split.cost
+            >= box_area(node.box) * (float)node.count)
+            return;
+        mid = (unsigned int)(std::partition(
+            prims.begin() + node.first,
+            prims.begin() + node.first + node.count,
+            [&](const Prim &p) {
+                return bin_of(axis_of(p.center, split.axis), split.cmin,
+                              split.scale, split.bins)
+                    < split.bin;
+            }) - prims.begin());
+        left.box = split.left;
+        left.centroids = split.leftCentroids;
+        right.box = split.right;
+        right.centroids = split.rightCentroids;
+    } else {
+        if (node.count <= BVH_LEAF_MAX)
+            return;
+        mid = node.first + node.count / 2;
+        range_bounds(&prims[node.first], mid - node.first, left.box,
+                     left.centroids);
+        range_bounds(&prims[mid], node.first + node.count - mid,
+                     right.box, right.centroids);
+    }
+    child = (unsigned int)nodes.size();
+    nodes.resize(nodes.size() + 2);
+    nodes[node.node].first = child;
+    nodes[node.node].count = 0;
+    left.node = child;
+    left.first = node.first;
+    left.count = mid - node.first;
+    left.depth = node.depth + 1;
+    right.node = child + 1;
+    right.first = mid;
+    right.count = node.first + node.count - mid;
+    right.depth = node.depth + 1;
+    build_node(prims, nodes, left, tasks, taskMin);
+    build_node(prims, nodes, right, tasks, taskMin);
+}
+
+Bvh::Bvh()
+    : m_nodes(),
+      m_order()
+{
+}
+
+void Bvh::build(const std::vector<Vec3> &vertices,
+                const std::vector<Face> &faces, ThreadPool *pool)
+{
+    std::vector<Prim> prims;
+    BuildTask root;
+    std::vector<BuildTask> tasks;
+    std::vector<std::vector<BvhNode>> local;
+    std::size_t taskMin;
+    std::size_t blocks;
+    std::size_t count;
+    std::size_t k;
+
+    clear();
+    if (faces.empty())
+        return;
+    prims.resize(faces.size());
+    blocks = (faces.size() + BVH_BLOCK - 1) / BVH_BLOCK;
+    auto prepare = [&](std::size_t blk) {
+        std::size_t end;
+        std::size_t f;
+
+        end = std::min(faces.size(), (blk + 1) * BVH_BLOCK);
+        f = blk * BVH_BLOCK;
+        while (f < end) {
+            Box b;
+
+            b = empty_box();
+            grow_point(b, vertices[faces[f].a]);
+            grow_point(b, vertices[faces[f].b]);
+            grow_point(b, vertices[faces[f].c]);
+            prims[f].box = b;
+            prims[f].center = make_vec3((b.min.x + b.max.x) * 0.5f,
+                                           (b.min.y + b.max.y) * 0.5f,
+                                           (b.min.z + b.max.z) * 0.5f);
+            prims[f].face = (unsigned int)f;
+            f++;
+        }
+    };
+    parallel_for(pool, blocks, prepare);
+    m_nodes.resize(1);
+    root.node = 0;
+    root.first = 0;
+    root.count = (unsigned int)prims.size();
+    root.depth = 0;
+    range_bounds(prims.data(), root.count, root.box, root.centroids);
+    taskMin = 0;
+    if (pool && pool->getThreadCount() > 1)
+        taskMin = std::max(BVH_TASK_MIN,
+                           faces.size() / (pool->getThreadCount() * 4));
+    build_node(prims, m_nodes, root, taskMin > 0 ? &tasks : nullptr,
+               taskMin);
+    local.resize(tasks.size());
+    auto subtree = [&](std::size_t k) {
+        BuildTask t;
+
+        t = tasks[k];
+        t.node = 0;
+        local[k].resize(1);
+        build_node(prims, local[k], t, nullptr, 0);
+    };
+    parallel_for(pool, tasks.size(), subtree);
+    count = m_nodes.size();
+    for (const std::vector<BvhNode> &nodes : local)
+        count += nodes.size();
+    m_nodes.reserve(count);
+    k = 0;
+    while (k < tasks.size()) {
+        unsigned int base;
+
+        base = (unsigned int)m_nodes.size();
+        for (BvhNode node : local[k]) {
+            if (node.count == 0)
+                node.first += base;
+            m_nodes.push_back(node);
+        }
+        m_nodes[tasks[k].node] = m_nodes[base];
+        k++;
+    }
+    /* Grown by push_back; trimmed as the tree stays resident. */
+    m_nodes.shrink_to_fit();
+    m_order.resize(faces.size());
+    k = 0;
+    while (k < prims.size()) {
+        m_order[k] = prims[k].face;
+        k++;
+    }
+}
+
+void Bvh::clear()
+{
+    m_nodes.clear();
+    m_order.clear();
+}
+
+bool Bvh::empty() const
+{
+    return m_nodes.empty();
+}
+
+/*
+** Children always follow their parent, as build() lays them out, and
+** no node lies deeper than BVH_MAX_DEPTH: the recursive collect() then
+** ends, whatever the arrays hold.
+*/
+bool Bvh::assign(std::vector<BvhNode> &nodes,
+                 std::vector<unsigned int> &order, std::size_t faceCount)
+{
+    std::vector<unsigned char> depth;
+    std::size_t i;
+
+    clear();
+    if (order.size() != faceCount)
+        return false;
+    for (unsigned int f : order) {
+        if (f >= faceCount)
+            return false;
+    }
+    depth.assign(nodes.size(), 0);
+    i = 0;
+    while (i < nodes.size()) {
+        const BvhNode &node = nodes[i];
+
+        if (node.count > 0 && ((std::size_t)node.first + node.count
+                               > order.size()))
+            return false;
+        if (node.count == 0) {
+            if (node.first <= i
+                || (std::size_t)node.first + 1 >= nodes.size()
+                || depth[i] >= BVH_MAX_DEPTH)
+                return false;
+            depth[node.first] = std::max(depth[node.first],
+                                         (unsigned char)(depth[i] + 1));
+            depth[node.first + 1] = std::max(depth[node.first + 1],
+                                             (unsigned char)(depth[i] + 1));
+        }
+        i++;
+    }
+    m_nodes.swap(nodes);
+    m_order.swap(order);
+    return true;
+}
+
+const std::vector<BvhNode> &Bvh::getNodes() const
+{
+    return m_nodes;
+}
+
+const std::vector<unsigned int> &Bvh::getFaceOrder() const
+{
+    return m_order;
+}
+
+/*
+** Plane test on the box corners furthest along and against each
+** plane normal. Returns false when the box is outside one plane and
+** clears the bit of every plane it is fully inside of.
+*/
+static bool test_planes(const BvhNode &node, const Frustum &f,
+                        unsigned int &mask)
+{
+    int i;
+
+    i = 0;
+    while (i < 5) {
+        if (mask & (1u << i)) {
+            const Vec3 &n = f.n[i];
+            Vec3 pos;
+            Vec3 neg;
+
+            pos.x = n.x >= 0.0f ? node.max.x : node.min.x;
+            pos.y = n.y >= 0.0f ? node.max.y : node.min.y;
+            pos.z = n.z >= 0.0f ? node.max.z : node.min.z;
+            neg.x = n.x >= 0.0f ? node.min.x : node.max.x;
+            neg.y = n.y >= 0.0f ? node.min.y : node.max.y;
+            neg.z = n.z >= 0.0f ? node.min.z : node.max.z;
+            if (dot_vec3(n, pos) + f.d[i] < 0.0f)
+                return false;
+            if (dot_vec3(n, neg) + f.d[i] >= 0.0f)
+                mask &= ~(1u << i);
+        }
+        i++;
+    }
+    return true;
+}
+
+void Bvh::collect(unsigned int index, const Frustum &frustum,
+                  unsigned int mask, std::vector<unsigned int> &out) const
+{
+    const BvhNode &node = m_nodes[index];
+    unsigned int i;
+
+    if (mask != 0 && !test_planes(node, frustum, mask))
+        return;
+    if (node.count > 0) {
+        i = 0;
+        while (i < node.count) {
+            out.push_back(m_order[node.first + i]);
+            i++;
+        }
+        return;
+    }
+    collect(node.first, frustum, mask, out);
+    collect(node.first + 1, frustum, mask, out);
+}
+
+bool Bvh::collectVisible(const Frustum &frustum,
+                         std::vector<unsigned int> &out) const
+{
+    unsigned int mask;
+
+    out.clear();
+    if (m_nodes.empty())
+        return true;
+    mask = 0x1f;
+    if (!test_planes(m_nodes[0], frustum, mask))
+        return false;
+    if (mask == 0)
+        return true;
+    collect(0, frustum, mask, out);
+    return false;
+}
+
+static bool hit_box(const BvhNode &node, const Vec3 &origin,
+                    const Vec3 &inv, float tmax)
+{
+    float t0;
+    float t1;
+    float lo;
+    float hi;
+
+    t0 = (node.min.x - origin.x) * inv.x;
+    t1 = (node.max.x - origin.x) * inv.x;
+    lo = std::min(t0, t1);
+    hi = std::max(t0, t1);
+    t0 = (node.min.y - origin.y) * inv.y;
+    t1 = (node.max.y - origin.y) * inv.y;
+    lo = std::max(lo, std::min(t0, t1));
+    hi = std::min(hi, std::max(t0, t1));
+    t0 = (node.min.z - origin.z) * inv.z;
+    t1 = (node.max.z - origin.z) * inv.z;
+    lo = std::max(lo, std::min(t0, t1));
+    hi = std::min(hi, std::max(t0, t1));
+    return hi >= std::max(lo, 0.0f) && lo < tmax;
+}
+
+/* Moller-Trumbore, both sides. */
+static bool hit_triangle(const Vec3 &origin, const Vec3 &dir,
+                         const Vec3 &v0, const Vec3 &v1, const Vec3 &v2,
+                         float &t)
+{
+    Vec3 e1;
+    Vec3 e2;
+    Vec3 p;
+    Vec3 s;
+    Vec3 q;
+    float det;
+    float inv;
+    float u;
+    float v;
+
+    e1 = sub_vec3(v1, v0);
+    e2 = sub_vec3(v2, v0);
+    p = cross_vec3(dir, e2);
+    det = dot_vec3(e1, p);
+    if (std::fabs(det) < 1e-12f)
+        return false;
+    inv = 1.0f / det;
+    s = sub_vec3(origin, v0);
+    u = dot_vec3(s, p) * inv;
+    if (u < 0.0f || u > 1.0f)
+        return false;
+    q = cross_vec3(s, e1);
+    v = dot_vec3(dir, q) * inv;
+    if (v < 0.0f || u + v > 1.0f)
+        return false;
+    t = dot_vec3(e2, q) * inv;
+    return t > 0.0f;
+}
+
+int Bvh::intersect(const Vec3 &origin, const Vec3 &dir,
+                   const PositionBuffer &vertices,
+                   const IndexBuffer &faces, float &t) const
+{
+    unsigned int stack[BVH_STACK];
+    Vec3 inv;
+    int size;
+    int best;
+
+    best = -1;
+    t = std::numeric_limits<float>::infinity();
+    if (m_nodes.empty())
+        return best;
+    inv = make_vec3(1.0f / dir.x, 1.0f / dir.y, 1.0f / dir.z);
+    stack[0] = 0;
+    size = 1;
+    while (size > 0) {
+        const BvhNode &node = m_nodes[stack[--size]];
+        unsigned int i;
+
+        if (!hit_box(node, origin, inv, t))
+            continue;
+        if (node.count == 0) {
+            if (size + 2 > BVH_STACK)
+                continue;
+            stack[size++] = node.first + 1;
+            stack[size++] = node.first;
+            continue;
+        }
+        i = 0;
+        while (i < node.count) {
+            Face f;
+            float hit;
+
+            f = faces.getFace(m_order[node.first + i]);
+            if (hit_triangle(origin, dir, vertices.get(f.a),
+                             vertices.get(f.b), vertices.get(f.c), hit)
+                && hit < t) {
+                t = hit;
+                best = (int)m_order[node.first + i];
+            }
+            i++;
+        }
+    }
+    return best;
+}
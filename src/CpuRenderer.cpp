@@ -0,0 +1,743 @@
+#include "CpuRenderer.hpp"
+#include "Math.hpp"
+#include "Scene.hpp"
+#include "TriangleSetup.hpp"
+#include "Profiler.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+/*
+** A 1080p frame has about 500 tiles: the profiler ring only gets one
+** tile event in this many, the HUD window still sees every tile.
+*/
+static const unsigned int TILE_TRACE_EVERY = 64;
+
+CpuRenderer::CpuRenderer()
+{
+    m_model = nullptr;
+    m_scene = nullptr;
+    m_angleY = 0.0f;
+    m_angleX = 0.0f;
+    m_zoom = 1.0f;
+    m_kernel = raster_best_kernel();
+    m_cullMode = CULL_ALL;
+    m_sort = DepthSort::None;
+    m_edgeMode = EdgeMode::Off;
+    m_shading = ShadingMode::Forward;
+    m_highlightInstance = 0;
+    m_highlightFace = -1;
+    m_lodMode = -1;
+    m_hasView = false;
+    m_dirty = true;
+}
+
+void CpuRenderer::setModel(const Model *model)
+{
+    if (model == m_model && !m_scene)
+        return;
+    m_model = model;
+    m_scene = nullptr;
+    m_dirty = true;
+}
+
+void CpuRenderer::setScene(const Scene *scene)
+{
+    if (scene == m_scene && !m_model)
+        return;
+    m_scene = scene;
+    m_model = nullptr;
+    m_dirty = true;
+}
+
+void CpuRenderer::setAngles(float angleY, float angleX)
+{
+    if (angleY == m_angleY && angleX == m_angleX)
+        return;
+    m_angleY = angleY;
+    m_angleX = angleX;
+    m_dirty = true;
+}
+
+void CpuRenderer::setZoom(float zoom)
+{
+    if (zoom == m_zoom)
+        return;
+    m_zoom = zoom;
+    m_dirty = true;
+}
+
+void CpuRenderer::setThreadCount(unsigned int threads)
+{
+    if (threads == 0)
+        threads = ThreadPool::defaultThreadCount();
+    threads = ThreadPool::clampThreadCount(threads);
+    if (m_pool && threads == m_pool->getThreadCount())
+        return;
+    m_pool = std::make_shared<ThreadPool>(threads);
+    m_dirty = true;
+}
+
+void CpuRenderer::shareThreadPool(CpuRenderer &other)
+{
+    other.getThreadPool();
+    if (other.m_pool == m_pool)
+        return;
+    m_pool = other.m_pool;
+    m_dirty = true;
+}
+
+unsigned int CpuRenderer::getThreadCount() const
+{
+    if (!m_pool)
+        return ThreadPool::clampThreadCount(
+            ThreadPool::defaultThreadCount());
+    return m_pool->getThreadCount();
+}
+
+ThreadPool &CpuRenderer::getThreadPool()
+{
+    if (!m_pool)
+        m_pool = std::make_shared<ThreadPool>(
+            ThreadPool::defaultThreadCount());
+    return *m_pool;
+}
+
+void CpuRenderer::setRasterKernel(RasterKernel kernel)
+{
+    if (!raster_kernel_supported(kernel) || kernel == m_kernel)
+        return;
+    m_kernel = kernel;
+    m_dirty = true;
+}
+
+RasterKernel CpuRenderer::getRasterKernel() const
+{
+    return m_kernel;
+}
+
+void CpuRenderer::setCullMode(unsigned int mode)
+{
+    if (mode == m_cullMode)
+        return;
+    m_cullMode = mode;
+    m_dirty = true;
+}
+
+unsigned int CpuRenderer::getCullMode() const
+{
+    return m_cullMode;
+}
+
+void CpuRenderer::setDepthSort(DepthSort sort)
+{
+    if (sort == m_sort)
+        return;
+    m_sort = sort;
+    m_dirty = true;
+}
+
+DepthSort CpuRenderer::getDepthSort() const
+{
+    return m_sort;
+}
+
+void CpuRenderer::setEdgeMode(EdgeMode mode)
+{
+    if (mode == m_edgeMode)
+        return;
+    if (mode == EdgeMode::Visible || m_edgeMode == EdgeMode::Visible)
+        m_dirty = true;
+    m_edgeMode = mode;
+}
+
+EdgeMode CpuRenderer::getEdgeMode() const
+{
+    return m_edgeMode;
+}
+
+void CpuRenderer::setShading(ShadingMode mode)
+{
+    if (mode == m_shading)
+        return;
+    m_shading = mode;
+    m_dirty = true;
+}
+
+ShadingMode CpuRenderer::getShading() const
+{
+    return m_shading;
+}
+
+void CpuRenderer::setHighlightFace(int instance, int face)
+{
+    if (instance == m_highlightInstance && face == m_highlightFace)
+        return;
+    m_highlightInstance = instance;
+    m_highlightFace = face;
+    m_dirty = true;
+}
+
+void CpuRenderer::setLod(int level)
+{
+    if (level == m_lodMode)
+        return;
+    m_lodMode = level;
+    m_dirty = true;
+}
+
+/*
+** Reads the visibility buffer or casts the ray under a screen point
+** through the BVH of each instance, using the views of the last
+** rendered frame so it matches what is shown. Ray distances are
+** compared in view units, the nearest hit wins.
+*/
+int CpuRenderer::pick(float x, float y, int &instance) const
+{
+    Vec3 origin;
+    Vec3 dir;
+    unsigned int k;
+    float best;
+    float t;
+    int face;
+    int hit;
+
+    instance = -1;
+    if ((!m_model && !m_scene) || !m_hasView)
+        return -1;
+    face = -1;
+    if (m_shading == ShadingMode::Visibility)
+        face = visible_face(m_frame, (int)std::floor(x),
+                            (int)std::floor(y), k);
+    if (face >= 0 && m_frame.instances[k].lod == 0) {
+        instance = (int)m_frame.instances[k].source;
+        return face;
+    }
+    best = std::numeric_limits<float>::infinity();
+    hit = -1;
+    for (const FrameInstance &inst : m_frame.instances) {
+        view_ray(inst.view, x, y, origin, dir);
+        face = inst.model->getBvh().intersect(
+            origin, dir, inst.model->getPositions(),
+            inst.model->getLodIndices(0), t);
+        if (face >= 0 && t * inst.scale < best) {
+            best = t * inst.scale;
+            hit = face;
+            instance = (int)inst.source;
+        }
+    }
+    return hit;
+}
+
+const FrameContext &CpuRenderer::getFrame() const
+{
+    return m_frame;
+}
+
+const RenderStats &CpuRenderer::getStats() const
+{
+    return m_stats;
+}
+
+static void sort_triangles(std::vector<TriData> &tris)
+{
+    std::sort(tris.begin(), tris.end(),
+              [](const TriData &a, const TriData &b) {
+                  float za;
+                  float zb;
+
+                  za = (a.w1.z + a.w2.z + a.w3.z) / 3.0f;
+                  zb = (b.w1.z + b.w2.z + b.w3.z) / 3.0f;
+                  return za > zb;
+              });
+}
+
+static const std::size_t SORT_BLOCK = 1 << 14;
+
+/*
+** Sets the order bin_triangles() walks the triangles in. The painter's
+** sort moves the triangles themselves and leaves sortKeys empty, like
+** setup order; front to back sorts (centroid depth, index) pairs.
+*/
+static void order_triangles(DepthSort sort, FrameContext &frame,
+                            ThreadPool *pool)
+{
+    std::size_t blocks;
+
+    frame.sortKeys.clear();
+    if (sort == DepthSort::BackToFront)
+        sort_triangles(frame.tris);
+    if (sort != DepthSort::FrontToBack)
+        return;
+    frame.sortKeys.resize(frame.tris.size());
+    blocks = (frame.tris.size() + SORT_BLOCK - 1) / SORT_BLOCK;
+    auto build = [&](std::size_t blk) {
+        std::size_t end;
+        std::size_t i;
+
+        end = std::min(frame.tris.size(), (blk + 1) * SORT_BLOCK);
+        i = blk * SORT_BLOCK;
+        while (i < end) {
+            const TriData &t = frame.tris[i];
+
+            frame.sortKeys[i].key = depth_key(t.w1.z + t.w2.z + t.w3.z);
+            frame.sortKeys[i].index = (std::uint32_t)i;
+            i++;
+        }
+    };
+    parallel_for(pool, blocks, build);
+    radix_sort_keys(frame.sortKeys, frame.sortScratch, frame.sortCounts,
+                    pool);
+}
+
+static RasterTriangle make_raster_triangle(const TriData &t)
+{
+    RasterTriangle r;
+
+    r.x1 = t.p1.x;
+    r.y1 = t.p1.y;
+    r.x2 = t.p2.x;
+    r.y2 = t.p2.y;
+    r.x3 = t.p3.x;
+    r.y3 = t.p3.y;
+    r.z1 = t.w1.z;
+    r.z2 = t.w2.z;
+    r.z3 = t.w3.z;
+    r.color = t.color;
+    return r;
+}
+
+/*
+** Sorts the (already depth-ordered) triangles into screen tiles with a
+** count / prefix-sum / scatter pass into one flat index array.
+** Triangles keep their sorted order inside every bin, so each pixel
+** sees the same sequence of depth tests as a full-screen pass.
+*/
+static void bin_triangles(FrameContext &frame)
+{
+    std::size_t i;
+    unsigned int total;
+    int tx;
+    int ty;
+
+    for (Tile &tile : frame.tiles)
+        tile.count = 0;
+    frame.triTiles.resize(frame.tris.size());
+    i = 0;
+    while (i < frame.tris.size()) {
+        TileRect &r = frame.triTiles[i];
+
+        if (raster_bounds(make_raster_triangle(frame.tris[i]), 0, 0,
+                          (int)frame.width - 1, (int)frame.height - 1,
+                          r.x0, r.y0, r.x1, r.y1)) {
+            r.x0 /= (int)TILE_SIZE;
+            r.y0 /= (int)TILE_SIZE;
+            r.x1 /= (int)TILE_SIZE;
+            r.y1 /= (int)TILE_SIZE;
+            ty = r.y0;
+            while (ty <= r.y1) {
+                tx = r.x0;
+                while (tx <= r.x1) {
+                    frame.tiles[(std::size_t)ty * frame.tilesX + tx]
+                        .count++;
+                    tx++;
+                }
+                ty++;
+            }
+        } else {
+            r.x0 = 1;
+            r.x1 = 0;
+            r.y0 = 1;
+            r.y1 = 0;
+        }
+        i++;
+    }
+    total = 0;
+    for (Tile &tile : frame.tiles) {
+        tile.first = total;
+        total += tile.count;
+        tile.count = 0;
+    }
+    if (total > frame.bins.capacity())
+        frame.bins.reserve(total + total / 2);
+    frame.bins.resize(total);
+    i = 0;
+    while (i < frame.tris.size()) {
+        const TileRect *r;
+        unsigned int t;
+
+        t = frame.sortKeys.empty() ? (unsigned int)i
+            : frame.sortKeys[i].index;
+        r = &frame.triTiles[t];
+        ty = r->y0;
+        while (ty <= r->y1) {
+            tx = r->x0;
+            while (tx <= r->x1) {
+                Tile &tile = frame.tiles[(std::size_t)ty * frame.tilesX
+                                         + tx];
+
+                frame.bins[tile.first + tile.count] = t;
+                tile.count++;
+                tx++;
+            }
+            ty++;
+        }
+        i++;
+    }
+}
+
+/*
+** Each tile clears its own rows of the color (or id) buffer and its
+** own slice of the z-buffer before drawing, so the clear is spread
+** over the pool along with the raster work. In visibility shading the
+** kernels write the triangle index where they would write its color.
+*/
+static void raster_tile(RasterKernel kernel, ShadingMode shading,
+                        FrameContext &frame, std::size_t index)
+{
+    const Tile &tile = frame.tiles[index];
+    RasterTarget target;
+    RasterTriangle t;
+    std::uint32_t *color;
+    float *zbuf;
+    std::uint32_t clear;
+    unsigned int i;
+    int y;
+
+    PROFILE_SAMPLED_SCOPE("tile", TILE_TRACE_EVERY);
+    zbuf = &frame.depth[index * TILE_AREA];
+    std::fill(zbuf, zbuf + TILE_AREA,
+              std::numeric_limits<float>::infinity());
+    color = frame.pixels.data();
+    clear = pack_rgba(0, 0, 0, 255);
+    if (shading == ShadingMode::Visibility) {
+        color = frame.ids.data();
+        clear = NO_TRIANGLE;
+    }
+    y = tile.y0;
+    while (y <= tile.y1) {
+        std::uint32_t *row;
+
+        row = color + (std::size_t)y * frame.width;
+        std::fill(row + tile.x0, row + tile.x1 + 1, clear);
+        y++;
+    }
+    target.color = color;
+    target.colorStride = frame.width;
+    target.depth = zbuf;
+    target.depthStride = TILE_SIZE;
+    target.depthX0 = tile.x0;
+    target.depthY0 = tile.y0;
+    target.clipX0 = tile.x0;
+    target.clipY0 = tile.y0;
+    target.clipX1 = tile.x1;
+    target.clipY1 = tile.y1;
+    i = 0;
+    while (i < tile.count) {
+        t = make_raster_triangle(frame.tris[frame.bins[tile.first + i]]);
+        if (shading == ShadingMode::Visibility)
+            t.color = frame.bins[tile.first + i];
+        raster_triangle(kernel, t, target);
+        i++;
+    }
+}
+
+/*
+** One band of rows per pool thread: every band walks the whole edge
+** list but only draws the part that falls in its rows.
+*/
+static void draw_edge_bands(FrameContext &frame, ThreadPool *pool)
+{
+    std::uint32_t white;
+    unsigned int bands;
+    int rows;
+
+    white = pack_rgba(255, 255, 255, 255);
+    bands = std::min(pool->getThreadCount(), frame.height);
+    rows = (int)((frame.height + bands - 1) / bands);
+    pool->parallelFor(bands, [&](std::size_t i) {
+        int y0;
+
+        y0 = (int)i * rows;
+        for (const FrameInstance &inst : frame.instances)
+            draw_visible_edges(inst.model->getLodEdges(inst.lod),
+                               inst.firstVertex, frame, white, y0,
+                               std::min(y0 + rows, (int)frame.height));
+    });
+}
+
+static const float LOD_PIXEL_ERROR = 1.0f;
+
+/*
+** Coarsest level whose error, seen at the nearest point of the
+** model's bounding sphere, stays under LOD_PIXEL_ERROR pixels. The
+** zoom is part of the view scale, so zooming in refines the level;
+** an instance scale grows both the sphere and the error.
+*/
+static int select_lod(const Model &model, const ViewTransform &view,
+                      float scale)
+{
+    float depth;
+    float pixels;
+    int level;
+
+    depth = view.offset.z - MODEL_RADIUS * scale;
+    if (depth < NEAR_PLANE)
+        return 0;
+    pixels = std::max(view.scaleX, view.scaleY) * scale / depth;
+    level = model.getLodCount() - 1;
+    while (level > 0
+           && model.getLodError(level) * pixels > LOD_PIXEL_ERROR)
+        level--;
+    return level;
+}
+
+/*
+** Whether a sphere of radius around the model origin crosses the
+** view: the same four side planes and near plane as
+** make_view_frustum(), tested in view space.
+*/
+static bool sphere_in_view(const ViewTransform &view, float radius)
+{
+    const Vec3 &c = view.offset;
+    float kx;
+    float ky;
+    float rx;
+    float ry;
+
+    kx = view.centerX / view.scaleX;
+    ky = view.centerY / view.scaleY;
+    rx = radius * std::sqrt(1.0f + kx * kx);
+    ry = radius * std::sqrt(1.0f + ky * ky);
+    return c.z + radius >= NEAR_PLANE
+        && c.x + kx * c.z + rx >= 0.0f && kx * c.z - c.x + rx >= 0.0f
+        && c.y + ky * c.z + ry >= 0.0f && ky * c.z - c.y + ry >= 0.0f;
+}
+
+static std::size_t block_count(const Model &model)
+{
+    return (model.getPositions().size() + TRANSFORM_BLOCK - 1)
+        / TRANSFORM_BLOCK;
+}
+
+/*
+** Fills m_frame.instances with the lone model, or the scene instances
+** whose bounding sphere is in view, each with its own view, level of
+** detail and slice of the vertex stream. Mesh data stays shared: only
+** the transformed vertices of the drawn instances are per frame.
+*/
+void CpuRenderer::placeInstances(const ViewTransform &view)
+{
+    FrameInstance inst;
+    std::size_t count;
+    std::size_t vertices;
+    std::size_t blocks;
+    std::size_t i;
+
+    m_frame.instances.clear();
+    m_stats.culling = SetupStats();
+    m_stats.instancesCulled = 0;
+    count = m_scene ? m_scene->getInstances().size() : 1;
+    vertices = 0;
+    blocks = 0;
+    i = 0;
+    while (i < count) {
+        inst.model = m_model;
+        inst.view = view;
+        inst.scale = 1.0f;
+        if (m_scene) {
+            const SceneInstance &s = m_scene->getInstances()[i];
+
+            inst.model = &m_scene->getMesh(s.mesh);
+            inst.view = instance_view(view, s.position, s.yaw, s.scale);
+            inst.scale = s.scale;
+        }
+        inst.lod = m_lodMode < 0
+            ? select_lod(*inst.model, inst.view, inst.scale)
+            : std::min(m_lodMode, inst.model->getLodCount() - 1);
+        inst.source = (unsigned int)i;
+        i++;
+        if (!sphere_in_view(inst.view, MODEL_RADIUS * inst.scale)) {
+            m_stats.instancesCulled++;
+            m_stats.culling.culledFrustum +=
+                inst.model->getLodIndices(inst.lod).size();
+            continue;
+        }
+        inst.highlightFace = inst.lod == 0
+            && (int)inst.source == m_highlightInstance
+            ? m_highlightFace : -1;
+        inst.firstVertex = vertices;
+        inst.firstBlock = blocks;
+        vertices += inst.model->getPositions().size();
+        blocks += block_count(*inst.model);
+        m_frame.instances.push_back(inst);
+    }
+    m_frame.verts.resize(vertices);
+}
+
+/*
+** Every drawn instance in one parallel pass. A job is up to
+** TRANSFORM_BLOCK vertices of one instance, so one large mesh still
+** spreads over the pool and a thousand small ones are a thousand
+** jobs of one dispatch, not a thousand dispatches.
+*/
+void CpuRenderer::transformInstances(ThreadPool *pool)
+{
+    const std::vector<FrameInstance> &instances = m_frame.instances;
+    std::size_t blocks;
+
+    if (instances.empty())
+        return;
+    blocks = instances.back().firstBlock
+        + block_count(*instances.back().model);
+    parallel_for(pool, blocks, [&](std::size_t b) {
+        const FrameInstance *inst;
+        std::size_t begin;
+        std::size_t size;
+
+        inst = &*(std::upper_bound(instances.begin(), instances.end(), b,
+                                   [](std::size_t block,
+                                      const FrameInstance &i) {
+                                       return block < i.firstBlock;
+                                   }) - 1);
+        size = inst->model->getPositions().size();
+        begin = (b - inst->firstBlock) * TRANSFORM_BLOCK;
+        transform_positions(inst->view, inst->model->getPositions(),
+                            begin, std::min(TRANSFORM_BLOCK, size - begin),
+                            m_frame.verts, inst->firstVertex + begin);
+    });
+}
+
+/*
+** Triangle setup of each drawn instance in turn, appended into one
+** list; level 0 instances set up only the faces their BVH finds in
+** the view.
+*/
+void CpuRenderer::setupInstances()
+{
+    SetupParams params;
+    std::size_t faces;
+    std::size_t k;
+
+    faces = 0;
+    for (const FrameInstance &inst : m_frame.instances)
+        faces += inst.model->getLodIndices(inst.lod).size();
+    m_stats.lodFaces = faces;
+    m_stats.lod = 0;
+    m_frame.tris.clear();
+    m_frame.tris.reserve(faces);
+    params.cullMode = m_cullMode;
+    params.shade = m_shading == ShadingMode::Forward;
+    k = 0;
+    while (k < m_frame.instances.size()) {
+        const FrameInstance &inst = m_frame.instances[k];
+
+        params.lod = inst.lod;
+        params.highlightFace = inst.highlightFace;
+        params.instance = (std::uint32_t)k;
+        params.firstVertex = inst.firstVertex;
+        params.faces = nullptr;
+        if (inst.lod == 0
+            && !inst.model->getBvh().collectVisible(
+                make_view_frustum(inst.view, NEAR_PLANE),
+                m_frame.visibleFaces))
+            params.faces = &m_frame.visibleFaces;
+        build_triangles(*inst.model, inst.view, m_frame.verts, params,
+                        m_frame.tris, m_stats.culling);
+        if (k == 0 || inst.lod < m_stats.lod)
+            m_stats.lod = inst.lod;
+        k++;
+    }
+    m_stats.instances = m_frame.instances.size();
+}
+
+bool CpuRenderer::render(unsigned int width, unsigned int height)
+{
+    if (!prepare(width, height, false))
+        return false;
+    rasterize();
+    return true;
+}
+
+bool CpuRenderer::prepare(unsigned int width, unsigned int height,
+                          bool serial)
+{
+    ThreadPool *pool;
+    ViewTransform view;
+
+    if ((!m_model && !m_scene) || width == 0 || height == 0)
+        return false;
+    if (!m_dirty && width == m_frame.width && height == m_frame.height) {
+        m_stats.reused = true;
+        m_stats.framesSkipped++;
+        return true;
+    }
+    pool = serial ? nullptr : &getThreadPool();
+    m_allocBase = alloc_stats();
+    {
+        ScopedTimer timer("transform", m_stats.transformMs);
+
+        m_frame.resize(width, height);
+        if (m_shading == ShadingMode::Visibility)
+            m_frame.ids.resize(m_frame.pixels.size());
+        else
+            m_frame.ids.clear();
+        view = make_view_transform(m_angleY, m_angleX,
+                                   make_vec3(0.0f, 0.0f, 4.0f), m_zoom,
+                                   (float)width, (float)height);
+        m_hasView = true;
+        placeInstances(view);
+        transformInstances(pool);
+    }
+    {
+        ScopedTimer timer("setup", m_stats.setupMs);
+
+        setupInstances();
+    }
+    {
+        ScopedTimer timer("sort", m_stats.sortMs);
+
+        order_triangles(m_sort, m_frame, pool);
+    }
+    {
+        ScopedTimer timer("bin", m_stats.binMs);
+
+        bin_triangles(m_frame);
+    }
+    m_stats.reused = false;
+    return true;
+}
+
+void CpuRenderer::rasterize()
+{
+    ThreadPool *pool;
+
+    if (m_stats.reused)
+        return;
+    pool = &getThreadPool();
+    {
+        ScopedTimer timer("raster", m_stats.rasterMs);
+
+        pool->parallelFor(m_frame.tiles.size(), [this](std::size_t i) {
+            raster_tile(m_kernel, m_shading, m_frame, i);
+        });
+    }
+    m_stats.resolveMs = 0.0;
+    if (m_shading == ShadingMode::Visibility) {
+        ScopedTimer timer("resolve", m_stats.resolveMs);
+
+        resolve_visibility(m_frame, pool);
+    }
+    m_stats.edgesMs = 0.0;
+    if (m_edgeMode == EdgeMode::Visible) {
+        ScopedTimer timer("edges", m_stats.edgesMs);
+
+        draw_edge_bands(m_frame, pool);
+    }
+    m_stats.triangles = m_frame.tris.size();
+    m_stats.allocations = alloc_stats().count - m_allocBase.count;
+    m_stats.framesRendered++;
+    m_dirty = false;
+}
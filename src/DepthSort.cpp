@@ -0,0 +1,121 @@
+#include "DepthSort.hpp"
+#include "ThreadPool.hpp"
+#include <algorithm>
+#include <cstring>
+
+static const std::size_t RADIX_BLOCK = 1 << 14;
+static const unsigned int RADIX_BUCKETS = 256;
+
+const char *depth_sort_name(DepthSort sort)
+{
+    if (sort == DepthSort::FrontToBack)
+        return "radix";
+    if (sort == DepthSort::None)
+        return "none";
+    return "painter";
+}
+
+bool depth_sort_from_name(const char *name, DepthSort &sort)
+{
+    if (std::strcmp(name, "painter") == 0)
+        sort = DepthSort::BackToFront;
+    else if (std::strcmp(name, "radix") == 0)
+        sort = DepthSort::FrontToBack;
+    else if (std::strcmp(name, "none") == 0)
+        sort = DepthSort::None;
+    else
+        return false;
+    return true;
+}
+
+/* Negative floats have every bit flipped, positive ones the sign bit. */
+std::uint32_t depth_key(float z)
+{
+    std::uint32_t bits;
+
+    std::memcpy(&bits, &z, sizeof(bits));
+    if (bits & 0x80000000u)
+        return ~bits;
+    return bits | 0x80000000u;
+}
+
+void radix_sort_keys(std::vector<DepthKey> &keys,
+                     std::vector<DepthKey> &scratch,
+                     std::vector<unsigned int> &counts, ThreadPool *pool)
+{
+    std::size_t blocks;
+    unsigned int shift;
+
+    if (keys.size() < 2)
+        return;
+    blocks = (keys.size() + RADIX_BLOCK - 1) / RADIX_BLOCK;
+    scratch.resize(keys.size());
+    counts.resize(blocks * RADIX_BUCKETS);
+    shift = 0;
+    while (shift < 32) {
+        unsigned int sums[RADIX_BUCKETS];
+        unsigned int total;
+        unsigned int d;
+        std::size_t b;
+
+        auto count = [&](std::size_t blk) {
+            unsigned int *c;
+            std::size_t end;
+            std::size_t i;
+
+            c = &counts[blk * RADIX_BUCKETS];
+            std::fill(c, c + RADIX_BUCKETS, 0u);
+            end = std::min(keys.size(), (blk + 1) * RADIX_BLOCK);
+            i = blk * RADIX_BLOCK;
+            while (i < end) {
+                c[(keys[i].key >> shift) & 0xff]++;
+                i++;
+            }
+        };
+        parallel_for(pool, blocks, count);
+        std::fill(sums, sums + RADIX_BUCKETS, 0u);
+        b = 0;
+        while (b < blocks) {
+            d = 0;
+            while (d < RADIX_BUCKETS) {
+                sums[d] += counts[b * RADIX_BUCKETS + d];
+                d++;
+            }
+            b++;
+        }
+        if (sums[(keys[0].key >> shift) & 0xff] == keys.size()) {
+            shift += 8;
+            continue;
+        }
+        total = 0;
+        d = 0;
+        while (d < RADIX_BUCKETS) {
+            b = 0;
+            while (b < blocks) {
+                unsigned int n;
+
+                n = counts[b * RADIX_BUCKETS + d];
+                counts[b * RADIX_BUCKETS + d] = total;
+                total += n;
+                b++;
+            }
+            d++;
+        }
+        auto scatter = [&](std::size_t blk) {
+            unsigned int *c;
+            std::size_t end;
+            std::size_t i;
+
+            c = &counts[blk * RADIX_BUCKETS];
+            end = std::min(keys.size(), (blk + 1) * RADIX_BLOCK);
+            i = blk * RADIX_BLOCK;
+            while (i < end) {
+                scratch[c[(keys[i].key >> shift) & 0xff]++] = keys[i];
+                i++;
+            }
+        };
+        parallel_for(pool, blocks, scatter);
+        keys.swap(scratch);
+        shift += 8;
+    }
+}
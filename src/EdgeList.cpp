@@ -0,0 +1,82 @@
+#include "EdgeList.hpp"
+#include <algorithm>
+
+template <typename Index>
+static void count_edge(Index a, Index b, std::vector<unsigned int> &first)
+{
+    if (a == b)
+        return;
+    first[(std::size_t)std::min(a, b) + 1]++;
+}
+
+template <typename Index>
+static void put_edge(Index a, Index b, std::vector<unsigned int> &fill,
+                     std::vector<unsigned int> &other)
+{
+    if (a == b)
+        return;
+    other[fill[std::min(a, b)]++] = (unsigned int)std::max(a, b);
+}
+
+template <typename Index>
+static void bucket_edges(const Index *idx, std::size_t faceCount,
+                         std::size_t vertexCount,
+                         std::vector<unsigned int> &first,
+                         std::vector<unsigned int> &other)
+{
+    std::vector<unsigned int> fill;
+    std::size_t i;
+    std::size_t v;
+
+    first.assign(vertexCount + 1, 0);
+    i = 0;
+    while (i < faceCount * 3) {
+        count_edge(idx[i], idx[i + 1], first);
+        count_edge(idx[i + 1], idx[i + 2], first);
+        count_edge(idx[i + 2], idx[i], first);
+        i += 3;
+    }
+    v = 0;
+    while (v < vertexCount) {
+        first[v + 1] += first[v];
+        v++;
+    }
+    fill.assign(first.begin(), first.end() - 1);
+    other.resize(first[vertexCount]);
+    i = 0;
+    while (i < faceCount * 3) {
+        put_edge(idx[i], idx[i + 1], fill, other);
+        put_edge(idx[i + 1], idx[i + 2], fill, other);
+        put_edge(idx[i + 2], idx[i], fill, other);
+        i += 3;
+    }
+}
+
+void build_edge_list(const IndexBuffer &faces, std::size_t vertexCount,
+                     std::vector<Edge> &edges)
+{
+    std::vector<unsigned int> first;
+    std::vector<unsigned int> other;
+    std::size_t v;
+    unsigned int *begin;
+    unsigned int *end;
+
+    edges.clear();
+    visit_indices(faces, [&](const auto *idx) {
+        bucket_edges(idx, faces.size(), vertexCount, first, other);
+    });
+    /* A closed mesh has about as many edges as half its face corners. */
+    edges.reserve(other.size() / 2 + 1);
+    v = 0;
+    while (v < vertexCount) {
+        begin = other.data() + first[v];
+        end = other.data() + first[v + 1];
+        std::sort(begin, end);
+        end = std::unique(begin, end);
+        while (begin < end) {
+            edges.push_back(Edge{(unsigned int)v, *begin});
+            begin++;
+        }
+        v++;
+    }
+}
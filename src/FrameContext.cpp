@@ -0,0 +1,55 @@
+#include "FrameContext.hpp"
+#include <algorithm>
+
+FrameContext::FrameContext()
+    : width(0),
+      height(0),
+      tilesX(0),
+      tilesY(0),
+      verts(),
+      visibleFaces(),
+      tris(),
+      sortKeys(),
+      sortScratch(),
+      sortCounts(),
+      tiles(),
+      triTiles(),
+      bins(),
+      depth(),
+      pixels(),
+      ids()
+{
+}
+
+bool FrameContext::resize(unsigned int w, unsigned int h)
+{
+    unsigned int tx;
+    unsigned int ty;
+
+    if (w == width && h == height)
+        return false;
+    width = w;
+    height = h;
+    tilesX = (w + TILE_SIZE - 1) / TILE_SIZE;
+    tilesY = (h + TILE_SIZE - 1) / TILE_SIZE;
+    tiles.resize((std::size_t)tilesX * tilesY);
+    ty = 0;
+    while (ty < tilesY) {
+        tx = 0;
+        while (tx < tilesX) {
+            Tile &tile = tiles[(std::size_t)ty * tilesX + tx];
+
+            tile.x0 = (int)(tx * TILE_SIZE);
+            tile.y0 = (int)(ty * TILE_SIZE);
+            tile.x1 = std::min(tile.x0 + (int)TILE_SIZE, (int)w) - 1;
+            tile.y1 = std::min(tile.y0 + (int)TILE_SIZE, (int)h) - 1;
+            tile.first = 0;
+            tile.count = 0;
+            tx++;
+        }
+        ty++;
+    }
+    depth.resize(tiles.size() * TILE_AREA);
+    pixels.resize((std::size_t)w * h);
+    return true;
+}
@@ -0,0 +1,420 @@
+#include "FramePipeline.hpp"
+
+FramePipeline::FramePipeline()
+{
+    m_settings.kernel = raster_best_kernel();
+    m_last = m_settings;
+    m_lastWidth = 0;
+    m_lastHeight = 0;
+    m_sequence = 0;
+    m_acquired = -1;
+    m_hasInput = false;
+    m_pipelined = false;
+    m_stop = false;
+}
+
+FramePipeline::~FramePipeline()
+{
+    if (m_pipelined)
+        stopThreads();
+}
+
+void FramePipeline::setPipelined(bool pipelined)
+{
+    if (pipelined == m_pipelined)
+        return;
+    drain();
+    if (pipelined)
+        startThreads();
+    else
+        stopThreads();
+    m_pipelined = pipelined;
+}
+
+bool FramePipeline::isPipelined() const
+{
+    return m_pipelined;
+}
+
+void FramePipeline::setModel(const Model *model)
+{
+    m_settings.model = model;
+    m_settings.scene = nullptr;
+}
+
+void FramePipeline::setScene(const Scene *scene)
+{
+    m_settings.scene = scene;
+    m_settings.model = nullptr;
+}
+
+void FramePipeline::setAngles(float angleY, float angleX)
+{
+    m_settings.angleY = angleY;
+    m_settings.angleX = angleX;
+}
+
+void FramePipeline::setZoom(float zoom)
+{
+    m_settings.zoom = zoom;
+}
+
+/* The pool is shared, so it is only replaced with no frame in flight. */
+void FramePipeline::setThreadCount(unsigned int threads)
+{
+    drain();
+    m_slots[0].renderer.setThreadCount(threads);
+    m_slots[1].renderer.shareThreadPool(m_slots[0].renderer);
+}
+
+unsigned int FramePipeline::getThreadCount() const
+{
+    return m_slots[0].renderer.getThreadCount();
+}
+
+ThreadPool &FramePipeline::getThreadPool()
+{
+    drain();
+    return m_slots[0].renderer.getThreadPool();
+}
+
+void FramePipeline::setRasterKernel(RasterKernel kernel)
+{
+    if (raster_kernel_supported(kernel))
+        m_settings.kernel = kernel;
+}
+
+RasterKernel FramePipeline::getRasterKernel() const
+{
+    return m_settings.kernel;
+}
+
+void FramePipeline::setCullMode(unsigned int mode)
+{
+    m_settings.cullMode = mode;
+}
+
+unsigned int FramePipeline::getCullMode() const
+{
+    return m_settings.cullMode;
+}
+
+void FramePipeline::setDepthSort(DepthSort sort)
+{
+    m_settings.sort = sort;
+}
+
+DepthSort FramePipeline::getDepthSort() const
+{
+    return m_settings.sort;
+}
+
+void FramePipeline::setEdgeMode(EdgeMode mode)
+{
+    m_settings.edges = mode;
+}
+
+EdgeMode FramePipeline::getEdgeMode() const
+{
+    return m_settings.edges;
+}
+
+void FramePipeline::setShading(ShadingMode mode)
+{
+    m_settings.shading = mode;
+}
+
+ShadingMode FramePipeline::getShading() const
+{
+    return m_settings.shading;
+}
+
+void FramePipeline::setHighlightFace(int instance, int face)
+{
+    m_settings.highlightInstance = instance;
+    m_settings.highlightFace = face;
+}
+
+void FramePipeline::setLod(int level)
+{
+    m_settings.lod = level;
+}
+
+void FramePipeline::markInput(Clock::time_point time)
+{
+    if (m_hasInput)
+        return;
+    m_input = time;
+    m_hasInput = true;
+}
+
+/* CpuRenderer setters only mark its frame dirty on a real change. */
+void FramePipeline::applySettings(CpuRenderer &renderer) const
+{
+    if (m_settings.scene)
+        renderer.setScene(m_settings.scene);
+    else
+        renderer.setModel(m_settings.model);
+    renderer.setAngles(m_settings.angleY, m_settings.angleX);
+    renderer.setZoom(m_settings.zoom);
+    renderer.setRasterKernel(m_settings.kernel);
+    renderer.setCullMode(m_settings.cullMode);
+    renderer.setDepthSort(m_settings.sort);
+    renderer.setEdgeMode(m_settings.edges);
+    renderer.setShading(m_settings.shading);
+    renderer.setHighlightFace(m_settings.highlightInstance,
+                              m_settings.highlightFace);
+    renderer.setLod(m_settings.lod);
+}
+
+bool FramePipeline::sameAsLast(unsigned int width,
+                               unsigned int height) const
+{
+    const FrameSettings &a = m_settings;
+    const FrameSettings &b = m_last;
+
+    return m_sequence > 0 && width == m_lastWidth
+        && height == m_lastHeight && a.model == b.model
+        && a.scene == b.scene
+        && a.angleY == b.angleY && a.angleX == b.angleX
+        && a.zoom == b.zoom && a.kernel == b.kernel
+        && a.cullMode == b.cullMode && a.sort == b.sort
+        && a.edges == b.edges && a.shading == b.shading
+        && a.highlightInstance == b.highlightInstance
+        && a.highlightFace == b.highlightFace && a.lod == b.lod;
+}
+
+bool FramePipeline::submit(unsigned int width, unsigned int height)
+{
+    Slot *slot;
+    int i;
+
+    if (sameAsLast(width, height)) {
+        m_hasInput = false;
+        return false;
+    }
+    i = 0;
+    if (m_pipelined) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        i = nextSlot(SlotState::Free);
+    } else if (m_slots[0].state != SlotState::Free) {
+        i = -1;
+    }
+    if (i < 0)
+        return false;
+    /* Starts the shared pool on the first frame if nothing did yet. */
+    m_slots[1].renderer.shareThreadPool(m_slots[0].renderer);
+    slot = &m_slots[i];
+    applySettings(slot->renderer);
+    m_sequence++;
+    slot->sequence = m_sequence;
+    slot->width = width;
+    slot->height = height;
+    slot->hasInput = m_hasInput;
+    slot->input = m_input;
+    m_hasInput = false;
+    m_last = m_settings;
+    m_lastWidth = width;
+    m_lastHeight = height;
+    if (!m_pipelined) {
+        if (slot->renderer.render(width, height))
+            slot->state = SlotState::Ready;
+        return true;
+    }
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        slot->state = SlotState::Queued;
+    }
+    m_wake.notify_all();
+    return true;
+}
+
+/*
+** The newest ready frame wins; an older one still waiting is dropped,
+** it would only add a frame of latency.
+*/
+const CpuRenderer *FramePipeline::acquire(bool wait)
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    int best;
+    int i;
+
+    if (wait)
+        m_done.wait(lock, [this] {
+            return nextSlot(SlotState::Ready) >= 0 || !inFlight();
+        });
+    best = -1;
+    i = 0;
+    while (i < SLOTS) {
+        if (m_slots[i].state == SlotState::Ready) {
+            if (best < 0 || m_slots[i].sequence > m_slots[best].sequence) {
+                if (best >= 0)
+                    m_slots[best].state = SlotState::Free;
+                best = i;
+            } else {
+                m_slots[i].state = SlotState::Free;
+            }
+        }
+        i++;
+    }
+    if (best < 0)
+        return nullptr;
+    m_slots[best].state = SlotState::Acquired;
+    m_acquired = best;
+    return &m_slots[best].renderer;
+}
+
+void FramePipeline::release()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    if (m_acquired < 0)
+        return;
+    m_slots[m_acquired].state = SlotState::Free;
+    m_acquired = -1;
+}
+
+bool FramePipeline::acquiredInput(Clock::time_point &time) const
+{
+    if (m_acquired < 0 || !m_slots[m_acquired].hasInput)
+        return false;
+    time = m_slots[m_acquired].input;
+    return true;
+}
+
+bool FramePipeline::busy() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    return inFlight() || nextSlot(SlotState::Ready) >= 0;
+}
+
+/*
+** Picks in the newest frame that is done, after waiting for the ones
+** in flight: that is the frame on screen, or the one about to be.
+*/
+int FramePipeline::pick(float x, float y, int &instance)
+{
+    int best;
+    int i;
+
+    drain();
+    best = 0;
+    i = 1;
+    while (i < SLOTS) {
+        if (m_slots[i].sequence > m_slots[best].sequence)
+            best = i;
+        i++;
+    }
+    return m_slots[best].renderer.pick(x, y, instance);
+}
+
+/* Called with m_mutex held (or from the only thread). */
+bool FramePipeline::inFlight() const
+{
+    int i;
+
+    i = 0;
+    while (i < SLOTS) {
+        if (m_slots[i].state != SlotState::Free
+            && m_slots[i].state != SlotState::Ready
+            && m_slots[i].state != SlotState::Acquired)
+            return true;
+        i++;
+    }
+    return false;
+}
+
+/* Oldest slot in state, -1 for none. Called with m_mutex held. */
+int FramePipeline::nextSlot(SlotState state) const
+{
+    int best;
+    int i;
+
+    best = -1;
+    i = 0;
+    while (i < SLOTS) {
+        if (m_slots[i].state == state
+            && (best < 0 || m_slots[i].sequence < m_slots[best].sequence))
+            best = i;
+        i++;
+    }
+    return best;
+}
+
+void FramePipeline::drain()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+
+    m_done.wait(lock, [this] { return !inFlight(); });
+}
+
+void FramePipeline::startThreads()
+{
+    m_stop = false;
+    m_setupThread = std::thread(&FramePipeline::setupLoop, this);
+    m_rasterThread = std::thread(&FramePipeline::rasterLoop, this);
+}
+
+void FramePipeline::stopThreads()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        m_stop = true;
+    }
+    m_wake.notify_all();
+    m_setupThread.join();
+    m_rasterThread.join();
+}
+
+/*
+** Frame setup without the pool, which the raster thread is using for
+** the previous frame meanwhile.
+*/
+void FramePipeline::setupLoop()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    bool ok;
+    int i;
+
+    while (true) {
+        m_wake.wait(lock, [this] {
+            return m_stop || nextSlot(SlotState::Queued) >= 0;
+        });
+        if (m_stop)
+            return;
+        i = nextSlot(SlotState::Queued);
+        m_slots[i].state = SlotState::Setup;
+        lock.unlock();
+        ok = m_slots[i].renderer.prepare(m_slots[i].width,
+                                         m_slots[i].height, true);
+        lock.lock();
+        m_slots[i].state = ok ? SlotState::Prepared : SlotState::Free;
+        m_wake.notify_all();
+        m_done.notify_all();
+    }
+}
+
+void FramePipeline::rasterLoop()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    int i;
+
+    while (true) {
+        m_wake.wait(lock, [this] {
+            return m_stop || nextSlot(SlotState::Prepared) >= 0;
+        });
+        if (m_stop)
+            return;
+        i = nextSlot(SlotState::Prepared);
+        m_slots[i].state = SlotState::Raster;
+        lock.unlock();
+        m_slots[i].renderer.rasterize();
+        lock.lock();
+        m_slots[i].state = SlotState::Ready;
+        m_done.notify_all();
+    }
+}
@@ -0,0 +1,65 @@
+#include "MappedFile.hpp"
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+MappedFile::MappedFile()
+    : m_data(nullptr),
+      m_size(0)
+{
+}
+
+MappedFile::~MappedFile()
+{
+    close();
+}
+
+bool MappedFile::open(const std::string &path)
+{
+    struct stat st;
+    void *ptr;
+    int fd;
+
+    close();
+    fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        return false;
+    if (fstat(fd, &st) != 0 || st.st_size <= 0) {
+        ::close(fd);
+        return false;
+    }
+    ptr = mmap(nullptr, (std::size_t)st.st_size, PROT_READ, MAP_PRIVATE,
+               fd, 0);
+    ::close(fd);
+    if (ptr == MAP_FAILED)
+        return false;
+    madvise(ptr, (std::size_t)st.st_size, MADV_SEQUENTIAL);
+    m_data = static_cast<const char *>(ptr);
+    m_size = (std::size_t)st.st_size;
+    return true;
+}
+
+void MappedFile::close()
+{
+    if (m_data)
+        munmap(const_cast<char *>(m_data), m_size);
+    m_data = nullptr;
+    m_size = 0;
+}
+
+void MappedFile::keepMapped()
+{
+    if (m_data)
+        madvise(const_cast<char *>(m_data), m_size, MADV_NORMAL);
+}
+
+const char *MappedFile::data() const
+{
+    return m_data;
+}
+
+std::size_t MappedFile::size() const
+{
+    return m_size;
+}
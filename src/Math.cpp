@@ -123,3 +123,143 @@ Vec2 project_perspective(const Vec3 &v, float fovScale,
     p.y = height * 0.5f - sy * height * 0.5f;
     return p;
 }
+
+ViewTransform make_view_transform(float angleY, float angleX,
+                                  const Vec3 &offset, float fovScale,
+                                  float width, float height)
+{
+    ViewTransform v;
+    float cy;
+    float sy;
+    float cx;
+    float sx;
+
+    cy = std::cos(angleY);
+    sy = std::sin(angleY);
+    cx = std::cos(angleX);
+    sx = std::sin(angleX);
+    v.m[0][0] = cy;
+    v.m[0][1] = 0.0f;
+    v.m[0][2] = sy;
+    v.m[1][0] = sy * sx;
+    v.m[1][1] = cx;
+    v.m[1][2] = -cy * sx;
+    v.m[2][0] = -sy * cx;
+    v.m[2][1] = sx;
+    v.m[2][2] = cy * cx;
+    v.offset = offset;
+    v.centerX = width * 0.5f;
+    v.centerY = height * 0.5f;
+    v.scaleX = fovScale * width * 0.5f;
+    v.scaleY = fovScale * height * 0.5f;
+    return v;
+}
+
+/* Same operations, in the same order, as transform_vertices(). */
+Vec2 project_view(const ViewTransform &view, const Vec3 &v)
+{
+    float invz;
+    Vec2 p;
+
+    invz = 1.0f / v.z;
+    p.x = view.centerX + v.x * invz * view.scaleX;
+    p.y = view.centerY - v.y * invz * view.scaleY;
+    return p;
+}
+
+/* v -> M v, the view rotation alone. */
+static Vec3 rotate(const ViewTransform &view, const Vec3 &v)
+{
+    Vec3 r;
+
+    r.x = view.m[0][0] * v.x + view.m[0][1] * v.y + view.m[0][2] * v.z;
+    r.y = view.m[1][0] * v.x + view.m[1][1] * v.y + view.m[1][2] * v.z;
+    r.z = view.m[2][0] * v.x + view.m[2][1] * v.y + view.m[2][2] * v.z;
+    return r;
+}
+
+ViewTransform instance_view(const ViewTransform &view,
+                            const Vec3 &position, float yaw, float scale)
+{
+    ViewTransform v;
+    float c;
+    float s;
+    int r;
+
+    v = view;
+    c = std::cos(yaw) * scale;
+    s = std::sin(yaw) * scale;
+    r = 0;
+    while (r < 3) {
+        v.m[r][0] = view.m[r][0] * c - view.m[r][2] * s;
+        v.m[r][1] = view.m[r][1] * scale;
+        v.m[r][2] = view.m[r][0] * s + view.m[r][2] * c;
+        r++;
+    }
+    v.offset = translate(rotate(view, position), view.offset);
+    return v;
+}
+
+/*
+** v -> M^T v: the inverse of the view rotation, times the square of
+** its scale for an instance_view().
+*/
+static Vec3 unrotate(const ViewTransform &view, const Vec3 &v)
+{
+    Vec3 r;
+
+    r.x = view.m[0][0] * v.x + view.m[1][0] * v.y + view.m[2][0] * v.z;
+    r.y = view.m[0][1] * v.x + view.m[1][1] * v.y + view.m[2][1] * v.z;
+    r.z = view.m[0][2] * v.x + view.m[1][2] * v.y + view.m[2][2] * v.z;
+    return r;
+}
+
+/*
+** A view-space plane n . v + d >= 0 with v = M p + o becomes
+** (M^T n) . p + (n . o + d) >= 0 in model space.
+*/
+Frustum make_view_frustum(const ViewTransform &view, float nearZ)
+{
+    Frustum f;
+    Vec3 planes[5];
+    float offsets[5];
+    float kx;
+    float ky;
+    int i;
+
+    kx = view.centerX / view.scaleX;
+    ky = view.centerY / view.scaleY;
+    planes[0] = make_vec3(1.0f, 0.0f, kx);
+    planes[1] = make_vec3(-1.0f, 0.0f, kx);
+    planes[2] = make_vec3(0.0f, 1.0f, ky);
+    planes[3] = make_vec3(0.0f, -1.0f, ky);
+    planes[4] = make_vec3(0.0f, 0.0f, 1.0f);
+    offsets[0] = 0.0f;
+    offsets[1] = 0.0f;
+    offsets[2] = 0.0f;
+    offsets[3] = 0.0f;
+    offsets[4] = -nearZ;
+    i = 0;
+    while (i < 5) {
+        f.n[i] = unrotate(view, planes[i]);
+        f.d[i] = dot_vec3(planes[i], view.offset) + offsets[i];
+        i++;
+    }
+    return f;
+}
+
+void view_ray(const ViewTransform &view, float sx, float sy,
+              Vec3 &origin, Vec3 &dir)
+{
+    Vec3 d;
+    float scale2;
+
+    d.x = (sx - view.centerX) / view.scaleX;
+    d.y = (view.centerY - sy) / view.scaleY;
+    d.z = 1.0f;
+    scale2 = view.m[0][0] * view.m[0][0] + view.m[0][1] * view.m[0][1]
+        + view.m[0][2] * view.m[0][2];
+    origin = mul_vec3(unrotate(view, mul_vec3(view.offset, -1.0f)),
+                      1.0f / scale2);
+    dir = normalize_vec3(unrotate(view, d));
+}
@@ -0,0 +1,258 @@
+#include "MeshBuffers.hpp"
+#include "Model.hpp"
+#include <cmath>
+#include <utility>
+
+IndexBuffer::IndexBuffer()
+{
+    m_mappedIndices = nullptr;
+    m_mappedMaterials = nullptr;
+    m_size = 0;
+    m_isWide = false;
+}
+
+std::size_t IndexBuffer::assign(const std::vector<Face> &faces,
+                                std::size_t vertexCount)
+{
+    std::size_t dropped;
+    std::size_t i;
+    unsigned int id;
+
+    clear();
+    m_size = faces.size();
+    m_isWide = vertexCount > 0x10000;
+    if (m_isWide)
+        m_wide.resize(faces.size() * 3);
+    else
+        m_narrow.resize(faces.size() * 3);
+    m_materials.resize(faces.size());
+    dropped = 0;
+    i = 0;
+    while (i < faces.size()) {
+        const Face &f = faces[i];
+
+        if (m_isWide) {
+            m_wide[i * 3] = (std::uint32_t)f.a;
+            m_wide[i * 3 + 1] = (std::uint32_t)f.b;
+            m_wide[i * 3 + 2] = (std::uint32_t)f.c;
+        } else {
+            m_narrow[i * 3] = (std::uint16_t)f.a;
+            m_narrow[i * 3 + 1] = (std::uint16_t)f.b;
+            m_narrow[i * 3 + 2] = (std::uint16_t)f.c;
+        }
+        id = f.mat < 0 ? 0 : (unsigned int)f.mat + 1;
+        if (id > MAX_MATERIAL_ID) {
+            id = 0;
+            dropped++;
+        }
+        m_materials[i] = (std::uint16_t)id;
+        i++;
+    }
+    return dropped;
+}
+
+void IndexBuffer::assign(bool wide, const void *indices,
+                         const std::uint16_t *materials,
+                         std::size_t faceCount,
+                         std::shared_ptr<const void> backing)
+{
+    clear();
+    m_size = faceCount;
+    m_isWide = wide;
+    m_backing = std::move(backing);
+    m_mappedIndices = indices;
+    m_mappedMaterials = materials;
+}
+
+void IndexBuffer::clear()
+{
+    std::vector<std::uint16_t>().swap(m_narrow);
+    std::vector<std::uint32_t>().swap(m_wide);
+    std::vector<std::uint16_t>().swap(m_materials);
+    m_backing.reset();
+    m_mappedIndices = nullptr;
+    m_mappedMaterials = nullptr;
+    m_size = 0;
+    m_isWide = false;
+}
+
+std::size_t IndexBuffer::size() const
+{
+    return m_size;
+}
+
+bool IndexBuffer::isWide() const
+{
+    return m_isWide;
+}
+
+const std::uint16_t *IndexBuffer::narrow() const
+{
+    if (m_backing)
+        return static_cast<const std::uint16_t *>(m_mappedIndices);
+    return m_narrow.data();
+}
+
+const std::uint32_t *IndexBuffer::wide() const
+{
+    if (m_backing)
+        return static_cast<const std::uint32_t *>(m_mappedIndices);
+    return m_wide.data();
+}
+
+const std::uint16_t *IndexBuffer::materials() const
+{
+    if (m_backing)
+        return m_mappedMaterials;
+    return m_materials.data();
+}
+
+const void *IndexBuffer::indexData() const
+{
+    if (m_isWide)
+        return wide();
+    return narrow();
+}
+
+std::size_t IndexBuffer::indexBytes() const
+{
+    return m_size * 3 * (m_isWide ? 4 : 2);
+}
+
+std::size_t IndexBuffer::bytes() const
+{
+    return indexBytes() + m_size * sizeof(std::uint16_t);
+}
+
+Face IndexBuffer::getFace(std::size_t face) const
+{
+    Face f;
+
+    if (m_isWide) {
+        f.a = (int)wide()[face * 3];
+        f.b = (int)wide()[face * 3 + 1];
+        f.c = (int)wide()[face * 3 + 2];
+    } else {
+        f.a = narrow()[face * 3];
+        f.b = narrow()[face * 3 + 1];
+        f.c = narrow()[face * 3 + 2];
+    }
+    f.mat = (int)materials()[face] - 1;
+    return f;
+}
+
+PositionBuffer::PositionBuffer()
+{
+    m_mapped = nullptr;
+    m_count = 0;
+    m_isQuantized = false;
+}
+
+static std::int16_t quantize_coord(float v)
+{
+    if (v > 1.0f)
+        v = 1.0f;
+    if (v < -1.0f)
+        v = -1.0f;
+    return (std::int16_t)std::lround(v * 32767.0f);
+}
+
+Vec3 quantize_position(const Vec3 &v)
+{
+    return make_vec3(quantize_coord(v.x) * POSITION_QUANTUM,
+                     quantize_coord(v.y) * POSITION_QUANTUM,
+                     quantize_coord(v.z) * POSITION_QUANTUM);
+}
+
+void PositionBuffer::assign(std::vector<Vec3> &&vertices, bool quantize)
+{
+    std::size_t i;
+
+    clear();
+    m_isQuantized = quantize;
+    m_count = vertices.size();
+    if (!quantize) {
+        m_floats = std::move(vertices);
+        m_floats.shrink_to_fit();
+        return;
+    }
+    m_quantized.resize(vertices.size() * 3);
+    i = 0;
+    while (i < vertices.size()) {
+        m_quantized[i * 3] = quantize_coord(vertices[i].x);
+        m_quantized[i * 3 + 1] = quantize_coord(vertices[i].y);
+        m_quantized[i * 3 + 2] = quantize_coord(vertices[i].z);
+        i++;
+    }
+    std::vector<Vec3>().swap(vertices);
+}
+
+void PositionBuffer::assign(bool quantized, const void *data,
+                            std::size_t count,
+                            std::shared_ptr<const void> backing)
+{
+    clear();
+    m_isQuantized = quantized;
+    m_count = count;
+    m_backing = std::move(backing);
+    m_mapped = data;
+}
+
+void PositionBuffer::clear()
+{
+    std::vector<Vec3>().swap(m_floats);
+    std::vector<std::int16_t>().swap(m_quantized);
+    m_backing.reset();
+    m_mapped = nullptr;
+    m_count = 0;
+    m_isQuantized = false;
+}
+
+std::size_t PositionBuffer::size() const
+{
+    return m_count;
+}
+
+bool PositionBuffer::isQuantized() const
+{
+    return m_isQuantized;
+}
+
+const Vec3 *PositionBuffer::floats() const
+{
+    if (m_backing)
+        return static_cast<const Vec3 *>(m_mapped);
+    return m_floats.data();
+}
+
+const std::int16_t *PositionBuffer::quantized() const
+{
+    if (m_backing)
+        return static_cast<const std::int16_t *>(m_mapped);
+    return m_quantized.data();
+}
+
+const void *PositionBuffer::data() const
+{
+    if (m_isQuantized)
+        return quantized();
+    return floats();
+}
+
+std::size_t PositionBuffer::bytes() const
+{
+    if (m_isQuantized)
+        return m_count * 3 * sizeof(std::int16_t);
+    return m_count * sizeof(Vec3);
+}
+
+Vec3 PositionBuffer::get(std::size_t i) const
+{
+    const std::int16_t *q;
+
+    if (!m_isQuantized)
+        return floats()[i];
+    q = quantized() + i * 3;
+    return make_vec3(q[0] * POSITION_QUANTUM, q[1] * POSITION_QUANTUM,
+                     q[2] * POSITION_QUANTUM);
+}
@@ -0,0 +1,424 @@
+#include "MeshCache.hpp"
+#include "MappedFile.hpp"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <sys/stat.h>
+
+static const char CACHE_MAGIC[8] = {'O', 'B', 'J', 'C', 'A', 'C', 'H', 'E'};
+static const std::uint32_t CACHE_VERSION = 6;
+
+/*
+** positionSize is 12 (float) or 6 (quantized) bytes per vertex,
+** indexSize 2 or 4 bytes per index, for every level.
+*/
+struct CacheHeader {
+    char magic[8];
+    std::uint32_t version;
+    std::uint32_t positionSize;
+    std::uint32_t indexSize;
+    std::uint32_t nodeSize;
+    std::uint32_t hasMaterial;
+    std::uint32_t optimized;
+    std::uint32_t quantized;
+    std::uint32_t pad;
+    std::uint64_t objSize;
+    std::int64_t objMtime;
+    std::uint64_t mtlSize;
+    std::int64_t mtlMtime;
+    std::uint64_t objPathLen;
+    std::uint64_t mtlPathLen;
+    std::uint64_t vertexCount;
+    std::uint64_t faceCount;
+    std::uint64_t materialCount;
+    std::uint64_t nodeCount;
+    std::uint64_t lodCount;
+    std::uint64_t payloadSize;
+    std::uint64_t checksum;
+};
+
+/*
+** Per LOD level in the payload, followed by its faceCount * 3 indices
+** and faceCount material ids.
+*/
+struct CacheLod {
+    std::uint64_t faceCount;
+    float error;
+    std::uint32_t pad;
+};
+
+/* Per material in the payload, followed by nameLen bytes + padding. */
+struct CacheMaterial {
+    float r;
+    float g;
+    float b;
+    std::uint32_t nameLen;
+};
+
+/* Modification time in nanoseconds: an edit within a second counts. */
+static std::int64_t mtime_ns(const struct stat &st)
+{
+#ifdef __APPLE__
+    return (std::int64_t)st.st_mtimespec.tv_sec * 1000000000
+        + st.st_mtimespec.tv_nsec;
+#else
+    return (std::int64_t)st.st_mtim.tv_sec * 1000000000
+        + st.st_mtim.tv_nsec;
+#endif
+}
+
+static std::size_t align8(std::size_t n)
+{
+    return (n + 7) & ~(std::size_t)7;
+}
+
+/* Word-at-a-time 64-bit mix, fast enough to verify GBs on reload. */
+static std::uint64_t checksum64(const unsigned char *data, std::size_t size)
+{
+    std::uint64_t h;
+    std::uint64_t w;
+    std::size_t i;
+
+    h = 0x9e3779b97f4a7c15ull ^ size;
+    i = 0;
+    while (i + 8 <= size) {
+        std::memcpy(&w, data + i, 8);
+        h = (h ^ (w * 0xff51afd7ed558ccdull)) * 0xc4ceb9fe1a85ec53ull;
+        h ^= h >> 29;
+        i += 8;
+    }
+    w = 0;
+    std::memcpy(&w, data + i, size - i);
+    h = (h ^ (w * 0xff51afd7ed558ccdull)) * 0xc4ceb9fe1a85ec53ull;
+    h ^= h >> 32;
+    return h;
+}
+
+std::string mesh_cache_path(const std::string &objPath)
+{
+    return objPath + ".objc";
+}
+
+bool make_cache_key(const std::string &objPath, const std::string &mtlPath,
+                    bool optimized, bool quantized, CacheKey &key)
+{
+    struct stat st;
+
+    if (stat(objPath.c_str(), &st) != 0)
+        return false;
+    key.objPath = objPath;
+    key.objSize = (std::uint64_t)st.st_size;
+    key.objMtime = mtime_ns(st);
+    key.mtlPath = mtlPath;
+    key.mtlSize = 0;
+    key.mtlMtime = 0;
+    key.optimized = optimized;
+    key.quantized = quantized;
+    if (!mtlPath.empty() && stat(mtlPath.c_str(), &st) == 0) {
+        key.mtlSize = (std::uint64_t)st.st_size;
+        key.mtlMtime = mtime_ns(st);
+    }
+    return true;
+}
+
+static void put_bytes(std::vector<unsigned char> &out,
+                      const void *data, std::size_t size)
+{
+    const unsigned char *p;
+
+    p = static_cast<const unsigned char *>(data);
+    out.insert(out.end(), p, p + size);
+    out.resize(align8(out.size()), 0);
+}
+
+static void put_faces(std::vector<unsigned char> &out,
+                      const IndexBuffer &faces)
+{
+    put_bytes(out, faces.indexData(), faces.indexBytes());
+    put_bytes(out, faces.materials(),
+              faces.size() * sizeof(std::uint16_t));
+}
+
+bool write_mesh_cache(const std::string &cachePath, const CacheKey &key,
+                      const PositionBuffer &vertices,
+                      const IndexBuffer &faces,
+                      const std::vector<Material> &materials,
+                      bool hasMaterial, const Bvh &bvh,
+                      const std::vector<LodLevel> &lods)
+{
+    std::vector<unsigned char> payload;
+    std::string tmpPath;
+    CacheHeader header;
+    std::FILE *file;
+    bool ok;
+
+    put_bytes(payload, key.objPath.data(), key.objPath.size());
+    put_bytes(payload, key.mtlPath.data(), key.mtlPath.size());
+    put_bytes(payload, vertices.data(), vertices.bytes());
+    put_faces(payload, faces);
+    for (const Material &m : materials) {
+        CacheMaterial cm;
+
+        cm.r = m.r;
+        cm.g = m.g;
+        cm.b = m.b;
+        cm.nameLen = (std::uint32_t)m.name.size();
+        put_bytes(payload, &cm, sizeof(cm));
+        put_bytes(payload, m.name.data(), m.name.size());
+    }
+    put_bytes(payload, bvh.getNodes().data(),
+              bvh.getNodes().size() * sizeof(BvhNode));
+    put_bytes(payload, bvh.getFaceOrder().data(),
+              bvh.getFaceOrder().size() * sizeof(unsigned int));
+    for (const LodLevel &lod : lods) {
+        CacheLod cl;
+
+        cl.faceCount = lod.indices.size();
+        cl.error = lod.error;
+        cl.pad = 0;
+        put_bytes(payload, &cl, sizeof(cl));
+        put_faces(payload, lod.indices);
+    }
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC));
+    header.version = CACHE_VERSION;
+    header.positionSize = vertices.isQuantized() ? 6 : sizeof(Vec3);
+    header.indexSize = faces.isWide() ? 4 : 2;
+    header.nodeSize = sizeof(BvhNode);
+    header.hasMaterial = hasMaterial ? 1 : 0;
+    header.optimized = key.optimized ? 1 : 0;
+    header.quantized = key.quantized ? 1 : 0;
+    header.objSize = key.objSize;
+    header.objMtime = key.objMtime;
+    header.mtlSize = key.mtlSize;
+    header.mtlMtime = key.mtlMtime;
+    header.objPathLen = key.objPath.size();
+    header.mtlPathLen = key.mtlPath.size();
+    header.vertexCount = vertices.size();
+    header.faceCount = faces.size();
+    header.materialCount = materials.size();
+    header.nodeCount = bvh.getNodes().size();
+    header.lodCount = lods.size();
+    header.payloadSize = payload.size();
+    header.checksum = checksum64(payload.data(), payload.size());
+    tmpPath = cachePath + ".tmp";
+    file = std::fopen(tmpPath.c_str(), "wb");
+    if (!file)
+        return false;
+    ok = std::fwrite(&header, sizeof(header), 1, file) == 1
+        && std::fwrite(payload.data(), 1, payload.size(), file)
+            == payload.size();
+    ok = std::fclose(file) == 0 && ok;
+    if (ok)
+        ok = std::rename(tmpPath.c_str(), cachePath.c_str()) == 0;
+    if (!ok)
+        std::remove(tmpPath.c_str());
+    return ok;
+}
+
+static bool header_matches(const CacheHeader &h, const CacheKey &key,
+                           std::size_t fileSize)
+{
+    return std::memcmp(h.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC)) == 0
+        && h.version == CACHE_VERSION
+        && h.positionSize == (key.quantized ? 6u : sizeof(Vec3))
+        && (h.indexSize == 2 || h.indexSize == 4)
+        && h.nodeSize == sizeof(BvhNode)
+        && h.optimized == (key.optimized ? 1u : 0u)
+        && h.quantized == (key.quantized ? 1u : 0u)
+        && h.objSize == key.objSize
+        && h.objMtime == key.objMtime
+        && h.mtlSize == key.mtlSize
+        && h.mtlMtime == key.mtlMtime
+        && h.objPathLen == key.objPath.size()
+        && h.mtlPathLen == key.mtlPath.size()
+        && h.payloadSize == fileSize - sizeof(CacheHeader);
+}
+
+/* Bounds-checked cursor over the mapped payload. */
+struct Reader {
+    const unsigned char *p;
+    const unsigned char *end;
+
+    const unsigned char *take(std::size_t size)
+    {
+        const unsigned char *at;
+
+        if ((std::size_t)(end - p) < size)
+            return nullptr;
+        at = p;
+        p += std::min(align8(size), (std::size_t)(end - p));
+        return at;
+    }
+};
+
+/* False when a value of values[0 .. count) is not below limit. */
+template <typename T>
+static bool all_below(const T *values, std::size_t count,
+                      std::uint64_t limit)
+{
+    T most;
+    std::size_t i;
+
+    if (count == 0)
+        return true;
+    most = 0;
+    i = 0;
+    while (i < count) {
+        most = std::max(most, values[i]);
+        i++;
+    }
+    return most < limit;
+}
+
+/*
+** The counts of a cache come from its header, the checksum only
+** catches accidental damage: every array a later loop indexes with is
+** checked before use.
+*/
+struct CacheLimits {
+    std::uint32_t indexSize;
+    std::uint64_t vertexCount;
+    std::uint64_t materialCount;
+    std::uint64_t payloadSize;
+    std::shared_ptr<const MappedFile> file;
+};
+
+/*
+** faceCount faces of indexSize-byte indices plus their material ids,
+** used in place.
+*/
+static bool take_faces(Reader &rd, std::uint64_t faceCount,
+                       const CacheLimits &lim, IndexBuffer &faces)
+{
+    const unsigned char *indices;
+    const unsigned char *at;
+    const std::uint16_t *mats;
+
+    if (faceCount > lim.payloadSize
+        / (3 * lim.indexSize + sizeof(std::uint16_t)))
+        return false;
+    indices = rd.take(faceCount * 3 * lim.indexSize);
+    if (!indices)
+        return false;
+    at = rd.take(faceCount * sizeof(std::uint16_t));
+    if (!at)
+        return false;
+    mats = reinterpret_cast<const std::uint16_t *>(at);
+    if (lim.indexSize == 4
+        ? !all_below(reinterpret_cast<const std::uint32_t *>(indices),
+                     faceCount * 3, lim.vertexCount)
+        : !all_below(reinterpret_cast<const std::uint16_t *>(indices),
+                     faceCount * 3, lim.vertexCount))
+        return false;
+    if (!all_below(mats, faceCount, lim.materialCount + 1))
+        return false;
+    faces.assign(lim.indexSize == 4, indices, mats, faceCount, lim.file);
+    return true;
+}
+
+bool read_mesh_cache(const std::string &cachePath, const CacheKey &key,
+                     PositionBuffer &vertices, IndexBuffer &faces,
+                     std::vector<Material> &materials, bool &hasMaterial,
+                     Bvh &bvh, std::vector<LodLevel> &lods,
+                     std::size_t &bytes)
+{
+    std::shared_ptr<MappedFile> file;
+    CacheLimits lim;
+    CacheHeader h;
+    Reader rd;
+    const unsigned char *payload;
+    const unsigned char *at;
+    std::vector<BvhNode> nodes;
+    std::vector<unsigned int> order;
+    std::uint64_t i;
+
+    file = std::make_shared<MappedFile>();
+    if (!file->open(cachePath) || file->size() < sizeof(CacheHeader))
+        return false;
+    std::memcpy(&h, file->data(), sizeof(h));
+    if (!header_matches(h, key, file->size()))
+        return false;
+    payload = reinterpret_cast<const unsigned char *>(file->data())
+        + sizeof(CacheHeader);
+    if (checksum64(payload, h.payloadSize) != h.checksum)
+        return false;
+    rd.p = payload;
+    rd.end = payload + h.payloadSize;
+    at = rd.take(h.objPathLen);
+    if (!at || std::memcmp(at, key.objPath.data(), h.objPathLen) != 0)
+        return false;
+    at = rd.take(h.mtlPathLen);
+    if (!at || std::memcmp(at, key.mtlPath.data(), h.mtlPathLen) != 0)
+        return false;
+    if (h.vertexCount > h.payloadSize / h.positionSize)
+        return false;
+    at = rd.take(h.vertexCount * h.positionSize);
+    if (!at)
+        return false;
+    vertices.assign(key.quantized, at, h.vertexCount, file);
+    lim.indexSize = h.indexSize;
+    lim.vertexCount = h.vertexCount;
+    lim.materialCount = h.materialCount;
+    lim.payloadSize = h.payloadSize;
+    lim.file = file;
+    if (!take_faces(rd, h.faceCount, lim, faces))
+        return false;
+    materials.clear();
+    i = 0;
+    while (i < h.materialCount) {
+        CacheMaterial cm;
+        Material m;
+
+        at = rd.take(sizeof(cm));
+        if (!at)
+            return false;
+        std::memcpy(&cm, at, sizeof(cm));
+        at = rd.take(cm.nameLen);
+        if (!at)
+            return false;
+        m.r = cm.r;
+        m.g = cm.g;
+        m.b = cm.b;
+        m.name.assign(reinterpret_cast<const char *>(at), cm.nameLen);
+        materials.push_back(m);
+        i++;
+    }
+    bvh.clear();
+    if (h.nodeCount > 0) {
+        if (h.nodeCount > h.payloadSize / sizeof(BvhNode))
+            return false;
+        at = rd.take(h.nodeCount * sizeof(BvhNode));
+        if (!at)
+            return false;
+        nodes.resize(h.nodeCount);
+        std::memcpy(nodes.data(), at, h.nodeCount * sizeof(BvhNode));
+        at = rd.take(h.faceCount * sizeof(unsigned int));
+        if (!at)
+            return false;
+        order.resize(h.faceCount);
+        std::memcpy(order.data(), at, h.faceCount * sizeof(unsigned int));
+        if (!bvh.assign(nodes, order, faces.size()))
+            return false;
+    }
+    lods.clear();
+    if (h.lodCount > h.payloadSize / sizeof(CacheLod))
+        return false;
+    lods.resize(h.lodCount);
+    for (LodLevel &lod : lods) {
+        CacheLod cl;
+
+        at = rd.take(sizeof(cl));
+        if (!at)
+            return false;
+        std::memcpy(&cl, at, sizeof(cl));
+        if (!take_faces(rd, cl.faceCount, lim, lod.indices))
+            return false;
+        lod.error = cl.error;
+    }
+    hasMaterial = h.hasMaterial != 0;
+    bytes = file->size();
+    file->keepMapped();
+    return true;
+}
@@ -0,0 +1,436 @@
+#include "MeshOptimize.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+
+static const unsigned int NONE = std::numeric_limits<unsigned int>::max();
+static const float WELD_MAX_CELL = (float)(1 << 20);
+static const float WELD_CELL_SCALE = 8.0f;
+static const std::uint64_t WELD_EMPTY = ~(std::uint64_t)0;
+
+static const int VCACHE_SIZE = 32;
+static const unsigned int VCACHE_VALENCE_TABLE = 32;
+static const float VCACHE_DECAY_POWER = 1.5f;
+static const float VCACHE_LAST_FACE = 0.75f;
+static const float VCACHE_VALENCE_SCALE = 2.0f;
+static const float VCACHE_VALENCE_POWER = 0.5f;
+static const std::size_t ACMR_FIFO = 16;
+
+static unsigned int corner(const Face &f, int k)
+{
+    if (k == 0)
+        return (unsigned int)f.a;
+    if (k == 1)
+        return (unsigned int)f.b;
+    return (unsigned int)f.c;
+}
+
+/*
+** Open addressed map from grid cell to the last kept vertex in it;
+** the kept vertices of a cell are chained through next.
+*/
+struct CellTable {
+    std::vector<std::uint64_t> keys;
+    std::vector<unsigned int> heads;
+    std::size_t mask;
+    int shift;
+};
+
+static void init_table(CellTable &table, std::size_t count)
+{
+    std::size_t size;
+
+    size = 16;
+    table.shift = 60;
+    while (size < count * 2) {
+        size <<= 1;
+        table.shift--;
+    }
+    table.keys.assign(size, WELD_EMPTY);
+    table.heads.assign(size, NONE);
+    table.mask = size - 1;
+}
+
+static std::size_t table_slot(const CellTable &table, std::uint64_t key)
+{
+    std::size_t slot;
+
+    slot = (std::size_t)((key * 0x9e3779b97f4a7c15ull) >> table.shift);
+    while (table.keys[slot] != key && table.keys[slot] != WELD_EMPTY)
+        slot = (slot + 1) & table.mask;
+    return slot;
+}
+
+/* side is the neighbor cell the point is within 1 / scale of, or 0. */
+static int weld_cell(float v, float inv, int &side)
+{
+    float c;
+    float cell;
+
+    c = std::max(-WELD_MAX_CELL, std::min(WELD_MAX_CELL, v * inv));
+    cell = std::floor(c);
+    side = 0;
+    if (c - cell <= 1.0f / WELD_CELL_SCALE)
+        side = -1;
+    else if (c - cell >= 1.0f - 1.0f / WELD_CELL_SCALE)
+        side = 1;
+    return (int)cell;
+}
+
+static std::uint64_t weld_key(int x, int y, int z)
+{
+    return ((std::uint64_t)(x & 0x1fffff) << 42)
+        | ((std::uint64_t)(y & 0x1fffff) << 21)
+        | (std::uint64_t)(z & 0x1fffff);
+}
+
+static bool within(const Vec3 &p, const Vec3 &q, float epsilon)
+{
+    return std::fabs(p.x - q.x) <= epsilon
+        && std::fabs(p.y - q.y) <= epsilon
+        && std::fabs(p.z - q.z) <= epsilon;
+}
+
+/*
+** Kept vertices are hashed on a grid of WELD_CELL_SCALE * epsilon
+** cells. Only a point within epsilon of a cell face has to look at
+** the neighbor across it, so most points probe one or two cells.
+*/
+std::size_t weld_vertices(const std::vector<Vec3> &vertices,
+                          std::vector<Face> &faces, float epsilon)
+{
+    CellTable table;
+    std::vector<unsigned int> next;
+    std::vector<unsigned int> remap;
+    std::size_t merged;
+    std::size_t kept;
+    float inv;
+    unsigned int i;
+
+    if (vertices.empty() || !(epsilon > 0.0f))
+        return 0;
+    inv = 1.0f / (WELD_CELL_SCALE * epsilon);
+    init_table(table, vertices.size());
+    next.assign(vertices.size(), NONE);
+    remap.resize(vertices.size());
+    merged = 0;
+    i = 0;
+    while (i < vertices.size()) {
+        const Vec3 &p = vertices[i];
+        int cell[3];
+        int side[3];
+        unsigned int found;
+        int n;
+
+        cell[0] = weld_cell(p.x, inv, side[0]);
+        cell[1] = weld_cell(p.y, inv, side[1]);
+        cell[2] = weld_cell(p.z, inv, side[2]);
+        found = NONE;
+        n = 0;
+        while (n < 8) {
+            unsigned int j;
+
+            if (((n & 1) && !side[0]) || ((n & 2) && !side[1])
+                || ((n & 4) && !side[2])) {
+                n++;
+                continue;
+            }
+            j = table.heads[table_slot(table,
+                weld_key(cell[0] + (n & 1 ? side[0] : 0),
+                         cell[1] + (n & 2 ? side[1] : 0),
+                         cell[2] + (n & 4 ? side[2] : 0)))];
+            while (j != NONE) {
+                if (j < found && within(p, vertices[j], epsilon))
+                    found = j;
+                j = next[j];
+            }
+            n++;
+        }
+        if (found != NONE) {
+            remap[i] = found;
+            merged++;
+        } else {
+            std::size_t slot;
+
+            slot = table_slot(table, weld_key(cell[0], cell[1], cell[2]));
+            table.keys[slot] = weld_key(cell[0], cell[1], cell[2]);
+            remap[i] = i;
+            next[i] = table.heads[slot];
+            table.heads[slot] = i;
+        }
+        i++;
+    }
+    if (merged == 0)
+        return 0;
+    kept = 0;
+    for (const Face &f : faces) {
+        Face w;
+
+        w = f;
+        w.a = (int)remap[f.a];
+        w.b = (int)remap[f.b];
+        w.c = (int)remap[f.c];
+        if (w.a != w.b && w.b != w.c && w.a != w.c)
+            faces[kept++] = w;
+    }
+    faces.resize(kept);
+    return merged;
+}
+
+struct CacheScores {
+    float position[VCACHE_SIZE];
+    float valence[VCACHE_VALENCE_TABLE];
+};
+
+static void init_scores(CacheScores &s)
+{
+    int i;
+    unsigned int v;
+
+    i = 0;
+    while (i < VCACHE_SIZE) {
+        if (i < 3)
+            s.position[i] = VCACHE_LAST_FACE;
+        else
+            s.position[i] = std::pow(1.0f - (float)(i - 3)
+                                     / (float)(VCACHE_SIZE - 3),
+                                     VCACHE_DECAY_POWER);
+        i++;
+    }
+    s.valence[0] = 0.0f;
+    v = 1;
+    while (v < VCACHE_VALENCE_TABLE) {
+        s.valence[v] = VCACHE_VALENCE_SCALE
+            * std::pow((float)v, -VCACHE_VALENCE_POWER);
+        v++;
+    }
+}
+
+/*
+** Forsyth: recently used vertices score high (the last face's three
+** a bit less, to avoid strips), vertices with few faces left get a
+** boost so they are finished off rather than left stranded.
+*/
+static float vertex_score(const CacheScores &s, int position,
+                          unsigned int live)
+{
+    float score;
+
+    if (live == 0)
+        return -1.0f;
+    score = position >= 0 ? s.position[position] : 0.0f;
+    if (live < VCACHE_VALENCE_TABLE)
+        return score + s.valence[live];
+    return score + VCACHE_VALENCE_SCALE
+        * std::pow((float)live, -VCACHE_VALENCE_POWER);
+}
+
+/*
+** Greedy: emit the best scored face around the simulated cache, then
+** rescore only the vertices the cache touched and their faces. When
+** no face is left around the cache, resume at the first face not yet
+** emitted.
+*/
+void optimize_vertex_cache(std::vector<Face> &faces,
+                           std::size_t vertexCount)
+{
+    CacheScores table;
+    std::vector<unsigned int> first(vertexCount + 1, 0);
+    std::vector<unsigned int> list(faces.size() * 3);
+    std::vector<unsigned int> live(vertexCount, 0);
+    std::vector<int> position(vertexCount, -1);
+    std::vector<float> vscore(vertexCount);
+    std::vector<float> fscore(faces.size());
+    std::vector<char> done(faces.size(), 0);
+    std::vector<Face> out;
+    unsigned int cache[VCACHE_SIZE + 3];
+    unsigned int fresh[VCACHE_SIZE + 3];
+    int cacheCount;
+    std::size_t cursor;
+    unsigned int best;
+    unsigned int t;
+    std::size_t v;
+    int k;
+
+    if (faces.size() < 2)
+        return;
+    init_scores(table);
+    for (const Face &f : faces) {
+        k = 0;
+        while (k < 3) {
+            first[corner(f, k) + 1]++;
+            k++;
+        }
+    }
+    v = 0;
+    while (v < vertexCount) {
+        first[v + 1] += first[v];
+        v++;
+    }
+    t = 0;
+    while (t < faces.size()) {
+        k = 0;
+        while (k < 3) {
+            unsigned int c;
+
+            c = corner(faces[t], k);
+            list[first[c] + live[c]] = t;
+            live[c]++;
+            k++;
+        }
+        t++;
+    }
+    v = 0;
+    while (v < vertexCount) {
+        vscore[v] = vertex_score(table, -1, live[v]);
+        v++;
+    }
+    best = 0;
+    t = 0;
+    while (t < faces.size()) {
+        fscore[t] = vscore[faces[t].a] + vscore[faces[t].b]
+            + vscore[faces[t].c];
+        if (fscore[t] > fscore[best])
+            best = t;
+        t++;
+    }
+    out.reserve(faces.size());
+    cacheCount = 0;
+    cursor = 0;
+    while (out.size() < faces.size()) {
+        const Face *f;
+        int count;
+        int i;
+
+        if (best == NONE) {
+            while (done[cursor])
+                cursor++;
+            best = (unsigned int)cursor;
+        }
+        f = &faces[best];
+        done[best] = 1;
+        out.push_back(*f);
+        count = 0;
+        k = 0;
+        while (k < 3) {
+            unsigned int c;
+            unsigned int *it;
+            unsigned int *end;
+
+            c = corner(*f, k);
+            it = &list[first[c]];
+            end = it + live[c];
+            it = std::find(it, end, best);
+            if (it != end && (k == 0 || c != corner(*f, 0))
+                && (k < 2 || c != corner(*f, 1))) {
+                *it = end[-1];
+                live[c]--;
+                fresh[count++] = c;
+            }
+            k++;
+        }
+        i = 0;
+        while (i < cacheCount) {
+            if (cache[i] != (unsigned int)f->a
+                && cache[i] != (unsigned int)f->b
+                && cache[i] != (unsigned int)f->c)
+                fresh[count++] = cache[i];
+            i++;
+        }
+        best = NONE;
+        i = 0;
+        while (i < count) {
+            unsigned int c;
+            float score;
+            float delta;
+            unsigned int j;
+
+            c = fresh[i];
+            position[c] = i < VCACHE_SIZE ? i : -1;
+            score = vertex_score(table, position[c], live[c]);
+            delta = score - vscore[c];
+            vscore[c] = score;
+            j = 0;
+            while (j < live[c]) {
+                fscore[list[first[c] + j]] += delta;
+                j++;
+            }
+            i++;
+        }
+        cacheCount = std::min(count, VCACHE_SIZE);
+        i = 0;
+        while (i < cacheCount) {
+            unsigned int c;
+            unsigned int j;
+
+            c = fresh[i];
+            cache[i] = c;
+            j = 0;
+            while (j < live[c]) {
+                t = list[first[c] + j];
+                if (!done[t] && (best == NONE || fscore[t] > fscore[best]))
+                    best = t;
+                j++;
+            }
+            i++;
+        }
+    }
+    faces.swap(out);
+}
+
+void reorder_vertices(std::vector<Vec3> &vertices, std::vector<Face> &faces)
+{
+    std::vector<int> remap(vertices.size(), -1);
+    std::vector<Vec3> out;
+    int used;
+    std::size_t i;
+
+    used = 0;
+    for (Face &f : faces) {
+        if (remap[f.a] < 0)
+            remap[f.a] = used++;
+        if (remap[f.b] < 0)
+            remap[f.b] = used++;
+        if (remap[f.c] < 0)
+            remap[f.c] = used++;
+        f.a = remap[f.a];
+        f.b = remap[f.b];
+        f.c = remap[f.c];
+    }
+    out.resize(used);
+    i = 0;
+    while (i < vertices.size()) {
+        if (remap[i] >= 0)
+            out[remap[i]] = vertices[i];
+        i++;
+    }
+    vertices.swap(out);
+}
+
+/* entered[v] is the miss count when v was loaded: an implicit FIFO. */
+float compute_acmr(const std::vector<Face> &faces, std::size_t vertexCount)
+{
+    std::vector<std::size_t> entered(vertexCount,
+                                     std::numeric_limits<std::size_t>::max());
+    std::size_t misses;
+    int k;
+
+    if (faces.empty())
+        return 0.0f;
+    misses = 0;
+    for (const Face &f : faces) {
+        k = 0;
+        while (k < 3) {
+            unsigned int c;
+
+            c = corner(f, k);
+            if (entered[c] > misses || misses - entered[c] > ACMR_FIFO) {
+                entered[c] = misses;
+                misses++;
+            }
+            k++;
+        }
+    }
+    return (float)misses / (float)faces.size();
+}
@@ -1,4 +1,16 @@
 #include "Model.hpp"
+#include "AllocStats.hpp"
+#include "EdgeList.hpp"
+#include "MappedFile.hpp"
+#include "MeshCache.hpp"
+#include "MeshOptimize.hpp"
+#include "ObjParser.hpp"
+#include "Profiler.hpp"
+#include "Raster.hpp"
+#include "Simplify.hpp"
+#include "ThreadPool.hpp"
+#include <algorithm>
+#include <chrono>
 #include <fstream>
 #include <sstream>
 #include <limits>
@@ -10,66 +22,225 @@ Model::Model()
     m_faces.clear();
     m_materials.clear();
     m_hasMaterial = false;
+    m_hasEdges = false;
 }
 
-const std::vector<Vec3> &Model::getVertices() const
+const PositionBuffer &Model::getPositions() const
 {
-    return m_vertices;
+    return m_positions;
 }
 
-const std::vector<Face> &Model::getFaces() const
+std::size_t Model::getVertexCount() const
 {
-    return m_faces;
+    return m_positions.size();
 }
 
-void Model::normalize()
+std::size_t Model::getFaceCount() const
 {
-    if (m_vertices.empty())
-        return;
-    float minX;
-    float maxX;
-    float minY;
-    float maxY;
-    float minZ;
-    float maxZ;
-    float cx;
-    float cy;
-    float cz;
+    return m_indices.size();
+}
+
+std::size_t Model::getMeshBytes() const
+{
+    std::size_t bytes;
+
+    bytes = m_positions.bytes() + m_indices.bytes()
+        + m_edges.size() * sizeof(Edge)
+        + m_palette.size() * sizeof(std::uint32_t)
+        + m_bvh.getNodes().size() * sizeof(BvhNode)
+        + m_bvh.getFaceOrder().size() * sizeof(unsigned int);
+    for (const LodLevel &level : m_lods)
+        bytes += level.indices.bytes() + level.edges.size() * sizeof(Edge);
+    return bytes;
+}
+
+static const std::size_t NORMALIZE_BLOCK = 1 << 16;
+
+struct Bounds {
+    Vec3 min;
+    Vec3 max;
+};
+
+static Bounds empty_bounds()
+{
+    Bounds b;
+    float inf;
+
+    inf = std::numeric_limits<float>::infinity();
+    b.min = make_vec3(inf, inf, inf);
+    b.max = make_vec3(-inf, -inf, -inf);
+    return b;
+}
+
+static void grow_bounds(Bounds &b, const Vec3 &v)
+{
+    if (v.x < b.min.x) b.min.x = v.x;
+    if (v.x > b.max.x) b.max.x = v.x;
+    if (v.y < b.min.y) b.min.y = v.y;
+    if (v.y > b.max.y) b.max.y = v.y;
+    if (v.z < b.min.z) b.min.z = v.z;
+    if (v.z > b.max.z) b.max.z = v.z;
+}
+
+/*
+** Centers the model on the origin and scales its largest extent to 2.
+** The bounding box is a per-block reduction so it can run on the pool.
+*/
+void Model::normalize(ThreadPool *pool)
+{
+    std::vector<Bounds> partial;
+    std::size_t blocks;
+    Bounds box;
+    Vec3 center;
     float maxRange;
     float invScale;
 
-    minX = std::numeric_limits<float>::infinity();
-    maxX = -minX;
-    minY = minX;
-    maxY = maxX;
-    minZ = minX;
-    maxZ = maxX;
-    for (const Vec3 &v : m_vertices) {
-        if (v.x < minX) minX = v.x;
-        if (v.x > maxX) maxX = v.x;
-        if (v.y < minY) minY = v.y;
-        if (v.y > maxY) maxY = v.y;
-        if (v.z < minZ) minZ = v.z;
-        if (v.z > maxZ) maxZ = v.z;
+    if (m_vertices.empty())
+        return;
+    blocks = (m_vertices.size() + NORMALIZE_BLOCK - 1) / NORMALIZE_BLOCK;
+    partial.assign(blocks, empty_bounds());
+    auto reduce = [&](std::size_t blk) {
+        std::size_t end;
+        std::size_t k;
+
+        end = std::min(m_vertices.size(), (blk + 1) * NORMALIZE_BLOCK);
+        k = blk * NORMALIZE_BLOCK;
+        while (k < end) {
+            grow_bounds(partial[blk], m_vertices[k]);
+            k++;
+        }
+    };
+    parallel_for(pool, blocks, reduce);
+    box = empty_bounds();
+    for (const Bounds &b : partial) {
+        grow_bounds(box, b.min);
+        grow_bounds(box, b.max);
     }
-    cx = (minX + maxX) * 0.5f;
-    cy = (minY + maxY) * 0.5f;
-    cz = (minZ + maxZ) * 0.5f;
-    maxRange = maxX - minX;
-    if (maxRange < maxY - minY)
-        maxRange = maxY - minY;
-    if (maxRange < maxZ - minZ)
-        maxRange = maxZ - minZ;
+    center.x = (box.min.x + box.max.x) * 0.5f;
+    center.y = (box.min.y + box.max.y) * 0.5f;
+    center.z = (box.min.z + box.max.z) * 0.5f;
+    maxRange = box.max.x - box.min.x;
+    if (maxRange < box.max.y - box.min.y)
+        maxRange = box.max.y - box.min.y;
+    if (maxRange < box.max.z - box.min.z)
+        maxRange = box.max.z - box.min.z;
     if (maxRange <= 0.0f)
         return;
     invScale = 2.0f / maxRange;
-    for (Vec3 &v : m_vertices) {
-        v.x = (v.x - cx) * invScale;
-        v.y = (v.y - cy) * invScale;
-        v.z = (v.z - cz) * invScale;
+    auto scale = [&](std::size_t blk) {
+        std::size_t end;
+        std::size_t k;
+
+        end = std::min(m_vertices.size(), (blk + 1) * NORMALIZE_BLOCK);
+        k = blk * NORMALIZE_BLOCK;
+        while (k < end) {
+            Vec3 &v = m_vertices[k];
+
+            v.x = (v.x - center.x) * invScale;
+            v.y = (v.y - center.y) * invScale;
+            v.z = (v.z - center.z) * invScale;
+            k++;
+        }
+    };
+    parallel_for(pool, blocks, scale);
+}
+
+/* In normalized units, the model being 2 across. */
+static const float WELD_EPSILON = 1e-5f;
+
+void Model::optimizeMesh()
+{
+    ScopedTimer timer("optimize", m_loadStats.optimizeMs);
+
+    m_loadStats.acmrBefore = compute_acmr(m_faces, m_vertices.size());
+    m_loadStats.weldedVertices = weld_vertices(m_vertices, m_faces,
+                                               WELD_EPSILON);
+    optimize_vertex_cache(m_faces, m_vertices.size());
+    reorder_vertices(m_vertices, m_faces);
+    m_loadStats.acmrAfter = compute_acmr(m_faces, m_vertices.size());
+    m_loadStats.optimized = true;
+}
+
+/*
+** Moves the load-time mesh into the resident buffers and frees it,
+** each array as soon as it is packed.
+** Index width follows the vertex count; every level shares it.
+*/
+void Model::pack(bool quantize)
+{
+    std::size_t vertexCount;
+    std::size_t dropped;
+
+    PROFILE_SCOPE("pack");
+    vertexCount = m_vertices.size();
+    m_positions.assign(std::move(m_vertices), quantize);
+    m_vertices.clear();
+    dropped = m_indices.assign(m_faces, vertexCount);
+    std::vector<Face>().swap(m_faces);
+    for (LodLevel &level : m_lods) {
+        level.indices.assign(level.faces, vertexCount);
+        std::vector<Face>().swap(level.faces);
+    }
+    if (dropped > 0)
+        std::cerr << "Warning: " << dropped << " faces use a material"
+                  << " past id " << MAX_MATERIAL_ID - 1
+                  << ", drawn in white." << std::endl;
+}
+
+void Model::bakePalette()
+{
+    float r;
+    float g;
+    float b;
+    std::size_t count;
+    std::size_t i;
+
+    count = std::min<std::size_t>(m_materials.size(), MAX_MATERIAL_ID);
+    m_palette.assign(count + 1, pack_rgba(255, 255, 255, 255));
+    i = 0;
+    while (i < count) {
+        getMaterialColor((int)i, r, g, b);
+        m_palette[i + 1] = pack_rgba((unsigned char)(r * 255.0f),
+                                     (unsigned char)(g * 255.0f),
+                                     (unsigned char)(b * 255.0f), 255);
+        i++;
     }
 }
 
+void Model::clearMesh()
+{
+    m_bvh.clear();
+    m_lods.clear();
+    m_vertices.clear();
+    m_faces.clear();
+    m_positions.clear();
+    m_indices.clear();
+    std::vector<Edge>().swap(m_edges);
+    m_hasEdges = false;
+    m_palette.clear();
+}
+
+/*
+** Edge lists are cheap next to the LOD chain and would add half the
+** face data again to the cache file, so they are neither cached nor
+** built until the wireframe is first turned on.
+*/
+void Model::prepareEdges()
+{
+    if (m_hasEdges)
+        return;
+    {
+        ScopedTimer timer("edge list", m_loadStats.edgesMs);
+
+        build_edge_list(m_indices, m_positions.size(), m_edges);
+        for (LodLevel &level : m_lods)
+            build_edge_list(level.indices, m_positions.size(),
+                            level.edges);
+    }
+    m_loadStats.edges = m_edges.size();
+    m_hasEdges = true;
+}
+
 bool Model::loadFromMtl(const std::string &path)
 {
     std::ifstream file;
@@ -119,101 +290,215 @@ bool Model::loadFromMtl(const std::string &path)
     return m_hasMaterial;
 }
 
-bool Model::loadFromObj(const std::string &path)
+/* Heap counters when a load starts; also restarts the RSS peak. */
+static AllocStats begin_load_stats(LoadStats &stats)
 {
-    std::ifstream file;
-    std::string line;
-    std::vector<Vec3> verts;
-    std::vector<Face> faces;
-    int currentMat;
+    stats.peakRssOfLoad = reset_peak_rss();
+    return alloc_stats();
+}
 
-    currentMat = -1;
-    file.open(path.c_str());
-    if (!file.is_open())
-        return false;
-    while (std::getline(file, line)) {
-        if (line.size() < 2)
-            continue;
+static void end_load_stats(LoadStats &stats, const AllocStats &before,
+                           std::chrono::steady_clock::time_point start)
+{
+    AllocStats after;
 
-        if (line[0] == 'v' && line[1] == ' ') {
-            std::istringstream iss(line.substr(2));
-            float x;
-            float y;
-            float z;
+    after = alloc_stats();
+    stats.allocations = after.count - before.count;
+    stats.allocatedBytes = after.bytes - before.bytes;
+    stats.peakRss = peak_rss_bytes();
+    stats.ms = std::chrono::duration<double, std::milli>(
+        std::chrono::steady_clock::now() - start).count();
+    stats.mbPerSec = stats.ms > 0.0
+        ? (double)stats.bytes / 1e6 / (stats.ms / 1000.0) : 0.0;
+}
 
-            iss >> x >> y >> z;
-            verts.push_back(make_vec3(x, y, z));
-        }
-        else if (line[0] == 'f' && line[1] == ' ') {
-            std::istringstream iss(line.substr(2));
-            std::vector<int> indices;
-            std::string token;
+/*
+** Files above OBJ_PARALLEL_MIN bytes are cut into newline-aligned
+** chunks (a few per thread, at least OBJ_CHUNK_MIN bytes each) that
+** are counted, then parsed concurrently into their slices of the
+** mesh arrays, see ObjParser.hpp.
+*/
+static const std::size_t OBJ_PARALLEL_MIN = 8u << 20;
+static const std::size_t OBJ_CHUNK_MIN = 4u << 20;
 
-            while (iss >> token) {
-                std::size_t slashPos;
-                std::string num;
-                int idx;
-
-                slashPos = token.find('/');
-                if (slashPos == std::string::npos)
-                    num = token;
-                else
-                    num = token.substr(0, slashPos);
-                if (num.empty())
-                    continue;
-                idx = std::stoi(num);
-                indices.push_back(idx - 1);
-            }
+/* Face indices are parsed as int. */
+static const std::size_t OBJ_MAX_VERTICES =
+    (std::size_t)std::numeric_limits<int>::max();
 
-            if (indices.size() >= 3) {
-                std::size_t i;
-                Face f;
-
-                i = 1;
-                while (i + 1 < indices.size()) {
-                    f.a = indices[0];
-                    f.b = indices[i];
-                    f.c = indices[i + 1];
-                    f.mat = currentMat;
-                    faces.push_back(f);
-                    i++;
-                }
-            }
-        }
-        else if (line.rfind("usemtl", 0) == 0) {
-            std::string name;
-            std::string token;
-            std::istringstream iss(line);
-            int matIndex;
+bool Model::loadFromObj(const std::string &path, ThreadPool *pool,
+                        bool optimize, bool quantize)
+{
+    std::chrono::steady_clock::time_point start;
+    AllocStats allocs;
+    MappedFile file;
+    std::vector<const char *> bounds;
+    std::vector<ObjChunk> chunks;
+    MaterialIndex materials;
+    std::size_t count;
+    std::size_t dropped;
 
-            iss >> token >> name;
-            matIndex = -1;
-            for (std::size_t i = 0; i < m_materials.size(); ++i) {
-                if (m_materials[i].name == name) {
-                    matIndex = (int)i;
-                    break;
-                }
-            }
-            currentMat = matIndex;
-        }
+    PROFILE_SCOPE("load obj");
+    start = std::chrono::steady_clock::now();
+    allocs = begin_load_stats(m_loadStats);
+    clearMesh();
+    if (!file.open(path))
+        return false;
+    count = 1;
+    if (pool && pool->getThreadCount() > 1
+        && file.size() >= OBJ_PARALLEL_MIN)
+        count = std::min((std::size_t)pool->getThreadCount() * 4,
+                         file.size() / OBJ_CHUNK_MIN);
+    else
+        pool = nullptr;
+    index_materials(m_materials, materials);
+    split_obj_ranges(file.data(), file.size(), count, bounds);
+    chunks.resize(bounds.size() - 1);
+    count = 0;
+    while (count < chunks.size()) {
+        chunks[count].begin = bounds[count];
+        chunks[count].end = bounds[count + 1];
+        count++;
+    }
+    auto countChunk = [&](std::size_t c) {
+        PROFILE_SCOPE("count chunk");
+        count_obj_range(chunks[c]);
+    };
+    parallel_for(pool, chunks.size(), countChunk);
+    count = 0;
+    for (const ObjChunk &chunk : chunks)
+        count += chunk.counts.vertices;
+    if (count > OBJ_MAX_VERTICES) {
+        std::cerr << "Error: " << count << " vertices, at most "
+                  << OBJ_MAX_VERTICES << " are supported." << std::endl;
+        return false;
+    }
+    place_obj_chunks(chunks, materials, m_vertices, m_faces);
+    auto parse = [&](std::size_t c) {
+        PROFILE_SCOPE("parse chunk");
+        parse_obj_range(chunks[c], materials, m_vertices, m_faces);
+    };
+    parallel_for(pool, chunks.size(), parse);
+    {
+        PROFILE_SCOPE("merge");
+        dropped = merge_obj_chunks(chunks, m_faces);
     }
+    /* Mapped pages count in the resident size as much as the mesh. */
+    m_loadStats.bytes = file.size();
     file.close();
+    if (dropped > 0)
+        std::cerr << "Warning: dropped " << dropped
+                  << " faces with invalid vertex indices." << std::endl;
+    if (m_vertices.empty() || m_faces.empty())
+        return false;
+    {
+        PROFILE_SCOPE("normalize");
+        normalize(pool);
+    }
+    m_loadStats.optimized = false;
+    m_loadStats.weldedVertices = 0;
+    m_loadStats.acmrBefore = 0.0f;
+    m_loadStats.acmrAfter = 0.0f;
+    m_loadStats.optimizeMs = 0.0;
+    if (optimize)
+        optimizeMesh();
+    if (m_faces.empty())
+        return false;
+    /* Later passes see the positions exactly as they will be kept. */
+    if (quantize)
+        for (Vec3 &v : m_vertices)
+            v = quantize_position(v);
+    m_loadStats.quantized = quantize;
+    {
+        ScopedTimer timer("bvh", m_loadStats.bvhMs);
+
+        m_bvh.build(m_vertices, m_faces, pool);
+    }
+    m_loadStats.bvhNodes = m_bvh.getNodes().size();
+    {
+        ScopedTimer timer("lod", m_loadStats.lodMs);
 
-    if (verts.empty() || faces.empty())
+        build_lod_chain(m_vertices, m_faces, m_lods, pool);
+    }
+    m_loadStats.lodLevels = m_lods.size();
+    pack(quantize);
+    bakePalette();
+    m_loadStats.edgesMs = 0.0;
+    m_loadStats.edges = 0;
+    m_loadStats.fromCache = false;
+    m_loadStats.chunks = chunks.size();
+    m_loadStats.threads = pool ? pool->getThreadCount() : 1;
+    end_load_stats(m_loadStats, allocs, start);
+    return true;
+}
+
+bool Model::loadCache(const std::string &objPath,
+                      const std::string &mtlPath, bool optimized,
+                      bool quantized)
+{
+    std::chrono::steady_clock::time_point start;
+    AllocStats allocs;
+    CacheKey key;
+    std::size_t bytes;
+
+    PROFILE_SCOPE("load cache");
+    start = std::chrono::steady_clock::now();
+    allocs = begin_load_stats(m_loadStats);
+    clearMesh();
+    if (!make_cache_key(objPath, mtlPath, optimized, quantized, key)
+        || !read_mesh_cache(mesh_cache_path(objPath), key, m_positions,
+                            m_indices, m_materials, m_hasMaterial, m_bvh,
+                            m_lods, bytes)) {
+        clearMesh();
+        m_materials.clear();
+        m_hasMaterial = false;
         return false;
-    m_vertices = verts;
-    m_faces = faces;
-    normalize();
+    }
+    m_loadStats.bytes = bytes;
+    m_loadStats.fromCache = true;
+    m_loadStats.bvhMs = 0.0;
+    m_loadStats.bvhNodes = m_bvh.getNodes().size();
+    m_loadStats.lodMs = 0.0;
+    m_loadStats.lodLevels = m_lods.size();
+    bakePalette();
+    m_loadStats.edgesMs = 0.0;
+    m_loadStats.edges = 0;
+    m_loadStats.optimized = optimized;
+    m_loadStats.quantized = quantized;
+    m_loadStats.weldedVertices = 0;
+    m_loadStats.acmrBefore = 0.0f;
+    m_loadStats.acmrAfter = 0.0f;
+    m_loadStats.optimizeMs = 0.0;
+    m_loadStats.chunks = 1;
+    m_loadStats.threads = 1;
+    end_load_stats(m_loadStats, allocs, start);
     return true;
 }
 
+bool Model::saveCache(const std::string &objPath,
+                      const std::string &mtlPath) const
+{
+    CacheKey key;
+
+    PROFILE_SCOPE("save cache");
+    if (!make_cache_key(objPath, mtlPath, m_loadStats.optimized,
+                        m_loadStats.quantized, key))
+        return false;
+    return write_mesh_cache(mesh_cache_path(objPath), key, m_positions,
+                            m_indices, m_materials, m_hasMaterial, m_bvh,
+                            m_lods);
+}
+
+const LoadStats &Model::getLoadStats() const
+{
+    return m_loadStats;
+}
+
 bool Model::hasMaterial() const
 {
     return m_hasMaterial;
 }
 
-void Model::getFaceColor(int faceIndex,
-                         float &r, float &g, float &b) const
+void Model::getMaterialColor(int mat, float &r, float &g, float &b) const
 {
     r = 1.0f;
     g = 1.0f;
@@ -221,16 +506,60 @@ void Model::getFaceColor(int faceIndex,
 
     if (!m_hasMaterial)
         return;
-    if (faceIndex < 0
-        || static_cast<std::size_t>(faceIndex) >= m_faces.size())
+    if (mat < 0 || static_cast<std::size_t>(mat) >= m_materials.size())
         return;
 
-    int midx = m_faces[faceIndex].mat;
-    if (midx < 0
+    r = m_materials[mat].r;
+    g = m_materials[mat].g;
+    b = m_materials[mat].b;
+}
+
+std::string Model::getFaceMaterial(int faceIndex) const
+{
+    int midx;
+
+    if (faceIndex < 0
+        || static_cast<std::size_t>(faceIndex) >= m_indices.size())
+        return "";
+    midx = (int)m_indices.materials()[faceIndex] - 1;
+    if (!m_hasMaterial || midx < 0
         || static_cast<std::size_t>(midx) >= m_materials.size())
-        return;
+        return "none";
+    return m_materials[midx].name;
+}
+
+const Bvh &Model::getBvh() const
+{
+    return m_bvh;
+}
+
+int Model::getLodCount() const
+{
+    return 1 + (int)m_lods.size();
+}
 
-    r = m_materials[midx].r;
-    g = m_materials[midx].g;
-    b = m_materials[midx].b;
-}
\ No newline at end of file
+const IndexBuffer &Model::getLodIndices(int level) const
+{
+    if (level <= 0 || level > (int)m_lods.size())
+        return m_indices;
+    return m_lods[level - 1].indices;
+}
+
+float Model::getLodError(int level) const
+{
+    if (level <= 0 || level > (int)m_lods.size())
+        return 0.0f;
+    return m_lods[level - 1].error;
+}
+
+const std::vector<std::uint32_t> &Model::getPalette() const
+{
+    return m_palette;
+}
+
+const std::vector<Edge> &Model::getLodEdges(int level) const
+{
+    if (level <= 0 || level > (int)m_lods.size())
+        return m_edges;
+    return m_lods[level - 1].edges;
+}
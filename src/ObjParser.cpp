@@ -0,0 +1,307 @@
+#include "ObjParser.hpp"
+#include <charconv>
+#include <cstdlib>
+#include <cstring>
+
+static bool is_blank(char c)
+{
+    return c == ' ' || c == '\t' || c == '\r' || c == '\v' || c == '\f';
+}
+
+static const char *skip_blanks(const char *p, const char *end)
+{
+    while (p < end && is_blank(*p))
+        p++;
+    return p;
+}
+
+static const char *skip_token(const char *p, const char *end)
+{
+    while (p < end && !is_blank(*p))
+        p++;
+    return p;
+}
+
+static bool parse_float(const char *&p, const char *end, float &out)
+{
+    p = skip_blanks(p, end);
+    if (p < end && *p == '+')
+        p++;
+#if defined(__cpp_lib_to_chars) && __cpp_lib_to_chars >= 201611L
+    std::from_chars_result res;
+
+    res = std::from_chars(p, end, out);
+    if (res.ec != std::errc())
+        return false;
+    p = res.ptr;
+    return true;
+#else
+    char buf[64];
+    const char *tokEnd;
+    char *numEnd;
+    std::size_t len;
+
+    tokEnd = skip_token(p, end);
+    len = (std::size_t)(tokEnd - p);
+    if (len == 0 || len >= sizeof(buf))
+        return false;
+    std::memcpy(buf, p, len);
+    buf[len] = '\0';
+    out = std::strtof(buf, &numEnd);
+    if (numEnd == buf)
+        return false;
+    p += numEnd - buf;
+    return true;
+#endif
+}
+
+static Vec3 parse_vertex(const char *p, const char *end)
+{
+    Vec3 v;
+
+    if (parse_float(p, end, v.x) && parse_float(p, end, v.y))
+        parse_float(p, end, v.z);
+    return v;
+}
+
+/*
+** Fan-triangulates one face line into chunk's slice of faces.
+** nextVertex is the file index of the next vertex to come, which
+** relative indices count back from.
+*/
+static void parse_face(const char *p, const char *end, int mat,
+                       int nextVertex, int vertexCount,
+                       std::vector<int> &indices, std::vector<Face> &faces,
+                       ObjChunk &chunk)
+{
+    std::size_t i;
+
+    indices.clear();
+    while (true) {
+        const char *tok;
+        const char *tokEnd;
+        int value;
+
+        tok = skip_blanks(p, end);
+        if (tok == end)
+            break;
+        tokEnd = skip_token(tok, end);
+        p = tokEnd;
+        if (*tok == '+')
+            tok++;
+        if (std::from_chars(tok, tokEnd, value).ec != std::errc())
+            continue;
+        indices.push_back(value < 0 ? value + nextVertex : value - 1);
+    }
+    i = 1;
+    while (i + 1 < indices.size()) {
+        Face f;
+
+        f.a = indices[0];
+        f.b = indices[i];
+        f.c = indices[i + 1];
+        f.mat = mat;
+        i++;
+        if (f.a < 0 || f.b < 0 || f.c < 0 || f.a >= vertexCount
+            || f.b >= vertexCount || f.c >= vertexCount
+            || chunk.faceCount >= chunk.counts.faces) {
+            chunk.dropped++;
+            continue;
+        }
+        faces[chunk.firstFace + chunk.faceCount] = f;
+        chunk.faceCount++;
+    }
+}
+
+void index_materials(const std::vector<Material> &materials,
+                     MaterialIndex &index)
+{
+    std::size_t i;
+
+    index.clear();
+    index.reserve(materials.size());
+    i = 0;
+    while (i < materials.size()) {
+        index.emplace(std::string_view(materials[i].name), (int)i);
+        i++;
+    }
+}
+
+static int find_material(const char *p, const char *end,
+                         const MaterialIndex &materials)
+{
+    MaterialIndex::const_iterator it;
+    const char *name;
+
+    p = skip_token(skip_blanks(p, end), end);
+    name = skip_blanks(p, end);
+    it = materials.find(std::string_view(
+        name, (std::size_t)(skip_token(name, end) - name)));
+    return it == materials.end() ? -1 : it->second;
+}
+
+/* Line starts: "v ", "f " and "usemtl" are what both passes look at. */
+static bool is_vertex_line(const char *line, const char *eol)
+{
+    return eol - line >= 2 && line[0] == 'v' && line[1] == ' ';
+}
+
+static bool is_face_line(const char *line, const char *eol)
+{
+    return eol - line >= 2 && line[0] == 'f' && line[1] == ' ';
+}
+
+static bool is_usemtl_line(const char *line, const char *eol)
+{
+    return eol - line >= 6 && std::memcmp(line, "usemtl", 6) == 0;
+}
+
+static const char *line_end(const char *line, const char *end)
+{
+    const char *eol;
+
+    eol = static_cast<const char *>(
+        std::memchr(line, '\n', (std::size_t)(end - line)));
+    return eol ? eol : end;
+}
+
+void count_obj_range(ObjChunk &chunk)
+{
+    const char *line;
+
+    chunk.counts = ObjCounts();
+    line = chunk.begin;
+    while (line < chunk.end) {
+        const char *eol;
+
+        eol = line_end(line, chunk.end);
+        if (is_vertex_line(line, eol)) {
+            chunk.counts.vertices++;
+        } else if (is_face_line(line, eol)) {
+            const char *p;
+            std::size_t tokens;
+
+            tokens = 0;
+            p = skip_blanks(line + 2, eol);
+            while (p < eol) {
+                tokens++;
+                p = skip_blanks(skip_token(p, eol), eol);
+            }
+            if (tokens >= 3)
+                chunk.counts.faces += tokens - 2;
+        } else if (is_usemtl_line(line, eol)) {
+            chunk.counts.lastMaterial = line;
+        }
+        line = eol + 1;
+    }
+}
+
+void place_obj_chunks(std::vector<ObjChunk> &chunks,
+                      const MaterialIndex &materials,
+                      std::vector<Vec3> &vertices,
+                      std::vector<Face> &faces)
+{
+    std::size_t vertexCount;
+    std::size_t faceCount;
+    int mat;
+
+    vertexCount = 0;
+    faceCount = 0;
+    mat = -1;
+    for (ObjChunk &chunk : chunks) {
+        chunk.firstVertex = vertexCount;
+        chunk.firstFace = faceCount;
+        chunk.entryMat = mat;
+        chunk.faceCount = 0;
+        chunk.dropped = 0;
+        vertexCount += chunk.counts.vertices;
+        faceCount += chunk.counts.faces;
+        if (chunk.counts.lastMaterial)
+            mat = find_material(chunk.counts.lastMaterial,
+                                line_end(chunk.counts.lastMaterial,
+                                         chunk.end), materials);
+    }
+    vertices.resize(vertexCount);
+    faces.resize(faceCount);
+}
+
+void parse_obj_range(ObjChunk &chunk, const MaterialIndex &materials,
+                     std::vector<Vec3> &vertices, std::vector<Face> &faces)
+{
+    std::vector<int> indices;
+    const char *line;
+    std::size_t vertex;
+    int currentMat;
+
+    currentMat = chunk.entryMat;
+    vertex = 0;
+    line = chunk.begin;
+    while (line < chunk.end) {
+        const char *eol;
+
+        eol = line_end(line, chunk.end);
+        if (is_vertex_line(line, eol)) {
+            if (vertex < chunk.counts.vertices)
+                vertices[chunk.firstVertex + vertex] =
+                    parse_vertex(line + 2, eol);
+            vertex++;
+        } else if (is_face_line(line, eol)) {
+            parse_face(line + 2, eol, currentMat,
+                       (int)(chunk.firstVertex + vertex),
+                       (int)vertices.size(), indices, faces, chunk);
+        } else if (is_usemtl_line(line, eol)) {
+            currentMat = find_material(line, eol, materials);
+        }
+        line = eol + 1;
+    }
+}
+
+void split_obj_ranges(const char *data, std::size_t size,
+                      std::size_t count,
+                      std::vector<const char *> &bounds)
+{
+    const char *end;
+    const char *cut;
+    std::size_t step;
+    std::size_t i;
+
+    end = data + size;
+    if (count == 0)
+        count = 1;
+    step = size / count;
+    bounds.clear();
+    bounds.push_back(data);
+    i = 1;
+    while (i < count) {
+        cut = data + i * step;
+        if (cut <= bounds.back())
+            cut = bounds.back();
+        cut = static_cast<const char *>(
+            std::memchr(cut, '\n', (std::size_t)(end - cut)));
+        if (!cut || cut + 1 >= end)
+            break;
+        bounds.push_back(cut + 1);
+        i++;
+    }
+    bounds.push_back(end);
+}
+
+std::size_t merge_obj_chunks(const std::vector<ObjChunk> &chunks,
+                             std::vector<Face> &faces)
+{
+    std::size_t kept;
+    std::size_t dropped;
+
+    kept = 0;
+    dropped = 0;
+    for (const ObjChunk &chunk : chunks) {
+        if (kept != chunk.firstFace)
+            std::memmove(faces.data() + kept,
+                         faces.data() + chunk.firstFace,
+                         chunk.faceCount * sizeof(Face));
+        kept += chunk.faceCount;
+        dropped += chunk.dropped;
+    }
+    faces.resize(kept);
+    return dropped;
+}
@@ -0,0 +1,417 @@
+#include "Options.hpp"
+#include <cerrno>
+#include <climits>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+/*
+** strtoul() skips blanks and takes a sign, so "-1" would wrap around;
+** only plain digits that fit an unsigned int are read.
+*/
+static bool read_uint(const char *str, char **end, unsigned long &value)
+{
+    if (!str || *str < '0' || *str > '9')
+        return false;
+    errno = 0;
+    value = std::strtoul(str, end, 10);
+    return errno != ERANGE && value <= UINT_MAX;
+}
+
+static bool parse_uint(const char *str, unsigned int &out)
+{
+    char *end;
+    unsigned long value;
+
+    if (!read_uint(str, &end, value) || *end != '\0')
+        return false;
+    out = (unsigned int)value;
+    return true;
+}
+
+static bool parse_size(const char *str, unsigned int &w, unsigned int &h)
+{
+    char *end;
+    unsigned long width;
+    unsigned long height;
+
+    if (!read_uint(str, &end, width) || *end != 'x')
+        return false;
+    if (!read_uint(end + 1, &end, height) || *end != '\0' || width == 0
+        || height == 0)
+        return false;
+    w = (unsigned int)width;
+    h = (unsigned int)height;
+    return true;
+}
+
+/*
+** A level past the coarsest one draws the coarsest, but it must stay
+** an int: a negative lod is auto.
+*/
+static bool parse_lod(const char *str, int &lod)
+{
+    unsigned int level;
+
+    if (str && std::strcmp(str, "auto") == 0) {
+        lod = -1;
+        return true;
+    }
+    if (!parse_uint(str, level) || level > (unsigned int)INT_MAX)
+        return false;
+    lod = (int)level;
+    return true;
+}
+
+/* Angles of the first --bench frame, pitch of --views without one. */
+static const float DEFAULT_ANGLE_Y = 0.5f;
+static const float DEFAULT_ANGLE_X = 0.3f;
+static const float DEG_TO_RAD = 3.14159265f / 180.0f;
+
+static bool parse_degrees(const char *str, char **end, float &out)
+{
+    out = std::strtof(str, end);
+    return *end != str && std::isfinite(out);
+}
+
+/* Comma list of yaw[:pitch] in degrees, e.g. "0,90:30,180". */
+static bool parse_views(const char *str, std::vector<CameraView> &views)
+{
+    CameraView view;
+    char *end;
+
+    views.clear();
+    while (str && *str) {
+        if (!parse_degrees(str, &end, view.angleY))
+            return false;
+        view.angleY *= DEG_TO_RAD;
+        view.angleX = DEFAULT_ANGLE_X;
+        str = end;
+        if (*str == ':') {
+            if (!parse_degrees(str + 1, &end, view.angleX))
+                return false;
+            view.angleX *= DEG_TO_RAD;
+            str = end;
+        }
+        views.push_back(view);
+        if (*str == '\0')
+            return true;
+        if (*str != ',')
+            return false;
+        str++;
+    }
+    return false;
+}
+
+/* count views evenly spaced around the Y axis. */
+static void turntable_views(unsigned int count,
+                            std::vector<CameraView> &views)
+{
+    unsigned int i;
+
+    views.clear();
+    i = 0;
+    while (i < count) {
+        views.push_back({360.0f * DEG_TO_RAD * (float)i / (float)count,
+                         DEFAULT_ANGLE_X});
+        i++;
+    }
+}
+
+static bool image_format_from_name(const char *name, ImageFormat &format)
+{
+    if (!name)
+        return false;
+    if (std::strcmp(name, "png") == 0)
+        format = ImageFormat::Png;
+    else if (std::strcmp(name, "rgba") == 0)
+        format = ImageFormat::Rgba;
+    else
+        return false;
+    return true;
+}
+
+void print_usage()
+{
+    std::cerr << "Usage: ./viewer model.obj [material.mtl] [options]\n"
+              << "       ./viewer --scene FILE [options]\n"
+              << "       ./viewer --bench model.obj [material.mtl]"
+              << " [--frames N] [--size WxH] [--output FILE]\n"
+              << "       ./viewer --batch MANIFEST [--views LIST |"
+              << " --turntable N] [--out-dir DIR]\n"
+              << "Options:\n"
+              << "  --scene FILE      draw the meshes and instances of a"
+              << " scene file instead\n"
+              << "  -t, --threads N   raster threads (0 = all cores)\n"
+              << "  --kernel NAME     raster kernel: scalar, sse2, avx2"
+              << " (default: best supported)\n"
+              << "  --cull LIST       none, all or a comma list of back,"
+              << " zero, offscreen (default: all)\n"
+              << "  --sort MODE       triangle order: none, radix (front"
+              << " to back), painter (default: none)\n"
+              << "  --edges MODE      edge overlay: off, all, visible"
+              << " (hidden edges removed)\n"
+              << "  --shading MODE    forward, or visibility (raster ids,"
+              << " shade visible pixels)\n"
+              << "  --lod auto|N      level of detail, 0 = full model"
+              << " (default: auto)\n"
+              << "  --no-cache        ignore and do not write model.obj.objc\n"
+              << "  --optimize        weld vertices, reorder for vertex"
+              << " cache locality\n"
+              << "  --quantize        store positions on 16 bits"
+              << " (half the vertex memory)\n"
+              << "  --pipeline        set up frame N+1 while frame N"
+              << " rasterizes (double-buffered)\n"
+              << "  --trace FILE      write stage timings on exit"
+              << " (.csv, otherwise Chrome trace JSON)\n"
+              << "  --bench           render offscreen, print JSON timings\n"
+              << "  --frames N        frames to render in --bench"
+              << " (default 100)\n"
+              << "  --size WxH        offscreen size in --bench and --batch"
+              << " (default 800x600)\n"
+              << "  --output FILE     save the last --bench frame as an"
+              << " image\n"
+              << "  --batch FILE      render every OBJ [TAB MTL] line of FILE"
+              << " offscreen\n"
+              << "  --views LIST      batch views, comma list of yaw[:pitch]"
+              << " in degrees\n"
+              << "  --turntable N     batch views: N yaws around the model\n"
+              << "  --out-dir DIR     batch image directory (default .)\n"
+              << "  --format FMT      batch images: png or rgba (raw pixels)"
+              << std::endl;
+}
+
+bool parse_options(int argc, char **argv, Options &opts)
+{
+    unsigned int views;
+    int i;
+
+    i = 1;
+    while (i < argc) {
+        const char *arg;
+
+        arg = argv[i];
+        if (std::strcmp(arg, "-t") == 0
+            || std::strcmp(arg, "--threads") == 0) {
+            if (i + 1 >= argc || !parse_uint(argv[i + 1], opts.threads)) {
+                std::cerr << "Error: " << arg
+                          << " expects a number." << std::endl;
+                return false;
+            }
+            i += 2;
+            continue;
+        }
+        if (std::strcmp(arg, "--sort") == 0) {
+            if (i + 1 >= argc
+                || !depth_sort_from_name(argv[i + 1], opts.sort)) {
+                std::cerr << "Error: --sort expects none, radix "
+                          << "or painter." << std::endl;
+                return false;
+            }
+            i += 2;
+            continue;
+        }
+        if (std::strcmp(arg, "--shading") == 0) {
+            if (i + 1 >= argc
+                || !shading_mode_from_name(argv[i + 1], opts.shading)) {
+                std::cerr << "Error: --shading expects forward "
+                          << "or visibility." << std::endl;
+                return false;
+            }
+            i += 2;
+            continue;
+        }
+        if (std::strcmp(arg, "--edges") == 0) {
+            if (i + 1 >= argc
+                || !edge_mode_from_name(argv[i + 1], opts.edges)) {
+                std::cerr << "Error: --edges expects off, all "
+                          << "or visible." << std::endl;
+                return false;
+            }
+            i += 2;
+            continue;
+        }
+        if (std::strcmp(arg, "--lod") == 0) {
+            if (i + 1 >= argc || !parse_lod(argv[i + 1], opts.lod)) {
+                std::cerr << "Error: --lod expects auto or a level."
+                          << std::endl;
+                return false;
+            }
+            i += 2;
+            continue;
+        }
+        if (std::strcmp(arg, "--no-cache") == 0) {
+            opts.useCache = false;
+            i++;
+            continue;
+        }
+        if (std::strcmp(arg, "--optimize") == 0) {
+            opts.optimize = true;
+            i++;
+            continue;
+        }
+        if (std::strcmp(arg, "--pipeline") == 0) {
+            opts.pipelined = true;
+            i++;
+            continue;
+        }
+        if (std::strcmp(arg, "--quantize") == 0) {
+            opts.quantize = true;
+            i++;
+            continue;
+        }
+        if (std::strcmp(arg, "--bench") == 0) {
+            opts.bench = true;
+            i++;
+            continue;
+        }
+        if (std::strcmp(arg, "--frames") == 0) {
+            if (i + 1 >= argc || !parse_uint(argv[i + 1], opts.frames)) {
+                std::cerr << "Error: --frames expects a number."
+                          << std::endl;
+                return false;
+            }
+            i += 2;
+            continue;
+        }
+        if (std::strcmp(arg, "--size") == 0) {
+            if (i + 1 >= argc
+                || !parse_size(argv[i + 1], opts.width, opts.height)) {
+                std::cerr << "Error: --size expects WxH." << std::endl;
+                return false;
+            }
+            i += 2;
+            continue;
+        }
+        if (std::strcmp(arg, "--output") == 0) {
+            if (i + 1 >= argc) {
+                std::cerr << "Error: --output expects a path."
+                          << std::endl;
+                return false;
+            }
+            opts.outputPath = argv[i + 1];
+            i += 2;
+            continue;
+        }
+        if (std::strcmp(arg, "--batch") == 0) {
+            if (i + 1 >= argc) {
+                std::cerr << "Error: --batch expects a manifest path."
+                          << std::endl;
+                return false;
+            }
+            opts.batchPath = argv[i + 1];
+            i += 2;
+            continue;
+        }
+        if (std::strcmp(arg, "--scene") == 0) {
+            if (i + 1 >= argc) {
+                std::cerr << "Error: --scene expects a scene file."
+                          << std::endl;
+                return false;
+            }
+            opts.scenePath = argv[i + 1];
+            i += 2;
+            continue;
+        }
+        if (std::strcmp(arg, "--views") == 0) {
+            if (i + 1 >= argc || !parse_views(argv[i + 1], opts.views)) {
+                std::cerr << "Error: --views expects a comma list of "
+                          << "yaw[:pitch] degrees." << std::endl;
+                return false;
+            }
+            i += 2;
+            continue;
+        }
+        if (std::strcmp(arg, "--turntable") == 0) {
+            if (i + 1 >= argc || !parse_uint(argv[i + 1], views)
+                || views == 0) {
+                std::cerr << "Error: --turntable expects a view count."
+                          << std::endl;
+                return false;
+            }
+            turntable_views(views, opts.views);
+            i += 2;
+            continue;
+        }
+        if (std::strcmp(arg, "--out-dir") == 0) {
+            if (i + 1 >= argc) {
+                std::cerr << "Error: --out-dir expects a path."
+                          << std::endl;
+                return false;
+            }
+            opts.outDir = argv[i + 1];
+            i += 2;
+            continue;
+        }
+        if (std::strcmp(arg, "--format") == 0) {
+            if (i + 1 >= argc
+                || !image_format_from_name(argv[i + 1], opts.format)) {
+                std::cerr << "Error: --format expects png or rgba."
+                          << std::endl;
+                return false;
+            }
+            i += 2;
+            continue;
+        }
+        if (std::strcmp(arg, "--trace") == 0) {
+            if (i + 1 >= argc) {
+                std::cerr << "Error: --trace expects a path."
+                          << std::endl;
+                return false;
+            }
+            opts.tracePath = argv[i + 1];
+            i += 2;
+            continue;
+        }
+        if (std::strcmp(arg, "--kernel") == 0) {
+            if (i + 1 >= argc
+                || !raster_kernel_from_name(argv[i + 1], opts.kernel)) {
+                std::cerr << "Error: --kernel expects scalar, sse2 "
+                          << "or avx2." << std::endl;
+                return false;
+            }
+            opts.hasKernel = true;
+            i += 2;
+            continue;
+        }
+        if (std::strcmp(arg, "--cull") == 0) {
+            if (i + 1 >= argc
+                || !cull_mode_from_string(argv[i + 1], opts.cullMode)) {
+                std::cerr << "Error: --cull expects none, all or a list"
+                          << " of back, zero, offscreen." << std::endl;
+                return false;
+            }
+            i += 2;
+            continue;
+        }
+        if (arg[0] == '-') {
+            std::cerr << "Error: unknown option " << arg << std::endl;
+            return false;
+        }
+        if (!opts.objPath)
+            opts.objPath = arg;
+        else if (!opts.mtlPath)
+            opts.mtlPath = arg;
+        else {
+            std::cerr << "Error: unexpected argument " << arg
+                      << std::endl;
+            return false;
+        }
+        i++;
+    }
+    if (opts.views.empty())
+        opts.views.push_back({DEFAULT_ANGLE_Y, DEFAULT_ANGLE_X});
+    if (opts.batchPath && opts.objPath) {
+        std::cerr << "Error: --batch takes its models from the manifest."
+                  << std::endl;
+        return false;
+    }
+    if (opts.scenePath && (opts.objPath || opts.batchPath)) {
+        std::cerr << "Error: --scene takes its models from the scene file"
+                  << " and does not mix with --batch." << std::endl;
+        return false;
+    }
+    return opts.objPath != nullptr || opts.batchPath != nullptr
+        || opts.scenePath != nullptr;
+}
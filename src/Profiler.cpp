@@ -0,0 +1,333 @@
+#include "Profiler.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+
+static const std::size_t PROFILE_RING = 1 << 16;
+static const std::size_t PROFILE_WINDOW = 120;
+static const std::size_t PROFILE_STAGES = 64;
+
+struct ProfileEvent {
+    const char *name;
+    std::int64_t startNs;
+    std::int64_t durationNs;
+    unsigned int thread;
+};
+
+#if PROFILE
+/*
+** One event of the ring. seq is n + 1 once event n is fully written
+** and 0 while a writer is on it, so a reader takes an event only when
+** seq reads n + 1 both before and after copying the fields.
+*/
+struct RingSlot {
+    std::atomic<std::uint64_t> seq;
+    std::atomic<const char *> name;
+    std::atomic<std::int64_t> startNs;
+    std::atomic<std::int64_t> durationNs;
+    std::atomic<unsigned int> thread;
+};
+
+/*
+** Rolling window of one stage, kept up to date by record() so that
+** the HUD reads PROFILE_WINDOW values per stage instead of the whole
+** ring. Durations are stored plus one: 0 marks a slot not written yet.
+** Stages are keyed by the name pointer; literals that are equal but
+** not merged by the linker get an entry each and are merged on read.
+*/
+struct StageWindow {
+    std::atomic<const char *> name;
+    std::atomic<std::uint64_t> count;
+    std::atomic<std::int64_t> ns[PROFILE_WINDOW];
+};
+
+static RingSlot g_events[PROFILE_RING];
+static std::atomic<std::uint64_t> g_next(0);
+static StageWindow g_stages[PROFILE_STAGES];
+static std::atomic<std::size_t> g_stageCount(0);
+static std::mutex g_stageLock;
+static std::atomic<unsigned int> g_threads(0);
+static const std::chrono::steady_clock::time_point g_epoch =
+    std::chrono::steady_clock::now();
+
+static unsigned int thread_index()
+{
+    static thread_local unsigned int index = g_threads.fetch_add(1);
+
+    return index;
+}
+
+/* First use of a name; null once PROFILE_STAGES names are taken. */
+static StageWindow *add_stage(const char *name)
+{
+    std::lock_guard<std::mutex> lock(g_stageLock);
+    std::size_t count;
+    std::size_t i;
+
+    count = g_stageCount.load(std::memory_order_relaxed);
+    i = 0;
+    while (i < count) {
+        if (g_stages[i].name.load(std::memory_order_relaxed) == name)
+            return &g_stages[i];
+        i++;
+    }
+    if (count == PROFILE_STAGES)
+        return nullptr;
+    g_stages[count].name.store(name, std::memory_order_relaxed);
+    g_stageCount.store(count + 1, std::memory_order_release);
+    return &g_stages[count];
+}
+
+static StageWindow *find_stage(const char *name)
+{
+    std::size_t count;
+    std::size_t i;
+
+    count = g_stageCount.load(std::memory_order_acquire);
+    i = 0;
+    while (i < count) {
+        if (g_stages[i].name.load(std::memory_order_relaxed) == name)
+            return &g_stages[i];
+        i++;
+    }
+    return add_stage(name);
+}
+
+/* Every event feeds its stage window, one in every reaches the ring. */
+static void record(const char *name,
+                   std::chrono::steady_clock::time_point start,
+                   std::chrono::steady_clock::time_point end,
+                   unsigned int every)
+{
+    StageWindow *stage;
+    RingSlot *e;
+    std::int64_t ns;
+    std::uint64_t k;
+    std::uint64_t n;
+
+    ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        end - start).count();
+    k = 0;
+    stage = find_stage(name);
+    if (stage) {
+        k = stage->count.fetch_add(1, std::memory_order_relaxed);
+        stage->ns[k % PROFILE_WINDOW].store(std::max<std::int64_t>(ns, 0)
+                                            + 1, std::memory_order_relaxed);
+    }
+    if (every > 1 && k % every != 0)
+        return;
+    n = g_next.fetch_add(1, std::memory_order_relaxed);
+    e = &g_events[n % PROFILE_RING];
+    e->seq.store(0, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    e->name.store(name, std::memory_order_relaxed);
+    e->startNs.store(std::chrono::duration_cast<std::chrono::nanoseconds>(
+        start - g_epoch).count(), std::memory_order_relaxed);
+    e->durationNs.store(ns, std::memory_order_relaxed);
+    e->thread.store(thread_index(), std::memory_order_relaxed);
+    e->seq.store(n + 1, std::memory_order_release);
+}
+
+/*
+** Copies event n; false when it is not written yet or already
+** overwritten by a later lap of the ring.
+*/
+static bool read_event(std::uint64_t n, ProfileEvent &out)
+{
+    const RingSlot &e = g_events[n % PROFILE_RING];
+
+    if (e.seq.load(std::memory_order_acquire) != n + 1)
+        return false;
+    out.name = e.name.load(std::memory_order_relaxed);
+    out.startNs = e.startNs.load(std::memory_order_relaxed);
+    out.durationNs = e.durationNs.load(std::memory_order_relaxed);
+    out.thread = e.thread.load(std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return e.seq.load(std::memory_order_relaxed) == n + 1;
+}
+#endif
+
+ScopedTimer::ScopedTimer(const char *name)
+    : m_name(name), m_ms(nullptr), m_every(1),
+      m_start(std::chrono::steady_clock::now())
+{
+}
+
+ScopedTimer::ScopedTimer(const char *name, double &ms)
+    : m_name(name), m_ms(&ms), m_every(1),
+      m_start(std::chrono::steady_clock::now())
+{
+}
+
+ScopedTimer::ScopedTimer(const char *name, unsigned int every)
+    : m_name(name), m_ms(nullptr), m_every(every),
+      m_start(std::chrono::steady_clock::now())
+{
+}
+
+ScopedTimer::~ScopedTimer()
+{
+    std::chrono::steady_clock::time_point end;
+
+    end = std::chrono::steady_clock::now();
+    if (m_ms)
+        *m_ms = std::chrono::duration<double, std::milli>(
+            end - m_start).count();
+#if PROFILE
+    record(m_name, m_start, end, m_every);
+#endif
+}
+
+void profile_record(const char *name,
+                    std::chrono::steady_clock::time_point start,
+                    std::chrono::steady_clock::time_point end)
+{
+#if PROFILE
+    record(name, start, end, 1);
+#else
+    (void)name;
+    (void)start;
+    (void)end;
+#endif
+}
+
+#if PROFILE
+/* Oldest event still in the ring and the count of events kept. */
+static void ring_range(std::uint64_t &first, std::uint64_t &count)
+{
+    std::uint64_t next;
+
+    next = g_next.load(std::memory_order_acquire);
+    count = std::min<std::uint64_t>(next, PROFILE_RING);
+    first = next - count;
+}
+
+struct StageSamples {
+    const char *name;
+    std::vector<double> ms;
+};
+
+static double percentile(std::vector<double> &sorted, unsigned int p)
+{
+    std::size_t rank;
+
+    rank = (sorted.size() * p + 99) / 100;
+    if (rank > 0)
+        rank--;
+    return sorted[rank];
+}
+
+/* Appends the written values of one stage window to the samples. */
+static void read_window(const StageWindow &stage, std::vector<double> &ms)
+{
+    std::uint64_t count;
+    std::int64_t ns;
+    std::size_t i;
+
+    count = std::min<std::uint64_t>(
+        stage.count.load(std::memory_order_relaxed), PROFILE_WINDOW);
+    i = 0;
+    while (i < count) {
+        ns = stage.ns[i].load(std::memory_order_relaxed);
+        if (ns > 0)
+            ms.push_back((double)(ns - 1) / 1e6);
+        i++;
+    }
+}
+#endif
+
+void profile_summary(std::vector<ProfileSummary> &out)
+{
+    out.clear();
+#if PROFILE
+    std::vector<StageSamples> stages;
+    std::size_t count;
+    std::size_t i;
+
+    count = g_stageCount.load(std::memory_order_acquire);
+    i = 0;
+    while (i < count) {
+        const char *name;
+        std::size_t s;
+
+        name = g_stages[i].name.load(std::memory_order_relaxed);
+        s = 0;
+        while (s < stages.size() && std::strcmp(stages[s].name, name))
+            s++;
+        if (s == stages.size())
+            stages.push_back(StageSamples{name, {}});
+        read_window(g_stages[i], stages[s].ms);
+        i++;
+    }
+    for (StageSamples &stage : stages) {
+        ProfileSummary sum;
+        double total;
+
+        if (stage.ms.empty())
+            continue;
+        std::sort(stage.ms.begin(), stage.ms.end());
+        total = 0.0;
+        for (double ms : stage.ms)
+            total += ms;
+        sum.name = stage.name;
+        sum.samples = stage.ms.size();
+        sum.meanMs = total / (double)stage.ms.size();
+        sum.p50Ms = percentile(stage.ms, 50);
+        sum.p99Ms = percentile(stage.ms, 99);
+        out.push_back(sum);
+    }
+#endif
+}
+
+bool profile_write_trace(const std::string &path)
+{
+#if PROFILE
+    std::FILE *file;
+    std::uint64_t first;
+    std::uint64_t count;
+    std::uint64_t i;
+    const char *sep;
+    bool csv;
+    bool ok;
+
+    csv = path.size() >= 4
+        && path.compare(path.size() - 4, 4, ".csv") == 0;
+    file = std::fopen(path.c_str(), "w");
+    if (!file)
+        return false;
+    ring_range(first, count);
+    if (csv)
+        std::fprintf(file, "name,thread,start_us,duration_us\n");
+    else
+        std::fprintf(file, "{\"traceEvents\": [\n");
+    sep = "";
+    i = 0;
+    while (i < count) {
+        ProfileEvent e;
+
+        if (!read_event(first + i, e)) {
+            i++;
+            continue;
+        }
+        if (csv)
+            std::fprintf(file, "%s,%u,%.3f,%.3f\n", e.name, e.thread,
+                         e.startNs / 1e3, e.durationNs / 1e3);
+        else
+            std::fprintf(file, "%s  {\"name\": \"%s\", \"ph\": \"X\", "
+                         "\"pid\": 1, \"tid\": %u, \"ts\": %.3f, "
+                         "\"dur\": %.3f}", sep, e.name, e.thread,
+                         e.startNs / 1e3, e.durationNs / 1e3);
+        sep = ",\n";
+        i++;
+    }
+    if (!csv)
+        std::fprintf(file, "\n]}\n");
+    ok = !std::ferror(file);
+    return std::fclose(file) == 0 && ok;
+#else
+    (void)path;
+    return false;
+#endif
+}
@@ -0,0 +1,649 @@
+#include "Raster.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define RASTER_X86 1
+#include <immintrin.h>
+#else
+#define RASTER_X86 0
+#endif
+
+/*
+** Fixed-point setup.
+** Corners are snapped to 28.4 (1/16 pixel) and the edge functions are
+** evaluated exactly, in integers, at pixel centers: two triangles
+** sharing an edge compute the very same values along it. Edges run
+** V1 -> V2 -> V3 -> V1, the winding normalised so that inside means
+** e >= 0, with e = dx * py - dy * px + c (px, py in 1/16 pixel). The
+** top-left rule is folded into c: the other edges get a -1 bias that
+** turns their e >= 0 into e > 0, so a pixel center on a shared edge
+** is filled by exactly one of the two triangles.
+** Depth stays a float plane z = zA * px + zB * py + zC in pixels,
+** evaluated in every kernel as zA * px + (zB * py + zC) at the pixel
+** center, never stepped: the same pixel gets the same bits whatever
+** the kernel and wherever the tile starts, so depth ties resolve the
+** same way too. (SIMD kernels step px itself by the span width, which
+** is exact: pixel centers are far below 2^22.)
+*/
+static const int SUBPIXEL_BITS = 4;
+static const int SUBPIXEL = 1 << SUBPIXEL_BITS;
+
+/* Corners farther than this from the origin (pixels) are dropped. */
+static const float RASTER_MAX_COORD = 16777216.0f;
+
+/*
+** SIMD kernels evaluate edges up to 7 lanes before minX and 15 past
+** maxX (aligned spans plus the step after the last one).
+*/
+static const int EDGE_MARGIN = 16;
+
+struct FixedTriangle {
+    std::int64_t x[3];
+    std::int64_t y[3];
+    float z[3];
+    std::int64_t area;
+};
+
+/*
+** Int32: the kernels step e / stepX / stepY from (minX, minY).
+** Int64: some value overflows 32 bits (huge triangle), the box is
+** filled by the exact 64-bit scalar loop instead.
+*/
+enum class EdgeFit {
+    Empty,
+    Int32,
+    Int64
+};
+
+struct EdgeSetup {
+    std::int64_t dx[3];
+    std::int64_t dy[3];
+    std::int64_t c[3];
+    std::int32_t e[3];
+    std::int32_t stepX[3];
+    std::int32_t stepY[3];
+    float zA;
+    float zB;
+    float zC;
+    int minX;
+    int minY;
+    int maxX;
+    int maxY;
+};
+
+std::uint32_t pack_rgba(unsigned char r, unsigned char g,
+                        unsigned char b, unsigned char a)
+{
+    unsigned char bytes[4];
+    std::uint32_t packed;
+
+    bytes[0] = r;
+    bytes[1] = g;
+    bytes[2] = b;
+    bytes[3] = a;
+    std::memcpy(&packed, bytes, sizeof(packed));
+    return packed;
+}
+
+static bool snap_coord(float v, std::int64_t &out)
+{
+    if (!(std::fabs(v) <= RASTER_MAX_COORD))
+        return false;
+    out = (std::int64_t)std::lrintf(v * (float)SUBPIXEL);
+    return true;
+}
+
+/*
+** Snaps the corners and orders them so that the area is positive;
+** false for a corner out of range or NaN and for a zero area.
+*/
+static bool snap_triangle(const RasterTriangle &t, FixedTriangle &f)
+{
+    if (!snap_coord(t.x1, f.x[0]) || !snap_coord(t.y1, f.y[0])
+        || !snap_coord(t.x2, f.x[1]) || !snap_coord(t.y2, f.y[1])
+        || !snap_coord(t.x3, f.x[2]) || !snap_coord(t.y3, f.y[2]))
+        return false;
+    f.z[0] = t.z1;
+    f.z[1] = t.z2;
+    f.z[2] = t.z3;
+    f.area = (f.x[1] - f.x[0]) * (f.y[2] - f.y[0])
+        - (f.y[1] - f.y[0]) * (f.x[2] - f.x[0]);
+    if (f.area == 0)
+        return false;
+    if (f.area < 0) {
+        std::swap(f.x[1], f.x[2]);
+        std::swap(f.y[1], f.y[2]);
+        std::swap(f.z[1], f.z[2]);
+        f.area = -f.area;
+    }
+    return true;
+}
+
+/*
+** Pixels whose center lies in [lo, hi] (1/16 pixel), clipped to
+** [clip0, clip1]. False when there is none: sub-pixel triangles that
+** miss every center are rejected here, before any edge is set up.
+*/
+static bool pixel_span(std::int64_t lo, std::int64_t hi,
+                       int clip0, int clip1, int &p0, int &p1)
+{
+    lo = -((SUBPIXEL / 2 - lo) >> SUBPIXEL_BITS);
+    hi = (hi - SUBPIXEL / 2) >> SUBPIXEL_BITS;
+    if (lo < clip0)
+        lo = clip0;
+    if (hi > clip1)
+        hi = clip1;
+    if (lo > hi)
+        return false;
+    p0 = (int)lo;
+    p1 = (int)hi;
+    return true;
+}
+
+static bool pixel_bounds(const FixedTriangle &f,
+                         int clipX0, int clipY0, int clipX1, int clipY1,
+                         int &x0, int &y0, int &x1, int &y1)
+{
+    return pixel_span(std::min(f.x[0], std::min(f.x[1], f.x[2])),
+                      std::max(f.x[0], std::max(f.x[1], f.x[2])),
+                      clipX0, clipX1, x0, x1)
+        && pixel_span(std::min(f.y[0], std::min(f.y[1], f.y[2])),
+                      std::max(f.y[0], std::max(f.y[1], f.y[2])),
+                      clipY0, clipY1, y0, y1);
+}
+
+bool raster_bounds(const RasterTriangle &t,
+                   int clipX0, int clipY0, int clipX1, int clipY1,
+                   int &x0, int &y0, int &x1, int &y1)
+{
+    FixedTriangle f;
+
+    return snap_triangle(t, f)
+        && pixel_bounds(f, clipX0, clipY0, clipX1, clipY1,
+                        x0, y0, x1, y1);
+}
+
+/* Edge i at the center of pixel (x, y), bias included. */
+static std::int64_t edge_at(const EdgeSetup &s, int i, int x, int y)
+{
+    return s.dx[i] * ((std::int64_t)y * SUBPIXEL + SUBPIXEL / 2)
+        - s.dy[i] * ((std::int64_t)x * SUBPIXEL + SUBPIXEL / 2) + s.c[i];
+}
+
+/*
+** Range of edge i over the box. An edge negative on the whole box
+** rejects the triangle; one non-negative on the whole box always
+** passes and is dropped (zero value and steps). Otherwise it is
+** stepped on 32 bits when every value a kernel computes fits.
+*/
+static EdgeFit fit_edge(EdgeSetup &s, int i)
+{
+    std::int64_t e;
+    std::int64_t sx;
+    std::int64_t sy;
+    std::int64_t lo;
+    std::int64_t hi;
+    std::int64_t margin;
+
+    e = edge_at(s, i, s.minX, s.minY);
+    sx = -s.dy[i] * SUBPIXEL;
+    sy = s.dx[i] * SUBPIXEL;
+    lo = e + std::min<std::int64_t>(0, sx * (s.maxX - s.minX))
+        + std::min<std::int64_t>(0, sy * (s.maxY - s.minY));
+    hi = e + std::max<std::int64_t>(0, sx * (s.maxX - s.minX))
+        + std::max<std::int64_t>(0, sy * (s.maxY - s.minY));
+    if (hi < 0)
+        return EdgeFit::Empty;
+    s.e[i] = 0;
+    s.stepX[i] = 0;
+    s.stepY[i] = 0;
+    if (lo >= 0)
+        return EdgeFit::Int32;
+    margin = std::abs(sx) * EDGE_MARGIN + std::abs(sy);
+    if (lo - margin < INT32_MIN || hi + margin > INT32_MAX)
+        return EdgeFit::Int64;
+    s.e[i] = (std::int32_t)e;
+    s.stepX[i] = (std::int32_t)sx;
+    s.stepY[i] = (std::int32_t)sy;
+    return EdgeFit::Int32;
+}
+
+static EdgeFit setup_edges(const RasterTriangle &t,
+                           const RasterTarget &target, EdgeSetup &s)
+{
+    FixedTriangle f;
+    EdgeFit fit;
+    EdgeFit edge;
+    double inv;
+    int i;
+    int j;
+
+    if (!snap_triangle(t, f)
+        || !pixel_bounds(f, target.clipX0, target.clipY0,
+                         target.clipX1, target.clipY1,
+                         s.minX, s.minY, s.maxX, s.maxY))
+        return EdgeFit::Empty;
+    i = 0;
+    while (i < 3) {
+        j = i == 2 ? 0 : i + 1;
+        s.dx[i] = f.x[j] - f.x[i];
+        s.dy[i] = f.y[j] - f.y[i];
+        s.c[i] = s.dy[i] * f.x[i] - s.dx[i] * f.y[i];
+        if (!(s.dy[i] < 0 || (s.dy[i] == 0 && s.dx[i] > 0)))
+            s.c[i] -= 1;
+        i++;
+    }
+    /* the weight of corner k is the edge opposite to it over the area */
+    inv = (double)SUBPIXEL / (double)f.area;
+    s.zA = (float)(-((double)s.dy[1] * f.z[0] + (double)s.dy[2] * f.z[1]
+                     + (double)s.dy[0] * f.z[2]) * inv);
+    s.zB = (float)(((double)s.dx[1] * f.z[0] + (double)s.dx[2] * f.z[1]
+                    + (double)s.dx[0] * f.z[2]) * inv);
+    s.zC = (float)(f.z[0] - (double)s.zA * f.x[0] / SUBPIXEL
+                   - (double)s.zB * f.y[0] / SUBPIXEL);
+    if (!std::isfinite(s.zA) || !std::isfinite(s.zB)
+        || !std::isfinite(s.zC))
+        return EdgeFit::Empty;
+    fit = EdgeFit::Int32;
+    i = 0;
+    while (i < 3) {
+        edge = fit_edge(s, i);
+        if (edge == EdgeFit::Empty)
+            return EdgeFit::Empty;
+        if (edge == EdgeFit::Int64)
+            fit = EdgeFit::Int64;
+        i++;
+    }
+    return fit;
+}
+
+/*
+** Scalar kernel, on 32-bit steps or, for Int64 boxes, on exact 64-bit
+** values. A pixel is inside when no edge value has its sign bit set.
+*/
+template <typename Int>
+static void raster_rows(const EdgeSetup &s, const Int start[3],
+                        const Int stepX[3], const Int stepY[3],
+                        const RasterTarget &target, std::uint32_t color)
+{
+    Int row[3];
+    int x;
+    int y;
+
+    row[0] = start[0];
+    row[1] = start[1];
+    row[2] = start[2];
+    y = s.minY;
+    while (y <= s.maxY) {
+        Int e0;
+        Int e1;
+        Int e2;
+        float rowZ;
+        float z;
+        std::uint32_t *crow;
+        float *zrow;
+
+        e0 = row[0];
+        e1 = row[1];
+        e2 = row[2];
+        rowZ = s.zB * ((float)y + 0.5f) + s.zC;
+        crow = target.color + (std::size_t)y * target.colorStride;
+        zrow = target.depth
+            + (std::size_t)(y - target.depthY0) * target.depthStride;
+        x = s.minX;
+        while (x <= s.maxX) {
+            z = s.zA * ((float)x + 0.5f) + rowZ;
+            if ((e0 | e1 | e2) >= 0 && z < zrow[x - target.depthX0]) {
+                zrow[x - target.depthX0] = z;
+                crow[x] = color;
+            }
+            e0 += stepX[0];
+            e1 += stepX[1];
+            e2 += stepX[2];
+            x++;
+        }
+        row[0] += stepY[0];
+        row[1] += stepY[1];
+        row[2] += stepY[2];
+        y++;
+    }
+}
+
+static void raster_wide(const EdgeSetup &s, const RasterTarget &target,
+                        std::uint32_t color)
+{
+    std::int64_t start[3];
+    std::int64_t stepX[3];
+    std::int64_t stepY[3];
+    int i;
+
+    i = 0;
+    while (i < 3) {
+        start[i] = edge_at(s, i, s.minX, s.minY);
+        stepX[i] = -s.dy[i] * SUBPIXEL;
+        stepY[i] = s.dx[i] * SUBPIXEL;
+        i++;
+    }
+    raster_rows(s, start, stepX, stepY, target, color);
+}
+
+static void raster_scalar(const EdgeSetup &s, const RasterTarget &target,
+                          std::uint32_t color)
+{
+    raster_rows(s, s.e, s.stepX, s.stepY, target, color);
+}
+
+#if RASTER_X86
+
+/* One pixel of a row whose edges are row[] at minX. */
+static void fill_pixel(const EdgeSetup &s, const RasterTarget &target,
+                       std::uint32_t color, const std::int32_t row[3],
+                       int x, int y)
+{
+    std::int32_t e0;
+    std::int32_t e1;
+    std::int32_t e2;
+    float z;
+    float *zp;
+
+    e0 = row[0] + (x - s.minX) * s.stepX[0];
+    e1 = row[1] + (x - s.minX) * s.stepX[1];
+    e2 = row[2] + (x - s.minX) * s.stepX[2];
+    if ((e0 | e1 | e2) < 0)
+        return;
+    z = s.zA * ((float)x + 0.5f) + (s.zB * ((float)y + 0.5f) + s.zC);
+    zp = target.depth
+        + (std::size_t)(y - target.depthY0) * target.depthStride
+        + (std::size_t)(x - target.depthX0);
+    if (z < *zp) {
+        *zp = z;
+        target.color[(std::size_t)y * target.colorStride
+                     + (std::size_t)x] = color;
+    }
+}
+
+/*
+** Spans are aligned on clipX0 so that every full span lies inside the
+** clip rectangle; only the last span of a row can stick out past
+** clipX1 and is then finished pixel by pixel.
+*/
+__attribute__((target("sse2")))
+static void raster_sse2(const EdgeSetup &s, const RasterTarget &target,
+                        std::uint32_t color)
+{
+    __m128 lane;
+    __m128i lanei;
+    __m128i laneE[3];
+    __m128i stepE[3];
+    __m128 stepX;
+    __m128 zA;
+    __m128i colori;
+    std::int32_t row[3];
+    int x;
+    int y;
+    int xs;
+    int i;
+
+    lane = _mm_set_ps(3.0f, 2.0f, 1.0f, 0.0f);
+    lanei = _mm_set_epi32(3, 2, 1, 0);
+    i = 0;
+    while (i < 3) {
+        laneE[i] = _mm_set_epi32(s.stepX[i] * 3, s.stepX[i] * 2,
+                                 s.stepX[i], 0);
+        stepE[i] = _mm_set1_epi32(s.stepX[i] * 4);
+        row[i] = s.e[i];
+        i++;
+    }
+    stepX = _mm_set1_ps(4.0f);
+    zA = _mm_set1_ps(s.zA);
+    colori = _mm_set1_epi32((int)color);
+    xs = target.clipX0 + ((s.minX - target.clipX0) & ~3);
+    y = s.minY;
+    while (y <= s.maxY) {
+        __m128 px;
+        __m128 rowZ;
+        __m128i e[3];
+        std::uint32_t *crow;
+        float *zrow;
+
+        px = _mm_add_ps(_mm_set1_ps((float)xs + 0.5f), lane);
+        rowZ = _mm_set1_ps(s.zB * ((float)y + 0.5f) + s.zC);
+        i = 0;
+        while (i < 3) {
+            e[i] = _mm_add_epi32(
+                _mm_set1_epi32(row[i] + (xs - s.minX) * s.stepX[i]),
+                laneE[i]);
+            i++;
+        }
+        crow = target.color + (std::size_t)y * target.colorStride;
+        zrow = target.depth
+            + (std::size_t)(y - target.depthY0) * target.depthStride;
+        x = xs;
+        while (x <= s.maxX) {
+            __m128i xi;
+            __m128i mi;
+            __m128 m;
+            __m128 z;
+            __m128 depth;
+            int bits;
+
+            if (x + 3 > target.clipX1) {
+                i = x < s.minX ? s.minX : x;
+                while (i <= s.maxX) {
+                    fill_pixel(s, target, color, row, i, y);
+                    i++;
+                }
+                break;
+            }
+            /* sign bits of the edges, lanes outside [minX, maxX] */
+            xi = _mm_add_epi32(_mm_set1_epi32(x), lanei);
+            mi = _mm_or_si128(e[0], _mm_or_si128(e[1], e[2]));
+            mi = _mm_andnot_si128(
+                _mm_srai_epi32(mi, 31),
+                _mm_andnot_si128(
+                    _mm_cmpgt_epi32(_mm_set1_epi32(s.minX), xi),
+                    _mm_cmpgt_epi32(_mm_set1_epi32(s.maxX + 1), xi)));
+            m = _mm_castsi128_ps(mi);
+            if (_mm_movemask_ps(m)) {
+                z = _mm_add_ps(_mm_mul_ps(zA, px), rowZ);
+                depth = _mm_loadu_ps(zrow + (x - target.depthX0));
+                m = _mm_and_ps(m, _mm_cmplt_ps(z, depth));
+                bits = _mm_movemask_ps(m);
+                if (bits) {
+                    __m128i dst;
+
+                    depth = _mm_or_ps(_mm_and_ps(m, z),
+                                      _mm_andnot_ps(m, depth));
+                    _mm_storeu_ps(zrow + (x - target.depthX0), depth);
+                    mi = _mm_castps_si128(m);
+                    dst = _mm_loadu_si128((__m128i *)(crow + x));
+                    dst = _mm_or_si128(_mm_and_si128(mi, colori),
+                                       _mm_andnot_si128(mi, dst));
+                    _mm_storeu_si128((__m128i *)(crow + x), dst);
+                }
+            }
+            e[0] = _mm_add_epi32(e[0], stepE[0]);
+            e[1] = _mm_add_epi32(e[1], stepE[1]);
+            e[2] = _mm_add_epi32(e[2], stepE[2]);
+            px = _mm_add_ps(px, stepX);
+            x += 4;
+        }
+        row[0] += s.stepY[0];
+        row[1] += s.stepY[1];
+        row[2] += s.stepY[2];
+        y++;
+    }
+}
+
+__attribute__((target("avx2")))
+static void raster_avx2(const EdgeSetup &s, const RasterTarget &target,
+                        std::uint32_t color)
+{
+    __m256 lane;
+    __m256i lanei;
+    __m256i laneE[3];
+    __m256i stepE[3];
+    __m256 stepX;
+    __m256 zA;
+    __m256 colorf;
+    std::int32_t row[3];
+    int x;
+    int y;
+    int xs;
+    int i;
+
+    lane = _mm256_set_ps(7.0f, 6.0f, 5.0f, 4.0f,
+                         3.0f, 2.0f, 1.0f, 0.0f);
+    lanei = _mm256_set_epi32(7, 6, 5, 4, 3, 2, 1, 0);
+    i = 0;
+    while (i < 3) {
+        laneE[i] = _mm256_mullo_epi32(_mm256_set1_epi32(s.stepX[i]),
+                                      lanei);
+        stepE[i] = _mm256_set1_epi32(s.stepX[i] * 8);
+        row[i] = s.e[i];
+        i++;
+    }
+    stepX = _mm256_set1_ps(8.0f);
+    zA = _mm256_set1_ps(s.zA);
+    colorf = _mm256_castsi256_ps(_mm256_set1_epi32((int)color));
+    xs = target.clipX0 + ((s.minX - target.clipX0) & ~7);
+    y = s.minY;
+    while (y <= s.maxY) {
+        __m256 px;
+        __m256 rowZ;
+        __m256i e[3];
+        std::uint32_t *crow;
+        float *zrow;
+
+        px = _mm256_add_ps(_mm256_set1_ps((float)xs + 0.5f), lane);
+        rowZ = _mm256_set1_ps(s.zB * ((float)y + 0.5f) + s.zC);
+        i = 0;
+        while (i < 3) {
+            e[i] = _mm256_add_epi32(
+                _mm256_set1_epi32(row[i] + (xs - s.minX) * s.stepX[i]),
+                laneE[i]);
+            i++;
+        }
+        crow = target.color + (std::size_t)y * target.colorStride;
+        zrow = target.depth
+            + (std::size_t)(y - target.depthY0) * target.depthStride;
+        x = xs;
+        while (x <= s.maxX) {
+            __m256i xi;
+            __m256i mi;
+            __m256 m;
+            __m256 z;
+            __m256 depth;
+
+            /* sign bits of the edges, lanes outside [minX, maxX] */
+            xi = _mm256_add_epi32(_mm256_set1_epi32(x), lanei);
+            mi = _mm256_or_si256(e[0], _mm256_or_si256(e[1], e[2]));
+            mi = _mm256_andnot_si256(
+                _mm256_srai_epi32(mi, 31),
+                _mm256_andnot_si256(
+                    _mm256_cmpgt_epi32(_mm256_set1_epi32(s.minX), xi),
+                    _mm256_cmpgt_epi32(_mm256_set1_epi32(s.maxX + 1),
+                                       xi)));
+            if (_mm256_movemask_ps(_mm256_castsi256_ps(mi))) {
+                z = _mm256_add_ps(_mm256_mul_ps(zA, px), rowZ);
+                depth = _mm256_maskload_ps(zrow + (x - target.depthX0), mi);
+                m = _mm256_and_ps(_mm256_castsi256_ps(mi),
+                                  _mm256_cmp_ps(z, depth, _CMP_LT_OQ));
+                if (_mm256_movemask_ps(m)) {
+                    mi = _mm256_castps_si256(m);
+                    _mm256_maskstore_ps(zrow + (x - target.depthX0),
+                                        mi, z);
+                    _mm256_maskstore_ps((float *)(crow + x), mi, colorf);
+                }
+            }
+            e[0] = _mm256_add_epi32(e[0], stepE[0]);
+            e[1] = _mm256_add_epi32(e[1], stepE[1]);
+            e[2] = _mm256_add_epi32(e[2], stepE[2]);
+            px = _mm256_add_ps(px, stepX);
+            x += 8;
+        }
+        row[0] += s.stepY[0];
+        row[1] += s.stepY[1];
+        row[2] += s.stepY[2];
+        y++;
+    }
+}
+
+#endif
+
+bool raster_kernel_supported(RasterKernel kernel)
+{
+    if (kernel == RasterKernel::Scalar)
+        return true;
+#if RASTER_X86
+    __builtin_cpu_init();
+    if (kernel == RasterKernel::SSE2)
+        return __builtin_cpu_supports("sse2");
+    if (kernel == RasterKernel::AVX2)
+        return __builtin_cpu_supports("avx2");
+#endif
+    return false;
+}
+
+RasterKernel raster_best_kernel()
+{
+    if (raster_kernel_supported(RasterKernel::AVX2))
+        return RasterKernel::AVX2;
+    if (raster_kernel_supported(RasterKernel::SSE2))
+        return RasterKernel::SSE2;
+    return RasterKernel::Scalar;
+}
+
+const char *raster_kernel_name(RasterKernel kernel)
+{
+    if (kernel == RasterKernel::SSE2)
+        return "sse2";
+    if (kernel == RasterKernel::AVX2)
+        return "avx2";
+    return "scalar";
+}
+
+bool raster_kernel_from_name(const char *name, RasterKernel &kernel)
+{
+    if (std::strcmp(name, "scalar") == 0)
+        kernel = RasterKernel::Scalar;
+    else if (std::strcmp(name, "sse2") == 0)
+        kernel = RasterKernel::SSE2;
+    else if (std::strcmp(name, "avx2") == 0)
+        kernel = RasterKernel::AVX2;
+    else
+        return false;
+    return true;
+}
+
+void raster_triangle(RasterKernel kernel, const RasterTriangle &t,
+                     const RasterTarget &target)
+{
+    EdgeSetup s;
+    EdgeFit fit;
+
+    fit = setup_edges(t, target, s);
+    if (fit == EdgeFit::Empty)
+        return;
+    if (fit == EdgeFit::Int64) {
+        raster_wide(s, target, t.color);
+        return;
+    }
+#if RASTER_X86
+    if (kernel == RasterKernel::AVX2) {
+        raster_avx2(s, target, t.color);
+        return;
+    }
+    if (kernel == RasterKernel::SSE2) {
+        raster_sse2(s, target, t.color);
+        return;
+    }
+#else
+    (void)kernel;
+#endif
+    raster_scalar(s, target, t.color);
+}
@@ -1,285 +1,242 @@
 #include "Renderer.hpp"
-#include "Math.hpp"
-#include <vector>
-#include <limits>
-#include <cmath>
-#include <algorithm>
-
-struct TriData {
-    Vec3 w1;
-    Vec3 w2;
-    Vec3 w3;
-    Vec2 p1;
-    Vec2 p2;
-    Vec2 p3;
-    float intensity;
-    unsigned char baseR;
-    unsigned char baseG;
-    unsigned char baseB;
-};
+#include "AllocStats.hpp"
+#include "Profiler.hpp"
+#include <cstdint>
 
 Renderer::Renderer()
+    : m_edgeLines(sf::PrimitiveType::Lines)
 {
-    m_model = nullptr;
-    m_angleY = 0.0f;
-    m_angleX = 0.0f;
-    m_zoom = 1.0f;
-    m_showEdges = false;
+    m_drawEdgeLines = false;
+    m_inputPending = false;
 }
 
 void Renderer::setModel(const Model *model)
 {
-    m_model = model;
+    m_pipeline.setModel(model);
+}
+
+void Renderer::setScene(const Scene *scene)
+{
+    m_pipeline.setScene(scene);
 }
 
 void Renderer::setAngles(float angleY, float angleX)
 {
-    m_angleY = angleY;
-    m_angleX = angleX;
+    m_pipeline.setAngles(angleY, angleX);
 }
 
 void Renderer::setZoom(float zoom)
 {
-    m_zoom = zoom;
+    m_pipeline.setZoom(zoom);
 }
 
-void Renderer::setShowEdges(bool showEdges)
+void Renderer::setEdgeMode(EdgeMode mode)
 {
-    m_showEdges = showEdges;
+    m_pipeline.setEdgeMode(mode);
 }
 
-static float compute_intensity(const Vec3 &w1,
-                               const Vec3 &w2,
-                               const Vec3 &w3)
+EdgeMode Renderer::getEdgeMode() const
 {
-    Vec3 e1;
-    Vec3 e2;
-    Vec3 n;
-    Vec3 lightDir;
-    float dot;
-    float intensity;
-
-    e1 = sub_vec3(w2, w1);
-    e2 = sub_vec3(w3, w1);
-    n = cross_vec3(e1, e2);
-    n = normalize_vec3(n);
-    lightDir = make_vec3(0.4f, 0.7f, -0.6f);
-    lightDir = normalize_vec3(lightDir);
-    dot = dot_vec3(n, lightDir);
-    if (dot < 0.0f)
-        dot = 0.0f;
-    intensity = 0.3f + 0.7f * dot;
-    return intensity;
+    return m_pipeline.getEdgeMode();
 }
 
-static void build_triangles(const Model *model,
-                            float angleY, float angleX,
-                            float zoom,
-                            float width, float height,
-                            std::vector<TriData> &out)
+void Renderer::setThreadCount(unsigned int threads)
 {
-    const std::vector<Vec3> *verts;
-    const std::vector<Face> *faces;
-    Vec3 camOffset;
-    std::size_t i;
-
-    verts = &model->getVertices();
-    faces = &model->getFaces();
-    out.clear();
-    out.reserve(faces->size());
-    camOffset = make_vec3(0.0f, 0.0f, 4.0f);
-    i = 0;
-    while (i < faces->size()) {
-        const Face &f = (*faces)[i];
-        TriData t;
-        Vec3 wCenter;
-        float cr;
-        float cg;
-        float cb;
-
-        t.w1 = rotate_xy((*verts)[f.a], angleY, angleX);
-        t.w2 = rotate_xy((*verts)[f.b], angleY, angleX);
-        t.w3 = rotate_xy((*verts)[f.c], angleY, angleX);
-        t.w1 = translate(t.w1, camOffset);
-        t.w2 = translate(t.w2, camOffset);
-        t.w3 = translate(t.w3, camOffset);
-        t.p1 = project_perspective(t.w1, zoom, width, height);
-        t.p2 = project_perspective(t.w2, zoom, width, height);
-        t.p3 = project_perspective(t.w3, zoom, width, height);
-        t.intensity = compute_intensity(t.w1, t.w2, t.w3);
-        wCenter.x = (t.w1.x + t.w2.x + t.w3.x) / 3.0f;
-        wCenter.y = (t.w1.y + t.w2.y + t.w3.y) / 3.0f;
-        wCenter.z = (t.w1.z + t.w2.z + t.w3.z) / 3.0f;
-        model->getFaceColor((int)i, cr, cg, cb);
-        if (!model->hasMaterial()) {
-            cr = 1.0f;
-            cg = 1.0f;
-            cb = 1.0f;
-        }
-        t.baseR = (unsigned char)(cr * 255.0f);
-        t.baseG = (unsigned char)(cg * 255.0f);
-        t.baseB = (unsigned char)(cb * 255.0f);
-        out.push_back(t);
-        i++;
-    }
-    std::sort(out.begin(), out.end(),
-              [](const TriData &a, const TriData &b) {
-                  float za;
-                  float zb;
-
-                  za = (a.w1.z + a.w2.z + a.w3.z) / 3.0f;
-                  zb = (b.w1.z + b.w2.z + b.w3.z) / 3.0f;
-                  return za > zb;
-              });
+    m_pipeline.setThreadCount(threads);
 }
 
-static void raster_triangle(const TriData &t,
-                            std::vector<float> &zbuf,
-                            sf::Image &image,
-                            unsigned int w, unsigned int h)
+unsigned int Renderer::getThreadCount() const
 {
-    float minX;
-    float maxX;
-    float minY;
-    float maxY;
-    int x;
-    int y;
-
-    minX = std::floor(std::fmin(t.p1.x, std::fmin(t.p2.x, t.p3.x)));
-    maxX = std::ceil(std::fmax(t.p1.x, std::fmax(t.p2.x, t.p3.x)));
-    minY = std::floor(std::fmin(t.p1.y, std::fmin(t.p2.y, t.p3.y)));
-    maxY = std::ceil(std::fmax(t.p1.y, std::fmax(t.p2.y, t.p3.y)));
-    if (minX < 0.0f)
-        minX = 0.0f;
-    if (minY < 0.0f)
-        minY = 0.0f;
-    if (maxX > (float)(w - 1))
-        maxX = (float)(w - 1);
-    if (maxY > (float)(h - 1))
-        maxY = (float)(h - 1);
-    y = (int)minY;
-    while (y <= (int)maxY) {
-        x = (int)minX;
-        while (x <= (int)maxX) {
-            float px;
-            float py;
-            float denom;
-            float w1;
-            float w2;
-            float w3;
-            float z;
-            unsigned int idx;
-            float k;
-            unsigned char r;
-            unsigned char g;
-            unsigned char b;
-            sf::Color col;
-
-            px = (float)x + 0.5f;
-            py = (float)y + 0.5f;
-            denom = (t.p2.y - t.p3.y) * (t.p1.x - t.p3.x)
-                + (t.p3.x - t.p2.x) * (t.p1.y - t.p3.y);
-            if (denom == 0.0f) {
-                x++;
-                continue;
-            }
-            w1 = ((t.p2.y - t.p3.y) * (px - t.p3.x)
-                + (t.p3.x - t.p2.x) * (py - t.p3.y))
-                / denom;
-            w2 = ((t.p3.y - t.p1.y) * (px - t.p3.x)
-                + (t.p1.x - t.p3.x) * (py - t.p3.y))
-                / denom;
-            w3 = 1.0f - w1 - w2;
-            if (w1 < 0.0f || w2 < 0.0f || w3 < 0.0f) {
-                x++;
+    return m_pipeline.getThreadCount();
+}
+
+ThreadPool &Renderer::getThreadPool()
+{
+    return m_pipeline.getThreadPool();
+}
+
+void Renderer::setRasterKernel(RasterKernel kernel)
+{
+    m_pipeline.setRasterKernel(kernel);
+}
+
+RasterKernel Renderer::getRasterKernel() const
+{
+    return m_pipeline.getRasterKernel();
+}
+
+void Renderer::setCullMode(unsigned int mode)
+{
+    m_pipeline.setCullMode(mode);
+}
+
+unsigned int Renderer::getCullMode() const
+{
+    return m_pipeline.getCullMode();
+}
+
+void Renderer::setDepthSort(DepthSort sort)
+{
+    m_pipeline.setDepthSort(sort);
+}
+
+DepthSort Renderer::getDepthSort() const
+{
+    return m_pipeline.getDepthSort();
+}
+
+void Renderer::setShading(ShadingMode mode)
+{
+    m_pipeline.setShading(mode);
+}
+
+ShadingMode Renderer::getShading() const
+{
+    return m_pipeline.getShading();
+}
+
+void Renderer::setHighlightFace(int instance, int face)
+{
+    m_pipeline.setHighlightFace(instance, face);
+}
+
+void Renderer::setLod(int level)
+{
+    m_pipeline.setLod(level);
+}
+
+int Renderer::pick(float x, float y, int &instance)
+{
+    return m_pipeline.pick(x, y, instance);
+}
+
+void Renderer::setPipelined(bool pipelined)
+{
+    m_pipeline.setPipelined(pipelined);
+}
+
+bool Renderer::isPipelined() const
+{
+    return m_pipeline.isPipelined();
+}
+
+bool Renderer::isBusy() const
+{
+    return m_pipeline.busy();
+}
+
+void Renderer::markInput()
+{
+    m_pipeline.markInput(FramePipeline::Clock::now());
+}
+
+/*
+** Every unique edge of the level each instance is drawn at, hidden
+** ones included, from the vertex positions of the current frame.
+*/
+void Renderer::buildEdgeLines(const CpuRenderer &frame)
+{
+    const FrameContext &fc = frame.getFrame();
+    const VertexStream &v = fc.verts;
+    sf::Vertex line[2];
+    std::size_t a;
+    std::size_t b;
+
+    m_edgeLines.clear();
+    line[0].color = sf::Color::White;
+    line[1].color = sf::Color::White;
+    for (const FrameInstance &inst : fc.instances) {
+        for (const Edge &e : inst.model->getLodEdges(inst.lod)) {
+            a = inst.firstVertex + e.a;
+            b = inst.firstVertex + e.b;
+            if (v.z[a] < NEAR_PLANE || v.z[b] < NEAR_PLANE)
                 continue;
-            }
-            z = w1 * t.w1.z + w2 * t.w2.z + w3 * t.w3.z;
-            idx = (unsigned int)y * w + (unsigned int)x;
-            if (z < zbuf[idx]) {
-                zbuf[idx] = z;
-                k = t.intensity;
-                if (k < 0.0f)
-                    k = 0.0f;
-                if (k > 1.0f)
-                    k = 1.0f;
-                r = (unsigned char)(t.baseR * k);
-                g = (unsigned char)(t.baseG * k);
-                b = (unsigned char)(t.baseB * k);
-                col = sf::Color(r, g, b);
-                image.setPixel(sf::Vector2u((unsigned int)x,
-                                            (unsigned int)y),
-                               col);
-            }
-            x++;
+            line[0].position = sf::Vector2f(v.sx[a], v.sy[a]);
+            line[1].position = sf::Vector2f(v.sx[b], v.sy[b]);
+            m_edgeLines.append(line[0]);
+            m_edgeLines.append(line[1]);
         }
-        y++;
     }
 }
 
-static void draw_wireframe(sf::RenderWindow &window,
-                           const std::vector<TriData> &tris)
+bool Renderer::prepareTexture(unsigned int w, unsigned int h)
 {
-    sf::Vertex line[2];
-    sf::Color col;
-    std::size_t i;
-
-    col = sf::Color::White;
-    i = 0;
-    while (i < tris.size()) {
-        const TriData &t = tris[i];
-
-        line[0].position = sf::Vector2f(t.p1.x, t.p1.y);
-        line[1].position = sf::Vector2f(t.p2.x, t.p2.y);
-        line[0].color = col;
-        line[1].color = col;
-        window.draw(line, 2, sf::PrimitiveType::Lines);
-        line[0].position = sf::Vector2f(t.p2.x, t.p2.y);
-        line[1].position = sf::Vector2f(t.p3.x, t.p3.y);
-        window.draw(line, 2, sf::PrimitiveType::Lines);
-        line[0].position = sf::Vector2f(t.p3.x, t.p3.y);
-        line[1].position = sf::Vector2f(t.p1.x, t.p1.y);
-        window.draw(line, 2, sf::PrimitiveType::Lines);
-        i++;
-    }
+    if (m_texture.getSize().x == w && m_texture.getSize().y == h)
+        return true;
+    if (!m_texture.resize(sf::Vector2u(w, h)))
+        return false;
+    if (m_sprite)
+        m_sprite->setTexture(m_texture, true);
+    else
+        m_sprite.emplace(m_texture);
+    return true;
 }
 
-void Renderer::render(sf::RenderWindow &window) const
+/*
+** A frame out of the pipeline is uploaded (and its edge lines built)
+** before it is released to the pipeline again; in between, the last
+** texture is drawn and the frame counts as reused.
+*/
+void Renderer::render(sf::RenderWindow &window)
 {
-    const Model *model;
+    const CpuRenderer *frame;
     sf::Vector2u size;
-    unsigned int w;
-    unsigned int h;
-    std::vector<TriData> tris;
-    std::vector<float> zbuf;
-    sf::Image image;
-    sf::Texture texture;
-    sf::Sprite sprite(texture);
-    unsigned int count;
-    unsigned int i;
-    bool ok;
-
-    model = m_model;
-    if (!model)
-        return;
+    AllocStats before;
+    RenderStats last;
+
+    PROFILE_SCOPE("frame");
     size = window.getSize();
-    w = size.x;
-    h = size.y;
-    build_triangles(model, m_angleY, m_angleX, m_zoom,
-                    (float)w, (float)h, tris);
-    count = w * h;
-    zbuf.assign(count, std::numeric_limits<float>::infinity());
-    image = sf::Image(sf::Vector2u(w, h), sf::Color::Black);
-    i = 0;
-    while (i < tris.size()) {
-        raster_triangle(tris[i], zbuf, image, w, h);
-        i++;
-    }
-    ok = texture.loadFromImage(image);
-    (void)ok;
-    sprite = sf::Sprite(texture);
-    window.draw(sprite);
-    if (m_showEdges) {
-        draw_wireframe(window, tris);
+    m_pipeline.submit(size.x, size.y);
+    frame = m_pipeline.acquire(false);
+    last = m_stats;
+    if (frame) {
+        const FrameContext &fc = frame->getFrame();
+
+        m_stats = frame->getStats();
+        m_stats.framesRendered = last.framesRendered + 1;
+        m_stats.framesSkipped = last.framesSkipped;
+        m_stats.latencyMs = last.latencyMs;
+        m_inputPending = m_pipeline.acquiredInput(m_input);
+        if (prepareTexture(fc.width, fc.height)) {
+            ScopedTimer timer("upload", m_stats.uploadMs);
+
+            before = alloc_stats();
+            m_texture.update((const std::uint8_t *)fc.pixels.data());
+            m_stats.allocations += alloc_stats().count - before.count;
+        }
+        m_drawEdgeLines = frame->getEdgeMode() == EdgeMode::All;
+        m_stats.edgesMs = 0.0;
+        if (m_drawEdgeLines) {
+            ScopedTimer timer("edges", m_stats.edgesMs);
+
+            buildEdgeLines(*frame);
+        }
+        m_pipeline.release();
+    } else {
+        m_stats.reused = true;
+        m_stats.framesSkipped++;
     }
+    if (!m_sprite)
+        return;
+    window.draw(*m_sprite);
+    if (m_drawEdgeLines)
+        window.draw(m_edgeLines);
+}
+
+void Renderer::framePresented()
+{
+    FramePipeline::Clock::time_point now;
+
+    if (!m_inputPending)
+        return;
+    now = FramePipeline::Clock::now();
+    m_stats.latencyMs = std::chrono::duration<double, std::milli>(
+        now - m_input).count();
+    profile_record("latency", m_input, now);
+    m_inputPending = false;
+}
+
+const RenderStats &Renderer::getStats() const
+{
+    return m_stats;
 }
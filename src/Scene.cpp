@@ -0,0 +1,318 @@
+#include "Scene.hpp"
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+static const float DEG_TO_RAD = 3.14159265f / 180.0f;
+
+/* One write per message so lines of parallel loads do not interleave. */
+static void warn(const std::string &message)
+{
+    std::cerr << ("Warning: " + message + "\n");
+}
+
+static bool fail(const std::string &where, const std::string &message)
+{
+    std::cerr << "Error: " << where << ": " << message << std::endl;
+    return false;
+}
+
+bool load_model(const Options &opts, const std::string &objPath,
+                const std::string &mtlPath, ThreadPool *pool,
+                Model &model)
+{
+    if (!opts.useCache
+        || !model.loadCache(objPath, mtlPath, opts.optimize,
+                            opts.quantize)) {
+        if (!mtlPath.empty() && !model.loadFromMtl(mtlPath))
+            warn(mtlPath + ": failed to load MTL, rendering in white.");
+        if (!model.loadFromObj(objPath, pool, opts.optimize,
+                               opts.quantize)) {
+            warn(objPath + ": failed to load OBJ file.");
+            return false;
+        }
+    }
+    if (opts.useCache && !model.getLoadStats().fromCache
+        && !model.saveCache(objPath, mtlPath))
+        warn(objPath + ": could not write the mesh cache.");
+    return true;
+}
+
+void print_load_stats(const Model &model)
+{
+    const LoadStats &ls = model.getLoadStats();
+
+    if (ls.fromCache)
+        std::cerr << "Info: loaded " << ls.bytes / 1e6 << " MB from "
+                  << "cache in " << ls.ms << " ms." << std::endl;
+    else
+        std::cerr << "Info: parsed " << ls.bytes / 1e6 << " MB in "
+                  << ls.ms << " ms (" << ls.mbPerSec << " MB/s, "
+                  << ls.chunks << " chunks on " << ls.threads
+                  << " threads), BVH " << ls.bvhNodes << " nodes in "
+                  << ls.bvhMs << " ms, " << ls.lodLevels
+                  << " LOD levels in " << ls.lodMs << " ms." << std::endl;
+    if (!ls.fromCache && ls.optimized)
+        std::cerr << "Info: optimized in " << ls.optimizeMs << " ms, "
+                  << ls.weldedVertices << " vertices welded, ACMR "
+                  << ls.acmrBefore << " -> " << ls.acmrAfter << "."
+                  << std::endl;
+    std::cerr << "Info: mesh uses " << model.getMeshBytes() / 1e6
+              << " MB (" << (model.getLodIndices(0).isWide() ? 32 : 16)
+              << "-bit indices, "
+              << (model.getPositions().isQuantized() ? "16-bit" : "float")
+              << " positions)." << std::endl;
+    std::cerr << "Info: load made " << ls.allocations
+              << " allocations (" << ls.allocatedBytes / 1e6
+              << " MB), peak resident " << ls.peakRss / 1e6 << " MB"
+              << (ls.peakRssOfLoad ? "" : " (process)") << "."
+              << std::endl;
+}
+
+Scene::Scene()
+{
+}
+
+/*
+** Reads value unless the line ends first, keeping its default then.
+** False on anything but a number.
+*/
+static bool read_optional(std::istringstream &iss, float &value)
+{
+    iss >> std::ws;
+    if (iss.eof())
+        return true;
+    return static_cast<bool>(iss >> value);
+}
+
+static bool at_end(std::istringstream &iss)
+{
+    iss >> std::ws;
+    return iss.eof();
+}
+
+/* "OBJ [TAB MTL]", the rest of a mesh line. */
+static bool read_paths(std::istringstream &iss, std::string &objPath,
+                       std::string &mtlPath)
+{
+    std::string rest;
+    std::size_t tab;
+
+    iss >> std::ws;
+    std::getline(iss, rest);
+    tab = rest.find('\t');
+    objPath = rest.substr(0, tab);
+    mtlPath.clear();
+    if (tab != std::string::npos)
+        mtlPath = rest.substr(tab + 1);
+    return !objPath.empty();
+}
+
+bool Scene::findMesh(const std::string &name, const std::string &where,
+                     unsigned int &mesh) const
+{
+    std::vector<std::string>::const_iterator it;
+
+    it = std::find(m_names.begin(), m_names.end(), name);
+    if (it == m_names.end())
+        return fail(where, "no mesh named " + name);
+    mesh = (unsigned int)(it - m_names.begin());
+    return true;
+}
+
+bool Scene::parseLine(const std::string &line, const std::string &where,
+                      std::vector<std::string> &objPaths,
+                      std::vector<std::string> &mtlPaths)
+{
+    std::istringstream iss(line);
+    std::string keyword;
+    std::string name;
+    SceneInstance inst;
+
+    iss >> keyword;
+    if (keyword.empty() || keyword[0] == '#')
+        return true;
+    if (!(iss >> name))
+        return fail(where, keyword + " expects a mesh name");
+    if (keyword == "mesh") {
+        std::string objPath;
+        std::string mtlPath;
+
+        if (std::find(m_names.begin(), m_names.end(), name)
+            != m_names.end())
+            return fail(where, "mesh " + name + " is already defined");
+        if (!read_paths(iss, objPath, mtlPath))
+            return fail(where, "mesh expects NAME OBJ [TAB MTL]");
+        m_names.push_back(name);
+        objPaths.push_back(objPath);
+        mtlPaths.push_back(mtlPath);
+        return true;
+    }
+    if (!findMesh(name, where, inst.mesh))
+        return false;
+    if (keyword == "instance") {
+        if (!(iss >> inst.position.x >> inst.position.y
+              >> inst.position.z)
+            || !read_optional(iss, inst.yaw)
+            || !read_optional(iss, inst.scale) || !at_end(iss)
+            || !(inst.scale > 0.0f) || !std::isfinite(inst.scale))
+            return fail(where, "instance expects NAME X Y Z [YAW [SCALE]]"
+                        " with SCALE > 0");
+        inst.yaw *= DEG_TO_RAD;
+        m_instances.push_back(inst);
+        return true;
+    }
+    if (keyword == "grid") {
+        int columns;
+        int rows;
+        float spacing;
+        int r;
+        int c;
+
+        if (!(iss >> columns >> rows >> spacing)
+            || !read_optional(iss, inst.scale) || !at_end(iss)
+            || columns <= 0 || rows <= 0 || !(spacing > 0.0f)
+            || !(inst.scale > 0.0f) || !std::isfinite(inst.scale))
+            return fail(where, "grid expects NAME COLUMNS ROWS SPACING "
+                        "[SCALE], all > 0");
+        r = 0;
+        while (r < rows) {
+            c = 0;
+            while (c < columns) {
+                inst.position = make_vec3(
+                    ((float)c - (float)(columns - 1) * 0.5f) * spacing,
+                    0.0f,
+                    ((float)r - (float)(rows - 1) * 0.5f) * spacing);
+                m_instances.push_back(inst);
+                c++;
+            }
+            r++;
+        }
+        return true;
+    }
+    return fail(where, "unknown keyword " + keyword);
+}
+
+bool Scene::load(const std::string &path, const Options &opts,
+                 ThreadPool *pool)
+{
+    std::ifstream file(path);
+    std::vector<std::string> objPaths;
+    std::vector<std::string> mtlPaths;
+    std::vector<std::size_t> placed;
+    std::string line;
+    std::size_t number;
+    std::size_t i;
+
+    m_meshes.clear();
+    m_names.clear();
+    m_instances.clear();
+    if (!file)
+        return fail(path, "cannot read the scene");
+    number = 0;
+    while (std::getline(file, line)) {
+        number++;
+        if (!line.empty() && line.back() == '\r')
+            line.pop_back();
+        if (!parseLine(line, path + ":" + std::to_string(number),
+                       objPaths, mtlPaths))
+            return false;
+    }
+    if (m_instances.empty())
+        return fail(path, "no instance in the scene");
+    placed.assign(m_names.size(), 0);
+    for (const SceneInstance &inst : m_instances)
+        placed[inst.mesh]++;
+    i = 0;
+    while (i < m_names.size()) {
+        if (placed[i] == 0)
+            warn(path + ": mesh " + m_names[i] + " is never placed.");
+        m_meshes.push_back(std::make_unique<Model>());
+        if (!load_model(opts, objPaths[i], mtlPaths[i], pool,
+                        *m_meshes.back()))
+            return fail(path, "cannot load mesh " + m_names[i]);
+        i++;
+    }
+    fit();
+    return true;
+}
+
+/*
+** Moves the center of the instances' bounding spheres to the origin
+** and scales the layout down (or up) until they all fit in a sphere
+** of MODEL_RADIUS, the one of a lone model.
+*/
+void Scene::fit()
+{
+    Vec3 lo;
+    Vec3 hi;
+    Vec3 center;
+    float radius;
+    float r;
+    float k;
+
+    lo = m_instances[0].position;
+    hi = lo;
+    for (const SceneInstance &inst : m_instances) {
+        r = MODEL_RADIUS * inst.scale;
+        lo.x = std::min(lo.x, inst.position.x - r);
+        lo.y = std::min(lo.y, inst.position.y - r);
+        lo.z = std::min(lo.z, inst.position.z - r);
+        hi.x = std::max(hi.x, inst.position.x + r);
+        hi.y = std::max(hi.y, inst.position.y + r);
+        hi.z = std::max(hi.z, inst.position.z + r);
+    }
+    center = mul_vec3(make_vec3(lo.x + hi.x, lo.y + hi.y, lo.z + hi.z),
+                      0.5f);
+    radius = 0.0f;
+    for (const SceneInstance &inst : m_instances) {
+        Vec3 d;
+
+        d = sub_vec3(inst.position, center);
+        radius = std::max(radius, std::sqrt(dot_vec3(d, d))
+                          + MODEL_RADIUS * inst.scale);
+    }
+    k = MODEL_RADIUS / radius;
+    for (SceneInstance &inst : m_instances) {
+        inst.position = mul_vec3(sub_vec3(inst.position, center), k);
+        inst.scale *= k;
+    }
+}
+
+std::size_t Scene::getMeshCount() const
+{
+    return m_meshes.size();
+}
+
+const Model &Scene::getMesh(std::size_t mesh) const
+{
+    return *m_meshes[mesh];
+}
+
+const std::string &Scene::getMeshName(std::size_t mesh) const
+{
+    return m_names[mesh];
+}
+
+const std::vector<SceneInstance> &Scene::getInstances() const
+{
+    return m_instances;
+}
+
+std::size_t Scene::getMeshBytes() const
+{
+    std::size_t bytes;
+
+    bytes = 0;
+    for (const std::unique_ptr<Model> &mesh : m_meshes)
+        bytes += mesh->getMeshBytes();
+    return bytes;
+}
+
+void Scene::prepareEdges()
+{
+    for (std::unique_ptr<Model> &mesh : m_meshes)
+        mesh->prepareEdges();
+}
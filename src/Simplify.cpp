@@ -0,0 +1,587 @@
+#include "Simplify.hpp"
+#include "ThreadPool.hpp"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <numeric>
+
+static const std::size_t LOD_MIN_FACES = 4096;
+static const std::size_t LOD_MAX_LEVELS = 8;
+static const float LOD_MIN_SHRINK = 0.8f;
+static const int LOD_MAX_PASSES = 16;
+static const float LOD_BORDER_WEIGHT = 10.0f;
+static const std::size_t LOD_BLOCK = 1 << 14;
+
+enum VertexKind {
+    KIND_UNUSED,
+    KIND_INTERIOR,
+    KIND_BORDER,
+    KIND_LOCKED
+};
+
+/* Symmetric 4x4 error quadric, upper triangle row by row, + weight. */
+struct Quadric {
+    float q[10];
+    float w;
+};
+
+/* Faces around every vertex: list[first[v] .. first[v + 1]). */
+struct Adjacency {
+    std::vector<unsigned int> first;
+    std::vector<unsigned int> list;
+};
+
+/* Edge from the vertex being looked at to v. */
+struct Neighbor {
+    unsigned int v;
+    unsigned int faces;
+    int mat;
+    bool mixed;
+};
+
+/* Cheapest allowed move of vertex from onto its neighbor to. */
+struct Collapse {
+    unsigned int from;
+    unsigned int to;
+    float cost;
+};
+
+static unsigned int corner(const Face &f, int k)
+{
+    if (k == 0)
+        return (unsigned int)f.a;
+    if (k == 1)
+        return (unsigned int)f.b;
+    return (unsigned int)f.c;
+}
+
+static bool has_corner(const Face &f, unsigned int v)
+{
+    return corner(f, 0) == v || corner(f, 1) == v || corner(f, 2) == v;
+}
+
+static bool is_degenerate(const Face &f)
+{
+    return f.a == f.b || f.b == f.c || f.a == f.c;
+}
+
+static void build_adjacency(const std::vector<Face> &faces,
+                            std::size_t vertexCount, Adjacency &adj)
+{
+    std::vector<unsigned int> cursor;
+    std::size_t i;
+    int k;
+
+    adj.first.assign(vertexCount + 1, 0);
+    for (const Face &f : faces) {
+        k = 0;
+        while (k < 3) {
+            adj.first[corner(f, k) + 1]++;
+            k++;
+        }
+    }
+    i = 0;
+    while (i < vertexCount) {
+        adj.first[i + 1] += adj.first[i];
+        i++;
+    }
+    adj.list.resize(adj.first[vertexCount]);
+    cursor.assign(adj.first.begin(), adj.first.end() - 1);
+    i = 0;
+    while (i < faces.size()) {
+        k = 0;
+        while (k < 3) {
+            adj.list[cursor[corner(faces[i], k)]++] = (unsigned int)i;
+            k++;
+        }
+        i++;
+    }
+}
+
+/* Edges of u with how many faces share each, and whether mats differ. */
+static void gather_neighbors(const Adjacency &adj,
+                             const std::vector<Face> &faces,
+                             unsigned int u, std::vector<Neighbor> &out)
+{
+    unsigned int i;
+    int k;
+
+    out.clear();
+    i = adj.first[u];
+    while (i < adj.first[u + 1]) {
+        const Face &f = faces[adj.list[i]];
+
+        k = 0;
+        while (k < 3) {
+            unsigned int w;
+            std::size_t n;
+
+            w = corner(f, k);
+            if (w == u) {
+                k++;
+                continue;
+            }
+            n = 0;
+            while (n < out.size() && out[n].v != w)
+                n++;
+            if (n == out.size()) {
+                out.push_back({w, 1, f.mat, false});
+            } else {
+                out[n].faces++;
+                if (out[n].mat != f.mat)
+                    out[n].mixed = true;
+            }
+            k++;
+        }
+        i++;
+    }
+}
+
+static bool is_border_edge(const Neighbor &n)
+{
+    return n.faces == 1 || n.mixed;
+}
+
+/*
+** Interior vertices are surrounded by one material. Border vertices
+** sit on exactly one open or material boundary line; anything else
+** (boundary corners, junctions, non-manifold edges) is locked.
+*/
+static unsigned char classify(const std::vector<Neighbor> &nbrs)
+{
+    int borders;
+
+    if (nbrs.empty())
+        return KIND_UNUSED;
+    borders = 0;
+    for (const Neighbor &n : nbrs) {
+        if (n.faces > 2)
+            return KIND_LOCKED;
+        if (is_border_edge(n))
+            borders++;
+    }
+    if (borders == 0)
+        return KIND_INTERIOR;
+    if (borders == 2)
+        return KIND_BORDER;
+    return KIND_LOCKED;
+}
+
+static void classify_vertices(const Adjacency &adj,
+                              const std::vector<Face> &faces,
+                              std::vector<unsigned char> &kinds,
+                              ThreadPool *pool)
+{
+    std::size_t blocks;
+
+    kinds.resize(adj.first.size() - 1);
+    blocks = (kinds.size() + LOD_BLOCK - 1) / LOD_BLOCK;
+    auto job = [&](std::size_t blk) {
+        std::vector<Neighbor> nbrs;
+        std::size_t end;
+        std::size_t v;
+
+        end = std::min(kinds.size(), (blk + 1) * LOD_BLOCK);
+        v = blk * LOD_BLOCK;
+        while (v < end) {
+            gather_neighbors(adj, faces, (unsigned int)v, nbrs);
+            kinds[v] = classify(nbrs);
+            v++;
+        }
+    };
+    parallel_for(pool, blocks, job);
+}
+
+static void add_plane(Quadric &q, const Vec3 &n, float d, float w)
+{
+    q.q[0] += w * n.x * n.x;
+    q.q[1] += w * n.x * n.y;
+    q.q[2] += w * n.x * n.z;
+    q.q[3] += w * n.x * d;
+    q.q[4] += w * n.y * n.y;
+    q.q[5] += w * n.y * n.z;
+    q.q[6] += w * n.y * d;
+    q.q[7] += w * n.z * n.z;
+    q.q[8] += w * n.z * d;
+    q.q[9] += w * d * d;
+    q.w += w;
+}
+
+static void add_quadric(Quadric &dst, const Quadric &src)
+{
+    int i;
+
+    i = 0;
+    while (i < 10) {
+        dst.q[i] += src.q[i];
+        i++;
+    }
+    dst.w += src.w;
+}
+
+static float eval_quadric(const Quadric &q, const Vec3 &p)
+{
+    return q.q[0] * p.x * p.x + 2.0f * q.q[1] * p.x * p.y
+        + 2.0f * q.q[2] * p.x * p.z + 2.0f * q.q[3] * p.x
+        + q.q[4] * p.y * p.y + 2.0f * q.q[5] * p.y * p.z
+        + 2.0f * q.q[6] * p.y + q.q[7] * p.z * p.z
+        + 2.0f * q.q[8] * p.z + q.q[9];
+}
+
+static Vec3 face_normal(const Vec3 &p0, const Vec3 &p1, const Vec3 &p2)
+{
+    return cross_vec3(sub_vec3(p1, p0), sub_vec3(p2, p0));
+}
+
+/* Plane through border edge u-v, perpendicular to face f, on both. */
+static void add_border_plane(const std::vector<Vec3> &vertices,
+                             const Face &f, unsigned int u, unsigned int v,
+                             std::vector<Quadric> &quads)
+{
+    Vec3 e;
+    Vec3 n;
+    float len;
+    float d;
+
+    e = sub_vec3(vertices[v], vertices[u]);
+    n = cross_vec3(e, face_normal(vertices[f.a], vertices[f.b],
+                                  vertices[f.c]));
+    len = std::sqrt(dot_vec3(n, n));
+    if (!(len > 0.0f))
+        return;
+    n = mul_vec3(n, 1.0f / len);
+    d = -dot_vec3(n, vertices[u]);
+    add_plane(quads[u], n, d, dot_vec3(e, e) * LOD_BORDER_WEIGHT);
+    add_plane(quads[v], n, d, dot_vec3(e, e) * LOD_BORDER_WEIGHT);
+}
+
+/*
+** Area-weighted face planes on every corner, plus the border planes
+** that keep border vertices from drifting off the border line.
+*/
+static void compute_quadrics(const std::vector<Vec3> &vertices,
+                             const std::vector<Face> &faces,
+                             const Adjacency &adj,
+                             const std::vector<unsigned char> &kinds,
+                             std::vector<Quadric> &quads)
+{
+    std::vector<Neighbor> nbrs;
+    Quadric zero;
+    unsigned int u;
+    int k;
+
+    std::fill(zero.q, zero.q + 10, 0.0f);
+    zero.w = 0.0f;
+    quads.assign(vertices.size(), zero);
+    for (const Face &f : faces) {
+        Vec3 n;
+        float len;
+
+        n = face_normal(vertices[f.a], vertices[f.b], vertices[f.c]);
+        len = std::sqrt(dot_vec3(n, n));
+        if (!(len > 0.0f))
+            continue;
+        n = mul_vec3(n, 1.0f / len);
+        k = 0;
+        while (k < 3) {
+            add_plane(quads[corner(f, k)], n,
+                      -dot_vec3(n, vertices[f.a]), len * 0.5f);
+            k++;
+        }
+    }
+    u = 0;
+    while (u < kinds.size()) {
+        if (kinds[u] == KIND_INTERIOR || kinds[u] == KIND_UNUSED) {
+            u++;
+            continue;
+        }
+        gather_neighbors(adj, faces, u, nbrs);
+        for (const Neighbor &nb : nbrs) {
+            unsigned int i;
+
+            if (!is_border_edge(nb) || nb.v < u)
+                continue;
+            i = adj.first[u];
+            while (!has_corner(faces[adj.list[i]], nb.v))
+                i++;
+            add_border_plane(vertices, faces[adj.list[i]], u, nb.v, quads);
+        }
+        u++;
+    }
+}
+
+/*
+** The edge u-v may collapse only if the vertices both ends share are
+** the tips of the faces on the edge; any other common neighbor would
+** fold the surface into a non-manifold fin. Walks the faces of v
+** against the neighbors of u, so a high-valence v stays cheap.
+*/
+static bool link_ok(const Adjacency &adj, const std::vector<Face> &faces,
+                    const std::vector<Neighbor> &nu, const Neighbor &edge,
+                    std::vector<unsigned char> &seen)
+{
+    unsigned int common;
+    unsigned int i;
+    std::size_t n;
+    int k;
+
+    seen.assign(nu.size(), 0);
+    i = adj.first[edge.v];
+    while (i < adj.first[edge.v + 1]) {
+        const Face &f = faces[adj.list[i]];
+
+        k = 0;
+        while (k < 3) {
+            n = 0;
+            while (n < nu.size() && nu[n].v != corner(f, k))
+                n++;
+            if (n < nu.size() && nu[n].v != edge.v)
+                seen[n] = 1;
+            k++;
+        }
+        i++;
+    }
+    common = 0;
+    n = 0;
+    while (n < seen.size()) {
+        common += seen[n];
+        n++;
+    }
+    return common == edge.faces;
+}
+
+/* Per-thread buffers of find_collapses(). */
+struct Scratch {
+    std::vector<Neighbor> nu;
+    std::vector<float> costs;
+    std::vector<unsigned char> seen;
+};
+
+/*
+** Classifies u and finds its cheapest collapse. Candidates are tried
+** in cost order, so usually only the first one pays for the link test.
+*/
+static void best_collapse(const std::vector<Vec3> &vertices,
+                          const std::vector<Face> &faces,
+                          const Adjacency &adj,
+                          const std::vector<Quadric> &quads, unsigned int u,
+                          unsigned char &kind, Collapse &best, Scratch &s)
+{
+    float inf;
+    std::size_t k;
+
+    inf = std::numeric_limits<float>::infinity();
+    best.from = u;
+    best.to = u;
+    best.cost = inf;
+    gather_neighbors(adj, faces, u, s.nu);
+    kind = classify(s.nu);
+    if (kind != KIND_INTERIOR && kind != KIND_BORDER)
+        return;
+    s.costs.resize(s.nu.size());
+    k = 0;
+    while (k < s.nu.size()) {
+        const Neighbor &n = s.nu[k];
+
+        s.costs[k] = inf;
+        if (kind == KIND_INTERIOR || is_border_edge(n))
+            s.costs[k] = std::max(0.0f,
+                                  eval_quadric(quads[u], vertices[n.v])
+                                  + eval_quadric(quads[n.v], vertices[n.v]));
+        k++;
+    }
+    while (true) {
+        k = (std::size_t)(std::min_element(s.costs.begin(), s.costs.end())
+                          - s.costs.begin());
+        if (s.costs[k] == inf)
+            return;
+        if (link_ok(adj, faces, s.nu, s.nu[k], s.seen)) {
+            best.to = s.nu[k].v;
+            best.cost = s.costs[k];
+            return;
+        }
+        s.costs[k] = inf;
+    }
+}
+
+static void find_collapses(const std::vector<Vec3> &vertices,
+                           const std::vector<Face> &faces,
+                           const Adjacency &adj,
+                           const std::vector<Quadric> &quads,
+                           std::vector<unsigned char> &kinds,
+                           std::vector<Collapse> &out, ThreadPool *pool)
+{
+    std::size_t blocks;
+
+    kinds.resize(vertices.size());
+    out.resize(vertices.size());
+    blocks = (vertices.size() + LOD_BLOCK - 1) / LOD_BLOCK;
+    auto job = [&](std::size_t blk) {
+        Scratch scratch;
+        std::size_t end;
+        std::size_t u;
+
+        end = std::min(vertices.size(), (blk + 1) * LOD_BLOCK);
+        u = blk * LOD_BLOCK;
+        while (u < end) {
+            best_collapse(vertices, faces, adj, quads, (unsigned int)u,
+                          kinds[u], out[u], scratch);
+            u++;
+        }
+    };
+    parallel_for(pool, blocks, job);
+}
+
+/* True if moving u onto v turns any surviving face of u over. */
+static bool collapse_flips(const std::vector<Vec3> &vertices,
+                           const std::vector<Face> &faces,
+                           const Adjacency &adj, unsigned int u,
+                           unsigned int v)
+{
+    unsigned int i;
+
+    i = adj.first[u];
+    while (i < adj.first[u + 1]) {
+        const Face &f = faces[adj.list[i]];
+        Vec3 p[3];
+        Vec3 before;
+        int k;
+
+        i++;
+        if (has_corner(f, v))
+            continue;
+        k = 0;
+        while (k < 3) {
+            p[k] = vertices[corner(f, k)];
+            k++;
+        }
+        before = face_normal(p[0], p[1], p[2]);
+        k = 0;
+        while (k < 3) {
+            if (corner(f, k) == u)
+                p[k] = vertices[v];
+            k++;
+        }
+        if (dot_vec3(before, face_normal(p[0], p[1], p[2])) <= 0.0f)
+            return true;
+    }
+    return false;
+}
+
+/*
+** One pass: the cheapest collapses are applied in order, skipping any
+** that touches a face already changed in this pass so the flip test
+** always sees final positions. Returns the number of faces removed.
+*/
+static std::size_t collapse_pass(const std::vector<Vec3> &vertices,
+                                 std::vector<Face> &faces,
+                                 std::vector<Quadric> &quads,
+                                 std::size_t target, float &error,
+                                 ThreadPool *pool)
+{
+    Adjacency adj;
+    std::vector<unsigned char> kinds;
+    std::vector<Collapse> collapses;
+    std::vector<unsigned int> remap;
+    std::vector<unsigned char> touched;
+    std::size_t removed;
+    std::size_t kept;
+    std::size_t i;
+
+    build_adjacency(faces, vertices.size(), adj);
+    find_collapses(vertices, faces, adj, quads, kinds, collapses, pool);
+    collapses.erase(std::remove_if(collapses.begin(), collapses.end(),
+                                   [](const Collapse &c) {
+                                       return c.from == c.to;
+                                   }),
+                    collapses.end());
+    std::sort(collapses.begin(), collapses.end(),
+              [](const Collapse &a, const Collapse &b) {
+                  return a.cost < b.cost;
+              });
+    remap.resize(vertices.size());
+    std::iota(remap.begin(), remap.end(), 0u);
+    touched.assign(vertices.size(), 0);
+    removed = 0;
+    for (const Collapse &c : collapses) {
+        float w;
+
+        if (faces.size() - removed <= target)
+            break;
+        if (touched[c.from] || touched[c.to]
+            || collapse_flips(vertices, faces, adj, c.from, c.to))
+            continue;
+        remap[c.from] = c.to;
+        w = quads[c.from].w + quads[c.to].w;
+        add_quadric(quads[c.to], quads[c.from]);
+        if (w > 0.0f && std::sqrt(c.cost / w) > error)
+            error = std::sqrt(c.cost / w);
+        i = adj.first[c.from];
+        while (i < adj.first[c.from + 1]) {
+            const Face &f = faces[adj.list[i]];
+
+            touched[f.a] = 1;
+            touched[f.b] = 1;
+            touched[f.c] = 1;
+            if (has_corner(f, c.to))
+                removed++;
+            i++;
+        }
+    }
+    kept = 0;
+    i = 0;
+    while (i < faces.size()) {
+        Face f;
+
+        f = faces[i];
+        f.a = (int)remap[f.a];
+        f.b = (int)remap[f.b];
+        f.c = (int)remap[f.c];
+        if (!is_degenerate(f))
+            faces[kept++] = f;
+        i++;
+    }
+    faces.resize(kept);
+    return removed;
+}
+
+void build_lod_chain(const std::vector<Vec3> &vertices,
+                     const std::vector<Face> &faces,
+                     std::vector<LodLevel> &levels, ThreadPool *pool)
+{
+    std::vector<Face> work;
+    std::vector<Quadric> quads;
+    Adjacency adj;
+    std::vector<unsigned char> kinds;
+    float error;
+
+    levels.clear();
+    if (faces.size() < LOD_MIN_FACES * 2)
+        return;
+    work.reserve(faces.size());
+    for (const Face &f : faces) {
+        if (!is_degenerate(f))
+            work.push_back(f);
+    }
+    build_adjacency(work, vertices.size(), adj);
+    classify_vertices(adj, work, kinds, pool);
+    compute_quadrics(vertices, work, adj, kinds, quads);
+    error = 0.0f;
+    while (levels.size() < LOD_MAX_LEVELS
+           && work.size() >= LOD_MIN_FACES * 2) {
+        std::size_t before;
+        int pass;
+
+        before = work.size();
+        pass = 0;
+        while (pass < LOD_MAX_PASSES && work.size() > before / 2
+               && collapse_pass(vertices, work, quads, before / 2, error,
+                                pool) > 0)
+            pass++;
+        if ((float)work.size() > (float)before * LOD_MIN_SHRINK)
+            break;
+        levels.emplace_back();
+        levels.back().faces = work;
+        levels.back().error = error;
+    }
+}
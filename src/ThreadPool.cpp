@@ -0,0 +1,205 @@
+#include "ThreadPool.hpp"
+
+/*
+** Pool whose items this thread is running, if any. A job calling
+** parallelFor() on that same pool runs its items inline (the pool is
+** busy with the outer call); another pool runs them in parallel.
+*/
+static thread_local const ThreadPool *t_pool = nullptr;
+
+ThreadPool::ThreadPool(unsigned int threadCount)
+    : m_threads(),
+      m_queues(),
+      m_submit(),
+      m_mutex(),
+      m_wake(),
+      m_done(),
+      m_jobFn(nullptr),
+      m_job(nullptr),
+      m_pending(0),
+      m_busy(0),
+      m_generation(0),
+      m_stop(false)
+{
+    unsigned int i;
+
+    threadCount = clampThreadCount(threadCount);
+    i = 0;
+    while (i < threadCount) {
+        m_queues.push_back(std::make_unique<Queue>());
+        i++;
+    }
+    i = 1;
+    while (i < threadCount) {
+        m_threads.emplace_back(&ThreadPool::workerLoop, this, i);
+        i++;
+    }
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> guard(m_mutex);
+        m_stop = true;
+    }
+    m_wake.notify_all();
+    for (std::thread &t : m_threads)
+        t.join();
+}
+
+unsigned int ThreadPool::getThreadCount() const
+{
+    return (unsigned int)m_queues.size();
+}
+
+unsigned int ThreadPool::defaultThreadCount()
+{
+    unsigned int n;
+
+    n = std::thread::hardware_concurrency();
+    if (n == 0)
+        n = 1;
+    return n;
+}
+
+unsigned int ThreadPool::clampThreadCount(unsigned int threadCount)
+{
+    unsigned int most;
+
+    most = defaultThreadCount() * MAX_THREADS_PER_CORE;
+    if (threadCount > most)
+        return most;
+    return threadCount == 0 ? 1 : threadCount;
+}
+
+bool ThreadPool::popLocal(unsigned int id, std::size_t &item)
+{
+    Queue &q = *m_queues[id];
+    std::lock_guard<std::mutex> guard(q.lock);
+
+    if (q.head == q.items.size())
+        return false;
+    item = q.items.back();
+    q.items.pop_back();
+    return true;
+}
+
+bool ThreadPool::steal(unsigned int id, std::size_t &item)
+{
+    std::size_t n;
+    std::size_t k;
+
+    n = m_queues.size();
+    k = 1;
+    while (k < n) {
+        Queue &q = *m_queues[(id + k) % n];
+        std::lock_guard<std::mutex> guard(q.lock);
+
+        if (q.head < q.items.size()) {
+            item = q.items[q.head];
+            q.head++;
+            return true;
+        }
+        k++;
+    }
+    return false;
+}
+
+void ThreadPool::runItems(unsigned int id)
+{
+    std::size_t item;
+
+    while (popLocal(id, item) || steal(id, item)) {
+        m_jobFn(m_job, item);
+        m_pending.fetch_sub(1, std::memory_order_acq_rel);
+    }
+}
+
+void ThreadPool::workerLoop(unsigned int id)
+{
+    unsigned long seen;
+
+    t_pool = this;
+    seen = 0;
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+
+            m_wake.wait(lock, [&]() {
+                return m_stop || m_generation != seen;
+            });
+            if (m_stop)
+                return;
+            seen = m_generation;
+            m_busy++;
+        }
+        runItems(id);
+        {
+            std::lock_guard<std::mutex> guard(m_mutex);
+
+            m_busy--;
+        }
+        m_done.notify_all();
+    }
+}
+
+void ThreadPool::run(std::size_t count, JobFn fn, const void *job)
+{
+    const ThreadPool *outer;
+    std::size_t i;
+    std::size_t n;
+
+    if (count == 0)
+        return;
+    if (m_threads.empty() || count == 1 || t_pool == this) {
+        i = 0;
+        while (i < count) {
+            fn(job, i);
+            i++;
+        }
+        return;
+    }
+    std::lock_guard<std::mutex> submit(m_submit);
+    {
+        std::lock_guard<std::mutex> guard(m_mutex);
+
+        m_jobFn = fn;
+        m_job = job;
+        m_pending.store(count, std::memory_order_release);
+    }
+    n = m_queues.size();
+    for (std::unique_ptr<Queue> &q : m_queues) {
+        std::lock_guard<std::mutex> guard(q->lock);
+
+        q->items.clear();
+        q->head = 0;
+    }
+    i = 0;
+    while (i < count) {
+        Queue &q = *m_queues[i % n];
+        std::lock_guard<std::mutex> guard(q.lock);
+
+        q.items.push_back(i);
+        i++;
+    }
+    {
+        std::lock_guard<std::mutex> guard(m_mutex);
+
+        m_generation++;
+    }
+    m_wake.notify_all();
+    outer = t_pool;
+    t_pool = this;
+    runItems(0);
+    t_pool = outer;
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+
+        m_done.wait(lock, [&]() {
+            return m_busy == 0
+                && m_pending.load(std::memory_order_acquire) == 0;
+        });
+        m_jobFn = nullptr;
+        m_job = nullptr;
+    }
+}
@@ -0,0 +1,326 @@
+#include "TriangleSetup.hpp"
+#include "Raster.hpp"
+#include <cstring>
+
+static float compute_intensity(const Vec3 &w1,
+                               const Vec3 &w2,
+                               const Vec3 &w3)
+{
+    Vec3 e1;
+    Vec3 e2;
+    Vec3 n;
+    Vec3 lightDir;
+    float dot;
+    float intensity;
+
+    e1 = sub_vec3(w2, w1);
+    e2 = sub_vec3(w3, w1);
+    n = cross_vec3(e1, e2);
+    n = normalize_vec3(n);
+    lightDir = make_vec3(0.4f, 0.7f, -0.6f);
+    lightDir = normalize_vec3(lightDir);
+    dot = dot_vec3(n, lightDir);
+    if (dot < 0.0f)
+        dot = 0.0f;
+    intensity = 0.3f + 0.7f * dot;
+    return intensity;
+}
+
+/* base is the face's material color (Model::getPalette()). */
+static std::uint32_t face_color(std::uint32_t base, const Vec3 &w1,
+                                const Vec3 &w2, const Vec3 &w3)
+{
+    const unsigned char *c;
+    float k;
+
+    k = compute_intensity(w1, w2, w3);
+    if (k < 0.0f)
+        k = 0.0f;
+    if (k > 1.0f)
+        k = 1.0f;
+    c = reinterpret_cast<const unsigned char *>(&base);
+    return pack_rgba((unsigned char)(c[0] * k),
+                     (unsigned char)(c[1] * k),
+                     (unsigned char)(c[2] * k), 255);
+}
+
+/* Picked face: keep the shading, push the color towards orange. */
+static std::uint32_t highlight_color(std::uint32_t color)
+{
+    const unsigned char *c;
+
+    c = reinterpret_cast<const unsigned char *>(&color);
+    return pack_rgba((unsigned char)((c[0] + 255) / 2),
+                     (unsigned char)((c[1] + 140) / 2),
+                     (unsigned char)(c[2] / 4), 255);
+}
+
+std::uint32_t shade_face(std::uint32_t base, const Vec3 &w1,
+                         const Vec3 &w2, const Vec3 &w3, bool highlight)
+{
+    std::uint32_t color;
+
+    color = face_color(base, w1, w2, w3);
+    if (highlight)
+        color = highlight_color(color);
+    return color;
+}
+
+static Vec3 stream_vec3(const VertexStream &vs, std::size_t i)
+{
+    return make_vec3(vs.x[i], vs.y[i], vs.z[i]);
+}
+
+static Vec2 stream_vec2(const VertexStream &vs, std::size_t i)
+{
+    return make_vec2(vs.sx[i], vs.sy[i]);
+}
+
+/*
+** The camera sits at the origin of view space, so a face is turned
+** away from it when its normal points the same way as the ray to any
+** of its corners. Works for faces crossing the near plane too, where
+** the screen-space winding is meaningless.
+*/
+static bool is_back_face(const Vec3 &w1, const Vec3 &w2, const Vec3 &w3)
+{
+    Vec3 n;
+
+    n = cross_vec3(sub_vec3(w2, w1), sub_vec3(w3, w1));
+    return dot_vec3(n, w1) > 0.0f;
+}
+
+/*
+** Sutherland-Hodgman against z >= NEAR_PLANE for a triangle with one
+** or two corners behind it; returns the 3 or 4 corners of the result
+** in the original winding.
+*/
+static int clip_near(const Vec3 in[3], Vec3 out[4])
+{
+    int n;
+    int i;
+
+    n = 0;
+    i = 0;
+    while (i < 3) {
+        const Vec3 &a = in[i];
+        const Vec3 &b = in[(i + 1) % 3];
+        bool aIn;
+        bool bIn;
+
+        aIn = a.z >= NEAR_PLANE;
+        bIn = b.z >= NEAR_PLANE;
+        if (aIn)
+            out[n++] = a;
+        if (aIn != bIn) {
+            float t;
+
+            t = (NEAR_PLANE - a.z) / (b.z - a.z);
+            out[n] = make_vec3(a.x + (b.x - a.x) * t,
+                               a.y + (b.y - a.y) * t, NEAR_PLANE);
+            n++;
+        }
+        i++;
+    }
+    return n;
+}
+
+/* Zero-area and off-screen tests; returns false if t is culled. */
+static bool keep_triangle(const TriData &t, unsigned int cullMode,
+                          float width, float height, SetupStats &stats)
+{
+    float area;
+
+    if (cullMode & CULL_ZERO_AREA) {
+        area = (t.p2.x - t.p1.x) * (t.p3.y - t.p1.y)
+            - (t.p3.x - t.p1.x) * (t.p2.y - t.p1.y);
+        if (area == 0.0f) {
+            stats.culledZeroArea++;
+            return false;
+        }
+    }
+    if (cullMode & CULL_OFFSCREEN) {
+        if ((t.p1.x < 0.0f && t.p2.x < 0.0f && t.p3.x < 0.0f)
+            || (t.p1.y < 0.0f && t.p2.y < 0.0f && t.p3.y < 0.0f)
+            || (t.p1.x > width && t.p2.x > width && t.p3.x > width)
+            || (t.p1.y > height && t.p2.y > height && t.p3.y > height)) {
+            stats.culledOffScreen++;
+            return false;
+        }
+    }
+    return true;
+}
+
+static TriData make_tri(const ViewTransform &view, const Vec3 &w1,
+                        const Vec3 &w2, const Vec3 &w3)
+{
+    TriData t;
+
+    t.w1 = w1;
+    t.w2 = w2;
+    t.w3 = w3;
+    t.p1 = project_view(view, w1);
+    t.p2 = project_view(view, w2);
+    t.p3 = project_view(view, w3);
+    return t;
+}
+
+/* Palette and material ids of the level being set up. */
+struct FaceColors {
+    const std::uint32_t *palette;
+    const std::uint16_t *materials;
+};
+
+/*
+** Setup of one face: culling, clipping, then color for what is left.
+** Instantiated for 16- and 32-bit indices.
+*/
+template <typename Index>
+static void setup_face(const ViewTransform &view, const VertexStream &vs,
+                       const SetupParams &params, const Index *indices,
+                       const FaceColors &colors, std::size_t face,
+                       std::vector<TriData> &out, SetupStats &stats)
+{
+    const Index *f = indices + face * 3;
+    std::size_t v[3];
+    Vec3 w[3];
+    Vec3 poly[4];
+    TriData pieces[2];
+    float width;
+    float height;
+    int count;
+    int inside;
+    int k;
+
+    v[0] = params.firstVertex + f[0];
+    v[1] = params.firstVertex + f[1];
+    v[2] = params.firstVertex + f[2];
+    w[0] = stream_vec3(vs, v[0]);
+    w[1] = stream_vec3(vs, v[1]);
+    w[2] = stream_vec3(vs, v[2]);
+    if ((params.cullMode & CULL_BACKFACE)
+        && is_back_face(w[0], w[1], w[2])) {
+        stats.culledBackFace++;
+        return;
+    }
+    inside = (w[0].z >= NEAR_PLANE) + (w[1].z >= NEAR_PLANE)
+        + (w[2].z >= NEAR_PLANE);
+    if (inside == 0) {
+        stats.culledNear++;
+        return;
+    }
+    width = view.centerX * 2.0f;
+    height = view.centerY * 2.0f;
+    count = 0;
+    if (inside == 3) {
+        pieces[0].w1 = w[0];
+        pieces[0].w2 = w[1];
+        pieces[0].w3 = w[2];
+        pieces[0].p1 = stream_vec2(vs, v[0]);
+        pieces[0].p2 = stream_vec2(vs, v[1]);
+        pieces[0].p3 = stream_vec2(vs, v[2]);
+        count = keep_triangle(pieces[0], params.cullMode, width, height,
+                              stats) ? 1 : 0;
+    } else {
+        int n;
+
+        stats.clipped++;
+        n = clip_near(w, poly);
+        k = 1;
+        while (k + 1 < n) {
+            pieces[count] = make_tri(view, poly[0], poly[k], poly[k + 1]);
+            if (keep_triangle(pieces[count], params.cullMode, width,
+                              height, stats))
+                count++;
+            k++;
+        }
+    }
+    if (count == 0)
+        return;
+    pieces[0].color = 0;
+    if (params.shade)
+        pieces[0].color = shade_face(colors.palette[colors.materials[face]],
+                                     w[0], w[1], w[2],
+                                     (int)face == params.highlightFace);
+    pieces[0].face = (std::uint32_t)face;
+    pieces[0].instance = params.instance;
+    pieces[1].color = pieces[0].color;
+    pieces[1].face = pieces[0].face;
+    pieces[1].instance = params.instance;
+    k = 0;
+    while (k < count) {
+        out.push_back(pieces[k]);
+        k++;
+    }
+}
+
+template <typename Index>
+static void setup_faces(const ViewTransform &view, const VertexStream &vs,
+                        const SetupParams &params, const Index *indices,
+                        std::size_t total, const FaceColors &colors,
+                        std::vector<TriData> &out, SetupStats &stats)
+{
+    std::size_t i;
+
+    if (params.faces) {
+        stats.culledFrustum += total - params.faces->size();
+        for (unsigned int face : *params.faces)
+            setup_face(view, vs, params, indices, colors, face, out,
+                       stats);
+        return;
+    }
+    i = 0;
+    while (i < total) {
+        setup_face(view, vs, params, indices, colors, i, out, stats);
+        i++;
+    }
+}
+
+void build_triangles(const Model &model, const ViewTransform &view,
+                     const VertexStream &vs, const SetupParams &params,
+                     std::vector<TriData> &out, SetupStats &stats)
+{
+    const IndexBuffer &faces = model.getLodIndices(params.lod);
+    FaceColors colors;
+
+    colors.palette = model.getPalette().data();
+    colors.materials = faces.materials();
+    visit_indices(faces, [&](const auto *indices) {
+        setup_faces(view, vs, params, indices, faces.size(), colors, out,
+                    stats);
+    });
+}
+
+bool cull_mode_from_string(const char *str, unsigned int &mode)
+{
+    unsigned int result;
+    std::size_t len;
+
+    if (!str || !*str)
+        return false;
+    if (std::strcmp(str, "none") == 0) {
+        mode = CULL_NONE;
+        return true;
+    }
+    if (std::strcmp(str, "all") == 0) {
+        mode = CULL_ALL;
+        return true;
+    }
+    result = CULL_NONE;
+    while (*str) {
+        len = std::strcspn(str, ",");
+        if (len == 4 && std::strncmp(str, "back", 4) == 0)
+            result |= CULL_BACKFACE;
+        else if (len == 4 && std::strncmp(str, "zero", 4) == 0)
+            result |= CULL_ZERO_AREA;
+        else if (len == 9 && std::strncmp(str, "offscreen", 9) == 0)
+            result |= CULL_OFFSCREEN;
+        else
+            return false;
+        str += len;
+        if (*str == ',')
+            str++;
+    }
+    mode = result;
+    return true;
+}
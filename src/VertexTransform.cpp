@@ -0,0 +1,239 @@
+#include "VertexTransform.hpp"
+#include "MeshBuffers.hpp"
+#include "ThreadPool.hpp"
+#include <algorithm>
+
+#if defined(__SSE2__)
+#define TRANSFORM_SSE2 1
+#include <emmintrin.h>
+#else
+#define TRANSFORM_SSE2 0
+#endif
+
+/* Quantized vertices decoded per batch, 3 KB on the stack. */
+static const std::size_t DECODE_BATCH = 256;
+
+/*
+** Scalar reference; also handles the tail of every SSE2 block.
+** Operations are in the same order as the SSE2 path so both give
+** bit-identical results.
+*/
+static void transform_block(const ViewTransform &view,
+                            const Vec3 *in, std::size_t count,
+                            float *__restrict x, float *__restrict y,
+                            float *__restrict z, float *__restrict sx,
+                            float *__restrict sy)
+{
+    std::size_t i;
+
+    i = 0;
+    while (i < count) {
+        float px;
+        float py;
+        float pz;
+        float vx;
+        float vy;
+        float vz;
+        float invz;
+
+        px = in[i].x;
+        py = in[i].y;
+        pz = in[i].z;
+        vx = view.m[0][0] * px + view.m[0][1] * py + view.m[0][2] * pz
+            + view.offset.x;
+        vy = view.m[1][0] * px + view.m[1][1] * py + view.m[1][2] * pz
+            + view.offset.y;
+        vz = view.m[2][0] * px + view.m[2][1] * py + view.m[2][2] * pz
+            + view.offset.z;
+        invz = 1.0f / vz;
+        x[i] = vx;
+        y[i] = vy;
+        z[i] = vz;
+        sx[i] = view.centerX + vx * invz * view.scaleX;
+        sy[i] = view.centerY - vy * invz * view.scaleY;
+        i++;
+    }
+}
+
+#if TRANSFORM_SSE2
+/*
+** Four vertices per step: three unaligned loads cover x0..z3, a few
+** shuffles split them into x/y/z lanes, the rest is plain packed math
+** and one store per output array.
+*/
+static std::size_t transform_block_sse2(const ViewTransform &view,
+                                        const Vec3 *in, std::size_t count,
+                                        float *x, float *y, float *z,
+                                        float *sx, float *sy)
+{
+    const float *src;
+    __m128 m[3][3];
+    __m128 off[3];
+    __m128 center[2];
+    __m128 scale[2];
+    __m128 one;
+    std::size_t i;
+    int r;
+
+    r = 0;
+    while (r < 3) {
+        m[r][0] = _mm_set1_ps(view.m[r][0]);
+        m[r][1] = _mm_set1_ps(view.m[r][1]);
+        m[r][2] = _mm_set1_ps(view.m[r][2]);
+        r++;
+    }
+    off[0] = _mm_set1_ps(view.offset.x);
+    off[1] = _mm_set1_ps(view.offset.y);
+    off[2] = _mm_set1_ps(view.offset.z);
+    center[0] = _mm_set1_ps(view.centerX);
+    center[1] = _mm_set1_ps(view.centerY);
+    scale[0] = _mm_set1_ps(view.scaleX);
+    scale[1] = _mm_set1_ps(view.scaleY);
+    one = _mm_set1_ps(1.0f);
+    src = &in[0].x;
+    i = 0;
+    while (i + 4 <= count) {
+        __m128 a;
+        __m128 b;
+        __m128 c;
+        __m128 p[3];
+        __m128 v[3];
+        __m128 invz;
+
+        a = _mm_loadu_ps(src + i * 3);
+        b = _mm_loadu_ps(src + i * 3 + 4);
+        c = _mm_loadu_ps(src + i * 3 + 8);
+        p[0] = _mm_shuffle_ps(_mm_shuffle_ps(a, a, _MM_SHUFFLE(3, 3, 0, 0)),
+                              _mm_shuffle_ps(b, c, _MM_SHUFFLE(1, 1, 2, 2)),
+                              _MM_SHUFFLE(2, 0, 2, 0));
+        p[1] = _mm_shuffle_ps(_mm_shuffle_ps(a, b, _MM_SHUFFLE(0, 0, 1, 1)),
+                              _mm_shuffle_ps(b, c, _MM_SHUFFLE(2, 2, 3, 3)),
+                              _MM_SHUFFLE(2, 0, 2, 0));
+        p[2] = _mm_shuffle_ps(_mm_shuffle_ps(a, b, _MM_SHUFFLE(1, 1, 2, 2)),
+                              _mm_shuffle_ps(c, c, _MM_SHUFFLE(3, 3, 0, 0)),
+                              _MM_SHUFFLE(2, 0, 2, 0));
+        r = 0;
+        while (r < 3) {
+            v[r] = _mm_add_ps(
+                _mm_add_ps(_mm_add_ps(_mm_mul_ps(m[r][0], p[0]),
+                                      _mm_mul_ps(m[r][1], p[1])),
+                           _mm_mul_ps(m[r][2], p[2])),
+                off[r]);
+            r++;
+        }
+        invz = _mm_div_ps(one, v[2]);
+        _mm_storeu_ps(x + i, v[0]);
+        _mm_storeu_ps(y + i, v[1]);
+        _mm_storeu_ps(z + i, v[2]);
+        _mm_storeu_ps(sx + i, _mm_add_ps(center[0], _mm_mul_ps(
+            _mm_mul_ps(v[0], invz), scale[0])));
+        _mm_storeu_ps(sy + i, _mm_sub_ps(center[1], _mm_mul_ps(
+            _mm_mul_ps(v[1], invz), scale[1])));
+        i += 4;
+    }
+    return i;
+}
+#endif
+
+/* Transforms count vertices from in into out at index first. */
+static void transform_range(const ViewTransform &view, const Vec3 *in,
+                            std::size_t count, VertexStream &out,
+                            std::size_t first)
+{
+    std::size_t done;
+
+    done = 0;
+#if TRANSFORM_SSE2
+    done = transform_block_sse2(view, in, count, &out.x[first],
+                                &out.y[first], &out.z[first],
+                                &out.sx[first], &out.sy[first]);
+#endif
+    first += done;
+    if (done < count)
+        transform_block(view, in + done, count - done, &out.x[first],
+                        &out.y[first], &out.z[first], &out.sx[first],
+                        &out.sy[first]);
+}
+
+static void transform_quantized(const ViewTransform &view,
+                                const std::int16_t *in, std::size_t count,
+                                VertexStream &out, std::size_t first)
+{
+    Vec3 batch[DECODE_BATCH];
+    std::size_t n;
+    std::size_t i;
+
+    while (count > 0) {
+        n = std::min(count, DECODE_BATCH);
+        i = 0;
+        while (i < n) {
+            batch[i].x = in[i * 3] * POSITION_QUANTUM;
+            batch[i].y = in[i * 3 + 1] * POSITION_QUANTUM;
+            batch[i].z = in[i * 3 + 2] * POSITION_QUANTUM;
+            i++;
+        }
+        transform_range(view, batch, n, out, first);
+        in += n * 3;
+        first += n;
+        count -= n;
+    }
+}
+
+void VertexStream::resize(std::size_t count)
+{
+    x.resize(count);
+    y.resize(count);
+    z.resize(count);
+    sx.resize(count);
+    sy.resize(count);
+}
+
+void transform_vertices(const ViewTransform &view,
+                        const std::vector<Vec3> &in,
+                        VertexStream &out, ThreadPool *pool)
+{
+    std::size_t blocks;
+
+    out.resize(in.size());
+    blocks = (in.size() + TRANSFORM_BLOCK - 1) / TRANSFORM_BLOCK;
+    auto job = [&](std::size_t b) {
+        std::size_t first;
+
+        first = b * TRANSFORM_BLOCK;
+        transform_range(view, &in[first],
+                        std::min(TRANSFORM_BLOCK, in.size() - first), out,
+                        first);
+    };
+    parallel_for(pool, blocks, job);
+}
+
+void transform_vertices(const ViewTransform &view,
+                        const PositionBuffer &in,
+                        VertexStream &out, ThreadPool *pool)
+{
+    std::size_t blocks;
+
+    out.resize(in.size());
+    blocks = (in.size() + TRANSFORM_BLOCK - 1) / TRANSFORM_BLOCK;
+    auto job = [&](std::size_t b) {
+        std::size_t first;
+
+        first = b * TRANSFORM_BLOCK;
+        transform_positions(view, in, first,
+                            std::min(TRANSFORM_BLOCK, in.size() - first),
+                            out, first);
+    };
+    parallel_for(pool, blocks, job);
+}
+
+void transform_positions(const ViewTransform &view,
+                         const PositionBuffer &in, std::size_t begin,
+                         std::size_t count, VertexStream &out,
+                         std::size_t first)
+{
+    if (in.isQuantized())
+        transform_quantized(view, in.quantized() + begin * 3, count, out,
+                            first);
+    else
+        transform_range(view, in.floats() + begin, count, out, first);
+}
@@ -0,0 +1,157 @@
+#include "VisBuffer.hpp"
+#include "Raster.hpp"
+#include "ThreadPool.hpp"
+#include "TriangleSetup.hpp"
+#include <algorithm>
+#include <cstring>
+
+const char *shading_mode_name(ShadingMode mode)
+{
+    if (mode == ShadingMode::Visibility)
+        return "visibility";
+    return "forward";
+}
+
+bool shading_mode_from_name(const char *name, ShadingMode &mode)
+{
+    if (std::strcmp(name, "forward") == 0)
+        mode = ShadingMode::Forward;
+    else if (std::strcmp(name, "visibility") == 0)
+        mode = ShadingMode::Visibility;
+    else
+        return false;
+    return true;
+}
+
+static Vec3 corner(const VertexStream &vs, std::size_t i)
+{
+    return make_vec3(vs.x[i], vs.y[i], vs.z[i]);
+}
+
+/*
+** Same inputs as setup's shading (the face's own corners, not those
+** of a clipped piece), so both modes give the same color.
+*/
+template <typename Index>
+static std::uint32_t shade_face_of(const FrameContext &frame,
+                                   const FrameInstance &inst,
+                                   const IndexBuffer &faces,
+                                   const Index *indices,
+                                   std::uint32_t face)
+{
+    const Index *f;
+    std::size_t base;
+
+    f = indices + (std::size_t)face * 3;
+    base = inst.firstVertex;
+    return shade_face(inst.model->getPalette()[faces.materials()[face]],
+                      corner(frame.verts, base + f[0]),
+                      corner(frame.verts, base + f[1]),
+                      corner(frame.verts, base + f[2]),
+                      (int)face == inst.highlightFace);
+}
+
+/*
+** Triangles of a frame may come from several models, so the level and
+** index width are looked up per triangle; this only runs once per run
+** of pixels of the same triangle.
+*/
+static std::uint32_t shade_triangle(const FrameContext &frame,
+                                    std::uint32_t id)
+{
+    const TriData &t = frame.tris[id];
+    const FrameInstance &inst = frame.instances[t.instance];
+    const IndexBuffer &faces = inst.model->getLodIndices(inst.lod);
+    std::uint32_t color;
+
+    color = 0;
+    visit_indices(faces, [&](const auto *indices) {
+        color = shade_face_of(frame, inst, faces, indices, t.face);
+    });
+    return color;
+}
+
+/*
+** Rows are resolved RESOLVE_SPAN pixels at a time. A span whose ids
+** all equal the last one (inside a large triangle, or background) is
+** filled without a branch per pixel; any other is walked pixel by
+** pixel, shading on each change of id.
+*/
+static const int RESOLVE_SPAN = 16;
+
+static bool same_span(const std::uint32_t *ids, std::uint32_t id)
+{
+    std::uint32_t diff;
+    int k;
+
+    diff = 0;
+    k = 0;
+    while (k < RESOLVE_SPAN) {
+        diff |= ids[k] ^ id;
+        k++;
+    }
+    return diff == 0;
+}
+
+static void resolve_tile(FrameContext &frame, const Tile &tile)
+{
+    std::uint32_t black;
+    std::uint32_t last;
+    std::uint32_t color;
+    int x;
+    int y;
+    int end;
+
+    black = pack_rgba(0, 0, 0, 255);
+    last = NO_TRIANGLE;
+    color = black;
+    y = tile.y0;
+    while (y <= tile.y1) {
+        const std::uint32_t *ids;
+        std::uint32_t *row;
+
+        ids = &frame.ids[(std::size_t)y * frame.width];
+        row = &frame.pixels[(std::size_t)y * frame.width];
+        x = tile.x0;
+        while (x <= tile.x1) {
+            end = std::min(x + RESOLVE_SPAN, tile.x1 + 1);
+            if (end - x == RESOLVE_SPAN && same_span(ids + x, last)) {
+                std::fill(row + x, row + end, color);
+                x = end;
+                continue;
+            }
+            while (x < end) {
+                if (ids[x] != last) {
+                    last = ids[x];
+                    color = last == NO_TRIANGLE ? black
+                        : shade_triangle(frame, last);
+                }
+                row[x] = color;
+                x++;
+            }
+        }
+        y++;
+    }
+}
+
+void resolve_visibility(FrameContext &frame, ThreadPool *pool)
+{
+    parallel_for(pool, frame.tiles.size(), [&](std::size_t i) {
+        resolve_tile(frame, frame.tiles[i]);
+    });
+}
+
+int visible_face(const FrameContext &frame, int x, int y,
+                 unsigned int &instance)
+{
+    std::uint32_t id;
+
+    if (x < 0 || y < 0 || x >= (int)frame.width || y >= (int)frame.height
+        || frame.ids.size() != (std::size_t)frame.width * frame.height)
+        return -1;
+    id = frame.ids[(std::size_t)y * frame.width + x];
+    if (id == NO_TRIANGLE || id >= frame.tris.size())
+        return -1;
+    instance = frame.tris[id].instance;
+    return (int)frame.tris[id].face;
+}
@@ -0,0 +1,165 @@
+#include "Wireframe.hpp"
+#include "TriangleSetup.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+/*
+** An edge lies on the faces it borders, so its depth equals theirs up
+** to rounding; the relative slack keeps it from flickering under its
+** own faces.
+*/
+static const float EDGE_DEPTH_BIAS = 2e-3f;
+
+const char *edge_mode_name(EdgeMode mode)
+{
+    if (mode == EdgeMode::All)
+        return "all";
+    if (mode == EdgeMode::Visible)
+        return "visible";
+    return "off";
+}
+
+bool edge_mode_from_name(const char *name, EdgeMode &mode)
+{
+    if (std::strcmp(name, "off") == 0)
+        mode = EdgeMode::Off;
+    else if (std::strcmp(name, "all") == 0)
+        mode = EdgeMode::All;
+    else if (std::strcmp(name, "visible") == 0)
+        mode = EdgeMode::Visible;
+    else
+        return false;
+    return true;
+}
+
+/* One Liang-Barsky boundary: p * t <= q. */
+static bool clip_param(float p, float q, float &t0, float &t1)
+{
+    float r;
+
+    if (p == 0.0f)
+        return q >= 0.0f;
+    r = q / p;
+    if (p < 0.0f) {
+        if (r > t1)
+            return false;
+        if (r > t0)
+            t0 = r;
+    } else {
+        if (r < t0)
+            return false;
+        if (r < t1)
+            t1 = r;
+    }
+    return true;
+}
+
+/* Clips a -> b to [0, w) x [0, h); t0 / t1 bound the kept part. */
+static bool clip_segment(float ax, float ay, float bx, float by,
+                         float w, float h, float &t0, float &t1)
+{
+    float dx;
+    float dy;
+
+    dx = bx - ax;
+    dy = by - ay;
+    t0 = 0.0f;
+    t1 = 1.0f;
+    return clip_param(-dx, ax, t0, t1)
+        && clip_param(dx, w - ax, t0, t1)
+        && clip_param(-dy, ay, t0, t1)
+        && clip_param(dy, h - ay, t0, t1);
+}
+
+/*
+** Steps one pixel along the major axis. Depth is interpolated in
+** screen space, as the triangle kernels do, so an edge matches the
+** depth of its own faces. Only the steps landing in rows [y0, y1) are
+** walked, but they sample the same points as a full-screen pass, so
+** the result does not depend on how the rows are split.
+*/
+static void draw_segment(float ax, float ay, float az, float bx,
+                         float by, float bz, FrameContext &frame,
+                         std::uint32_t color, int y0, int y1)
+{
+    float steps;
+    float t;
+    float z;
+    float stepY;
+    int first;
+    int last;
+    int x;
+    int y;
+    std::size_t tile;
+    std::size_t d;
+
+    steps = std::ceil(std::max(std::fabs(bx - ax), std::fabs(by - ay)));
+    first = 0;
+    last = (int)steps;
+    stepY = last > 0 ? (by - ay) / steps : 0.0f;
+    if (std::fabs(stepY) > 1e-6f) {
+        float s0;
+        float s1;
+
+        s0 = ((float)y0 - ay) / stepY;
+        s1 = ((float)y1 - ay) / stepY;
+        first = std::max(first, (int)std::floor(std::min(s0, s1)) - 1);
+        last = std::min(last, (int)std::ceil(std::max(s0, s1)) + 1);
+    }
+    while (first <= last) {
+        t = steps > 0.0f ? (float)first / steps : 0.0f;
+        y = (int)(ay + (by - ay) * t);
+        if (y >= y0 && y < y1) {
+            x = (int)(ax + (bx - ax) * t);
+            z = az + (bz - az) * t;
+            x = std::min(std::max(x, 0), (int)frame.width - 1);
+            tile = (std::size_t)(y / (int)TILE_SIZE) * frame.tilesX
+                + (std::size_t)(x / (int)TILE_SIZE);
+            d = tile * TILE_AREA + (std::size_t)(y % (int)TILE_SIZE)
+                * TILE_SIZE + (std::size_t)(x % (int)TILE_SIZE);
+            if (z <= frame.depth[d] * (1.0f + EDGE_DEPTH_BIAS))
+                frame.pixels[(std::size_t)y * frame.width + x] = color;
+        }
+        first++;
+    }
+}
+
+void draw_visible_edges(const std::vector<Edge> &edges,
+                        std::size_t firstVertex, FrameContext &frame,
+                        std::uint32_t color, int y0, int y1)
+{
+    const VertexStream &v = frame.verts;
+    float t0;
+    float t1;
+
+    for (const Edge &e : edges) {
+        std::size_t a;
+        std::size_t b;
+        float ax;
+        float ay;
+        float dx;
+        float dy;
+        float dz;
+
+        a = firstVertex + e.a;
+        b = firstVertex + e.b;
+        if (v.z[a] < NEAR_PLANE || v.z[b] < NEAR_PLANE)
+            continue;
+        ay = v.sy[a];
+        dy = v.sy[b] - ay;
+        /* Most edges of a band pass miss it: reject on y first. */
+        if (std::max(ay, ay + dy) < (float)y0
+            || std::min(ay, ay + dy) >= (float)y1)
+            continue;
+        ax = v.sx[a];
+        dx = v.sx[b] - ax;
+        dz = v.z[b] - v.z[a];
+        if (!clip_segment(ax, ay, ax + dx, ay + dy, (float)frame.width,
+                          (float)frame.height, t0, t1))
+            continue;
+        draw_segment(ax + dx * t0, ay + dy * t0, v.z[a] + dz * t0,
+                     ax + dx * t1, ay + dy * t1, v.z[a] + dz * t1,
+                     frame, color, y0, y1);
+    }
+}
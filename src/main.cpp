@@ -1,22 +1,25 @@
 #include <iostream>
 #include "App.hpp"
+#include "Batch.hpp"
+#include "Bench.hpp"
+#include "Options.hpp"
 
 int main(int argc, char **argv)
 {
-    const char *objPath;
-    const char *mtlPath;
+    Options opts;
     bool ok;
 
-    if (argc < 2) {
-        std::cerr << "Usage: ./viewer model.obj [material.mtl]"
-                  << std::endl;
+    if (!parse_options(argc, argv, opts)) {
+        print_usage();
         return 84;
     }
-    objPath = argv[1];
-    mtlPath = (argc >= 3) ? argv[2] : nullptr;
+    if (opts.batchPath)
+        return run_batch(opts);
+    if (opts.bench)
+        return run_bench(opts);
     ok = false;
     {
-        App app(objPath, mtlPath, ok);
+        App app(opts, ok);
         if (!ok)
             return 84;
         app.run();